@@ -0,0 +1,40 @@
+#pragma pack_matrix(row_major)
+
+#include <donut/shaders/binding_helpers.hlsli>
+#include "DepthPyramid_cb.h"
+
+
+DECLARE_PUSH_CONSTANTS(DepthPyramidConstants, g_Push, 0, 0);
+
+Texture2D<float> t_Input : REGISTER_SRV(0, 0);
+RWTexture2D<float> u_Output : REGISTER_UAV(0, 0);
+
+
+// Each texel keeps the farthest depth of the 2x2 input texels it covers
+//  Output sizes are rounded down like mip sizes, so the last texel of an odd row or column also covers the third input texel
+[numthreads(8, 8, 1)]
+void depth_pyramid_cs(uint3 DTid : SV_DispatchThreadID)
+{
+    if (any(DTid.xy >= g_Push.outputSize))
+        return;
+
+    uint2 firstCoord = DTid.xy * 2;
+    uint2 lastCoord = firstCoord + 1;
+    if ((g_Push.inputSize.x & 1) && DTid.x == g_Push.outputSize.x - 1)
+        lastCoord.x++;
+    if ((g_Push.inputSize.y & 1) && DTid.y == g_Push.outputSize.y - 1)
+        lastCoord.y++;
+    lastCoord = min(lastCoord, g_Push.inputSize - 1);
+
+    float farthest = t_Input[firstCoord];
+    for (uint y = firstCoord.y; y <= lastCoord.y; y++)
+    {
+        for (uint x = firstCoord.x; x <= lastCoord.x; x++)
+        {
+            float depth = t_Input[uint2(x, y)];
+            farthest = g_Push.reverseDepth ? min(farthest, depth) : max(farthest, depth);
+        }
+    }
+
+    u_Output[DTid.xy] = farthest;
+}
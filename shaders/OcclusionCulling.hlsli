@@ -0,0 +1,78 @@
+#ifndef OCCLUSIONCULLING_H
+#define OCCLUSIONCULLING_H
+
+// Requires ViewEx_cb.h
+
+#include "PyramidHelpers.hlsli"
+
+
+// Returns true if any part of the bounding box may be visible in the depth pyramid
+//  Mip 0 of the pyramid is half the resolution of the depth buffer, and every texel holds the farthest depth it covers
+bool OcclusionCullingTest(PlanarViewExConstants viewEx, Texture2D<float> pyramid, float3 bmin, float3 bmax)
+{
+    if (!(viewEx.occlusionFlags & OCCLUSION_FLAG_ENABLED))
+        return true;
+
+    const bool reverseDepth = (viewEx.occlusionFlags & OCCLUSION_FLAG_REVERSE_DEPTH) != 0;
+
+    float2 uvMin = 1.0f;
+    float2 uvMax = 0.0f;
+    float nearestDepth = reverseDepth ? 0.0f : 1.0f;
+
+    for (uint i = 0; i < 8; ++i)
+    {
+        float3 corner = float3((i & 1) ? bmax.x : bmin.x, (i & 2) ? bmax.y : bmin.y, (i & 4) ? bmax.z : bmin.z);
+        float4 clipPos = mul(float4(corner, 1.0f), viewEx.matWorldToOcclusionClip);
+
+        // Boxes crossing the near plane of the pyramid's view cannot be tested
+        if (clipPos.w <= 0.0f)
+            return true;
+
+        float3 ndc = clipPos.xyz / clipPos.w;
+        float2 uv = ndc.xy * float2(0.5f, -0.5f) + 0.5f;
+
+        uvMin = min(uvMin, uv);
+        uvMax = max(uvMax, uv);
+        nearestDepth = reverseDepth ? max(nearestDepth, ndc.z) : min(nearestDepth, ndc.z);
+    }
+
+    // Nothing is known about what lies outside of the pyramid's view
+    if (any(uvMin < 0.0f) || any(uvMax > 1.0f))
+        return true;
+
+    uint pyramidWidth, pyramidHeight, mipLevels;
+    pyramid.GetDimensions(0, pyramidWidth, pyramidHeight, mipLevels);
+
+    int2 texelMin = int2(uvMin * viewEx.occlusionDepthSize) >> 1;
+    int2 texelMax = int2(uvMax * viewEx.occlusionDepthSize) >> 1;
+
+    // The box spans at most 2x2 texels of this level
+    uint level = GetPyramidLevel(texelMin, texelMax, mipLevels);
+    texelMin >>= level;
+    texelMax >>= level;
+
+    uint levelWidth, levelHeight, levelMips;
+    pyramid.GetDimensions(level, levelWidth, levelHeight, levelMips);
+    int2 maxTexel = int2(levelWidth, levelHeight) - 1;
+
+    float d0 = pyramid.Load(int3(min(int2(texelMin.x, texelMin.y), maxTexel), level));
+    float d1 = pyramid.Load(int3(min(int2(texelMax.x, texelMin.y), maxTexel), level));
+    float d2 = pyramid.Load(int3(min(int2(texelMin.x, texelMax.y), maxTexel), level));
+    float d3 = pyramid.Load(int3(min(int2(texelMax.x, texelMax.y), maxTexel), level));
+
+    if (reverseDepth)
+    {
+        return nearestDepth >= min(min(d0, d1), min(d2, d3));
+    }
+    return nearestDepth <= max(max(d0, d1), max(d2, d3));
+}
+
+bool OcclusionCullingTest(PlanarViewExConstants viewEx, Texture2D<float> pyramid, float3 patchVertices_WorldSpace[3])
+{
+	float3 bmin = min(min(patchVertices_WorldSpace[0], patchVertices_WorldSpace[1]), patchVertices_WorldSpace[2]);
+	float3 bmax = max(max(patchVertices_WorldSpace[0], patchVertices_WorldSpace[1]), patchVertices_WorldSpace[2]);
+
+	return OcclusionCullingTest(viewEx, pyramid, bmin, bmax);
+}
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef PYRAMID_HELPERS_H
+#define PYRAMID_HELPERS_H
+
+
+// Returns the lowest level of a mip pyramid at which the texel range (of level 0) spans at most 2x2 texels
+//  Each texel of a level covers 2x2 texels of the level below it
+uint GetPyramidLevel(int2 texelMin, int2 texelMax, uint mipLevels)
+{
+    int2 texelExtent = texelMax - texelMin;
+    return min(firstbithigh(uint(max(max(texelExtent.x, texelExtent.y), 1) - 1)) + 1, mipLevels - 1);
+}
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef DEPTHPYRAMIDCB_H
+#define DEPTHPYRAMIDCB_H
+
+struct DepthPyramidConstants
+{
+	uint2 inputSize;
+	uint2 outputSize;
+	uint reverseDepth;
+};
+
+#endif
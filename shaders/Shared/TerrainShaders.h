@@ -10,6 +10,12 @@
 #define GBUFFER_BINDING_TERRAIN_CONSTANTS 0
 #define GBUFFER_BINDING_TERRAIN_CBT 0
 #define GBUFFER_BINDING_TERRAIN_HEIGHTMAP_TEXTURE 1
+#define GBUFFER_BINDING_TERRAIN_CULLED_NODES 2
+#define GBUFFER_BINDING_TERRAIN_VERTICES 3
+#define GBUFFER_BINDING_TERRAIN_HEIGHTMAP_PAGE_TABLE 4
+#define GBUFFER_BINDING_TERRAIN_HEIGHTMAP_ATLAS 5
+#define GBUFFER_BINDING_TERRAIN_NORMAL_MAP 6
+#define GBUFFER_BINDING_TERRAIN_HEIGHTMAP_FEEDBACK 0 // u0
 #define GBUFFER_BINDING_TERRAIN_HEIGHTMAP_SAMPLER 0
 
 // Terrain tessellation bindings
@@ -20,16 +26,116 @@
 #define TESSELLATION_BINDING_TERRAIN_CONSTANTS 1 // b1
 #define TESSELLATION_BINDING_INSTANCE_BUFFER 1 // t1
 #define TESSELLATION_BINDING_SUBDIVISION_HEIGHTMAP 2 // t2
+#define TESSELLATION_BINDING_REDUCTION_SCRATCH 2 // u2
+#define TESSELLATION_BINDING_FEEDBACK 3 // u3
+#define TESSELLATION_BINDING_CULLED_NODES 4 // u4
+#define TESSELLATION_BINDING_CULLED_INDIRECT_ARGS 5 // u5
+#define TESSELLATION_BINDING_OCCLUDED_NODES 3 // t3
+#define TESSELLATION_BINDING_HEIGHT_BOUNDS 4 // t4
+#define TESSELLATION_BINDING_HEIGHT_ERROR 5 // t5
+#define TESSELLATION_BINDING_POOL_SCRATCH 6 // u6
+// Never bound; declares the CBT heap for the node types and LEB decoding of the bisector pool shaders
+#define TESSELLATION_BINDING_CBT_PLACEHOLDER 6 // t6
+#define TESSELLATION_BINDING_HEIGHTMAP_PAGE_TABLE 7 // t7
+#define TESSELLATION_BINDING_HEIGHTMAP_ATLAS 8 // t8
+#define TESSELLATION_BINDING_HEIGHTMAP_FEEDBACK 7 // u7
 
 #define TESSELLATION_SPACE_VIEW 1
 #define TESSELLATION_BINDING_SUBDIVISION_CONSTANTS 0 // b0
 #define TESSELLATION_BINDING_SUBDIVISION_HEIGHTMAP_SAMPLER 0 // s0
+#define TESSELLATION_BINDING_OCCLUSION_PYRAMID 0 // t0
+
+// Materialization of the culled leaves into an indexed mesh
+#define MATERIALIZE_BINDING_PUSH_CONSTANTS 0 // b0
+#define MATERIALIZE_BINDING_TERRAIN_CONSTANTS 1 // b1
+#define MATERIALIZE_BINDING_CBT 0 // t0
+#define MATERIALIZE_BINDING_HEIGHTMAP 1 // t1
+#define MATERIALIZE_BINDING_CULLED_NODES 2 // t2
+#define MATERIALIZE_BINDING_CULLED_INDIRECT_ARGS 3 // t3
+#define MATERIALIZE_BINDING_HEIGHTMAP_PAGE_TABLE 4 // t4
+#define MATERIALIZE_BINDING_HEIGHTMAP_ATLAS 5 // t5
+#define MATERIALIZE_BINDING_HEIGHTMAP_SAMPLER 0 // s0
+#define MATERIALIZE_BINDING_VERTICES 0 // u0
+#define MATERIALIZE_BINDING_INDICES 1 // u1
+#define MATERIALIZE_BINDING_VERTEX_HASH 2 // u2
+#define MATERIALIZE_BINDING_INDEXED_ARGS 3 // u3
+#define MATERIALIZE_BINDING_STATE 4 // u4
+
+#define MATERIALIZE_GROUP_SIZE 64
+// Vertices are hashed by their LEB coordinates on a 2^15 grid, which is exact down to this depth
+#define MATERIALIZE_MAX_DEPTH 30
+#define MATERIALIZE_GRID_SCALE 32768.0f
+#define MATERIALIZE_HASH_EMPTY 0xFFFFFFFF
+#define MATERIALIZE_MAX_PROBES 64
+
+// Draws in the culled indirect arguments buffer
+#define CULLED_DRAW_VISIBLE 0     // Leaves that passed the first culling pass
+#define CULLED_DRAW_DISOCCLUDED 1 // Occluded leaves that passed the occlusion retest
+#define CULLED_DRAW_OCCLUDED 2    // Never drawn; its instance count is the number of occluded leaves
+#define CULLED_DRAW_COUNT 3
+
+// Level of detail schemes of the subdivision shaders (LOD_SCHEME permutations)
+#define LOD_SCHEME_PERSPECTIVE 0 // Projected edge length
+#define LOD_SCHEME_GEOMETRIC 1   // Projected deviation of the heightmap from the triangle
+#define LOD_SCHEME_ORTHOGRAPHIC 2 // Edge length across the view plane of an orthographic view, e.g. a shadow cascade
+
+// Topology of the tessellated mesh (TERRAIN_TOPOLOGY permutations)
+#define TERRAIN_TOPOLOGY_CBT 0           // Concurrent binary tree of 2^MaxDepth bits
+#define TERRAIN_TOPOLOGY_BISECTOR_POOL 1 // Pool of the heap IDs of the leaves, of fixed capacity
+
+// Bisector pool, a buffer of uints: the header, then the allocation bitfield, then the heap ID of each slot
+#define BISECTOR_POOL_HEADER_MAX_DEPTH 0
+#define BISECTOR_POOL_HEADER_CAPACITY 1      // Slots of the pool, a multiple of 32
+#define BISECTOR_POOL_HEADER_HASH_CAPACITY 2 // Slots of the hash table of the scratch buffer, a power of two
+#define BISECTOR_POOL_HEADER_COUNT 3         // Allocated slots, i.e. leaves
+#define BISECTOR_POOL_HEADER_HIGH_WATER 4    // Every slot from here on is free
+#define BISECTOR_POOL_HEADER_FREE_COUNT 5    // Free slots below the high water mark, listed in the scratch buffer
+#define BISECTOR_POOL_HEADER_FREE_CURSOR 6   // Slots allocated by the current bisection
+#define BISECTOR_POOL_HEADER_RESERVED 7      // Slots reserved by the current split
+#define BISECTOR_POOL_HEADER_SIZE 8
+// Scratch buffer of the subdivision: the hash table of (heap ID, slot) pairs, then the command and free list of each slot
+//  Cleared to BISECTOR_POOL_NULL before each subdivision
+#define BISECTOR_POOL_NULL 0xFFFFFFFF
+#define BISECTOR_POOL_COMMAND_SPLIT 1
+#define BISECTOR_POOL_COMMAND_BLOCKED 2 // Claimed for a split, but the pool was full
+#define BISECTOR_POOL_MAX_PROBES 64
+// Heap IDs are 32 bits, and must not reach BISECTOR_POOL_NULL
+#define BISECTOR_POOL_MAX_DEPTH 30
+
+// Virtual heightmaps (see TerrainVirtualHeightmap)
+//  Entry of the page table: the slot of the atlas holding the finest resident page over the cell, if any
+#define VIRTUAL_PAGE_RESIDENT 0x80000000
+#define VIRTUAL_PAGE_LEVEL_SHIFT 16
+#define VIRTUAL_PAGE_SLOT_Y_SHIFT 8
+#define VIRTUAL_PAGE_SLOT_MASK 0xFF
+// Texels around each page in its slot, copied from the neighbouring pages for bilinear filtering
+#define VIRTUAL_PAGE_BORDER 1
+// Feedback entry of a cell no pass requested a page over
+#define VIRTUAL_FEEDBACK_NONE 0xFFFFFFFF
+
+// Fused sum reduction
+#define SUM_REDUCTION_FUSED_GROUP_SIZE 256
+// Upper bound on the number of groups, as the last group reduces all group sums in groupshared memory
+#define SUM_REDUCTION_FUSED_MAX_PARTIALS 4096
 
 struct TerrainConstants
 {
 	float4 TerrainExtentsAndInvExtents;
 	float4 HeightmapResolutionAndInvResolution;
 	float2 HeightScaleAndInvScale;
+	// Tiled terrains only (0 otherwise): the depth the leaves on the edges of the tile are kept at, and the number of
+	// segments of each edge at that depth, which the heights of the vertices on the edges are interpolated along
+	uint TileBorderDepth;
+	float TileBorderSegments;
+	// Resolution of the heightmap the height bounds and height error pyramids were built from, i.e. of the fallback of
+	// a virtual heightmap, whose bounds are widened by the margin to hold the heights of its finer levels
+	float2 HeightPyramidResolution;
+	float HeightBoundsMargin;
+	// Virtual heightmaps only (0 otherwise): texels per side of a page, pages of level 0 per side, and paged levels
+	uint VirtualPageSize;
+	uint2 VirtualPageTableSize;
+	uint VirtualLevelCount;
+	float VirtualAtlasInvSize;
 };
 
 struct SubdivisionConstants
@@ -38,11 +144,70 @@ struct SubdivisionConstants
 	PlanarViewExConstants viewEx;
 
 	float lodFactor;
+	// Vertex count of the culled draws, 3 * 4^level for patch rendering
+	uint patchVertexCount;
 };
 
 struct TerrainPushConstants
 {
 	uint startInstanceLocation;
+	uint patchLevel; // Patch rendering only
+};
+
+// Depths the leaves of TessellationFeedback are counted at; deeper leaves are counted at the last one
+#define TESSELLATION_FEEDBACK_DEPTH_COUNT 32
+
+// Written by the subdivision passes, read back by the CPU
+//  Cleared once per frame, so the counts cover every subdivision of the frame
+struct TessellationFeedback
+{
+	uint Changed; // Non-zero if any node was split or merged
+	uint SplitCount; // Nodes split (CBT), or splits claimed (bisector pool)
+	uint MergeCount; // Diamonds merged
+	uint Passes; // Subdivision passes of the frame, as a mask of 1 << pass, written by the tessellator
+	// Leaves evaluated by the subdivision of the frame, before its own splits and merges
+	uint LeafCountPerDepth[TESSELLATION_FEEDBACK_DEPTH_COUNT];
+};
+
+// Min/max height and height error pyramids, built once from the heightmap
+struct HeightBoundsConstants
+{
+	uint2 inputSize;
+	uint2 outputSize;
+	uint outputLevel;
+};
+
+// Normal map, baked from the heightmap at load and re-baked over the regions where it changes
+//  The region is in texels of the output level, and includes the texels whose central differences it affects
+struct NormalMapConstants
+{
+	uint2 regionOffset;
+	uint2 regionSize;
+	uint2 inputSize;
+	uint outputLevel;
+	float heightScale;
+	// Distance between the texels of the central differences, in the units of the terrain
+	float2 worldTexelSpan;
+	float2 padding;
+};
+
+struct MaterializePushConstants
+{
+	uint culledDraw; // CULLED_DRAW_*
+};
+
+// Vertex of a materialized terrain mesh, in the local space of the terrain (see LEBSpaceToLocalSpace)
+struct TerrainVertex
+{
+	float2 texCoord;
+	float height;
+};
+
+// Indirect dispatch arguments of the materialization passes, and the number of vertices written so far
+struct MaterializeState
+{
+	uint3 dispatchArgs;
+	uint vertexCount;
 };
 
 struct TessellationSumReductionPushConstants
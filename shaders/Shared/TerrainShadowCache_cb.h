@@ -0,0 +1,14 @@
+#ifndef TERRAINSHADOWCACHECB_H
+#define TERRAINSHADOWCACHECB_H
+
+struct TerrainShadowCacheConstants
+{
+	// Texel of the cache at the first texel of the shadow map cascade
+	uint2 cacheOffset;
+	uint cacheSize;
+	uint cascade;
+	// Depth of the triangle covering the viewport, written as is when there is no pixel shader
+	float clearDepth;
+};
+
+#endif
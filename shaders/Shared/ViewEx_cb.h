@@ -1,10 +1,22 @@
 #ifndef VIEWEXCB_H
 #define VIEWEXCB_H
 
+// Occlusion culling flags
+#define OCCLUSION_FLAG_ENABLED 0x1
+#define OCCLUSION_FLAG_REVERSE_DEPTH 0x2
+// Occluded nodes are not split (and are merged), not only culled from the draw
+#define OCCLUSION_FLAG_SUBDIVISION 0x4
+
 struct PlanarViewExConstants
 {
 	// extended view constants
 	float4 viewFrustum[6];
+
+	// Transform into the clip space of the view whose depth the occlusion pyramid was built from
+	float4x4 matWorldToOcclusionClip;
+	float2 occlusionDepthSize;
+	uint occlusionFlags;
+	uint occlusionPadding;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,60 @@
+#pragma pack_matrix(row_major)
+
+#include <donut/shaders/binding_helpers.hlsli>
+#include "TerrainShaders.h"
+
+
+DECLARE_PUSH_CONSTANTS(HeightBoundsConstants, g_Push, 0, 0);
+
+Texture2D<float> t_Heightmap : REGISTER_SRV(0, 0);
+Texture2D<float2> t_Input : REGISTER_SRV(1, 0);
+RWTexture2D<float2> u_Output : REGISTER_UAV(0, 0);
+
+
+#include "HeightPyramidHelpers.hlsli"
+
+// Builds mip 0 of the pyramid (half the heightmap resolution) from the heightmap
+[numthreads(8, 8, 1)]
+void height_bounds_init_cs(uint3 DTid : SV_DispatchThreadID)
+{
+    if (any(DTid.xy >= g_Push.outputSize))
+        return;
+
+    uint2 firstCoord, lastCoord;
+    GetInputTexels(DTid.xy, firstCoord, lastCoord);
+
+    float2 bounds = t_Heightmap[firstCoord].xx;
+    for (uint y = firstCoord.y; y <= lastCoord.y; y++)
+    {
+        for (uint x = firstCoord.x; x <= lastCoord.x; x++)
+        {
+            float height = t_Heightmap[uint2(x, y)];
+            bounds = float2(min(bounds.x, height), max(bounds.y, height));
+        }
+    }
+
+    u_Output[DTid.xy] = bounds;
+}
+
+// Builds a level of the pyramid from the level below it
+[numthreads(8, 8, 1)]
+void height_bounds_reduce_cs(uint3 DTid : SV_DispatchThreadID)
+{
+    if (any(DTid.xy >= g_Push.outputSize))
+        return;
+
+    uint2 firstCoord, lastCoord;
+    GetInputTexels(DTid.xy, firstCoord, lastCoord);
+
+    float2 bounds = t_Input[firstCoord];
+    for (uint y = firstCoord.y; y <= lastCoord.y; y++)
+    {
+        for (uint x = firstCoord.x; x <= lastCoord.x; x++)
+        {
+            float2 inputBounds = t_Input[uint2(x, y)];
+            bounds = float2(min(bounds.x, inputBounds.x), max(bounds.y, inputBounds.y));
+        }
+    }
+
+    u_Output[DTid.xy] = bounds;
+}
@@ -0,0 +1,103 @@
+#pragma pack_matrix(row_major)
+
+#include <donut/shaders/binding_helpers.hlsli>
+#include "TerrainShaders.h"
+
+
+DECLARE_PUSH_CONSTANTS(HeightBoundsConstants, g_Push, 0, 0);
+
+Texture2D<float> t_Heightmap : REGISTER_SRV(0, 0);
+Texture2D<float> t_Input : REGISTER_SRV(1, 0);
+RWTexture2D<float> u_Output : REGISTER_UAV(0, 0);
+
+
+#include "HeightPyramidHelpers.hlsli"
+
+// Heightmap texels at the corners of the region covered by an output texel
+//  Each texel of level k covers 2^(k+1) heightmap texels, and the last texel of a row or column extends to the edge
+void GetRegionCorners(uint2 outputCoord, out int2 p0, out int2 p1)
+{
+    uint heightmapWidth, heightmapHeight;
+    t_Heightmap.GetDimensions(heightmapWidth, heightmapHeight);
+    int2 heightmapMax = int2(heightmapWidth, heightmapHeight) - 1;
+
+    int step = 2 << g_Push.outputLevel;
+    p0 = min(int2(outputCoord) * step, heightmapMax);
+    p1 = min(p0 + step, heightmapMax);
+    if (outputCoord.x == g_Push.outputSize.x - 1)
+        p1.x = heightmapMax.x;
+    if (outputCoord.y == g_Push.outputSize.y - 1)
+        p1.y = heightmapMax.y;
+}
+
+// Deviation of the heightmap from the bilinear patch through the corners of the region
+float GetDeviation(int2 p0, int2 p1, float4 corners, int2 p)
+{
+    float2 f = float2(p - p0) / max(float2(p1 - p0), 1.0f);
+    float planar = lerp(lerp(corners.x, corners.y, f.x), lerp(corners.z, corners.w, f.x), f.y);
+    return abs(t_Heightmap[p] - planar);
+}
+
+float4 LoadCorners(int2 p0, int2 p1)
+{
+    return float4(t_Heightmap[p0], t_Heightmap[int2(p1.x, p0.y)], t_Heightmap[int2(p0.x, p1.y)], t_Heightmap[p1]);
+}
+
+// Builds mip 0 of the pyramid (half the heightmap resolution) from every heightmap texel of the regions
+[numthreads(8, 8, 1)]
+void height_error_init_cs(uint3 DTid : SV_DispatchThreadID)
+{
+    if (any(DTid.xy >= g_Push.outputSize))
+        return;
+
+    int2 p0, p1;
+    GetRegionCorners(DTid.xy, p0, p1);
+    float4 corners = LoadCorners(p0, p1);
+
+    float error = 0.0f;
+    for (int y = p0.y; y <= p1.y; y++)
+    {
+        for (int x = p0.x; x <= p1.x; x++)
+        {
+            error = max(error, GetDeviation(p0, p1, corners, int2(x, y)));
+        }
+    }
+
+    u_Output[DTid.xy] = error;
+}
+
+// Builds a level of the pyramid from the level below it
+//  The error of a region is bounded by the largest error of its subregions, plus the deviation of the bilinear
+//  patches of the subregions from the patch of the region, which is largest at the corners of the subregions
+[numthreads(8, 8, 1)]
+void height_error_reduce_cs(uint3 DTid : SV_DispatchThreadID)
+{
+    if (any(DTid.xy >= g_Push.outputSize))
+        return;
+
+    uint2 firstCoord, lastCoord;
+    GetInputTexels(DTid.xy, firstCoord, lastCoord);
+
+    float childError = 0.0f;
+    for (uint y = firstCoord.y; y <= lastCoord.y; y++)
+    {
+        for (uint x = firstCoord.x; x <= lastCoord.x; x++)
+        {
+            childError = max(childError, t_Input[uint2(x, y)]);
+        }
+    }
+
+    int2 p0, p1;
+    GetRegionCorners(DTid.xy, p0, p1);
+    float4 corners = LoadCorners(p0, p1);
+    int2 mid = (p0 + p1) / 2;
+
+    float error = 0.0f;
+    error = max(error, GetDeviation(p0, p1, corners, int2(mid.x, p0.y)));
+    error = max(error, GetDeviation(p0, p1, corners, int2(p0.x, mid.y)));
+    error = max(error, GetDeviation(p0, p1, corners, mid));
+    error = max(error, GetDeviation(p0, p1, corners, int2(p1.x, mid.y)));
+    error = max(error, GetDeviation(p0, p1, corners, int2(mid.x, p1.y)));
+
+    u_Output[DTid.xy] = childError + error;
+}
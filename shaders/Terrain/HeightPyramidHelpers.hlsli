@@ -0,0 +1,19 @@
+#ifndef HEIGHT_PYRAMID_HELPERS_H
+#define HEIGHT_PYRAMID_HELPERS_H
+
+// Requires g_Push (HeightBoundsConstants)
+
+// Range of input texels reduced into an output texel
+//  Output sizes are rounded down like mip sizes, so the last texel of an odd row or column also covers the third input texel
+void GetInputTexels(uint2 outputCoord, out uint2 firstCoord, out uint2 lastCoord)
+{
+    firstCoord = outputCoord * 2;
+    lastCoord = firstCoord + 1;
+    if ((g_Push.inputSize.x & 1) && outputCoord.x == g_Push.outputSize.x - 1)
+        lastCoord.x++;
+    if ((g_Push.inputSize.y & 1) && outputCoord.y == g_Push.outputSize.y - 1)
+        lastCoord.y++;
+    lastCoord = min(lastCoord, g_Push.inputSize - 1);
+}
+
+#endif
@@ -0,0 +1,185 @@
+#pragma pack_matrix(row_major)
+
+#include <donut/shaders/binding_helpers.hlsli>
+#include "TerrainShaders.h"
+
+#define CBT_HEAP_BUFFER_BINDING REGISTER_SRV(MATERIALIZE_BINDING_CBT, 0)
+#include "ConcurrentBinaryTree.hlsl"
+#include "LongestEdgeBisection.hlsl"
+
+DECLARE_PUSH_CONSTANTS(MaterializePushConstants, g_Push, MATERIALIZE_BINDING_PUSH_CONSTANTS, 0);
+DECLARE_CBUFFER(TerrainConstants, c_Terrain, MATERIALIZE_BINDING_TERRAIN_CONSTANTS, 0);
+
+Texture2D<float> t_HeightmapTexture : REGISTER_SRV(MATERIALIZE_BINDING_HEIGHTMAP, 0);
+Texture2D<uint> t_HeightmapPageTable : REGISTER_SRV(MATERIALIZE_BINDING_HEIGHTMAP_PAGE_TABLE, 0);
+Texture2D<float> t_HeightmapAtlas : REGISTER_SRV(MATERIALIZE_BINDING_HEIGHTMAP_ATLAS, 0);
+SamplerState s_HeightmapSampler : REGISTER_SAMPLER(MATERIALIZE_BINDING_HEIGHTMAP_SAMPLER, 0);
+
+// Heap IDs of the leaves to materialize, either the visible or the disoccluded ones
+StructuredBuffer<uint> t_CulledNodes : REGISTER_SRV(MATERIALIZE_BINDING_CULLED_NODES, 0);
+
+// Layout must match nvrhi::DrawIndirectArguments, indexed by CULLED_DRAW_*
+struct DrawIndirectArgs
+{
+    uint vertexCount;
+    uint instanceCount;
+    uint startVertexLocation;
+    uint startInstanceLocation;
+};
+StructuredBuffer<DrawIndirectArgs> t_CulledIndirectArgs : REGISTER_SRV(MATERIALIZE_BINDING_CULLED_INDIRECT_ARGS, 0);
+
+RWStructuredBuffer<TerrainVertex> u_Vertices : REGISTER_UAV(MATERIALIZE_BINDING_VERTICES, 0);
+// Between the vertex and index passes, shared vertices are referenced by their hash slot (flagged)
+RWStructuredBuffer<uint> u_Indices : REGISTER_UAV(MATERIALIZE_BINDING_INDICES, 0);
+// Open addressing hash table of (key, vertex index) pairs, cleared to MATERIALIZE_HASH_EMPTY every frame
+RWStructuredBuffer<uint> u_VertexHash : REGISTER_UAV(MATERIALIZE_BINDING_VERTEX_HASH, 0);
+
+// Layout must match nvrhi::DrawIndexedIndirectArguments, indexed by CULLED_DRAW_*
+struct DrawIndexedIndirectArgs
+{
+    uint indexCount;
+    uint instanceCount;
+    uint startIndexLocation;
+    int baseVertexLocation;
+    uint startInstanceLocation;
+};
+RWStructuredBuffer<DrawIndexedIndirectArgs> u_IndexedArgs : REGISTER_UAV(MATERIALIZE_BINDING_INDEXED_ARGS, 0);
+RWStructuredBuffer<MaterializeState> u_State : REGISTER_UAV(MATERIALIZE_BINDING_STATE, 0);
+
+#include "TerrainHelpers.hlsli"
+
+#define INDEX_SLOT_FLAG 0x80000000u
+
+
+// Writes the draw arguments of the culled draw, and the dispatch arguments of the other passes (one thread per leaf)
+//  The disoccluded leaves are appended after the visible ones, so they share the vertices of the visible leaves
+//  Leaves beyond the capacity of the mesh (see TerrainMeshViewDesc::MaterializedLeafCapacity) are dropped
+[numthreads(1, 1, 1)]
+void materialize_prepare_cs()
+{
+    uint indexCapacity, stride;
+    u_Indices.GetDimensions(indexCapacity, stride);
+
+    uint startIndex = 0;
+    if (g_Push.culledDraw == CULLED_DRAW_VISIBLE)
+    {
+        u_State[0].vertexCount = 0;
+    }
+    else
+    {
+        DrawIndexedIndirectArgs visibleArgs = u_IndexedArgs[CULLED_DRAW_VISIBLE];
+        startIndex = visibleArgs.startIndexLocation + visibleArgs.indexCount;
+    }
+
+    uint leafCount = min(t_CulledIndirectArgs[g_Push.culledDraw].instanceCount, (indexCapacity - startIndex) / 3);
+
+    DrawIndexedIndirectArgs args;
+    args.indexCount = 3 * leafCount;
+    args.instanceCount = 1;
+    args.startIndexLocation = startIndex;
+    args.baseVertexLocation = 0;
+    args.startInstanceLocation = 0;
+    u_IndexedArgs[g_Push.culledDraw] = args;
+
+    u_State[0].dispatchArgs = uint3((leafCount + MATERIALIZE_GROUP_SIZE - 1) / MATERIALIZE_GROUP_SIZE, 1, 1);
+}
+
+uint HashVertexKey(uint key)
+{
+    // Murmur3 finalizer
+    key ^= key >> 16;
+    key *= 0x85ebca6bu;
+    key ^= key >> 13;
+    key *= 0xc2b2ae35u;
+    key ^= key >> 16;
+    return key;
+}
+
+uint AppendVertex(float2 texCoord)
+{
+    uint vertex;
+    InterlockedAdd(u_State[0].vertexCount, 1u, vertex);
+
+    TerrainVertex terrainVertex;
+    terrainVertex.texCoord = texCoord;
+    terrainVertex.height = GetTerrainVertexHeight(texCoord);
+    u_Vertices[vertex] = terrainVertex;
+
+    return vertex;
+}
+
+// Returns the flagged hash slot of the vertex, which is written by whichever leaf inserts it first
+//  If the table is too full to find a slot, the vertex is not shared and its index is returned instead
+uint InsertVertex(float2 texCoord, uint hashCapacity)
+{
+    uint2 coord = uint2(round(texCoord * MATERIALIZE_GRID_SCALE));
+    uint key = (coord.x << 16) | coord.y;
+
+    uint slot = HashVertexKey(key) & (hashCapacity - 1);
+    for (uint probe = 0; probe < MATERIALIZE_MAX_PROBES; probe++)
+    {
+        uint previousKey;
+        InterlockedCompareExchange(u_VertexHash[2 * slot], MATERIALIZE_HASH_EMPTY, key, previousKey);
+        if (previousKey == MATERIALIZE_HASH_EMPTY)
+        {
+            u_VertexHash[2 * slot + 1] = AppendVertex(texCoord);
+            return slot | INDEX_SLOT_FLAG;
+        }
+        if (previousKey == key)
+        {
+            return slot | INDEX_SLOT_FLAG;
+        }
+        slot = (slot + 1) & (hashCapacity - 1);
+    }
+
+    return AppendVertex(texCoord);
+}
+
+// Decodes each leaf once, and writes the vertices that were not written by a neighbouring leaf yet
+[numthreads(MATERIALIZE_GROUP_SIZE, 1, 1)]
+void materialize_vertices_cs(uint3 DTid : SV_DispatchThreadID)
+{
+    DrawIndexedIndirectArgs args = u_IndexedArgs[g_Push.culledDraw];
+    uint leafIndex = DTid.x;
+
+    if (3 * leafIndex < args.indexCount)
+    {
+        uint nodeID = t_CulledNodes[leafIndex];
+        cbt_Node node = cbt_CreateNode(nodeID, firstbithigh(nodeID));
+
+        float3x2 pos = float3x2(float2(0, 1),
+            float2(0, 0),
+            float2(1, 0));
+        pos = leb_DecodeAttributeArray(node, pos);
+
+        uint hashEntries, stride;
+        u_VertexHash.GetDimensions(hashEntries, stride);
+        uint hashCapacity = hashEntries / 2;
+
+        uint firstIndex = args.startIndexLocation + 3 * leafIndex;
+        u_Indices[firstIndex + 0] = InsertVertex(pos[0], hashCapacity);
+        u_Indices[firstIndex + 1] = InsertVertex(pos[1], hashCapacity);
+        u_Indices[firstIndex + 2] = InsertVertex(pos[2], hashCapacity);
+    }
+}
+
+// Resolves the hash slots written by the vertex pass into vertex indices, now that every shared vertex was written
+[numthreads(MATERIALIZE_GROUP_SIZE, 1, 1)]
+void materialize_indices_cs(uint3 DTid : SV_DispatchThreadID)
+{
+    DrawIndexedIndirectArgs args = u_IndexedArgs[g_Push.culledDraw];
+    uint leafIndex = DTid.x;
+
+    if (3 * leafIndex < args.indexCount)
+    {
+        uint firstIndex = args.startIndexLocation + 3 * leafIndex;
+        for (uint corner = 0; corner < 3; corner++)
+        {
+            uint index = u_Indices[firstIndex + corner];
+            if (index & INDEX_SLOT_FLAG)
+            {
+                u_Indices[firstIndex + corner] = u_VertexHash[2 * (index & ~INDEX_SLOT_FLAG) + 1];
+            }
+        }
+    }
+}
@@ -0,0 +1,88 @@
+#pragma pack_matrix(row_major)
+
+#include <donut/shaders/binding_helpers.hlsli>
+#include "TerrainShaders.h"
+
+
+DECLARE_PUSH_CONSTANTS(NormalMapConstants, g_Push, 0, 0);
+
+Texture2D<float> t_HeightmapTexture : REGISTER_SRV(0, 0);
+Texture2D<float2> t_Input : REGISTER_SRV(1, 0);
+RWTexture2D<float2> u_Output : REGISTER_UAV(0, 0);
+
+// Virtual heightmaps only (see normal_map_virtual_init_cs)
+DECLARE_CBUFFER(TerrainConstants, c_Terrain, 1, 0);
+Texture2D<uint> t_HeightmapPageTable : REGISTER_SRV(2, 0);
+Texture2D<float> t_HeightmapAtlas : REGISTER_SRV(3, 0);
+SamplerState s_HeightmapSampler : REGISTER_SAMPLER(0, 0);
+
+
+#include "TerrainNormals.hlsli"
+#include "TerrainHelpers.hlsli"
+
+float3 GetCentralDifferenceNormal(float left, float right, float top, float bottom)
+{
+    float3 tangent = float3(g_Push.worldTexelSpan.x, (right - left) * g_Push.heightScale, 0);
+    float3 bitangent = float3(0, (top - bottom) * g_Push.heightScale, g_Push.worldTexelSpan.y);
+    return normalize(cross(bitangent, tangent));
+}
+
+// Builds mip 0 (the resolution of the heightmap) from the central differences of the heightmap, as GetTerrainNormal
+// computes them at the center of each texel
+[numthreads(8, 8, 1)]
+void normal_map_init_cs(uint3 DTid : SV_DispatchThreadID)
+{
+    if (any(DTid.xy >= g_Push.regionSize))
+        return;
+
+    int2 coord = int2(g_Push.regionOffset + DTid.xy);
+    int2 maxCoord = int2(g_Push.inputSize) - 1;
+
+    float left = t_HeightmapTexture[int2(max(coord.x - 1, 0), coord.y)];
+    float right = t_HeightmapTexture[int2(min(coord.x + 1, maxCoord.x), coord.y)];
+    float top = t_HeightmapTexture[int2(coord.x, min(coord.y + 1, maxCoord.y))];
+    float bottom = t_HeightmapTexture[int2(coord.x, max(coord.y - 1, 0))];
+
+    u_Output[coord] = EncodeTerrainNormal(GetCentralDifferenceNormal(left, right, top, bottom));
+}
+
+// Builds mip 0 of the normal map of a virtual heightmap, which has the resolution of its fallback level, from the
+// finest pages resident at the centers of the neighbouring texels
+[numthreads(8, 8, 1)]
+void normal_map_virtual_init_cs(uint3 DTid : SV_DispatchThreadID)
+{
+    if (any(DTid.xy >= g_Push.regionSize))
+        return;
+
+    int2 coord = int2(g_Push.regionOffset + DTid.xy);
+    int2 maxCoord = int2(g_Push.inputSize) - 1;
+    float2 invSize = 1.0f / float2(g_Push.inputSize);
+
+    float left = SampleVirtualHeightmap((float2(max(coord.x - 1, 0), coord.y) + 0.5f) * invSize);
+    float right = SampleVirtualHeightmap((float2(min(coord.x + 1, maxCoord.x), coord.y) + 0.5f) * invSize);
+    float top = SampleVirtualHeightmap((float2(coord.x, min(coord.y + 1, maxCoord.y)) + 0.5f) * invSize);
+    float bottom = SampleVirtualHeightmap((float2(coord.x, max(coord.y - 1, 0)) + 0.5f) * invSize);
+
+    u_Output[coord] = EncodeTerrainNormal(GetCentralDifferenceNormal(left, right, top, bottom));
+}
+
+// Builds a level from the normalized average of the normals of the level above, whose last odd row and column are
+// dropped like those of a mip chain
+[numthreads(8, 8, 1)]
+void normal_map_reduce_cs(uint3 DTid : SV_DispatchThreadID)
+{
+    if (any(DTid.xy >= g_Push.regionSize))
+        return;
+
+    uint2 coord = g_Push.regionOffset + DTid.xy;
+    uint2 first = min(coord * 2, g_Push.inputSize - 1);
+    uint2 last = min(coord * 2 + 1, g_Push.inputSize - 1);
+
+    float3 sum = DecodeTerrainNormal(t_Input[first])
+        + DecodeTerrainNormal(t_Input[uint2(last.x, first.y)])
+        + DecodeTerrainNormal(t_Input[uint2(first.x, last.y)])
+        + DecodeTerrainNormal(t_Input[last]);
+    float3 normal = dot(sum, sum) > 0.0f ? normalize(sum) : float3(0, 1, 0);
+
+    u_Output[coord] = EncodeTerrainNormal(normal);
+}
@@ -1,9 +1,106 @@
 #ifndef TERRAIN_HELPERS_H
 #define TERRAIN_HELPERS_H
 
+// Requires c_Terrain, t_HeightmapTexture, s_HeightmapSampler, and the page table and atlas of virtual heightmaps
+//  Shaders that request pages of virtual heightmaps define TERRAIN_HEIGHTMAP_FEEDBACK and declare u_HeightmapFeedback
+//  Shaders that read the normal map define TERRAIN_NORMAL_MAP and declare t_NormalMap
+
+// Virtual heightmaps (see TerrainVirtualHeightmap) are sampled from the finest resident page over the texture
+// coordinate, or from the always resident fallback level bound as the heightmap
+float SampleVirtualHeightmap(float2 texCoord)
+{
+    texCoord = saturate(texCoord);
+
+    uint2 tableSize = c_Terrain.VirtualPageTableSize;
+    uint2 cell = min(uint2(texCoord * float2(tableSize)), tableSize - 1);
+    uint entry = t_HeightmapPageTable.Load(int3(cell, 0));
+    if ((entry & VIRTUAL_PAGE_RESIDENT) == 0)
+    {
+        return t_HeightmapTexture.SampleLevel(s_HeightmapSampler, texCoord, 0);
+    }
+
+    uint level = (entry >> VIRTUAL_PAGE_LEVEL_SHIFT) & 0xFF;
+    uint2 slot = uint2(entry, entry >> VIRTUAL_PAGE_SLOT_Y_SHIFT) & VIRTUAL_PAGE_SLOT_MASK;
+
+    // Texels of the level from the first texel of the page, which its slot holds after the border
+    float pageSize = float(c_Terrain.VirtualPageSize);
+    float2 levelPos = texCoord * c_Terrain.HeightmapResolutionAndInvResolution.xy / float(1u << level);
+    float2 pagePos = levelPos - float2(cell >> level) * pageSize;
+    float2 atlasPos = float2(slot) * (pageSize + 2.0f * VIRTUAL_PAGE_BORDER) + VIRTUAL_PAGE_BORDER + pagePos;
+
+    return t_HeightmapAtlas.SampleLevel(s_HeightmapSampler, atlasPos * c_Terrain.VirtualAtlasInvSize, 0);
+}
+
 float GetTerrainHeight(float2 texCoord)
 {
-	return t_HeightmapTexture.SampleLevel(s_HeightmapSampler, texCoord, 0) * c_Terrain.HeightScaleAndInvScale.x;
+    float height;
+    if (c_Terrain.VirtualPageSize > 0)
+    {
+        height = SampleVirtualHeightmap(texCoord);
+    }
+    else
+    {
+        height = t_HeightmapTexture.SampleLevel(s_HeightmapSampler, texCoord, 0);
+    }
+    return height * c_Terrain.HeightScaleAndInvScale.x;
+}
+
+#ifdef TERRAIN_HEIGHTMAP_FEEDBACK
+// Requests the page of a virtual heightmap over the texture coordinate at the level where a texel spans the given
+// number of texels of level 0; the coarser pages over it are requested along with it
+void RequestHeightmapPage(float2 texCoord, float texelSpan)
+{
+    if (c_Terrain.VirtualPageSize == 0)
+    {
+        return;
+    }
+
+    // The fallback holds the levels beyond the paged ones
+    float level = floor(log2(max(texelSpan, 1.0f)));
+    if (level >= float(c_Terrain.VirtualLevelCount))
+    {
+        return;
+    }
+
+    uint2 tableSize = c_Terrain.VirtualPageTableSize;
+    uint2 cell = min(uint2(saturate(texCoord) * float2(tableSize)), tableSize - 1);
+    InterlockedMin(u_HeightmapFeedback[cell.y * tableSize.x + cell.x], uint(level));
+}
+#endif
+
+// Height of a vertex of the tessellated mesh
+//  On the edges of a tile, the height is interpolated between the ends of the border segment the vertex lies on
+//  Both tiles sharing an edge keep their leaves on it at least at the border depth, so every vertex either of them
+//  places on the edge lies on the same line, whatever their depth
+float GetTerrainVertexHeight(float2 texCoord)
+{
+    if (c_Terrain.TileBorderDepth > 0)
+    {
+        const float epsilon = 1e-6f;
+        bool2 onBorder = texCoord <= epsilon || texCoord >= 1.0f - epsilon;
+
+        // Corners are the ends of segments of both edges
+        if (onBorder.x != onBorder.y)
+        {
+            float t = (onBorder.x ? texCoord.y : texCoord.x) * c_Terrain.TileBorderSegments;
+            float segment = min(floor(t), c_Terrain.TileBorderSegments - 1.0f);
+
+            float2 start = texCoord;
+            float2 end = texCoord;
+            if (onBorder.x)
+            {
+                start.y = segment / c_Terrain.TileBorderSegments;
+                end.y = (segment + 1.0f) / c_Terrain.TileBorderSegments;
+            }
+            else
+            {
+                start.x = segment / c_Terrain.TileBorderSegments;
+                end.x = (segment + 1.0f) / c_Terrain.TileBorderSegments;
+            }
+            return lerp(GetTerrainHeight(start), GetTerrainHeight(end), t - segment);
+        }
+    }
+    return GetTerrainHeight(texCoord);
 }
 
 float3 GetTerrainNormal(float2 texCoord)
@@ -26,4 +123,26 @@ float3 GetTerrainNormal(float2 texCoord)
     return normalize(cross(bitangent, tangent));
 }
 
+#ifdef TERRAIN_NORMAL_MAP
+#include "TerrainNormals.hlsli"
+
+// Normal of the baked normal map (see TerrainNormalMapPass) at the given level
+float3 SampleTerrainNormalLevel(float2 texCoord, float level)
+{
+    return DecodeTerrainNormal(t_NormalMap.SampleLevel(s_HeightmapSampler, texCoord, level));
+}
+
+// Normal for shading a pixel, from the normal map filtered across its levels
+//  The normal map of a virtual heightmap has the resolution of its fallback level, so pixels take the central
+//  differences of the finest resident pages instead
+float3 SampleTerrainShadingNormal(float2 texCoord)
+{
+    if (c_Terrain.VirtualPageSize > 0)
+    {
+        return GetTerrainNormal(texCoord);
+    }
+    return DecodeTerrainNormal(t_NormalMap.Sample(s_HeightmapSampler, texCoord));
+}
+#endif
+
 #endif
\ No newline at end of file
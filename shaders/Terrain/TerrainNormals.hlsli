@@ -0,0 +1,32 @@
+#ifndef TERRAIN_NORMALS_H
+#define TERRAIN_NORMALS_H
+
+// Octahedral encoding of the terrain normal maps, in [-1, 1] for RG16_SNORM (see TerrainNormalMapPass)
+//  The octahedron is folded around +y, the up axis of terrains, so that the normals of all but the steepest slopes
+//  are away from the folded edges, where neighbouring texels would decode to distant normals once filtered
+//  EncodeOctahedral in the bake tool (tools/bake/TerrainBaker.cpp) mirrors EncodeTerrainNormal in C++, and checks
+//  that its output decodes as DecodeTerrainNormal does
+
+float2 TerrainNormalSignNotZero(float2 v)
+{
+    return float2(v.x >= 0.0f ? 1.0f : -1.0f, v.y >= 0.0f ? 1.0f : -1.0f);
+}
+
+float2 EncodeTerrainNormal(float3 n)
+{
+    // Encoded as the normal (x, z, y) with the pole on +z of the usual encoding
+    float2 p = n.xz / (abs(n.x) + abs(n.y) + abs(n.z));
+    return n.y <= 0.0f ? (1.0f - abs(p.yx)) * TerrainNormalSignNotZero(p) : p;
+}
+
+float3 DecodeTerrainNormal(float2 p)
+{
+    float3 n = float3(p, 1.0f - abs(p.x) - abs(p.y));
+    if (n.z < 0.0f)
+    {
+        n.xy = (1.0f - abs(n.yx)) * TerrainNormalSignNotZero(n.xy);
+    }
+    return normalize(n.xzy);
+}
+
+#endif
@@ -19,12 +19,50 @@ StructuredBuffer<InstanceData> t_Instances : REGISTER_SRV(GBUFFER_BINDING_INSTAN
 
 DECLARE_CBUFFER(TerrainConstants, c_Terrain, GBUFFER_BINDING_TERRAIN_CONSTANTS, GBUFFER_SPACE_TERRAIN);
 Texture2D<float> t_HeightmapTexture : REGISTER_SRV(GBUFFER_BINDING_TERRAIN_HEIGHTMAP_TEXTURE, GBUFFER_SPACE_TERRAIN);
+StructuredBuffer<uint> t_CulledNodes : REGISTER_SRV(GBUFFER_BINDING_TERRAIN_CULLED_NODES, GBUFFER_SPACE_TERRAIN);
+StructuredBuffer<TerrainVertex> t_Vertices : REGISTER_SRV(GBUFFER_BINDING_TERRAIN_VERTICES, GBUFFER_SPACE_TERRAIN);
+Texture2D<uint> t_HeightmapPageTable : REGISTER_SRV(GBUFFER_BINDING_TERRAIN_HEIGHTMAP_PAGE_TABLE, GBUFFER_SPACE_TERRAIN);
+Texture2D<float> t_HeightmapAtlas : REGISTER_SRV(GBUFFER_BINDING_TERRAIN_HEIGHTMAP_ATLAS, GBUFFER_SPACE_TERRAIN);
+
+#define TERRAIN_NORMAL_MAP
+Texture2D<float2> t_NormalMap : REGISTER_SRV(GBUFFER_BINDING_TERRAIN_NORMAL_MAP, GBUFFER_SPACE_TERRAIN);
+
+// Pages of a virtual heightmap requested by the pixels of the G-buffer, for the detail of their normals
+#define TERRAIN_HEIGHTMAP_FEEDBACK
+RWStructuredBuffer<uint> u_HeightmapFeedback : REGISTER_UAV(GBUFFER_BINDING_TERRAIN_HEIGHTMAP_FEEDBACK, GBUFFER_SPACE_TERRAIN);
 
 SamplerState s_HeightmapSampler : REGISTER_SAMPLER(GBUFFER_BINDING_TERRAIN_HEIGHTMAP_SAMPLER, GBUFFER_SPACE_VIEW);
 
 #include "TerrainHelpers.hlsli"
 
 
+void TerrainVertexOutput(
+    float2 texCoord,
+    float height,
+    out float4 o_position,
+    out SceneVertex o_vtx)
+{
+    const InstanceData instance = t_Instances[g_Push.startInstanceLocation];
+
+    float2 pos = (texCoord - 0.5f) * c_Terrain.TerrainExtentsAndInvExtents.xy;
+    float3 localPos = float3(pos.x, height, pos.y);
+
+    float3 worldPos = mul(instance.transform, float4(localPos, 1.0)).xyz;
+
+    // The tangent follows the u axis of the heightmap over the surface
+    float3 normal = SampleTerrainNormalLevel(texCoord, 0);
+    float3 tangent = normalize(float3(1, 0, 0) - normal * normal.x);
+
+    o_vtx.pos = worldPos;
+    o_vtx.texCoord = texCoord;
+    o_vtx.normal = mul(instance.transform, float4(normal, 0)).xyz;
+    o_vtx.tangent.xyz = mul(instance.transform, float4(tangent, 0)).xyz;
+    o_vtx.tangent.w = 0.0f;
+    o_vtx.prevPos = o_vtx.pos;
+
+    o_position = mul(float4(worldPos, 1.0), c_GBuffer.view.matWorldToClip);
+}
+
 void gbuffer_vs(
 	in uint i_vertex : SV_VertexID,
 	in uint i_instance : SV_InstanceID,
@@ -36,12 +74,11 @@ void gbuffer_vs(
     o_instance = g_Push.startInstanceLocation;
 
     // Terrain rendering uses instancing differently than other opaque geometry
-	// Each triangle is a different instance, and the instance ID is used to determine which node in the CBT it is
-    const InstanceData instance = t_Instances[g_Push.startInstanceLocation];
+	// Each triangle is a different instance, and the instance ID indexes the list of leaves that survived culling
+    uint nodeID = t_CulledNodes[i_instance];
+    cbt_Node node = cbt_CreateNode(nodeID, firstbithigh(nodeID));
 
     // Use LEB to find vertex position
-    cbt_Node node = cbt_DecodeNode(i_instance);
-
     float3x2 posMatrix = float3x2(float2(0, 1),
 								  float2(0, 0),
 								  float2(1, 0));
@@ -49,25 +86,81 @@ void gbuffer_vs(
 
     float2 texCoord = posMatrix[i_vertex];
 
-    float2 pos = (texCoord - 0.5f) * c_Terrain.TerrainExtentsAndInvExtents.xy;
-    float3 localPos = float3(pos.x, GetTerrainHeight(texCoord), pos.y);
+    TerrainVertexOutput(texCoord, GetTerrainVertexHeight(texCoord), o_position, o_vtx);
+}
 
-    float3 worldPos = mul(instance.transform, float4(localPos, 1.0)).xyz;
+// Position of a vertex of a patch in its triangle grid, relative to the edges of the leaf (0 to 1)
+//  Row r of the grid holds 2r+1 triangles, alternately pointing towards and away from the apex, in the winding of the leaf
+float2 GetPatchVertex(uint vertexID, uint patchLevel)
+{
+    uint triangleID = vertexID / 3;
+    uint corner = vertexID % 3;
+
+    // The first r rows hold r^2 triangles
+    uint row = uint(sqrt(float(triangleID)));
+    if (row * row > triangleID)
+        row--;
+    else if ((row + 1) * (row + 1) <= triangleID)
+        row++;
+
+    uint rowTriangle = triangleID - row * row;
+    uint column = rowTriangle / 2;
+
+    // (row, column) on the lattice, from the apex (0, 0) to the base (n, 0) - (n, n)
+    uint2 lattice;
+    if ((rowTriangle & 1) == 0)
+        lattice = corner == 0 ? uint2(row, column) : corner == 1 ? uint2(row + 1, column) : uint2(row + 1, column + 1);
+    else
+        lattice = corner == 0 ? uint2(row, column) : corner == 1 ? uint2(row + 1, column + 1) : uint2(row, column + 1);
+
+    return float2(lattice) / float(1u << patchLevel);
+}
+
+// Draws each leaf as a grid of 4^patchLevel triangles, interpolated from the leaf's LEB attributes
+void gbuffer_patch_vs(
+	in uint i_vertex : SV_VertexID,
+	in uint i_instance : SV_InstanceID,
+    out float4 o_position : SV_Position,
+    out SceneVertex o_vtx,
+    out uint o_instance : INSTANCE
+)
+{
+    o_instance = g_Push.startInstanceLocation;
 
-    float3 normal = float3(0, 1, 0);
-    float3 tangent = float3(1, 0, 0);
+    uint nodeID = t_CulledNodes[i_instance];
+    cbt_Node node = cbt_CreateNode(nodeID, firstbithigh(nodeID));
 
-    o_vtx.pos = worldPos;
-    o_vtx.texCoord = texCoord;
-    o_vtx.normal = mul(instance.transform, float4(normal, 0)).xyz;
-    o_vtx.tangent.xyz = mul(instance.transform, float4(tangent, 0)).xyz;
-    o_vtx.tangent.w = 0.0f;
-    o_vtx.prevPos = o_vtx.pos;
+    float3x2 posMatrix = float3x2(float2(0, 1),
+								  float2(0, 0),
+								  float2(1, 0));
+    posMatrix = leb_DecodeAttributeArray(node, posMatrix);
 
-    o_position = mul(float4(worldPos, 1.0), c_GBuffer.view.matWorldToClip);
+    float2 patchVertex = GetPatchVertex(i_vertex, g_Push.patchLevel);
+    float2 texCoord = posMatrix[0]
+        + patchVertex.x * (posMatrix[1] - posMatrix[0])
+        + patchVertex.y * (posMatrix[2] - posMatrix[1]);
+
+    TerrainVertexOutput(texCoord, GetTerrainVertexHeight(texCoord), o_position, o_vtx);
 }
 
+// Draws the materialized mesh of the culled leaves (see Materialize.hlsl), which shares vertices between leaves
+void gbuffer_indexed_vs(
+	in uint i_vertex : SV_VertexID,
+    out float4 o_position : SV_Position,
+    out SceneVertex o_vtx,
+    out uint o_instance : INSTANCE
+)
+{
+    o_instance = g_Push.startInstanceLocation;
 
+    TerrainVertex vertex = t_Vertices[i_vertex];
+
+    TerrainVertexOutput(vertex.texCoord, vertex.height, o_position, o_vtx);
+}
+
+
+// Writing the page requests would otherwise defer the depth test until after the shader
+[earlydepthstencil]
 void gbuffer_ps(
     in float4 i_position : SV_Position,
 	in SceneVertex i_vtx,
@@ -81,10 +174,17 @@ void gbuffer_ps(
     float opacity = 1.0f;
     float3 specularF0 = 0.0f;
     float occlusion = 0.0f;
-    float3 shadingNormal = GetTerrainNormal(i_vtx.texCoord);
+    float3 shadingNormal = SampleTerrainShadingNormal(i_vtx.texCoord);
     float roughness = 1.0f;
     float3 emissiveColor = 0.0f;
 
+    // Texels of level 0 covered by the pixel; a pixel of each 4x4 block requests the page of its level
+    float2 footprint = max(abs(ddx(i_vtx.texCoord)), abs(ddy(i_vtx.texCoord))) * c_Terrain.HeightmapResolutionAndInvResolution.xy;
+    if (all((uint2(i_position.xy) & 3) == 0))
+    {
+        RequestHeightmapPage(i_vtx.texCoord, max(footprint.x, footprint.y));
+    }
+
     o_channel0.xyz = diffuseAlbedo;
     o_channel0.w = opacity;
     o_channel1.xyz = specularF0;
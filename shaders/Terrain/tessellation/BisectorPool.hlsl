@@ -0,0 +1,88 @@
+#pragma pack_matrix(row_major)
+
+#include <donut/shaders/binding_helpers.hlsli>
+#include "TerrainShaders.h"
+
+#define BISECTOR_POOL_FLAG_WRITE
+#define BISECTOR_POOL_BUFFER_BINDING REGISTER_UAV(TESSELLATION_BINDING_CBT, TESSELLATION_SPACE_TERRAIN)
+#define BISECTOR_POOL_SCRATCH_BINDING REGISTER_UAV(TESSELLATION_BINDING_POOL_SCRATCH, TESSELLATION_SPACE_TERRAIN)
+#include "BisectorPool.hlsli"
+
+#include "IndirectArgs.hlsli"
+
+// Trailing free words of the allocation bitfield released per subdivision, which bounds the work of the dispatcher
+#define MAX_RELEASED_WORDS 64u
+
+
+// Inserts the allocated slots in the hash table, and lists the free slots below the high water mark
+//  The scratch buffer must be cleared to BISECTOR_POOL_NULL beforehand, which also clears the commands
+[numthreads(256, 1, 1)]
+void pool_prepare_cs(uint3 DTid : SV_DispatchThreadID)
+{
+    uint slot = DTid.x;
+
+    if (slot < GetPoolHighWater())
+    {
+        if (IsSlotAllocated(slot))
+        {
+            InsertLeaf(GetSlotHeapID(slot), slot);
+        }
+        else
+        {
+            uint index;
+            InterlockedAdd(u_BisectorPool[BISECTOR_POOL_HEADER_FREE_COUNT], 1u, index);
+            u_PoolScratch[GetFreeListIndex(index)] = slot;
+        }
+    }
+}
+
+// Splits the leaves claimed by the subdivision; the first child keeps the slot of the leaf and the second takes a free one
+//  Free slots below the high water mark are taken first, and the split never claims more slots than are available
+[numthreads(256, 1, 1)]
+void pool_bisect_cs(uint3 DTid : SV_DispatchThreadID)
+{
+    uint slot = DTid.x;
+
+    if (slot < GetPoolHighWater() && u_PoolScratch[GetCommandIndex(slot)] == BISECTOR_POOL_COMMAND_SPLIT)
+    {
+        uint heapID = GetSlotHeapID(slot);
+
+        uint index;
+        InterlockedAdd(u_BisectorPool[BISECTOR_POOL_HEADER_FREE_CURSOR], 1u, index);
+        uint freeCount = u_BisectorPool[BISECTOR_POOL_HEADER_FREE_COUNT];
+        uint childSlot = index < freeCount ? u_PoolScratch[GetFreeListIndex(index)] : GetPoolHighWater() + (index - freeCount);
+
+        SetSlotHeapID(slot, heapID << 1);
+        SetSlotHeapID(childSlot, (heapID << 1) | 1u);
+        AllocateSlot(childSlot);
+
+        InterlockedAdd(u_BisectorPool[BISECTOR_POOL_HEADER_COUNT], 1u);
+    }
+}
+
+// Moves the high water mark past the slots taken by the bisection, or back over the trailing free slots,
+// and resets the counters of the next subdivision
+//  The dispatch arguments cover the slots below the high water mark, and the draw arguments the leaves
+[numthreads(1, 1, 1)]
+void pool_dispatcher_cs()
+{
+    uint freeCount = u_BisectorPool[BISECTOR_POOL_HEADER_FREE_COUNT];
+    uint freeCursor = u_BisectorPool[BISECTOR_POOL_HEADER_FREE_CURSOR];
+    uint highWater = GetPoolHighWater() + (freeCursor > freeCount ? freeCursor - freeCount : 0u);
+
+    // Merges free slots anywhere in the pool, but the dispatches only shrink once the slots at the end are free
+    uint wordCount = (highWater + 31u) / 32u;
+    for (uint i = 0; i < MAX_RELEASED_WORDS && wordCount > 0 && u_BisectorPool[BISECTOR_POOL_HEADER_SIZE + wordCount - 1u] == 0u; i++)
+    {
+        wordCount--;
+    }
+    highWater = min(highWater, 32u * wordCount);
+
+    u_BisectorPool[BISECTOR_POOL_HEADER_HIGH_WATER] = highWater;
+    u_BisectorPool[BISECTOR_POOL_HEADER_FREE_COUNT] = 0u;
+    u_BisectorPool[BISECTOR_POOL_HEADER_FREE_CURSOR] = 0u;
+    u_BisectorPool[BISECTOR_POOL_HEADER_RESERVED] = 0u;
+
+    WriteCBTDispatchArgs(highWater);
+    WriteLEBDrawArgs(u_BisectorPool[BISECTOR_POOL_HEADER_COUNT]);
+}
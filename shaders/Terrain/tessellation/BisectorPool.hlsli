@@ -0,0 +1,135 @@
+#ifndef BISECTOR_POOL_H
+#define BISECTOR_POOL_H
+
+// Bisector pool topology (TERRAIN_TOPOLOGY_BISECTOR_POOL)
+//  The leaves of the LEB tree are a list of heap IDs with an allocation bitfield, so memory and work scale with the
+//  capacity of the pool rather than 2^MaxDepth; the layout of the buffers is described in TerrainShaders.h
+//  Neighbours are implied by the heap IDs, and found through a hash table of the leaves rebuilt before each subdivision
+
+// Requires BISECTOR_POOL_BUFFER_BINDING, and BISECTOR_POOL_FLAG_WRITE to modify the pool
+// The hash table, commands and free list require BISECTOR_POOL_SCRATCH_BINDING
+
+#ifdef BISECTOR_POOL_FLAG_WRITE
+RWStructuredBuffer<uint> u_BisectorPool : BISECTOR_POOL_BUFFER_BINDING;
+#else
+StructuredBuffer<uint> u_BisectorPool : BISECTOR_POOL_BUFFER_BINDING;
+#endif
+
+uint GetPoolMaxDepth()
+{
+    return u_BisectorPool[BISECTOR_POOL_HEADER_MAX_DEPTH];
+}
+
+uint GetPoolCapacity()
+{
+    return u_BisectorPool[BISECTOR_POOL_HEADER_CAPACITY];
+}
+
+uint GetPoolHighWater()
+{
+    return u_BisectorPool[BISECTOR_POOL_HEADER_HIGH_WATER];
+}
+
+uint GetSlotBitfieldIndex(uint slot)
+{
+    return BISECTOR_POOL_HEADER_SIZE + (slot >> 5);
+}
+
+bool IsSlotAllocated(uint slot)
+{
+    return (u_BisectorPool[GetSlotBitfieldIndex(slot)] >> (slot & 31u)) & 1u;
+}
+
+uint GetSlotHeapID(uint slot)
+{
+    return u_BisectorPool[BISECTOR_POOL_HEADER_SIZE + GetPoolCapacity() / 32u + slot];
+}
+
+#ifdef BISECTOR_POOL_FLAG_WRITE
+void SetSlotHeapID(uint slot, uint heapID)
+{
+    u_BisectorPool[BISECTOR_POOL_HEADER_SIZE + GetPoolCapacity() / 32u + slot] = heapID;
+}
+
+void AllocateSlot(uint slot)
+{
+    InterlockedOr(u_BisectorPool[GetSlotBitfieldIndex(slot)], 1u << (slot & 31u));
+}
+
+void FreeSlot(uint slot)
+{
+    InterlockedAnd(u_BisectorPool[GetSlotBitfieldIndex(slot)], ~(1u << (slot & 31u)));
+}
+#endif
+
+#ifdef BISECTOR_POOL_SCRATCH_BINDING
+RWStructuredBuffer<uint> u_PoolScratch : BISECTOR_POOL_SCRATCH_BINDING;
+
+uint GetPoolHashCapacity()
+{
+    return u_BisectorPool[BISECTOR_POOL_HEADER_HASH_CAPACITY];
+}
+
+uint GetCommandIndex(uint slot)
+{
+    return 2u * GetPoolHashCapacity() + slot;
+}
+
+uint GetFreeListIndex(uint index)
+{
+    return 2u * GetPoolHashCapacity() + GetPoolCapacity() + index;
+}
+
+uint HashHeapID(uint heapID)
+{
+    // Murmur3 finalizer
+    heapID ^= heapID >> 16;
+    heapID *= 0x85ebca6bu;
+    heapID ^= heapID >> 13;
+    heapID *= 0xc2b2ae35u;
+    heapID ^= heapID >> 16;
+    return heapID;
+}
+
+// The hash table has at least twice as many entries as the pool has slots, so probing ends well before the limit
+void InsertLeaf(uint heapID, uint slot)
+{
+    uint hashCapacity = GetPoolHashCapacity();
+    uint entry = HashHeapID(heapID) & (hashCapacity - 1u);
+    for (uint probe = 0; probe < BISECTOR_POOL_MAX_PROBES; probe++)
+    {
+        uint previousID;
+        InterlockedCompareExchange(u_PoolScratch[2u * entry], BISECTOR_POOL_NULL, heapID, previousID);
+        if (previousID == BISECTOR_POOL_NULL)
+        {
+            u_PoolScratch[2u * entry + 1u] = slot;
+            return;
+        }
+        entry = (entry + 1u) & (hashCapacity - 1u);
+    }
+}
+
+// Returns the slot of the leaf with the given heap ID, or BISECTOR_POOL_NULL if it is not a leaf
+//  Only valid once every leaf was inserted, i.e. in a later dispatch than the insertions
+uint FindLeafSlot(uint heapID)
+{
+    uint hashCapacity = GetPoolHashCapacity();
+    uint entry = HashHeapID(heapID) & (hashCapacity - 1u);
+    for (uint probe = 0; probe < BISECTOR_POOL_MAX_PROBES; probe++)
+    {
+        uint entryID = u_PoolScratch[2u * entry];
+        if (entryID == heapID)
+        {
+            return u_PoolScratch[2u * entry + 1u];
+        }
+        if (entryID == BISECTOR_POOL_NULL)
+        {
+            break;
+        }
+        entry = (entry + 1u) & (hashCapacity - 1u);
+    }
+    return BISECTOR_POOL_NULL;
+}
+#endif
+
+#endif
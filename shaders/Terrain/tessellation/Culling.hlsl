@@ -0,0 +1,150 @@
+
+#pragma pack_matrix(row_major)
+
+#include <donut/shaders/binding_helpers.hlsli>
+#include <donut/shaders/bindless.h>
+#include "TerrainShaders.h"
+
+#ifndef TERRAIN_TOPOLOGY
+#define TERRAIN_TOPOLOGY TERRAIN_TOPOLOGY_CBT
+#endif
+
+#if TERRAIN_TOPOLOGY == TERRAIN_TOPOLOGY_BISECTOR_POOL
+// The pool takes the binding of the CBT
+#define CBT_HEAP_BUFFER_BINDING REGISTER_SRV(TESSELLATION_BINDING_CBT_PLACEHOLDER, TESSELLATION_SPACE_TERRAIN)
+
+#define BISECTOR_POOL_BUFFER_BINDING REGISTER_SRV(TESSELLATION_BINDING_CBT, TESSELLATION_SPACE_TERRAIN)
+#include "BisectorPool.hlsli"
+#else
+#define CBT_HEAP_BUFFER_BINDING REGISTER_SRV(TESSELLATION_BINDING_CBT, TESSELLATION_SPACE_TERRAIN)
+#endif
+#include "ConcurrentBinaryTree.hlsl"
+#include "LongestEdgeBisection.hlsl"
+
+DECLARE_CBUFFER(SubdivisionConstants, c_Subdivision, TESSELLATION_BINDING_SUBDIVISION_CONSTANTS, TESSELLATION_SPACE_VIEW);
+DECLARE_PUSH_CONSTANTS(TerrainPushConstants, g_Push, TESSELLATION_BINDING_PUSH_CONSTANTS, TESSELLATION_SPACE_TERRAIN);
+DECLARE_CBUFFER(TerrainConstants, c_Terrain, TESSELLATION_BINDING_TERRAIN_CONSTANTS, TESSELLATION_SPACE_TERRAIN);
+
+StructuredBuffer<InstanceData> t_Instances : REGISTER_SRV(TESSELLATION_BINDING_INSTANCE_BUFFER, TESSELLATION_SPACE_TERRAIN);
+
+Texture2D<float> t_HeightmapTexture : REGISTER_SRV(TESSELLATION_BINDING_SUBDIVISION_HEIGHTMAP, TESSELLATION_SPACE_TERRAIN);
+Texture2D<float2> t_HeightBounds : REGISTER_SRV(TESSELLATION_BINDING_HEIGHT_BOUNDS, TESSELLATION_SPACE_TERRAIN);
+Texture2D<uint> t_HeightmapPageTable : REGISTER_SRV(TESSELLATION_BINDING_HEIGHTMAP_PAGE_TABLE, TESSELLATION_SPACE_TERRAIN);
+Texture2D<float> t_HeightmapAtlas : REGISTER_SRV(TESSELLATION_BINDING_HEIGHTMAP_ATLAS, TESSELLATION_SPACE_TERRAIN);
+SamplerState s_HeightmapSampler : REGISTER_SAMPLER(TESSELLATION_BINDING_SUBDIVISION_HEIGHTMAP_SAMPLER, TESSELLATION_SPACE_VIEW);
+
+Texture2D<float> t_OcclusionPyramid : REGISTER_SRV(TESSELLATION_BINDING_OCCLUSION_PYRAMID, TESSELLATION_SPACE_VIEW);
+
+// Heap IDs of the leaves that survived culling
+//  The visible leaves are appended from the front, and the occluded leaves from the back
+//  During the occlusion retest, it is the list of disoccluded leaves instead
+RWStructuredBuffer<uint> u_CulledNodes : REGISTER_UAV(TESSELLATION_BINDING_CULLED_NODES, TESSELLATION_SPACE_TERRAIN);
+
+// The culled nodes of the rendered mesh, read by the occlusion retest
+StructuredBuffer<uint> t_OccludedNodes : REGISTER_SRV(TESSELLATION_BINDING_OCCLUDED_NODES, TESSELLATION_SPACE_TERRAIN);
+
+// Layout must match nvrhi::DrawIndirectArguments, indexed by CULLED_DRAW_*
+struct DrawIndirectArgs
+{
+    uint vertexCount;
+    uint instanceCount;
+    uint startVertexLocation;
+    uint startInstanceLocation;
+};
+RWStructuredBuffer<DrawIndirectArgs> u_CulledIndirectArgs : REGISTER_UAV(TESSELLATION_BINDING_CULLED_INDIRECT_ARGS, TESSELLATION_SPACE_TERRAIN);
+
+#include "../TerrainHelpers.hlsli"
+#include "../FrustumCulling.hlsli"
+#include "../OcclusionCulling.hlsli"
+#include "LEBHelpers.hlsli"
+
+
+void CullLeaf(cbt_Node node)
+{
+    InstanceData instance = t_Instances[g_Push.startInstanceLocation];
+
+    float3 bmin, bmax;
+    DecodeNodeBounds(node, instance.transform, bmin, bmax);
+
+    if (FrustumCullingTest(c_Subdivision.viewEx.viewFrustum, bmin, bmax))
+    {
+        uint index;
+        if (OcclusionCullingTest(c_Subdivision.viewEx, t_OcclusionPyramid, bmin, bmax))
+        {
+            InterlockedAdd(u_CulledIndirectArgs[CULLED_DRAW_VISIBLE].instanceCount, 1u, index);
+            u_CulledNodes[index] = node.id;
+        }
+        else
+        {
+            // Both lists together never hold more than the leaf count, so they cannot overlap
+            uint capacity, stride;
+            u_CulledNodes.GetDimensions(capacity, stride);
+
+            InterlockedAdd(u_CulledIndirectArgs[CULLED_DRAW_OCCLUDED].instanceCount, 1u, index);
+            u_CulledNodes[capacity - 1 - index] = node.id;
+        }
+    }
+}
+
+// Compacts the leaves within the view frustum into u_CulledNodes
+//  Leaves hidden in the occlusion pyramid (of an earlier frame) are kept apart, to be retested once this frame's depth is known
+//  The instance counts of u_CulledIndirectArgs must be zero beforehand
+[numthreads(256, 1, 1)]
+void leaf_culling_cs(uint3 DTid : SV_DispatchThreadID)
+{
+    uint threadID = DTid.x;
+
+    // The vertex count depends on the render mode of the view (see SubdivisionConstants)
+    if (threadID == 0)
+    {
+        for (uint culledDraw = 0; culledDraw < CULLED_DRAW_COUNT; culledDraw++)
+        {
+            u_CulledIndirectArgs[culledDraw].vertexCount = c_Subdivision.patchVertexCount;
+        }
+    }
+
+#if TERRAIN_TOPOLOGY == TERRAIN_TOPOLOGY_BISECTOR_POOL
+    // One thread per slot of the pool below the high water mark
+    if (threadID < GetPoolHighWater() && IsSlotAllocated(threadID))
+    {
+        uint heapID = GetSlotHeapID(threadID);
+        CullLeaf(cbt_CreateNode(heapID, firstbithigh(heapID)));
+    }
+#else
+    if (threadID < cbt_NodeCount())
+    {
+        CullLeaf(cbt_DecodeNode(threadID));
+    }
+#endif
+}
+
+// Compacts the occluded leaves that are visible in the occlusion pyramid of the current frame into u_CulledNodes
+//  Dispatched for the leaf count, which bounds the number of occluded leaves
+//  The disoccluded instance count of u_CulledIndirectArgs must be zero beforehand
+[numthreads(256, 1, 1)]
+void leaf_occlusion_retest_cs(uint3 DTid : SV_DispatchThreadID)
+{
+    uint threadID = DTid.x;
+
+    if (threadID < u_CulledIndirectArgs[CULLED_DRAW_OCCLUDED].instanceCount)
+    {
+        uint capacity, stride;
+        t_OccludedNodes.GetDimensions(capacity, stride);
+
+        uint nodeID = t_OccludedNodes[capacity - 1 - threadID];
+        cbt_Node node = cbt_CreateNode(nodeID, firstbithigh(nodeID));
+        InstanceData instance = t_Instances[g_Push.startInstanceLocation];
+
+        float3 bmin, bmax;
+        DecodeNodeBounds(node, instance.transform, bmin, bmax);
+
+        // The first pass may have culled against an older view (e.g. with asynchronous tessellation)
+        if (FrustumCullingTest(c_Subdivision.viewEx.viewFrustum, bmin, bmax)
+            && OcclusionCullingTest(c_Subdivision.viewEx, t_OcclusionPyramid, bmin, bmax))
+        {
+            uint index;
+            InterlockedAdd(u_CulledIndirectArgs[CULLED_DRAW_DISOCCLUDED].instanceCount, 1u, index);
+            u_CulledNodes[index] = nodeID;
+        }
+    }
+}
@@ -7,34 +7,18 @@
 #define CBT_HEAP_BUFFER_BINDING REGISTER_SRV(TESSELLATION_BINDING_CBT, TESSELLATION_SPACE_TERRAIN)
 #include "ConcurrentBinaryTree.hlsl"
 
-struct IndirectArgs
-{
-    struct
-    {
-        uint groupsX;
-        uint groupsY;
-        uint groupsZ;
-    } cbtDispatch;
-
-    struct
-    {
-        uint vertexCount;
-        uint instanceCount;
-        uint startVertexLocation;
-        uint startInstanceLocation;
-    } lebDispatch;
-};
-RWStructuredBuffer<IndirectArgs> RWIndirectArgs : REGISTER_UAV(TESSELLATION_BINDING_INDIRECT_ARGS, TESSELLATION_SPACE_TERRAIN);
+#include "IndirectArgs.hlsli"
 
 [numthreads(1, 1, 1)]
 void cbt_dispatcher_cs()
 {
-    uint nodeCount = cbt_NodeCount();
-    RWIndirectArgs[0].cbtDispatch.groupsX = max(nodeCount >> 8, 1);
+    WriteCBTDispatchArgs(cbt_NodeCount());
 }
 
 [numthreads(1, 1, 1)]
 void leb_dispatcher_cs()
 {
-    RWIndirectArgs[0].lebDispatch.instanceCount = cbt_NodeCount();
+    // The dispatch arguments are also used by the culling that follows
+    WriteCBTDispatchArgs(cbt_NodeCount());
+    WriteLEBDrawArgs(cbt_NodeCount());
 }
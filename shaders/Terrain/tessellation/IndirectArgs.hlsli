@@ -0,0 +1,36 @@
+#ifndef INDIRECT_ARGS_H
+#define INDIRECT_ARGS_H
+
+// Layout must match TerrainMeshView::CreateBuffers
+struct IndirectArgs
+{
+    struct
+    {
+        uint groupsX;
+        uint groupsY;
+        uint groupsZ;
+    } cbtDispatch;
+
+    struct
+    {
+        uint vertexCount;
+        uint instanceCount;
+        uint startVertexLocation;
+        uint startInstanceLocation;
+    } lebDispatch;
+};
+RWStructuredBuffer<IndirectArgs> RWIndirectArgs : REGISTER_UAV(TESSELLATION_BINDING_INDIRECT_ARGS, TESSELLATION_SPACE_TERRAIN);
+
+
+// One thread per node, in groups of 256
+void WriteCBTDispatchArgs(uint nodeCount)
+{
+    RWIndirectArgs[0].cbtDispatch.groupsX = max((nodeCount + 255u) >> 8, 1u);
+}
+
+void WriteLEBDrawArgs(uint nodeCount)
+{
+    RWIndirectArgs[0].lebDispatch.instanceCount = nodeCount;
+}
+
+#endif
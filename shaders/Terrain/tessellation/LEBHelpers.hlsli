@@ -0,0 +1,136 @@
+#ifndef LEB_HELPERS_H
+#define LEB_HELPERS_H
+
+// Requires c_Terrain, t_HeightBounds and the terrain helpers
+
+#include "../../PyramidHelpers.hlsli"
+
+float3 LEBSpaceToLocalSpace(float2 leb_pos)
+{
+    float2 pos = (leb_pos - 0.5f) * c_Terrain.TerrainExtentsAndInvExtents.xy;
+    return float3(pos.x, GetTerrainVertexHeight(leb_pos), pos.y);
+}
+
+void DecodeFaceVertices(cbt_Node node, out float3 faceVertices[3])
+{
+    float3x2 pos = float3x2(float2(0, 1),
+        float2(0, 0),
+        float2(1, 0));
+    pos = leb_DecodeAttributeArray(node, pos);
+
+    faceVertices[0] = LEBSpaceToLocalSpace(pos[0]);
+    faceVertices[1] = LEBSpaceToLocalSpace(pos[1]);
+    faceVertices[2] = LEBSpaceToLocalSpace(pos[2]);
+}
+
+void TransformFaceVertices(inout float3 faceVertices[3], float3x4 mat)
+{
+    faceVertices[0] = mul(mat, float4(faceVertices[0], 1.0f)).xyz;
+    faceVertices[1] = mul(mat, float4(faceVertices[1], 1.0f)).xyz;
+    faceVertices[2] = mul(mat, float4(faceVertices[2], 1.0f)).xyz;
+}
+
+// Texels of the height pyramids covering every heightmap texel that a bilinear sample within a rectangle may read,
+//  at the level where they span at most 2x2 texels; returns the level
+//  The texels are those of the heightmap the pyramids were built from, the fallback level of a virtual heightmap
+uint GetHeightPyramidTexels(float2 texCoordMin, float2 texCoordMax, out int2 texelMin, out int2 texelMax)
+{
+    int2 resolution = int2(c_Terrain.HeightPyramidResolution);
+
+    texelMin = clamp(int2(floor(texCoordMin * resolution - 0.5f)), 0, resolution - 1);
+    texelMax = clamp(int2(floor(texCoordMax * resolution - 0.5f)) + 1, 0, resolution - 1);
+
+    uint boundsWidth, boundsHeight, mipLevels;
+    t_HeightBounds.GetDimensions(0, boundsWidth, boundsHeight, mipLevels);
+
+    // Mip 0 of the pyramids is half the resolution of the heightmap
+    texelMin >>= 1;
+    texelMax >>= 1;
+
+    uint level = GetPyramidLevel(texelMin, texelMax, mipLevels);
+    texelMin >>= level;
+    texelMax >>= level;
+
+    // The last texel of a level covers the remainder of an odd size
+    uint levelWidth, levelHeight, levelMips;
+    t_HeightBounds.GetDimensions(level, levelWidth, levelHeight, levelMips);
+    int2 maxTexel = int2(levelWidth, levelHeight) - 1;
+    texelMin = min(texelMin, maxTexel);
+    texelMax = min(texelMax, maxTexel);
+
+    return level;
+}
+
+// Conservative bounds of the (bilinearly sampled) terrain height within a rectangle of the heightmap
+float2 GetTerrainHeightBounds(float2 texCoordMin, float2 texCoordMax)
+{
+    int2 texelMin, texelMax;
+    uint level = GetHeightPyramidTexels(texCoordMin, texCoordMax, texelMin, texelMax);
+
+    float2 b0 = t_HeightBounds.Load(int3(texelMin.x, texelMin.y, level));
+    float2 b1 = t_HeightBounds.Load(int3(texelMax.x, texelMin.y, level));
+    float2 b2 = t_HeightBounds.Load(int3(texelMin.x, texelMax.y, level));
+    float2 b3 = t_HeightBounds.Load(int3(texelMax.x, texelMax.y, level));
+
+    float2 bounds = float2(min(min(b0.x, b1.x), min(b2.x, b3.x)), max(max(b0.y, b1.y), max(b2.y, b3.y)));
+    bounds += float2(-c_Terrain.HeightBoundsMargin, c_Terrain.HeightBoundsMargin);
+    return bounds * c_Terrain.HeightScaleAndInvScale.x;
+}
+
+// Bounding rectangle of the node in LEB space, which is also the heightmap texture space
+void DecodeNodeTexCoordBounds(cbt_Node node, out float2 lebMin, out float2 lebMax)
+{
+    float3x2 pos = float3x2(float2(0, 1),
+        float2(0, 0),
+        float2(1, 0));
+    pos = leb_DecodeAttributeArray(node, pos);
+
+    lebMin = min(min(pos[0], pos[1]), pos[2]);
+    lebMax = max(max(pos[0], pos[1]), pos[2]);
+}
+
+bool TouchesTileBorder(float2 lebMin, float2 lebMax)
+{
+    return c_Terrain.TileBorderDepth > 0 && (any(lebMin <= 0.0f) || any(lebMax >= 1.0f));
+}
+
+// Nodes on the edges of a tile above the border depth must be split, so that the vertices of both tiles sharing an
+// edge lie on its border segments (see GetTerrainVertexHeight)
+bool IsTileBorderNode(cbt_Node node)
+{
+    if (node.depth >= c_Terrain.TileBorderDepth)
+        return false;
+
+    float2 lebMin, lebMax;
+    DecodeNodeTexCoordBounds(node, lebMin, lebMax);
+    return TouchesTileBorder(lebMin, lebMax);
+}
+
+// World space bounding box of all of the terrain under the node, not only of its corners
+void DecodeNodeBounds(cbt_Node node, float3x4 mat, out float3 bmin, out float3 bmax)
+{
+    float2 lebMin, lebMax;
+    DecodeNodeTexCoordBounds(node, lebMin, lebMax);
+
+    // The heights on the edges of a tile are interpolated along border segments, which may extend beyond the node
+    float2 heightMin = lebMin, heightMax = lebMax;
+    if (TouchesTileBorder(lebMin, lebMax))
+    {
+        heightMin = floor(lebMin * c_Terrain.TileBorderSegments) / c_Terrain.TileBorderSegments;
+        heightMax = ceil(lebMax * c_Terrain.TileBorderSegments) / c_Terrain.TileBorderSegments;
+    }
+    float2 heightBounds = GetTerrainHeightBounds(heightMin, heightMax);
+
+    float2 localMin = (lebMin - 0.5f) * c_Terrain.TerrainExtentsAndInvExtents.xy;
+    float2 localMax = (lebMax - 0.5f) * c_Terrain.TerrainExtentsAndInvExtents.xy;
+    float3 localCenter = 0.5f * float3(localMin.x + localMax.x, heightBounds.x + heightBounds.y, localMin.y + localMax.y);
+    float3 localExtent = 0.5f * float3(localMax.x - localMin.x, heightBounds.y - heightBounds.x, localMax.y - localMin.y);
+
+    float3 center = mul(mat, float4(localCenter, 1.0f)).xyz;
+    float3 extent = mul(abs((float3x3)mat), localExtent);
+
+    bmin = center - extent;
+    bmax = center + extent;
+}
+
+#endif
@@ -5,9 +5,27 @@
 #include <donut/shaders/bindless.h>
 #include "TerrainShaders.h"
 
+#ifndef LOD_SCHEME
+#define LOD_SCHEME LOD_SCHEME_PERSPECTIVE
+#endif
+
+#ifndef TERRAIN_TOPOLOGY
+#define TERRAIN_TOPOLOGY TERRAIN_TOPOLOGY_CBT
+#endif
+
+#if TERRAIN_TOPOLOGY == TERRAIN_TOPOLOGY_BISECTOR_POOL
+// The pool takes the binding of the CBT
+#define CBT_HEAP_BUFFER_BINDING REGISTER_SRV(TESSELLATION_BINDING_CBT_PLACEHOLDER, TESSELLATION_SPACE_TERRAIN)
+
+#define BISECTOR_POOL_FLAG_WRITE
+#define BISECTOR_POOL_BUFFER_BINDING REGISTER_UAV(TESSELLATION_BINDING_CBT, TESSELLATION_SPACE_TERRAIN)
+#define BISECTOR_POOL_SCRATCH_BINDING REGISTER_UAV(TESSELLATION_BINDING_POOL_SCRATCH, TESSELLATION_SPACE_TERRAIN)
+#include "BisectorPool.hlsli"
+#else
 #define CBT_FLAG_WRITE
 
 #define CBT_HEAP_BUFFER_BINDING REGISTER_UAV(TESSELLATION_BINDING_CBT, TESSELLATION_SPACE_TERRAIN)
+#endif
 #include "ConcurrentBinaryTree.hlsl"
 #include "LongestEdgeBisection.hlsl"
 
@@ -17,37 +35,26 @@ DECLARE_CBUFFER(TerrainConstants, c_Terrain, TESSELLATION_BINDING_TERRAIN_CONSTA
 
 StructuredBuffer<InstanceData> t_Instances : REGISTER_SRV(TESSELLATION_BINDING_INSTANCE_BUFFER, TESSELLATION_SPACE_TERRAIN);
 
+RWStructuredBuffer<TessellationFeedback> u_Feedback : REGISTER_UAV(TESSELLATION_BINDING_FEEDBACK, TESSELLATION_SPACE_TERRAIN);
+
 Texture2D<float> t_HeightmapTexture : REGISTER_SRV(TESSELLATION_BINDING_SUBDIVISION_HEIGHTMAP, TESSELLATION_SPACE_TERRAIN);
+Texture2D<float2> t_HeightBounds : REGISTER_SRV(TESSELLATION_BINDING_HEIGHT_BOUNDS, TESSELLATION_SPACE_TERRAIN);
+Texture2D<float> t_HeightError : REGISTER_SRV(TESSELLATION_BINDING_HEIGHT_ERROR, TESSELLATION_SPACE_TERRAIN);
+Texture2D<uint> t_HeightmapPageTable : REGISTER_SRV(TESSELLATION_BINDING_HEIGHTMAP_PAGE_TABLE, TESSELLATION_SPACE_TERRAIN);
+Texture2D<float> t_HeightmapAtlas : REGISTER_SRV(TESSELLATION_BINDING_HEIGHTMAP_ATLAS, TESSELLATION_SPACE_TERRAIN);
 SamplerState s_HeightmapSampler : REGISTER_SAMPLER(TESSELLATION_BINDING_SUBDIVISION_HEIGHTMAP_SAMPLER, TESSELLATION_SPACE_VIEW);
 
-#include "../TerrainHelpers.hlsli"
-#include "../FrustumCulling.hlsli"
-
+// Pages of a virtual heightmap requested by the nodes that pass culling
+#define TERRAIN_HEIGHTMAP_FEEDBACK
+RWStructuredBuffer<uint> u_HeightmapFeedback : REGISTER_UAV(TESSELLATION_BINDING_HEIGHTMAP_FEEDBACK, TESSELLATION_SPACE_TERRAIN);
 
-float3 LEBSpaceToLocalSpace(float2 leb_pos)
-{
-    float2 pos = (leb_pos - 0.5f) * c_Terrain.TerrainExtentsAndInvExtents.xy;
-    return float3(pos.x, GetTerrainHeight(leb_pos), pos.y);
-}
+Texture2D<float> t_OcclusionPyramid : REGISTER_SRV(TESSELLATION_BINDING_OCCLUSION_PYRAMID, TESSELLATION_SPACE_VIEW);
 
-void DecodeFaceVertices(cbt_Node node, out float3 faceVertices[3])
-{
-    float3x2 pos = float3x2(float2(0, 1),
-        float2(0, 0),
-        float2(1, 0));
-    pos = leb_DecodeAttributeArray(node, pos);
-
-    faceVertices[0] = LEBSpaceToLocalSpace(pos[0]);
-    faceVertices[1] = LEBSpaceToLocalSpace(pos[1]);
-    faceVertices[2] = LEBSpaceToLocalSpace(pos[2]);
-}
+#include "../TerrainHelpers.hlsli"
+#include "../FrustumCulling.hlsli"
+#include "../OcclusionCulling.hlsli"
+#include "LEBHelpers.hlsli"
 
-void TransformFaceVertices(inout float3 faceVertices[3], float3x4 mat)
-{
-    faceVertices[0] = mul(mat, float4(faceVertices[0], 1.0f)).xyz;
-    faceVertices[1] = mul(mat, float4(faceVertices[1], 1.0f)).xyz;
-    faceVertices[2] = mul(mat, float4(faceVertices[2], 1.0f)).xyz;
-}
 
 float TriangleLevelOfDetail_Perspective(float3 patchVertices_WorldSpace[3])
 {
@@ -71,53 +78,205 @@ float TriangleLevelOfDetail_Perspective(float3 patchVertices_WorldSpace[3])
 #endif
 }
 
+// Only the extent across the view plane is projected by an orthographic view, at the same scale at any depth
+float TriangleLevelOfDetail_Orthographic(float3 patchVertices_WorldSpace[3])
+{
+    float2 v0 = mul(float4(patchVertices_WorldSpace[0], 1.0f), c_Subdivision.view.matWorldToView).xy;
+    float2 v2 = mul(float4(patchVertices_WorldSpace[2], 1.0f), c_Subdivision.view.matWorldToView).xy;
+    float2 edgeVector = v2 - v0;
+
+    return c_Subdivision.lodFactor + log2(dot(edgeVector, edgeVector));
+}
+
 float TriangleLevelOfDetail(float3 patchVertices_WorldSpace[3])
 {
+#if LOD_SCHEME == LOD_SCHEME_ORTHOGRAPHIC
+    return TriangleLevelOfDetail_Orthographic(patchVertices_WorldSpace);
+#else
     return TriangleLevelOfDetail_Perspective(patchVertices_WorldSpace);
+#endif
+}
+
+// Projected deviation of the heightmap from the planar triangle, bounded by the height error of the node's region
+float TriangleLevelOfDetail_Geometric(cbt_Node node, float3x4 transform, float3 bmin, float3 bmax)
+{
+    float2 lebMin, lebMax;
+    DecodeNodeTexCoordBounds(node, lebMin, lebMax);
+
+    // Splitting below the size of a heightmap texel adds no detail, so such nodes are neither split nor merged
+    float2 texelExtent = (lebMax - lebMin) * c_Terrain.HeightmapResolutionAndInvResolution.xy;
+    if (max(texelExtent.x, texelExtent.y) <= 1.0f)
+    {
+        return 1.0f;
+    }
+
+    int2 texelMin, texelMax;
+    uint level = GetHeightPyramidTexels(lebMin, lebMax, texelMin, texelMax);
+    float error = max(
+        max(t_HeightError.Load(int3(texelMin.x, texelMin.y, level)), t_HeightError.Load(int3(texelMax.x, texelMin.y, level))),
+        max(t_HeightError.Load(int3(texelMin.x, texelMax.y, level)), t_HeightError.Load(int3(texelMax.x, texelMax.y, level))));
+
+    // World space error, scaled by the vertical axis of the instance
+    error *= c_Terrain.HeightScaleAndInvScale.x * length(float3(transform._12, transform._22, transform._32));
+
+    // Distance from the camera to the closest point of the node
+    float3 cameraPosition = c_Subdivision.view.matViewToWorld[3].xyz;
+    float3 offset = max(max(bmin - cameraPosition, cameraPosition - bmax), 0.0f);
+    float distance = max(length(offset), 1e-3f);
+
+    return c_Subdivision.lodFactor + log2(error / distance);
+}
+
+// Requests the pages of a virtual heightmap that the corners of the node and of its children read
+void RequestNodeHeightmapPages(cbt_Node node)
+{
+    if (c_Terrain.VirtualPageSize == 0)
+    {
+        return;
+    }
+
+    float2 lebMin, lebMax;
+    DecodeNodeTexCoordBounds(node, lebMin, lebMax);
+
+    // A page of the level of the children is at least as large as the node, so the pages over its corners cover it
+    float2 texelExtent = (lebMax - lebMin) * c_Terrain.HeightmapResolutionAndInvResolution.xy;
+    float texelSpan = 0.5f * max(texelExtent.x, texelExtent.y);
+
+    RequestHeightmapPage(lebMin, texelSpan);
+    RequestHeightmapPage(float2(lebMax.x, lebMin.y), texelSpan);
+    RequestHeightmapPage(float2(lebMin.x, lebMax.y), texelSpan);
+    RequestHeightmapPage(lebMax, texelSpan);
 }
 
-float LevelOfDetail(float3 patchVertices_WorldSpace[3])
+float LevelOfDetail(cbt_Node node, float3x4 transform, float3 patchVertices_WorldSpace[3])
 {
+    // Tiles keep their edges at the border depth even out of view, as the neighbouring tile may see them
+    if (IsTileBorderNode(node))
+    {
+        return 2.0f;
+    }
+
+    // Culling is against the bounds of all of the terrain under the node, as peaks may rise above its corners
+    float3 bmin, bmax;
+    DecodeNodeBounds(node, transform, bmin, bmax);
+
 	// Frustum culling
-    if (!FrustumCullingTest(c_Subdivision.viewEx.viewFrustum, patchVertices_WorldSpace))
+    if (!FrustumCullingTest(c_Subdivision.viewEx.viewFrustum, bmin, bmax))
     {
 	    return 0.0f;
     }
+    // Occlusion culling (optional), against the depth of an earlier frame
+    if ((c_Subdivision.viewEx.occlusionFlags & OCCLUSION_FLAG_SUBDIVISION)
+        && !OcclusionCullingTest(c_Subdivision.viewEx, t_OcclusionPyramid, bmin, bmax))
+    {
+        return 0.0f;
+    }
+
+    RequestNodeHeightmapPages(node);
+
+#if LOD_SCHEME == LOD_SCHEME_GEOMETRIC
+    return TriangleLevelOfDetail_Geometric(node, transform, bmin, bmax);
+#else
     return TriangleLevelOfDetail(patchVertices_WorldSpace);
+#endif
 }
 
 
-[numthreads(256, 1, 1)]
-void split_cs(uint3 DTid : SV_DispatchThreadID)
+// Statistics of the group, added to the feedback once per group rather than once per leaf (see TessellationFeedback)
+#define GROUP_STATS_SPLITS TESSELLATION_FEEDBACK_DEPTH_COUNT
+#define GROUP_STATS_MERGES (TESSELLATION_FEEDBACK_DEPTH_COUNT + 1)
+#define GROUP_STATS_COUNT (TESSELLATION_FEEDBACK_DEPTH_COUNT + 2)
+groupshared uint gs_Stats[GROUP_STATS_COUNT];
+
+void BeginGroupStats(uint groupIndex)
+{
+    if (groupIndex < GROUP_STATS_COUNT)
+    {
+        gs_Stats[groupIndex] = 0u;
+    }
+    GroupMemoryBarrierWithGroupSync();
+}
+
+void CountLeaf(uint depth)
 {
-    uint threadID = DTid.x;
+    InterlockedAdd(gs_Stats[min(depth, TESSELLATION_FEEDBACK_DEPTH_COUNT - 1)], 1u);
+}
+
+void CountSplit()
+{
+    InterlockedAdd(gs_Stats[GROUP_STATS_SPLITS], 1u);
+}
+
+void CountMerge()
+{
+    InterlockedAdd(gs_Stats[GROUP_STATS_MERGES], 1u);
+}
+
+void EndGroupStats(uint groupIndex)
+{
+    GroupMemoryBarrierWithGroupSync();
+
+    if (groupIndex < GROUP_STATS_COUNT && gs_Stats[groupIndex] != 0u)
+    {
+        if (groupIndex == GROUP_STATS_SPLITS)
+        {
+            InterlockedAdd(u_Feedback[0].SplitCount, gs_Stats[groupIndex]);
+        }
+        else if (groupIndex == GROUP_STATS_MERGES)
+        {
+            InterlockedAdd(u_Feedback[0].MergeCount, gs_Stats[groupIndex]);
+        }
+        else
+        {
+            InterlockedAdd(u_Feedback[0].LeafCountPerDepth[groupIndex], gs_Stats[groupIndex]);
+        }
+    }
+}
+
 
+#if TERRAIN_TOPOLOGY == TERRAIN_TOPOLOGY_CBT
+
+void SplitPass(uint threadID)
+{
     if (threadID < cbt_NodeCount())
     {
         cbt_Node node = cbt_DecodeNode(threadID);
         InstanceData instance = t_Instances[g_Push.startInstanceLocation];
+        CountLeaf(node.depth);
 
         float3 faceVertices[3];
     	DecodeFaceVertices(node, faceVertices);
         TransformFaceVertices(faceVertices, instance.transform);
 
-        float lod = LevelOfDetail(faceVertices);
+        float lod = LevelOfDetail(node, instance.transform, faceVertices);
 
-        if (lod > 1.0f) {
+        // Nodes at the maximum depth cannot be split, so they do not count as a change
+        if (lod > 1.0f && !cbt_IsCeilNode(node)) {
             leb_SplitNode(node);
+            u_Feedback[0].Changed = 1u;
+            CountSplit();
         }
     }
 }
 
-[numthreads(256, 1, 1)]
-void merge_cs(uint3 DTid : SV_DispatchThreadID)
+// Same test as leb_MergeNode, which leaves a diamond as it is unless the four children of its parents are all leaves
+//  Diamonds blocked by a deeper child remain whenever the level of detail is not monotonic, so they must not count as a change
+bool IsDiamondMergeable(cbt_Node node, leb_DiamondParent diamondParent)
 {
-    uint threadID = DTid.x;
+    cbt_Node sibling = cbt_CreateNode(node.id ^ 1u, node.depth);
+    cbt_Node topChild = cbt_CreateNode(diamondParent.top.id << 1u, node.depth);
+    cbt_Node topSibling = cbt_CreateNode((diamondParent.top.id << 1u) | 1u, node.depth);
+
+    return cbt_HeapRead(sibling) == 1u && cbt_HeapRead(topChild) == 1u && cbt_HeapRead(topSibling) == 1u;
+}
 
+void MergePass(uint threadID)
+{
     if (threadID < cbt_NodeCount())
     {
         cbt_Node node = cbt_DecodeNode(threadID);
         InstanceData instance = t_Instances[g_Push.startInstanceLocation];
+        CountLeaf(node.depth);
 
         leb_DiamondParent diamondParent = leb_DecodeDiamondParent(node);
         bool mergeBase, mergeTop;
@@ -127,19 +286,212 @@ void merge_cs(uint3 DTid : SV_DispatchThreadID)
             DecodeFaceVertices(diamondParent.base, faceVertices);
             TransformFaceVertices(faceVertices, instance.transform);
 
-            mergeBase = LevelOfDetail(faceVertices) < 1.0f;
+            mergeBase = LevelOfDetail(diamondParent.base, instance.transform, faceVertices) < 1.0f;
         }
         {
             float3 faceVertices[3];
             DecodeFaceVertices(diamondParent.top, faceVertices);
             TransformFaceVertices(faceVertices, instance.transform);
 
-            mergeTop = LevelOfDetail(faceVertices) < 1.0f;
+            mergeTop = LevelOfDetail(diamondParent.top, instance.transform, faceVertices) < 1.0f;
         }
 
-        if (mergeTop && mergeBase)
+        // The root node cannot be merged, so it does not count as a change
+        if (mergeTop && mergeBase && !cbt_IsRootNode(node) && IsDiamondMergeable(node, diamondParent))
         {
             leb_MergeNode(node, diamondParent);
+            u_Feedback[0].Changed = 1u;
+
+            // Every child of the diamond merges it, so it is counted by the first child of its lower parent only, as
+            // the bisector pool merges it (on the border, the top is the base itself)
+            if ((node.id & 1u) == 0u && diamondParent.base.id <= diamondParent.top.id)
+            {
+                CountMerge();
+            }
         }
     }
 }
+
+#else // TERRAIN_TOPOLOGY_BISECTOR_POOL
+
+float NodeLevelOfDetail(cbt_Node node, float3x4 transform)
+{
+    float3 faceVertices[3];
+    DecodeFaceVertices(node, faceVertices);
+    TransformFaceVertices(faceVertices, transform);
+
+    return LevelOfDetail(node, transform, faceVertices);
+}
+
+// Heap ID of the node at the same depth across the longest edge, or of the node itself on the border
+uint GetEdgeNeighborID(cbt_Node node)
+{
+    // The top of the diamond of a child is the edge neighbour of its parent
+    cbt_Node child = cbt_CreateNode(node.id << 1, node.depth + 1);
+    return leb_DecodeDiamondParent(child).top.id;
+}
+
+// Claims the split of a diamond of two leaves (the same slot twice on the border) for the bisection pass
+//  Returns false if another thread claimed it first, or if the pool cannot hold the new children
+bool ClaimDiamondSplit(uint slot, uint edgeSlot)
+{
+    // Claimed through the lower slot, so that either leaf may claim the diamond
+    uint previousCommand;
+    InterlockedCompareExchange(u_PoolScratch[GetCommandIndex(min(slot, edgeSlot))], BISECTOR_POOL_NULL, BISECTOR_POOL_COMMAND_SPLIT, previousCommand);
+    if (previousCommand != BISECTOR_POOL_NULL)
+    {
+        return false;
+    }
+
+    // The slots are only reserved if they are all available, so that a claim blocked by a full pool does not hold
+    // capacity that a smaller claim could use
+    uint slotCount = slot == edgeSlot ? 1u : 2u;
+    uint availableSlots = u_BisectorPool[BISECTOR_POOL_HEADER_FREE_COUNT] + GetPoolCapacity() - GetPoolHighWater();
+    uint reserved = u_BisectorPool[BISECTOR_POOL_HEADER_RESERVED];
+    for (;;)
+    {
+        if (reserved + slotCount > availableSlots)
+        {
+            u_PoolScratch[GetCommandIndex(min(slot, edgeSlot))] = BISECTOR_POOL_COMMAND_BLOCKED;
+            return false;
+        }
+
+        uint previousReserved;
+        InterlockedCompareExchange(u_BisectorPool[BISECTOR_POOL_HEADER_RESERVED], reserved, reserved + slotCount, previousReserved);
+        if (previousReserved == reserved)
+        {
+            break;
+        }
+        reserved = previousReserved;
+    }
+
+    u_PoolScratch[GetCommandIndex(max(slot, edgeSlot))] = BISECTOR_POOL_COMMAND_SPLIT;
+    return true;
+}
+
+// Splits a leaf together with the leaf across its longest edge, which keeps the mesh conforming
+//  If that leaf is one level coarser, it is split instead (recursively), and the leaf is split by a later subdivision
+bool SplitLeaf(cbt_Node node, uint slot)
+{
+    // Each step moves one level up, so the walk ends at the root at the latest
+    for (uint step = 0; step <= BISECTOR_POOL_MAX_DEPTH; step++)
+    {
+        uint edgeID = GetEdgeNeighborID(node);
+        if (edgeID == node.id)
+        {
+            return ClaimDiamondSplit(slot, slot);
+        }
+
+        uint edgeSlot = FindLeafSlot(edgeID);
+        if (edgeSlot != BISECTOR_POOL_NULL)
+        {
+            return ClaimDiamondSplit(slot, edgeSlot);
+        }
+
+        node = cbt_CreateNode(edgeID >> 1, node.depth - 1);
+        slot = FindLeafSlot(node.id);
+        if (slot == BISECTOR_POOL_NULL)
+        {
+            break;
+        }
+    }
+    return false;
+}
+
+// Claims the splits of the leaves; the leaves are split by pool_bisect_cs
+void SplitPass(uint slot)
+{
+    if (slot < GetPoolHighWater() && IsSlotAllocated(slot))
+    {
+        uint heapID = GetSlotHeapID(slot);
+        cbt_Node node = cbt_CreateNode(heapID, firstbithigh(heapID));
+        InstanceData instance = t_Instances[g_Push.startInstanceLocation];
+        CountLeaf(node.depth);
+
+        float lod = NodeLevelOfDetail(node, instance.transform);
+
+        // Leaves at the maximum depth cannot be split, so they do not count as a change
+        if (lod > 1.0f && node.depth < GetPoolMaxDepth() && SplitLeaf(node, slot))
+        {
+            u_Feedback[0].Changed = 1u;
+            CountSplit();
+        }
+    }
+}
+
+// Merges the children of both parents of a diamond into the parents, once all four children are leaves
+//  Each diamond is merged by the thread of the first child of its lower parent, so merges never overlap
+void MergePass(uint slot)
+{
+    if (slot < GetPoolHighWater() && IsSlotAllocated(slot))
+    {
+        uint heapID = GetSlotHeapID(slot);
+        cbt_Node node = cbt_CreateNode(heapID, firstbithigh(heapID));
+        CountLeaf(node.depth);
+
+        // Both children of a parent are merged by the first one, and the root (odd as well) has no parent
+        if ((heapID & 1u) != 0u)
+            return;
+
+        leb_DiamondParent diamondParent = leb_DecodeDiamondParent(node);
+        const uint baseID = diamondParent.base.id;
+        const uint topID = diamondParent.top.id;
+        if (topID < baseID)
+            return;
+
+        uint siblingSlot = FindLeafSlot(heapID | 1u);
+        if (siblingSlot == BISECTOR_POOL_NULL)
+            return;
+
+        // On the border, the top is the base itself
+        uint topSlot = BISECTOR_POOL_NULL, topSiblingSlot = BISECTOR_POOL_NULL;
+        if (topID != baseID)
+        {
+            topSlot = FindLeafSlot(topID << 1);
+            topSiblingSlot = FindLeafSlot((topID << 1) | 1u);
+            if (topSlot == BISECTOR_POOL_NULL || topSiblingSlot == BISECTOR_POOL_NULL)
+                return;
+        }
+
+        InstanceData instance = t_Instances[g_Push.startInstanceLocation];
+        bool mergeBase = NodeLevelOfDetail(diamondParent.base, instance.transform) < 1.0f;
+        bool mergeTop = NodeLevelOfDetail(diamondParent.top, instance.transform) < 1.0f;
+
+        if (mergeBase && mergeTop)
+        {
+            SetSlotHeapID(slot, baseID);
+            FreeSlot(siblingSlot);
+            uint mergedCount = 1u;
+
+            if (topID != baseID)
+            {
+                SetSlotHeapID(topSlot, topID);
+                FreeSlot(topSiblingSlot);
+                mergedCount++;
+            }
+
+            InterlockedAdd(u_BisectorPool[BISECTOR_POOL_HEADER_COUNT], 0u - mergedCount);
+            u_Feedback[0].Changed = 1u;
+            CountMerge();
+        }
+    }
+}
+
+#endif
+
+
+[numthreads(256, 1, 1)]
+void split_cs(uint3 DTid : SV_DispatchThreadID, uint groupIndex : SV_GroupIndex)
+{
+    BeginGroupStats(groupIndex);
+    SplitPass(DTid.x);
+    EndGroupStats(groupIndex);
+}
+
+[numthreads(256, 1, 1)]
+void merge_cs(uint3 DTid : SV_DispatchThreadID, uint groupIndex : SV_GroupIndex)
+{
+    BeginGroupStats(groupIndex);
+    MergePass(DTid.x);
+    EndGroupStats(groupIndex);
+}
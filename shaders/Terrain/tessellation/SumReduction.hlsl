@@ -9,8 +9,13 @@
 #define CBT_HEAP_BUFFER_BINDING REGISTER_UAV(TESSELLATION_BINDING_CBT, TESSELLATION_SPACE_TERRAIN)
 #include "ConcurrentBinaryTree.hlsl"
 
+#include "IndirectArgs.hlsli"
+
 DECLARE_PUSH_CONSTANTS(TessellationSumReductionPushConstants, g_Push, TESSELLATION_BINDING_PUSH_CONSTANTS, TESSELLATION_SPACE_TERRAIN);
 
+// [0] counts the groups that have finished, [1 + groupID] holds the sum of each group's sub-tree
+globallycoherent RWStructuredBuffer<uint> u_ReductionScratch : REGISTER_UAV(TESSELLATION_BINDING_REDUCTION_SCRATCH, TESSELLATION_SPACE_TERRAIN);
+
 
 // For improved performance, multiple passes (5) can be performed in a single kernel
 // This avoids having situations where threads are operating on 2-6 bits a time, which results in high memory contention
@@ -81,3 +86,105 @@ void sum_reduction_cs(uint3 DTid : SV_DispatchThreadID)
         cbt__HeapWrite(cbt_CreateNode(nodeID, g_Push.PassID), x0 + x1);
     }
 }
+
+
+#define SUM_REDUCTION_FUSED_ITERATIONS (SUM_REDUCTION_FUSED_MAX_PARTIALS / (2 * SUM_REDUCTION_FUSED_GROUP_SIZE))
+
+groupshared uint gs_Sums[SUM_REDUCTION_FUSED_MAX_PARTIALS];
+groupshared bool gs_IsLastGroup;
+
+// Reduces nodeCount sums held in groupshared memory down to a single sum, writing every intermediate level to the CBT
+// firstNodeID is the heap ID of the node held in gs_Sums[0], and depth is the depth of that level
+void ReduceGroupSharedLevels(uint nodeCount, uint firstNodeID, uint depth, uint threadID)
+{
+    for (uint width = nodeCount >> 1; width > 0; width >>= 1)
+    {
+        uint sums[SUM_REDUCTION_FUSED_ITERATIONS];
+
+        [unroll]
+        for (uint it = 0; it < SUM_REDUCTION_FUSED_ITERATIONS; ++it)
+        {
+            uint i = threadID + it * SUM_REDUCTION_FUSED_GROUP_SIZE;
+            sums[it] = (i < width) ? gs_Sums[2 * i] + gs_Sums[2 * i + 1] : 0;
+        }
+
+        GroupMemoryBarrierWithGroupSync();
+
+        firstNodeID >>= 1;
+        --depth;
+
+        [unroll]
+        for (uint it = 0; it < SUM_REDUCTION_FUSED_ITERATIONS; ++it)
+        {
+            uint i = threadID + it * SUM_REDUCTION_FUSED_GROUP_SIZE;
+            if (i < width)
+            {
+                gs_Sums[i] = sums[it];
+                cbt__HeapWrite(cbt_CreateNode(firstNodeID + i, depth), sums[it]);
+            }
+        }
+
+        GroupMemoryBarrierWithGroupSync();
+    }
+}
+
+// Replaces the per-level sum_reduction_cs dispatches that follow the prepass
+// Each group reduces up to 8 levels of its own sub-tree in groupshared memory, and the last group to finish
+// reduces the group sums up to the root and writes the indirect arguments (replacing both dispatchers)
+// PassID is the depth of the deepest level that was written by the prepass
+[numthreads(SUM_REDUCTION_FUSED_GROUP_SIZE, 1, 1)]
+void sum_reduction_fused_cs(uint3 Gid : SV_GroupID, uint3 GTid : SV_GroupThreadID)
+{
+    const uint depth = g_Push.PassID;
+    const uint levelNodeCount = 1u << depth;
+    const uint groupNodeCount = min(levelNodeCount, SUM_REDUCTION_FUSED_GROUP_SIZE);
+    const uint groupCount = levelNodeCount / groupNodeCount;
+    const uint groupLevels = firstbithigh(groupNodeCount);
+    const uint threadID = GTid.x;
+
+    const uint groupFirstNodeID = levelNodeCount + Gid.x * groupNodeCount;
+
+    if (threadID < groupNodeCount)
+    {
+        gs_Sums[threadID] = cbt_HeapRead(cbt_CreateNode(groupFirstNodeID + threadID, depth));
+    }
+    GroupMemoryBarrierWithGroupSync();
+
+    ReduceGroupSharedLevels(groupNodeCount, groupFirstNodeID, depth, threadID);
+
+    // Publish the sum of this group and find out if it was the last group to finish
+    if (threadID == 0)
+    {
+        u_ReductionScratch[1 + Gid.x] = gs_Sums[0];
+        DeviceMemoryBarrier();
+
+        uint groupsFinished;
+        InterlockedAdd(u_ReductionScratch[0], 1, groupsFinished);
+        gs_IsLastGroup = groupsFinished == groupCount - 1;
+    }
+    GroupMemoryBarrierWithGroupSync();
+
+    if (!gs_IsLastGroup)
+        return;
+
+    DeviceMemoryBarrier();
+
+    const uint partialDepth = depth - groupLevels;
+    for (uint i = threadID; i < groupCount; i += SUM_REDUCTION_FUSED_GROUP_SIZE)
+    {
+        gs_Sums[i] = u_ReductionScratch[1 + i];
+    }
+    GroupMemoryBarrierWithGroupSync();
+
+    ReduceGroupSharedLevels(groupCount, 1u << partialDepth, partialDepth, threadID);
+
+    if (threadID == 0)
+    {
+        uint nodeCount = gs_Sums[0];
+        WriteCBTDispatchArgs(nodeCount);
+        WriteLEBDrawArgs(nodeCount);
+
+        // Ready for the next reduction
+        u_ReductionScratch[0] = 0;
+    }
+}
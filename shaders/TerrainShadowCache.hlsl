@@ -0,0 +1,30 @@
+#pragma pack_matrix(row_major)
+
+#include <donut/shaders/binding_helpers.hlsli>
+#include "TerrainShadowCache_cb.h"
+
+
+DECLARE_PUSH_CONSTANTS(TerrainShadowCacheConstants, g_Push, 0, 0);
+
+Texture2DArray<float> t_Cache : REGISTER_SRV(0, 0);
+
+
+// A single triangle covering the viewport
+void shadow_cache_vs(
+    in uint i_vertex : SV_VertexID,
+    out float4 o_position : SV_Position
+)
+{
+    float2 uv = float2((i_vertex << 1) & 2, i_vertex & 2);
+    o_position = float4(uv * float2(2.0f, -2.0f) + float2(-1.0f, 1.0f), g_Push.clearDepth, 1.0f);
+}
+
+// The cache of a cascade is addressed toroidally, so the shadow map starts at the cache offset and wraps around
+void shadow_cache_compose_ps(
+    in float4 i_position : SV_Position,
+    out float o_depth : SV_Depth
+)
+{
+    uint2 texel = (uint2(i_position.xy) + g_Push.cacheOffset) % g_Push.cacheSize;
+    o_depth = t_Cache.Load(int4(texel, g_Push.cascade, 0));
+}
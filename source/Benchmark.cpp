@@ -0,0 +1,298 @@
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <thread>
+
+#include <json/value.h>
+#include <nvrhi/nvrhi.h>
+
+#include <donut/app/DeviceManager.h>
+#include <donut/core/json.h>
+#include <donut/core/log.h>
+#include <donut/core/vfs/VFS.h>
+
+#include "LandscapesApplication.h"
+#include "UserInterface.h"
+
+using namespace donut;
+using namespace donut::math;
+
+
+bool Benchmark::Load(const std::filesystem::path& fileName)
+{
+	vfs::NativeFileSystem fs;
+	Json::Value root;
+	if (!json::LoadFromFile(fs, fileName, root))
+	{
+		log::error("Cannot read the benchmark '%s'", fileName.generic_string().c_str());
+		return false;
+	}
+
+	if (const auto& frames = root["frames"]; !frames.isNull())
+		frames >> m_FrameCount;
+	if (const auto& warmupFrames = root["warmupFrames"]; !warmupFrames.isNull())
+		warmupFrames >> m_WarmupFrames;
+	if (const auto& duration = root["duration"]; !duration.isNull())
+		duration >> m_Duration;
+	if (const auto& resolution = root["resolution"]; !resolution.isNull())
+		resolution >> m_Resolution;
+
+	if (const auto& settings = root["settings"]; settings.isObject())
+	{
+		if (const auto& triangleBudget = settings["triangleBudget"]; !triangleBudget.isNull())
+			m_TriangleBudget = triangleBudget.asInt();
+		if (const auto& occlusionCulling = settings["occlusionCulling"]; !occlusionCulling.isNull())
+			m_OcclusionCulling = occlusionCulling.asBool();
+		if (const auto& occlusionCulledSubdivision = settings["occlusionCulledSubdivision"]; !occlusionCulledSubdivision.isNull())
+			m_OcclusionCulledSubdivision = occlusionCulledSubdivision.asBool();
+		if (const auto& asyncTessellation = settings["asyncTessellation"]; !asyncTessellation.isNull())
+			m_AsyncTessellation = asyncTessellation.asBool();
+		if (const auto& depthPrepass = settings["depthPrepass"]; !depthPrepass.isNull())
+			m_DepthPrepass = depthPrepass.asBool();
+	}
+
+	if (const auto& thresholds = root["thresholds"]; thresholds.isObject())
+	{
+		m_Thresholds.AvgCpuFrameTime = thresholds.get("avgCpuFrameMs", 0.0).asDouble();
+		m_Thresholds.MaxCpuFrameTime = thresholds.get("maxCpuFrameMs", 0.0).asDouble();
+		m_Thresholds.AvgGpuFrameTime = thresholds.get("avgGpuFrameMs", 0.0).asDouble();
+		m_Thresholds.MaxGpuFrameTime = thresholds.get("maxGpuFrameMs", 0.0).asDouble();
+		m_Thresholds.MaxLeafCount = thresholds.get("maxLeaves", 0).asUInt64();
+		m_Thresholds.MaxTerrainDrawCount = thresholds.get("maxTerrainDraws", 0).asUInt();
+	}
+
+	m_Keyframes.clear();
+	for (const auto& src : root["keyframes"])
+	{
+		if (!src.isObject())
+		{
+			log::warning("Non-object found in the keyframes list.");
+			continue;
+		}
+
+		auto& keyframe = m_Keyframes.emplace_back();
+		if (const auto& time = src["time"]; !time.isNull())
+			time >> keyframe.Time;
+		if (const auto& position = src["position"]; !position.isNull())
+			position >> keyframe.Position;
+		if (const auto& target = src["target"]; !target.isNull())
+			target >> keyframe.Target;
+		if (const auto& up = src["up"]; !up.isNull())
+			up >> keyframe.Up;
+	}
+
+	if (m_Keyframes.empty())
+	{
+		log::error("The benchmark '%s' has no keyframes", fileName.generic_string().c_str());
+		return false;
+	}
+
+	std::stable_sort(m_Keyframes.begin(), m_Keyframes.end(), [](const Keyframe& a, const Keyframe& b) { return a.Time < b.Time; });
+	m_FrameCount = std::max(m_FrameCount, 1u);
+	m_Resolution = max(m_Resolution, uint2(1u));
+	return true;
+}
+
+void Benchmark::GetCamera(float time, float3& position, float3& target, float3& up) const
+{
+	auto next = std::upper_bound(m_Keyframes.begin(), m_Keyframes.end(), time, [](float t, const Keyframe& keyframe) { return t < keyframe.Time; });
+
+	if (next == m_Keyframes.begin() || next == m_Keyframes.end())
+	{
+		const Keyframe& keyframe = next == m_Keyframes.begin() ? m_Keyframes.front() : m_Keyframes.back();
+		position = keyframe.Position;
+		target = keyframe.Target;
+		up = keyframe.Up;
+		return;
+	}
+
+	const Keyframe& previous = *(next - 1);
+	const float t = (time - previous.Time) / std::max(next->Time - previous.Time, 1e-6f);
+	position = lerp(previous.Position, next->Position, t);
+	target = lerp(previous.Target, next->Target, t);
+	up = normalize(lerp(previous.Up, next->Up, t));
+}
+
+void Benchmark::ApplySettings(UIData& ui) const
+{
+	if (m_TriangleBudget)
+		ui.TriangleBudget = *m_TriangleBudget;
+	if (m_OcclusionCulling)
+		ui.OcclusionCulling = *m_OcclusionCulling;
+	if (m_OcclusionCulledSubdivision)
+		ui.OcclusionCullSubdivision = *m_OcclusionCulledSubdivision;
+	if (m_AsyncTessellation)
+		ui.AsyncTessellation = *m_AsyncTessellation && ui.AsyncTessellationSupported;
+	if (m_DepthPrepass)
+		ui.DepthPrepass = *m_DepthPrepass;
+
+	ui.UpdateTerrain = true;
+	ui.DrawTerrain = true;
+}
+
+bool Benchmark::CheckThresholds(const std::vector<FrameResult>& results) const
+{
+	double sumCpu = 0.0, maxCpu = 0.0, sumGpu = 0.0, maxGpu = 0.0;
+	uint64_t maxLeaves = 0;
+	uint32_t maxDraws = 0;
+	for (const auto& result : results)
+	{
+		sumCpu += result.CpuFrameTime;
+		maxCpu = std::max(maxCpu, result.CpuFrameTime);
+		sumGpu += result.GpuFrameTime;
+		maxGpu = std::max(maxGpu, result.GpuFrameTime);
+		maxLeaves = std::max(maxLeaves, result.LeafCount);
+		maxDraws = std::max(maxDraws, result.TerrainDrawCount);
+	}
+	const double avgCpu = sumCpu / static_cast<double>(results.size());
+	const double avgGpu = sumGpu / static_cast<double>(results.size());
+
+	log::info("Benchmark: CPU %.3f ms avg, %.3f ms max; GPU %.3f ms avg, %.3f ms max; %llu leaves max; %u terrain draws max",
+		avgCpu, maxCpu, avgGpu, maxGpu, static_cast<unsigned long long>(maxLeaves), maxDraws);
+
+	bool passed = true;
+	auto check = [&passed](const char* name, double value, double threshold)
+	{
+		if (threshold > 0.0 && value > threshold)
+		{
+			log::warning("Benchmark threshold exceeded: %s is %.3f, above %.3f", name, value, threshold);
+			passed = false;
+		}
+	};
+	check("avgCpuFrameMs", avgCpu, m_Thresholds.AvgCpuFrameTime);
+	check("maxCpuFrameMs", maxCpu, m_Thresholds.MaxCpuFrameTime);
+	check("avgGpuFrameMs", avgGpu, m_Thresholds.AvgGpuFrameTime);
+	check("maxGpuFrameMs", maxGpu, m_Thresholds.MaxGpuFrameTime);
+	check("maxLeaves", static_cast<double>(maxLeaves), static_cast<double>(m_Thresholds.MaxLeafCount));
+	check("maxTerrainDraws", static_cast<double>(maxDraws), static_cast<double>(m_Thresholds.MaxTerrainDrawCount));
+	return passed;
+}
+
+int Benchmark::Run(app::DeviceManager& deviceManager, LandscapesApplication& application, UIData& ui, const std::filesystem::path& csvFileName) const
+{
+	nvrhi::IDevice* device = deviceManager.GetDevice();
+
+	nvrhi::TextureDesc textureDesc;
+	textureDesc.dimension = nvrhi::TextureDimension::Texture2D;
+	textureDesc.format = nvrhi::Format::RGBA8_UNORM;
+	textureDesc.width = m_Resolution.x;
+	textureDesc.height = m_Resolution.y;
+	textureDesc.isRenderTarget = true;
+	textureDesc.initialState = nvrhi::ResourceStates::RenderTarget;
+	textureDesc.keepInitialState = true;
+	textureDesc.debugName = "BenchmarkOutput";
+	nvrhi::TextureHandle output = device->createTexture(textureDesc);
+	nvrhi::FramebufferHandle framebuffer = device->createFramebuffer(nvrhi::FramebufferDesc().addColorAttachment(output));
+
+	// The scene is loaded on a thread, and finished by the application when it renders
+	while (application.IsSceneLoading())
+	{
+		application.Render(framebuffer);
+		device->waitForIdle();
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+
+	if (!application.IsSceneLoaded())
+	{
+		log::error("The benchmark requires a scene");
+		return 1;
+	}
+
+	std::ofstream csv(csvFileName);
+	if (!csv)
+	{
+		log::error("Cannot write the benchmark results to '%s'", csvFileName.generic_string().c_str());
+		return 1;
+	}
+	ApplySettings(ui);
+	application.SetGpuFrameTiming(true);
+	ui.ShowGpuTimers = true;
+	GpuTimers& gpuTimers = application.GetGpuTimers();
+	// Known once the warmup has recorded every stage
+	std::vector<std::string> stageNames;
+
+	const float frameInterval = m_Duration / static_cast<float>(m_FrameCount);
+	std::vector<FrameResult> results;
+	results.reserve(m_FrameCount);
+
+	// The warmup frames are rendered from the first keyframe, so the tessellation converges before the first frame
+	const int firstFrame = -static_cast<int>(m_WarmupFrames);
+	for (int frame = firstFrame; frame < static_cast<int>(m_FrameCount); frame++)
+	{
+		FrameResult result;
+		result.Time = static_cast<float>(std::max(frame, 0)) * frameInterval;
+
+		float3 position, target, up;
+		GetCamera(result.Time, position, target, up);
+		application.SetCamera(position, target, up);
+
+		const auto start = std::chrono::steady_clock::now();
+		application.Animate(frameInterval);
+		application.Render(framebuffer);
+		result.CpuFrameTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		device->waitForIdle();
+		device->runGarbageCollection();
+
+		float gpuSeconds = 0.0f;
+		if (application.ReadGpuFrameTime(gpuSeconds))
+		{
+			result.GpuFrameTime = static_cast<double>(gpuSeconds) * 1e3;
+		}
+		result.LeafCount = ui.TerrainTriangleCount;
+		result.TerrainDrawCount = ui.TerrainDrawCount;
+
+		// The device is idle, so the frame is read entirely, and the history is cleared to hold this frame only
+		gpuTimers.Resolve();
+
+		if (frame == 0)
+		{
+			stageNames = gpuTimers.GetStageNames();
+			csv << "frame,time,cpu_ms,gpu_ms,leaves,terrain_draws";
+			for (const auto& name : stageNames)
+			{
+				csv << ",gpu_" << name << "_ms";
+			}
+			csv << '\n';
+		}
+
+		for (const auto& name : stageNames)
+		{
+			GpuTimers::Statistics statistics;
+			const bool recorded = gpuTimers.GetStatistics(name, statistics) && statistics.SampleCount > 0;
+			result.StageTimes.push_back(recorded ? statistics.Last : -1.0f);
+		}
+		gpuTimers.ClearHistory();
+
+		if (frame < 0)
+			continue;
+
+		csv << frame << ',' << result.Time << ',' << result.CpuFrameTime << ',' << result.GpuFrameTime << ','
+			<< result.LeafCount << ',' << result.TerrainDrawCount;
+		// Stages that were not recorded in the frame are left empty
+		for (float stageTime : result.StageTimes)
+		{
+			csv << ',';
+			if (stageTime >= 0.0f)
+				csv << stageTime;
+		}
+		csv << '\n';
+		results.push_back(std::move(result));
+	}
+
+	if (stageNames.size() != gpuTimers.GetStageNames().size())
+	{
+		log::warning("Benchmark: some GPU stages were first recorded after the warmup, and are missing from '%s'",
+			csvFileName.generic_string().c_str());
+	}
+
+	ui.ShowGpuTimers = false;
+	application.SetGpuFrameTiming(false);
+	csv.close();
+
+	log::info("Benchmark: %u frames written to '%s'", m_FrameCount, csvFileName.generic_string().c_str());
+	return CheckThresholds(results) ? 0 : 2;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <donut/core/math/math.h>
+
+#include <filesystem>
+#include <optional>
+#include <vector>
+
+
+namespace donut::app
+{
+	class DeviceManager;
+}
+
+class LandscapesApplication;
+struct UIData;
+
+
+// Renders a camera path offscreen for a fixed number of frames, and writes the statistics of every frame to a CSV file
+//  Every frame is waited for before the next one is recorded, so that the timings of the frames do not overlap
+//  The path is a JSON file:
+//  {
+//      "frames": 600, "duration": 20.0, "warmupFrames": 30, "resolution": [1920, 1080],
+//      "settings": { "triangleBudget": 0, "occlusionCulling": true, "occlusionCulledSubdivision": false, "asyncTessellation": false, "depthPrepass": false },
+//      "thresholds": { "avgCpuFrameMs": 8.0, "maxCpuFrameMs": 20.0, "avgGpuFrameMs": 8.0, "maxGpuFrameMs": 20.0, "maxLeaves": 2000000, "maxTerrainDraws": 16 },
+//      "keyframes": [ { "time": 0.0, "position": [0, 250, 0], "target": [100, 0, 100], "up": [0, 1, 0] }, ... ]
+//  }
+//  Keyframes are interpolated linearly, and the frames are spread evenly over the duration (in seconds)
+//  The stages measured by the GPU timers during the warmup get a column each
+//  Thresholds that are absent are not checked
+class Benchmark
+{
+public:
+	struct FrameResult
+	{
+		float Time = 0.0f;
+		double CpuFrameTime = 0.0; // Milliseconds to record and submit the frame
+		double GpuFrameTime = 0.0; // Milliseconds of the graphics command list of the frame
+		// Read back a few frames late (see TerrainTessellator::GetLeafCount)
+		uint64_t LeafCount = 0;
+		uint32_t TerrainDrawCount = 0;
+		// Milliseconds of each stage measured by the GPU timers (see GpuTimers), negative if it was not recorded
+		std::vector<float> StageTimes;
+	};
+
+	// Returns false if the file cannot be read or has no keyframes
+	bool Load(const std::filesystem::path& fileName);
+
+	// Returns the exit code of the application: 0 on success, 1 on failure, and 2 if a threshold was exceeded
+	[[nodiscard]] int Run(donut::app::DeviceManager& deviceManager, LandscapesApplication& application, UIData& ui,
+		const std::filesystem::path& csvFileName) const;
+
+private:
+	struct Keyframe
+	{
+		float Time = 0.0f;
+		dm::float3 Position = 0.0f;
+		dm::float3 Target = 0.0f;
+		dm::float3 Up{ 0.0f, 1.0f, 0.0f };
+	};
+
+	struct Thresholds
+	{
+		// 0 means unchecked
+		double AvgCpuFrameTime = 0.0;
+		double MaxCpuFrameTime = 0.0;
+		double AvgGpuFrameTime = 0.0;
+		double MaxGpuFrameTime = 0.0;
+		uint64_t MaxLeafCount = 0;
+		uint32_t MaxTerrainDrawCount = 0;
+	};
+
+	void GetCamera(float time, dm::float3& position, dm::float3& target, dm::float3& up) const;
+	// Logs every threshold exceeded
+	[[nodiscard]] bool CheckThresholds(const std::vector<FrameResult>& results) const;
+	void ApplySettings(UIData& ui) const;
+
+private:
+	uint32_t m_FrameCount = 600;
+	uint32_t m_WarmupFrames = 30;
+	float m_Duration = 10.0f;
+	dm::uint2 m_Resolution{ 1920, 1080 };
+
+	// Settings of the user interface, applied before the first frame if present
+	std::optional<int> m_TriangleBudget;
+	std::optional<bool> m_OcclusionCulling;
+	std::optional<bool> m_OcclusionCulledSubdivision;
+	std::optional<bool> m_AsyncTessellation;
+	std::optional<bool> m_DepthPrepass;
+
+	std::vector<Keyframe> m_Keyframes;
+	Thresholds m_Thresholds;
+};
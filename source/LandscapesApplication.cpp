@@ -15,6 +15,11 @@ using namespace donut::math;
 
 const char* g_WindowTitle = "Landscapes";
 
+// Shadow map of the sun; the distance is half the width of the last cascade, in world units
+static constexpr int c_ShadowMapResolution = 2048;
+static constexpr int c_ShadowCascadeCount = 4;
+static constexpr float c_ShadowDistance = 500.0f;
+
 
 LandscapesApplication::LandscapesApplication(donut::app::DeviceManager* deviceManager, UIData& ui)
 	: ApplicationBase(deviceManager)
@@ -57,11 +62,49 @@ LandscapesApplication::LandscapesApplication(donut::app::DeviceManager* deviceMa
     m_GBufferVisualizationPass = std::make_unique<GBufferVisualizationPass>(GetDevice());
     m_GBufferVisualizationPass->Init(m_ShaderFactory);
 
+    m_DepthPyramidPass = std::make_unique<DepthPyramidPass>(GetDevice());
+    m_DepthPyramidPass->Init(m_ShaderFactory);
+
+    m_ShadowMap = std::make_shared<render::CascadedShadowMap>(GetDevice(), c_ShadowMapResolution, c_ShadowCascadeCount, 0, nvrhi::Format::D32);
+    m_ShadowFramebuffer = std::make_shared<engine::FramebufferFactory>(GetDevice());
+    m_ShadowFramebuffer->DepthTarget = m_ShadowMap->GetTexture();
+
+    m_TerrainShadowCache = std::make_unique<TerrainShadowCache>(GetDevice(), c_ShadowMapResolution, c_ShadowCascadeCount);
+    m_TerrainShadowCache->Init(*m_ShaderFactory);
+    m_TerrainShadowCache->SetMaxDistance(c_ShadowDistance);
+
+    {
+        render::DepthPass::CreateParameters shadowDepthParams;
+        shadowDepthParams.useInputAssembler = false;
+        shadowDepthParams.depthBias = 100;
+        shadowDepthParams.slopeScaledDepthBias = 4.0f;
+        m_ShadowDepthPass = std::make_unique<render::DepthPass>(GetDevice(), m_CommonPasses);
+        m_ShadowDepthPass->Init(*m_ShaderFactory, shadowDepthParams);
+
+        TerrainDepthOnlyPass::CreateParameters terrainShadowParams;
+        terrainShadowParams.depthBias = shadowDepthParams.depthBias;
+        terrainShadowParams.slopeScaledDepthBias = shadowDepthParams.slopeScaledDepthBias;
+        m_TerrainShadowPass = std::make_unique<TerrainDepthOnlyPass>(GetDevice(), m_CommonPasses);
+        m_TerrainShadowPass->Init(*m_ShaderFactory, terrainShadowParams);
+    }
+
+    m_GpuTimers = std::make_unique<GpuTimers>(GetDevice());
+
     m_TerrainTessellator = std::make_unique<TerrainTessellator>(GetDevice());
     m_TerrainTessellator->Init(*m_ShaderFactory);
+    m_TerrainTessellator->SetGpuTimers(m_GpuTimers.get());
+
+    m_TerrainMaterializePass = std::make_unique<TerrainMaterializePass>(GetDevice(), m_CommonPasses);
+    m_TerrainMaterializePass->Init(*m_ShaderFactory);
 
     m_CommandList = GetDevice()->createCommandList();
 
+    if (GetDevice()->queryFeatureSupport(nvrhi::Feature::ComputeQueue))
+    {
+        m_ComputeCommandList = GetDevice()->createCommandList(
+            nvrhi::CommandListParameters().setQueueType(nvrhi::CommandQueue::Compute));
+    }
+
     m_Camera.LookAt(float3{ 0.0f, 250.0f, 0.0f }, float3{ 0.0f, 0.f, 0.0f }, float3{ 0.0f, 0.0f, 1.0f });
     m_Camera.SetMoveSpeed(75.0f);
 
@@ -94,6 +137,10 @@ void LandscapesApplication::CreateGBufferPasses()
 
     m_TerrainGBufferPass = std::make_unique<TerrainGBufferFillPass>(GetDevice(), m_CommonPasses);
     m_TerrainGBufferPass->Init(*m_ShaderFactory);
+
+    // Without a bias, so that the G-buffer fill pass finds the same depth
+    m_TerrainDepthPrepass = std::make_unique<TerrainDepthOnlyPass>(GetDevice(), m_CommonPasses);
+    m_TerrainDepthPrepass->Init(*m_ShaderFactory, TerrainDepthOnlyPass::CreateParameters());
 }
 
 void LandscapesApplication::SceneUnloading()
@@ -128,6 +175,10 @@ void LandscapesApplication::SceneLoaded()
 	ApplicationBase::SceneLoaded();
 
     m_Scene->FinishedLoading(GetFrameIndex());
+    m_TerrainShadowCache->Invalidate();
+
+    m_UI.AsyncTessellationSupported = m_ComputeCommandList && m_Scene->SupportsAsyncTessellation();
+    m_UI.AsyncTessellation &= m_UI.AsyncTessellationSupported;
 
     // Set up lights, camera, etc...
 
@@ -156,6 +207,148 @@ void LandscapesApplication::SceneLoaded()
     }
 }
 
+void LandscapesApplication::UpdateShadowCascadeViews()
+{
+    // The cascades follow the camera in steps of their texels, so the cached terrain depth stays valid as it moves
+    m_TerrainShadowCache->Update(m_UI.LightDirection, m_Camera.GetPosition(), m_Scene->GetSceneGraph()->GetRootNode()->GetGlobalBoundingBox());
+
+    m_ShadowCascadeViews.resize(m_TerrainShadowCache->GetCascadeCount());
+    for (uint32_t cascade = 0; cascade < m_TerrainShadowCache->GetCascadeCount(); cascade++)
+    {
+        affine3 worldToView;
+        float4x4 viewToClip;
+        m_TerrainShadowCache->GetCascadeMatrices(cascade, worldToView, viewToClip);
+
+        // The shadow map is sampled with the transforms of the cache
+        const auto& cascadeView = m_ShadowMap->GetCascade(static_cast<int>(cascade))->GetPlanarView();
+        cascadeView->SetMatrices(worldToView, viewToClip);
+        cascadeView->UpdateCache();
+
+        PlanarViewEx& view = m_ShadowCascadeViews[cascade];
+        view.SetViewport(cascadeView->GetViewport());
+        view.SetMatrices(worldToView, viewToClip);
+        view.SetArraySlice(static_cast<int>(cascade));
+        // Terrains without a view for the cascade are neither tessellated nor rendered into it (see TerrainDrawStrategy)
+        const int terrainViewIndex = m_Scene->GetShadowCascadeTerrainViewIndex(cascade);
+        view.SetTerrainViewIndex(terrainViewIndex >= 0 ? static_cast<size_t>(terrainViewIndex) : SIZE_MAX);
+        view.UpdateCache();
+    }
+}
+
+void LandscapesApplication::TessellateShadowCascades(nvrhi::ICommandList* commandList, bool subdivide)
+{
+    for (size_t cascade = 0; cascade < m_ShadowCascadeViews.size(); cascade++)
+    {
+        const std::string viewName = "Shadow Cascade " + std::to_string(cascade);
+        GpuTimerScope viewScope(m_GpuTimers.get(), commandList, viewName.c_str());
+        GpuTimerScope stageScope(m_GpuTimers.get(), commandList, "Tessellation");
+        TerrainDrawStrategy drawStrategy;
+        TessellateTerrainView(
+            commandList,
+            &m_ShadowCascadeViews[cascade],
+            m_Scene->GetSceneGraph()->GetRootNode(),
+            drawStrategy,
+            *m_TerrainTessellator,
+            subdivide
+        );
+    }
+}
+
+void LandscapesApplication::RenderShadowMap()
+{
+    const auto& rootNode = m_Scene->GetSceneGraph()->GetRootNode();
+
+    if (m_UI.DrawTerrain)
+    {
+        // Only the regions of the cache that scrolled in, or whose terrain has not settled yet, are rendered
+        for (uint32_t cascade = 0; cascade < m_ShadowCascadeViews.size(); cascade++)
+        {
+            std::vector<PlanarViewEx> updateViews = m_TerrainShadowCache->GetUpdateViews(cascade);
+            if (updateViews.empty())
+                continue;
+
+            const PlanarViewEx& cascadeView = m_ShadowCascadeViews[cascade];
+            const std::string viewName = "Shadow Cascade " + std::to_string(cascade);
+            GpuTimerScope viewScope(m_GpuTimers.get(), m_CommandList, viewName.c_str());
+
+            {
+                GpuTimerScope stageScope(m_GpuTimers.get(), m_CommandList, "Materialize");
+                TerrainDrawStrategy materializeDrawStrategy;
+                MaterializeTerrainView(
+                    m_CommandList,
+                    &cascadeView,
+                    rootNode,
+                    materializeDrawStrategy,
+                    *m_TerrainMaterializePass,
+                    false,
+                    m_GpuTimers.get()
+                );
+            }
+
+            GpuTimerScope stageScope(m_GpuTimers.get(), m_CommandList, "Cache Update");
+            m_TerrainShadowCache->ClearUpdateRegions(m_CommandList, cascade);
+            for (auto& updateView : updateViews)
+            {
+                // Drawn from the tessellation of the whole cascade
+                updateView.SetTerrainViewIndex(cascadeView.GetTerrainViewIndex());
+
+                TerrainDrawStrategy drawStrategy;
+                TerrainDepthOnlyPass::Context context;
+                m_UI.TerrainDrawCount += RenderTerrainView(
+                    m_CommandList,
+                    &updateView,
+                    &updateView,
+                    m_TerrainShadowCache->GetFramebuffer(cascade),
+                    rootNode,
+                    drawStrategy,
+                    *m_TerrainShadowPass,
+                    context,
+                    m_GpuTimers.get()
+                );
+            }
+
+            // The regions are rendered again every frame until the tessellation of the cascade has converged
+            TerrainDrawStrategy convergenceDrawStrategy;
+            if (IsTerrainViewConverged(&cascadeView, rootNode, convergenceDrawStrategy, *m_TerrainTessellator))
+            {
+                m_TerrainShadowCache->MarkUpdated(cascade);
+            }
+        }
+
+        GpuTimerScope stageScope(m_GpuTimers.get(), m_CommandList, "Shadow Map Compose");
+        for (uint32_t cascade = 0; cascade < m_ShadowCascadeViews.size(); cascade++)
+        {
+            const auto& cascadeView = m_ShadowMap->GetCascade(static_cast<int>(cascade))->GetPlanarView();
+            m_TerrainShadowCache->Compose(m_CommandList, cascade, m_ShadowFramebuffer->GetFramebuffer(*cascadeView));
+        }
+    }
+    else
+    {
+        // The cache is not kept up to date while the terrain is hidden
+        m_TerrainShadowCache->Invalidate();
+        m_ShadowMap->Clear(m_CommandList);
+    }
+
+    // The dynamic objects are drawn over the terrain every frame
+    {
+        GpuTimerScope stageScope(m_GpuTimers.get(), m_CommandList, "Shadow Map Objects");
+        render::InstancedOpaqueDrawStrategy drawStrategy;
+        render::DepthPass::Context context;
+
+        render::RenderCompositeView(
+            m_CommandList,
+            &m_ShadowMap->GetView(),
+            nullptr,
+            *m_ShadowFramebuffer,
+            rootNode,
+            drawStrategy,
+            *m_ShadowDepthPass,
+            context,
+            "Shadow Map"
+        );
+    }
+}
+
 bool LandscapesApplication::KeyboardUpdate(int key, int scancode, int action, int mods)
 {
     m_Camera.KeyboardUpdate(key, scancode, action, mods);
@@ -177,7 +370,11 @@ bool LandscapesApplication::MouseButtonUpdate(int button, int action, int mods)
 void LandscapesApplication::Animate(float fElapsedTimeSeconds)
 {
     m_Camera.Animate(fElapsedTimeSeconds);
-	GetDeviceManager()->SetInformativeWindowTitle(g_WindowTitle);
+    // There is no window in benchmark mode
+    if (GetDeviceManager()->GetWindow())
+    {
+	    GetDeviceManager()->SetInformativeWindowTitle(g_WindowTitle);
+    }
 
     m_UI.CameraPosition = m_Camera.GetPosition();
 
@@ -192,6 +389,33 @@ void LandscapesApplication::BackBufferResizing()
 
 }
 
+void LandscapesApplication::SetCamera(const float3& position, const float3& target, const float3& up)
+{
+    m_Camera.LookAt(position, target, up);
+}
+
+void LandscapesApplication::SetGpuFrameTiming(bool enable)
+{
+    if (enable && !m_GpuFrameTimerQuery)
+    {
+        m_GpuFrameTimerQuery = GetDevice()->createTimerQuery();
+    }
+    else if (!enable)
+    {
+        m_GpuFrameTimerQuery = nullptr;
+    }
+}
+
+bool LandscapesApplication::ReadGpuFrameTime(float& seconds)
+{
+    if (!m_GpuFrameTimerQuery || !GetDevice()->pollTimerQuery(m_GpuFrameTimerQuery))
+        return false;
+
+    seconds = GetDevice()->getTimerQueryTime(m_GpuFrameTimerQuery);
+    GetDevice()->resetTimerQuery(m_GpuFrameTimerQuery);
+    return true;
+}
+
 void LandscapesApplication::RenderScene(nvrhi::IFramebuffer* framebuffer)
 {
 	if (!m_Scene)
@@ -200,6 +424,9 @@ void LandscapesApplication::RenderScene(nvrhi::IFramebuffer* framebuffer)
 		return;
 	}
 
+    m_GpuTimers->SetEnabled(m_UI.ShowGpuTimers);
+    m_GpuTimers->BeginFrame();
+
     const auto& fbInfo = framebuffer->getFramebufferInfo();
 
     nvrhi::Viewport windowViewport(static_cast<float>(fbInfo.width), static_cast<float>(fbInfo.height));
@@ -215,15 +442,19 @@ void LandscapesApplication::RenderScene(nvrhi::IFramebuffer* framebuffer)
     {
 	    // m_ShadedColour should always match GBuffer
         m_GBuffer = nullptr;
+        m_DepthFramebuffer = nullptr;
         m_ShadedColour = nullptr;
         m_BindingCache->Clear();
         m_DeferredLightingPass->ResetBindingCache();
         m_GBufferVisualizationPass->ResetBindingCache();
+        m_DepthPyramidPass->ResetBindingCache();
 
         m_GBufferPass.reset();
 
         m_GBuffer = std::make_shared<render::GBufferRenderTargets>();
         m_GBuffer->Init(GetDevice(), size, 1, false, m_View.IsReverseDepth());
+        m_DepthFramebuffer = std::make_shared<engine::FramebufferFactory>(GetDevice());
+        m_DepthFramebuffer->DepthTarget = m_GBuffer->Depth;
         CreateDeferredShadingOutput(GetDevice(), size, 1);
     }
 
@@ -232,33 +463,203 @@ void LandscapesApplication::RenderScene(nvrhi::IFramebuffer* framebuffer)
         CreateGBufferPasses();
     }
 
+    // Tiles are loaded and released, and virtual heightmap pages uploaded, before anything is recorded for them this frame
+    if (m_Scene->HasStreamedTerrains() || m_Scene->HasVirtualHeightmaps())
+    {
+        m_CommandList->open();
+        const bool residencyChanged = m_Scene->UpdateTerrainStreaming(m_CommandList, m_Camera.GetPosition());
+        std::vector<box3> changedHeightBounds;
+        const bool heightsChanged = m_Scene->UpdateVirtualHeightmaps(m_CommandList, changedHeightBounds);
+        m_CommandList->close();
+        // Streamed terrains only record commands on the frame a tile becomes resident, whereas virtual heightmaps read
+        // their feedback back every frame
+        if (residencyChanged || m_Scene->HasVirtualHeightmaps())
+        {
+            // The atlas and the feedback buffer are rewritten once the last asynchronous tessellation is done with them
+            if (m_Scene->HasVirtualHeightmaps() && m_LastComputeInstance)
+                GetDevice()->queueWaitForCommandList(nvrhi::CommandQueue::Graphics, nvrhi::CommandQueue::Compute, m_LastComputeInstance);
+            // The compute queue waits for the last graphics submission, so an asynchronous tessellation never sees the
+            // buffers of a loaded tile before they are initialized
+            m_LastGraphicsInstance = GetDevice()->executeCommandList(m_CommandList);
+        }
+
+        if (residencyChanged)
+        {
+            m_TerrainTessellator->ResetTerrainCache();
+            m_TerrainMaterializePass->ResetBindingCache();
+            m_TerrainGBufferPass->ResetBindingCache();
+            m_TerrainDepthPrepass->ResetBindingCache();
+            m_TerrainShadowPass->ResetBindingCache();
+            m_TerrainShadowCache->Invalidate();
+        }
+        else if (heightsChanged)
+        {
+            // The cached cascades hold the shadows of the heights before the pages were uploaded, over the pages only
+            for (const box3& bounds : changedHeightBounds)
+            {
+                m_TerrainShadowCache->InvalidateBounds(bounds);
+            }
+        }
+    }
+
+    // The cascades are fitted to this frame's view before either queue tessellates them
+    const bool shadows = m_UI.Shadows && m_SunLight;
+    if (shadows)
+    {
+        UpdateShadowCascadeViews();
+    }
+    else
+    {
+        m_ShadowCascadeViews.clear();
+    }
+    if (m_SunLight)
+    {
+        m_SunLight->shadowMap = shadows ? m_ShadowMap : nullptr;
+    }
+
+    // With async tessellation, the terrain is rendered from the previous tessellation while the compute queue
+    // tessellates the next one into the back buffers of the (double buffered) terrain views
+    const bool asyncTessellation = m_UI.UpdateTerrain && m_UI.AsyncTessellation && m_UI.AsyncTessellationSupported;
+
+    // The capture of the last frame is compared once the GPU has finished it, which a debugging tool may wait for
+    if (m_TerrainTessellator->HasValidationCapture())
+    {
+        GetDevice()->waitForIdle();
+        m_UI.TessellationValidationReport = m_TerrainTessellator->ResolveValidation();
+    }
+    if (m_UI.ValidateTessellation)
+    {
+        m_TerrainTessellator->RequestValidation();
+        m_UI.ValidateTessellation = false;
+    }
+
+    m_TerrainTessellator->BeginFrame();
+    m_TerrainTessellator->SetTriangleBudget(static_cast<uint32_t>(std::max(m_UI.TriangleBudget, 0)));
+    m_UI.TerrainTriangleCount = m_TerrainTessellator->GetLeafCount();
+
+    // The tessellation culls against the depth pyramid of the previous frame, reprojected into this one
+    if (!m_UI.OcclusionCulling)
+    {
+        m_DepthPyramidPass->Invalidate();
+    }
+    m_View.SetOcclusionCulling(m_UI.OcclusionCulling, m_UI.OcclusionCullSubdivision);
+    m_View.SetOcclusionPyramid(m_DepthPyramidPass->GetPyramid(), m_DepthPyramidPass->GetWorldToClip(), m_DepthPyramidPass->GetDepthSize());
+
+    if (asyncTessellation)
+    {
+        // The instance buffer is updated in a submission of its own, which the tessellation waits for, so that it is
+        // never rewritten while either queue tessellates from it
+        m_CommandList->open();
+        m_Scene->Refresh(m_CommandList, GetFrameIndex());
+        m_CommandList->close();
+        if (m_LastComputeInstance)
+            GetDevice()->queueWaitForCommandList(nvrhi::CommandQueue::Graphics, nvrhi::CommandQueue::Compute, m_LastComputeInstance);
+        m_LastGraphicsInstance = GetDevice()->executeCommandList(m_CommandList);
+
+        m_ComputeCommandList->open();
+
+        {
+            GpuTimerScope viewScope(m_GpuTimers.get(), m_ComputeCommandList, "Primary View");
+            GpuTimerScope stageScope(m_GpuTimers.get(), m_ComputeCommandList, "Tessellation");
+            TerrainDrawStrategy drawStrategy;
+            TessellateTerrainView(
+                m_ComputeCommandList,
+                &m_View,
+                m_Scene->GetSceneGraph()->GetRootNode(),
+                drawStrategy,
+                *m_TerrainTessellator
+            );
+        }
+        TessellateShadowCascades(m_ComputeCommandList, true);
+
+        m_ComputeCommandList->close();
+    }
+
     m_CommandList->open();
+    if (m_GpuFrameTimerQuery)
+    {
+        m_CommandList->beginTimerQuery(m_GpuFrameTimerQuery);
+    }
+    m_UI.TerrainDrawCount = 0;
 
-    m_Scene->Refresh(m_CommandList, GetFrameIndex());
+    if (!asyncTessellation)
+    {
+        m_Scene->Refresh(m_CommandList, GetFrameIndex());
+    }
 
     m_GBuffer->Clear(m_CommandList);
 
     // Update terrain
-    if (m_UI.UpdateTerrain)
+    //  The leaves are culled against the views every frame, even when the terrain is not subdivided
+    if (!asyncTessellation)
 	{
-        TerrainDrawStrategy drawStrategy;
-        TessellateTerrainView(
-			m_CommandList,
-            &m_View,
-            m_Scene->GetSceneGraph()->GetRootNode(),
-            drawStrategy,
-            *m_TerrainTessellator
-        );
+        {
+            GpuTimerScope viewScope(m_GpuTimers.get(), m_CommandList, "Primary View");
+            GpuTimerScope stageScope(m_GpuTimers.get(), m_CommandList, "Tessellation");
+            TerrainDrawStrategy drawStrategy;
+            TessellateTerrainView(
+                m_CommandList,
+                &m_View,
+                m_Scene->GetSceneGraph()->GetRootNode(),
+                drawStrategy,
+                *m_TerrainTessellator,
+                m_UI.UpdateTerrain
+            );
+        }
+        TessellateShadowCascades(m_CommandList, m_UI.UpdateTerrain);
+
+        // Double buffered terrain views were tessellated into their back buffers
+        m_Scene->SwapTerrainBuffers();
     }
 
     // Draw terrain
     if (m_UI.DrawTerrain)
     {
+        GpuTimerScope viewScope(m_GpuTimers.get(), m_CommandList, "Primary View");
+
+        // Decode the leaves of indexed terrain views once, for every pass drawing them this frame
+        {
+            GpuTimerScope stageScope(m_GpuTimers.get(), m_CommandList, "Materialize");
+            TerrainDrawStrategy materializeDrawStrategy;
+            MaterializeTerrainView(
+                m_CommandList,
+                &m_View,
+                m_Scene->GetSceneGraph()->GetRootNode(),
+                materializeDrawStrategy,
+                *m_TerrainMaterializePass,
+                false,
+                m_GpuTimers.get()
+            );
+        }
+
+        // Lines do not rasterize at the depth of the prepass triangles, so wireframe is drawn without it
+        const bool depthPrepass = m_UI.DepthPrepass && !m_UI.Wireframe;
+        if (depthPrepass)
+        {
+            GpuTimerScope stageScope(m_GpuTimers.get(), m_CommandList, "Depth Prepass");
+            TerrainDrawStrategy drawStrategy;
+            TerrainDepthOnlyPass::Context context;
+
+            m_UI.TerrainDrawCount += RenderTerrainView(
+                m_CommandList,
+                &m_View,
+                &m_View,
+                m_DepthFramebuffer->GetFramebuffer(m_View),
+                m_Scene->GetSceneGraph()->GetRootNode(),
+                drawStrategy,
+                *m_TerrainDepthPrepass,
+                context,
+                m_GpuTimers.get()
+            );
+        }
+
+        GpuTimerScope stageScope(m_GpuTimers.get(), m_CommandList, "Render Terrain");
         TerrainDrawStrategy drawStrategy;
         TerrainGBufferFillPass::Context context;
         context.wireframe = m_UI.Wireframe;
+        context.depthPrepassed = depthPrepass;
 
-        RenderTerrainView(
+        m_UI.TerrainDrawCount += RenderTerrainView(
             m_CommandList,
             &m_View,
             &m_View,
@@ -266,12 +667,14 @@ void LandscapesApplication::RenderScene(nvrhi::IFramebuffer* framebuffer)
             m_Scene->GetSceneGraph()->GetRootNode(),
             drawStrategy,
             *m_TerrainGBufferPass,
-            context
+            context,
+            m_GpuTimers.get()
         );
     }
 
     // Draw opaque objects in scene
 	{
+        GpuTimerScope stageScope(m_GpuTimers.get(), m_CommandList, "Opaque Objects");
 		donut::render::InstancedOpaqueDrawStrategy drawStrategy;
         donut::render::GBufferFillPass::Context context;
 
@@ -288,6 +691,68 @@ void LandscapesApplication::RenderScene(nvrhi::IFramebuffer* framebuffer)
         );
 	}
 
+    if (m_UI.OcclusionCulling)
+    {
+        // Built from this frame's depth, to be used for the occlusion retest and by the next frame
+        {
+            GpuTimerScope stageScope(m_GpuTimers.get(), m_CommandList, "Depth Pyramid");
+            m_DepthPyramidPass->Build(m_CommandList, m_View, m_GBuffer->Depth);
+        }
+        m_View.SetOcclusionPyramid(m_DepthPyramidPass->GetPyramid(), m_DepthPyramidPass->GetWorldToClip(), m_DepthPyramidPass->GetDepthSize());
+
+        // Draw the terrain hidden in the previous frame's depth, but not in this one's
+        if (m_UI.DrawTerrain)
+        {
+            GpuTimerScope viewScope(m_GpuTimers.get(), m_CommandList, "Primary View");
+
+            TerrainDrawStrategy retestDrawStrategy;
+            RetestTerrainOcclusion(
+                m_CommandList,
+                &m_View,
+                m_Scene->GetSceneGraph()->GetRootNode(),
+                retestDrawStrategy,
+                *m_TerrainTessellator
+            );
+
+            {
+                GpuTimerScope stageScope(m_GpuTimers.get(), m_CommandList, "Materialize");
+                TerrainDrawStrategy materializeDrawStrategy;
+                MaterializeTerrainView(
+                    m_CommandList,
+                    &m_View,
+                    m_Scene->GetSceneGraph()->GetRootNode(),
+                    materializeDrawStrategy,
+                    *m_TerrainMaterializePass,
+                    true,
+                    m_GpuTimers.get()
+                );
+            }
+
+            GpuTimerScope stageScope(m_GpuTimers.get(), m_CommandList, "Render Terrain");
+            TerrainDrawStrategy drawStrategy;
+            TerrainGBufferFillPass::Context context;
+            context.wireframe = m_UI.Wireframe;
+            context.disoccluded = true;
+
+            m_UI.TerrainDrawCount += RenderTerrainView(
+                m_CommandList,
+                &m_View,
+                &m_View,
+                m_GBuffer->GBufferFramebuffer->GetFramebuffer(m_View),
+                m_Scene->GetSceneGraph()->GetRootNode(),
+                drawStrategy,
+                *m_TerrainGBufferPass,
+                context,
+                m_GpuTimers.get()
+            );
+        }
+    }
+
+    if (shadows)
+    {
+        RenderShadowMap();
+    }
+
     render::DeferredLightingPass::Inputs deferredInputs;
     deferredInputs.SetGBuffer(*m_GBuffer);
     deferredInputs.ambientColorTop = 0.0f;
@@ -295,7 +760,10 @@ void LandscapesApplication::RenderScene(nvrhi::IFramebuffer* framebuffer)
     deferredInputs.lights = &m_Scene->GetSceneGraph()->GetLights();
     deferredInputs.output = m_ShadedColour;
 
-    m_DeferredLightingPass->Render(m_CommandList, m_View, deferredInputs);
+    {
+        GpuTimerScope stageScope(m_GpuTimers.get(), m_CommandList, "Deferred Lighting");
+        m_DeferredLightingPass->Render(m_CommandList, m_View, deferredInputs);
+    }
 
     // Debug view modes
     switch(m_UI.ViewMode)
@@ -311,7 +779,35 @@ void LandscapesApplication::RenderScene(nvrhi::IFramebuffer* framebuffer)
     }
 
     m_CommonPasses->BlitTexture(m_CommandList, framebuffer, m_ShadedColour, m_BindingCache.get());
-    
+
+    if (m_GpuFrameTimerQuery)
+    {
+        m_CommandList->endTimerQuery(m_GpuFrameTimerQuery);
+    }
     m_CommandList->close();
-    GetDevice()->executeCommandList(m_CommandList);
+
+    if (asyncTessellation)
+    {
+        // Renders from the tessellation submitted last frame, which the submission of the instances waited for
+        const uint64_t instancesInstance = m_LastGraphicsInstance;
+        m_LastGraphicsInstance = GetDevice()->executeCommandList(m_CommandList);
+
+        // The back buffers were rendered from last frame, which the graphics queue finished before updating the
+        // instances, so the tessellation waits for that update only
+        GetDevice()->queueWaitForCommandList(nvrhi::CommandQueue::Compute, nvrhi::CommandQueue::Graphics, instancesInstance);
+        m_LastComputeInstance = GetDevice()->executeCommandList(m_ComputeCommandList, nvrhi::CommandQueue::Compute);
+
+        m_Scene->SwapTerrainBuffers();
+    }
+    else
+    {
+        // The last asynchronous tessellation, if async tessellation was just turned off, wrote the buffers this frame
+        // rendered from and swapped
+        if (m_LastComputeInstance)
+        {
+            GetDevice()->queueWaitForCommandList(nvrhi::CommandQueue::Graphics, nvrhi::CommandQueue::Compute, m_LastComputeInstance);
+            m_LastComputeInstance = 0;
+        }
+        m_LastGraphicsInstance = GetDevice()->executeCommandList(m_CommandList);
+    }
 }
@@ -8,7 +8,9 @@
 #include <donut/engine/BindingCache.h>
 #include <donut/render/GBuffer.h>
 
+#include <donut/render/CascadedShadowMap.h>
 #include <donut/render/DeferredLightingPass.h>
+#include <donut/render/DepthPass.h>
 #include <donut/render/GBufferFillPass.h>
 
 #include "UserInterface.h"
@@ -17,8 +19,12 @@
 
 #include "engine/ViewEx.h"
 #include "render/passes/DebugPasses.h"
+#include "render/GpuTimers.h"
+#include "render/TerrainShadowCache.h"
+#include "render/Passes/DepthPyramidPass.h"
 #include "render/Passes/GBufferVisualizationPass.h"
 #include "render/Passes/TerrainPass.h"
+#include "terrain/TerrainMaterialize.h"
 #include "terrain/TerrainTessellation.h"
 
 
@@ -47,11 +53,29 @@ public:
 
 	inline std::shared_ptr<donut::engine::ShaderFactory> GetShaderFactory() const { return m_ShaderFactory; }
 
+	// Benchmark mode (see Benchmark)
+	void SetCamera(const dm::float3& position, const dm::float3& target, const dm::float3& up);
+	// Times the graphics command list of every frame; the compute command list of asynchronous tessellation is not timed
+	//  The query is reused every frame, so a frame must be read before the next one is rendered
+	void SetGpuFrameTiming(bool enable);
+	// Returns false if timing is disabled or the last frame has not finished
+	[[nodiscard]] bool ReadGpuFrameTime(float& seconds);
+
+	[[nodiscard]] inline const TerrainTessellator& GetTerrainTessellator() const { return *m_TerrainTessellator; }
+
+	// Stages of the frame measured while UIData::ShowGpuTimers is set
+	[[nodiscard]] inline GpuTimers& GetGpuTimers() { return *m_GpuTimers; }
+
 private:
 
 	void CreateDeferredShadingOutput(nvrhi::IDevice* device, dm::uint2 size, dm::uint sampleCount);
 	void CreateGBufferPasses();
 
+	// Scrolls the shadow cascades to the camera, and sets up a terrain view for each one
+	void UpdateShadowCascadeViews();
+	void TessellateShadowCascades(nvrhi::ICommandList* commandList, bool subdivide);
+	void RenderShadowMap();
+
 private:
 	UIData& m_UI;
 
@@ -64,20 +88,41 @@ private:
 	nvrhi::BindingLayoutHandle m_BindlessLayout;
 
 	nvrhi::CommandListHandle m_CommandList;
+	// Only created if the device has a compute queue, for asynchronous tessellation
+	nvrhi::CommandListHandle m_ComputeCommandList;
+	// Submission instances of the last frame, which the queues wait on for asynchronous tessellation
+	uint64_t m_LastGraphicsInstance = 0;
+	uint64_t m_LastComputeInstance = 0;
+
+	nvrhi::TimerQueryHandle m_GpuFrameTimerQuery;
+	std::unique_ptr<GpuTimers> m_GpuTimers;
 
 	donut::app::FirstPersonCamera m_Camera;
 	PlanarViewEx m_View;
 
 	std::shared_ptr<donut::render::GBufferRenderTargets> m_GBuffer;
+	// Depth of the G-buffer only, for the terrain depth prepass
+	std::shared_ptr<donut::engine::FramebufferFactory> m_DepthFramebuffer;
 	nvrhi::TextureHandle m_ShadedColour;
 
 	std::unique_ptr<TerrainTessellator> m_TerrainTessellator;
+	std::unique_ptr<TerrainMaterializePass> m_TerrainMaterializePass;
 
 	std::unique_ptr<donut::render::GBufferFillPass> m_GBufferPass;
 	std::unique_ptr<TerrainGBufferFillPass> m_TerrainGBufferPass;
+	std::unique_ptr<TerrainDepthOnlyPass> m_TerrainDepthPrepass;
 
 	std::unique_ptr<donut::render::DeferredLightingPass> m_DeferredLightingPass;
 	std::unique_ptr<GBufferVisualizationPass> m_GBufferVisualizationPass;
+	std::unique_ptr<DepthPyramidPass> m_DepthPyramidPass;
+
+	std::shared_ptr<donut::render::CascadedShadowMap> m_ShadowMap;
+	std::shared_ptr<donut::engine::FramebufferFactory> m_ShadowFramebuffer;
+	std::unique_ptr<donut::render::DepthPass> m_ShadowDepthPass;
+	std::unique_ptr<TerrainDepthOnlyPass> m_TerrainShadowPass;
+	std::unique_ptr<TerrainShadowCache> m_TerrainShadowCache;
+	// Views of the cascades this frame, empty while shadows are disabled
+	std::vector<PlanarViewEx> m_ShadowCascadeViews;
 
 	std::unique_ptr<LandscapesScene> m_Scene;
 	std::shared_ptr<LandscapesSceneTypeFactory> m_SceneTypeFactory;
@@ -1,5 +1,8 @@
 #include "LandscapesScene.h"
 
+#include <bit>
+#include <chrono>
+
 #include <nvrhi/utils.h>
 #include <json/value.h>
 #include <donut/core/json.h>
@@ -9,7 +12,11 @@
 #include "engine/LandscapesSceneGraph.h"
 
 #include "terrain/Terrain.h"
+#include "terrain/TerrainFile.h"
+#include "terrain/TerrainHeightBounds.h"
+#include "terrain/TerrainNormalMap.h"
 #include "terrain/TerrainTessellation.h"
+#include "terrain/TerrainVirtualHeightmap.h"
 
 using namespace donut;
 using namespace donut::math;
@@ -17,6 +24,71 @@ using namespace donut::math;
 #include "TerrainShaders.h"
 
 
+// Terrain files are uploaded as they are mapped, without going through the texture cache
+//  The height bounds and height error pyramids baked into the file are used instead of being built, if they have the
+//  layout TerrainHeightBoundsPass builds them with
+//  The file is opened by the caller, and is left as is if it could not be
+static void LoadTerrainFile(nvrhi::IDevice* device, TerrainMeshInfo& terrainMesh, const TerrainFile& file, nvrhi::ICommandList* commandList)
+{
+    auto textureData = std::make_shared<engine::TextureData>();
+    textureData->path = terrainMesh.HeightmapTexturePath.generic_string();
+    terrainMesh.HeightmapTexture = textureData;
+
+    if (!file.IsOpen())
+        return;
+
+    const TerrainFileLayerDesc& heights = *file.FindLayer(TerrainFileLayer::Height);
+    textureData->texture = file.CreateTexture(device, commandList, heights, textureData->path.c_str());
+    textureData->format = TerrainFile::GetTextureFormat(heights.Format);
+    textureData->width = heights.Width;
+    textureData->height = heights.Height;
+    textureData->mipLevels = heights.MipLevels;
+
+    if (!textureData->texture)
+    {
+        log::warning("Cannot create the texture of the terrain file '%s'", textureData->path.c_str());
+        return;
+    }
+
+    const uint2 pyramidSize = max(uint2(heights.Width, heights.Height) / 2u, uint2(1u));
+    const uint32_t pyramidMipLevels = static_cast<uint32_t>(std::bit_width(std::max(pyramidSize.x, pyramidSize.y)));
+    auto loadPyramid = [&](TerrainFileLayer layer, TerrainFileFormat format, const char* debugName) -> nvrhi::TextureHandle
+    {
+        const TerrainFileLayerDesc* desc = file.FindLayer(layer);
+        if (!desc)
+            return nullptr;
+
+        if (desc->Format != format || desc->Width != pyramidSize.x || desc->Height != pyramidSize.y || desc->MipLevels != pyramidMipLevels)
+        {
+            log::warning("Ignoring the %s of the terrain file '%s', whose layout is not the one built at runtime", debugName, textureData->path.c_str());
+            return nullptr;
+        }
+
+        return file.CreateTexture(device, commandList, *desc, debugName);
+    };
+
+    terrainMesh.HeightBoundsTexture = loadPyramid(TerrainFileLayer::HeightBounds, TerrainFileFormat::RG32_FLOAT, "TerrainHeightBounds");
+    terrainMesh.HeightErrorTexture = loadPyramid(TerrainFileLayer::HeightError, TerrainFileFormat::R32_FLOAT, "TerrainHeightError");
+
+    // Normals depend on the shape of the terrain, and are only used if they were baked for this one
+    const TerrainFileHeader& header = file.GetHeader();
+    const TerrainFileLayerDesc* normals = file.FindLayer(TerrainFileLayer::Normal);
+    if (normals && normals->Format == TerrainFileFormat::RG16_SNORM && normals->Width == heights.Width && normals->Height == heights.Height
+        && normals->MipLevels == static_cast<uint32_t>(std::bit_width(std::max(heights.Width, heights.Height))))
+    {
+        if (all(float2(header.NormalExtents[0], header.NormalExtents[1]) == terrainMesh.HeightmapExtents)
+            && header.NormalHeightScale == terrainMesh.HeightmapHeightScale)
+        {
+            terrainMesh.NormalMapTexture = file.CreateTexture(device, commandList, *normals, "TerrainNormalMap", true);
+        }
+        else
+        {
+            log::info("Re-baking the normals of the terrain file '%s', which were baked for another extent or height", textureData->path.c_str());
+        }
+    }
+}
+
+
 LandscapesScene::LandscapesScene(
     UIData& ui,
     nvrhi::IDevice* device,
@@ -35,16 +107,51 @@ LandscapesScene::LandscapesScene(
         std::move(sceneTypeFactory)
     )
 	, m_UI(ui)
+	, m_CommonPasses(std::move(commonPasses))
 {
-    m_TerrainTessellationPass = std::make_shared<PrimaryViewTerrainTessellationPass>(device, std::move(commonPasses));
+    m_TerrainTessellationPass = std::make_shared<PrimaryViewTerrainTessellationPass>(device, m_CommonPasses);
     m_TerrainTessellationPass->Init(shaderFactory);
+
+    m_SplitMergeTessellationPass = std::make_shared<SplitMergeTerrainTessellationPass>(device, m_CommonPasses);
+    m_SplitMergeTessellationPass->Init(shaderFactory);
+
+    m_GeometricTessellationPass = std::make_shared<GeometricErrorTerrainTessellationPass>(device, m_CommonPasses);
+    m_GeometricTessellationPass->Init(shaderFactory);
+
+    m_DirectionalLightTessellationPass = std::make_shared<DirectionalLightTerrainTessellationPass>(device, m_CommonPasses);
+    m_DirectionalLightTessellationPass->Init(shaderFactory);
+
+    m_HeightBoundsPass = std::make_unique<TerrainHeightBoundsPass>(device);
+    m_HeightBoundsPass->Init(shaderFactory);
+
+    m_NormalMapPass = std::make_unique<TerrainNormalMapPass>(device);
+    m_NormalMapPass->Init(shaderFactory);
+
+    nvrhi::TextureDesc pageTableDesc;
+    pageTableDesc.setFormat(nvrhi::Format::R32_UINT)
+        .setInitialState(nvrhi::ResourceStates::ShaderResource)
+        .setKeepInitialState(true)
+        .setDebugName("PlaceholderPageTable");
+    m_PlaceholderPageTable = device->createTexture(pageTableDesc);
+
+    nvrhi::BufferDesc feedbackDesc;
+    feedbackDesc.setByteSize(sizeof(uint32_t))
+        .setStructStride(sizeof(uint32_t))
+        .setCanHaveUAVs(true)
+        .setInitialState(nvrhi::ResourceStates::UnorderedAccess)
+        .setKeepInitialState(true)
+        .setDebugName("PlaceholderHeightmapFeedback");
+    m_PlaceholderHeightmapFeedback = device->createBuffer(feedbackDesc);
 }
 
+LandscapesScene::~LandscapesScene() = default;
+
 void LandscapesScene::CreateMeshBuffers(nvrhi::ICommandList* commandList)
 {
     Scene::CreateMeshBuffers(commandList);
 
     // Create and populate buffers for terrain mesh data (initialize CBTs)
+    //  Streamed terrains are created by UpdateTerrainStreaming once the camera is close enough
     for (const auto& mesh : m_SceneGraph->GetMeshes())
     {
 	    if (const auto& terrainMesh = std::dynamic_pointer_cast<TerrainMeshInfo>(mesh))
@@ -54,42 +161,413 @@ void LandscapesScene::CreateMeshBuffers(nvrhi::ICommandList* commandList)
                 terrainMesh->buffers = std::make_shared<engine::BufferGroup>();
             }
 
-            if (!terrainMesh->HeightmapTexture)
+            if (terrainMesh->StreamingDistance <= 0.0f)
             {
-                terrainMesh->HeightmapTexture = m_TextureCache->LoadTextureFromFileDeferred(terrainMesh->HeightmapTexturePath, true);
+                CreateTerrainResources(*terrainMesh, commandList);
             }
+	    }
+    }
 
-            if (!terrainMesh->TerrainCB)
+    for (auto& meshInstance : m_SceneGraph->GetMeshInstances())
+    {
+	    if (const auto& terrainMeshInstance = std::dynamic_pointer_cast<TerrainMeshInstance>(meshInstance))
+	    {
+            if (terrainMeshInstance->GetTerrain()->StreamingDistance <= 0.0f)
             {
-                terrainMesh->TerrainCB = m_Device->createBuffer(nvrhi::utils::CreateStaticConstantBufferDesc(
-                    sizeof(TerrainConstants), "TerrainConstants"
-                ));
+		        terrainMeshInstance->CreateBuffers(m_Device, commandList);
+            }
+	    }
+    }
+}
+
+void LandscapesScene::CreateTerrainResources(TerrainMeshInfo& terrainMesh, nvrhi::ICommandList* commandList)
+{
+    if (terrainMesh.VirtualHeightmapDesc && !terrainMesh.VirtualHeightmap)
+    {
+        auto virtualHeightmap = std::make_shared<TerrainVirtualHeightmap>(m_Device, *terrainMesh.VirtualHeightmapDesc);
+        if (virtualHeightmap->Init(commandList))
+        {
+            // The fallback level stands in for the heightmap, and the height bounds are built from it below
+            auto fallback = std::make_shared<engine::TextureData>();
+            fallback->texture = virtualHeightmap->GetFallbackTexture();
+            fallback->path = terrainMesh.VirtualHeightmapDesc->Path.generic_string();
+            fallback->width = fallback->height = terrainMesh.VirtualHeightmapDesc->FallbackResolution;
+
+            terrainMesh.HeightmapTexture = std::move(fallback);
+            terrainMesh.VirtualHeightmap = std::move(virtualHeightmap);
+        }
+        else
+        {
+            log::warning("Falling back to the heightmap '%s'", terrainMesh.HeightmapTexturePath.generic_string().c_str());
+        }
+    }
+
+    if (terrainMesh.VirtualHeightmap)
+    {
+        terrainMesh.HeightmapPageTable = terrainMesh.VirtualHeightmap->GetPageTableTexture();
+        terrainMesh.HeightmapAtlas = terrainMesh.VirtualHeightmap->GetAtlasTexture();
+        terrainMesh.HeightmapFeedback = terrainMesh.VirtualHeightmap->GetFeedbackBuffer();
+        terrainMesh.HeightmapTessellationFeedback = terrainMesh.VirtualHeightmap->GetTessellationFeedbackBuffer();
+    }
+    else
+    {
+        terrainMesh.HeightmapPageTable = m_PlaceholderPageTable;
+        terrainMesh.HeightmapAtlas = m_CommonPasses->m_BlackTexture;
+        terrainMesh.HeightmapFeedback = m_PlaceholderHeightmapFeedback;
+        terrainMesh.HeightmapTessellationFeedback = m_PlaceholderHeightmapFeedback;
+    }
+
+    if (!terrainMesh.HeightmapTexture)
+    {
+        // Loaded immediately, as the height bounds are built from it below; streamed terrains are loaded by a worker
+        // before this (see UpdateTerrainStreaming)
+        if (terrainMesh.HeightmapTerrainFile)
+        {
+            TerrainFile file;
+            file.Open(terrainMesh.HeightmapTexturePath);
+            LoadTerrainFile(m_Device, terrainMesh, file, commandList);
+        }
+        else
+        {
+            terrainMesh.HeightmapTexture = m_TextureCache->LoadTextureFromFile(terrainMesh.HeightmapTexturePath, true, m_CommonPasses.get(), commandList);
+        }
+    }
+
+    if (!terrainMesh.HeightBoundsTexture && terrainMesh.HeightmapTexture->texture)
+    {
+        terrainMesh.HeightBoundsTexture = m_HeightBoundsPass->Build(commandList, terrainMesh.HeightmapTexture->texture);
+    }
+
+    if (!terrainMesh.HeightErrorTexture && terrainMesh.HeightmapTexture->texture)
+    {
+        terrainMesh.HeightErrorTexture = m_HeightBoundsPass->BuildError(commandList, terrainMesh.HeightmapTexture->texture);
+    }
+
+    if (!terrainMesh.NormalMapTexture && terrainMesh.HeightmapTexture->texture)
+    {
+        terrainMesh.NormalMapTexture = m_NormalMapPass->Build(commandList, terrainMesh.HeightmapTexture->texture,
+            terrainMesh.HeightmapExtents, terrainMesh.HeightmapHeightScale);
+    }
+
+    if (!terrainMesh.TerrainCB)
+    {
+        terrainMesh.TerrainCB = m_Device->createBuffer(nvrhi::utils::CreateStaticConstantBufferDesc(
+            sizeof(TerrainConstants), "TerrainConstants"
+        ));
+
+        // LoadTextureFromFile and LoadTerrainFile always return a shared pointer to TextureData
+        const auto& textureData = std::static_pointer_cast<engine::TextureData>(terrainMesh.HeightmapTexture);
 
-                // LoadTextureFromFileDeferred always returns a shared pointer to TextureData
-                const auto& textureData = std::static_pointer_cast<engine::TextureData>(terrainMesh->HeightmapTexture);
-                float2 heightmapResolution {
-					static_cast<float>(textureData->width),
-                    static_cast<float>(textureData->height)
-                };
+        TerrainConstants terrainConstants;
+        terrainMesh.FillTerrainConstants(terrainConstants, uint2(textureData->width, textureData->height));
+        if (terrainMesh.VirtualHeightmap)
+        {
+            terrainMesh.VirtualHeightmap->FillTerrainConstants(terrainConstants);
+        }
 
-                TerrainConstants terrainConstants;
-                terrainConstants.TerrainExtentsAndInvExtents = float4(terrainMesh->HeightmapExtents, 1.0f / terrainMesh->HeightmapExtents);
-                terrainConstants.HeightmapResolutionAndInvResolution = float4(heightmapResolution, 1.0f / heightmapResolution);
-                terrainConstants.HeightScaleAndInvScale = float2(terrainMesh->HeightmapHeightScale, 1.0f / terrainMesh->HeightmapHeightScale);
+        commandList->beginTrackingBufferState(terrainMesh.TerrainCB, nvrhi::ResourceStates::CopyDest);
+        commandList->writeBuffer(terrainMesh.TerrainCB, &terrainConstants, sizeof(terrainConstants));
+        commandList->setPermanentBufferState(terrainMesh.TerrainCB, nvrhi::ResourceStates::ConstantBuffer);
+    }
+}
 
-                commandList->beginTrackingBufferState(terrainMesh->TerrainCB, nvrhi::ResourceStates::CopyDest);
-                commandList->writeBuffer(terrainMesh->TerrainCB, &terrainConstants, sizeof(terrainConstants));
-                commandList->setPermanentBufferState(terrainMesh->TerrainCB, nvrhi::ResourceStates::ConstantBuffer);
+void LandscapesScene::ReleaseTerrainResources(TerrainMeshInfo& terrainMesh)
+{
+    // The constants only depend on the description of the terrain, and are kept for when it is streamed back in
+    if (terrainMesh.HeightmapTexture)
+    {
+        // Neither terrain files nor the fallback level of a virtual heightmap are in the texture cache
+        if (!terrainMesh.VirtualHeightmap && !terrainMesh.HeightmapTerrainFile)
+        {
+            m_TextureCache->UnloadTexture(std::static_pointer_cast<engine::TextureData>(terrainMesh.HeightmapTexture));
+        }
+        terrainMesh.HeightmapTexture = nullptr;
+    }
+    terrainMesh.HeightBoundsTexture = nullptr;
+    terrainMesh.HeightErrorTexture = nullptr;
+    terrainMesh.NormalMapTexture = nullptr;
+    terrainMesh.VirtualHeightmap = nullptr;
+    terrainMesh.HeightmapPageTable = nullptr;
+    terrainMesh.HeightmapAtlas = nullptr;
+    terrainMesh.HeightmapFeedback = nullptr;
+    terrainMesh.HeightmapTessellationFeedback = nullptr;
+}
+
+bool LandscapesScene::UpdateTerrainStreaming(nvrhi::ICommandList* commandList, const float3& cameraPosition)
+{
+    // Distance from the camera to the closest instance of each streamed terrain
+    std::unordered_map<TerrainMeshInfo*, float> terrainDistances;
+    std::vector<std::shared_ptr<TerrainMeshInstance>> streamedInstances;
+    for (const auto& meshInstance : m_SceneGraph->GetMeshInstances())
+    {
+        const auto& terrainMeshInstance = std::dynamic_pointer_cast<TerrainMeshInstance>(meshInstance);
+        if (!terrainMeshInstance || terrainMeshInstance->GetTerrain()->StreamingDistance <= 0.0f)
+            continue;
+
+        box3 bounds = terrainMeshInstance->GetNode()->GetGlobalBoundingBox();
+        float distance = length(max(max(bounds.m_mins - cameraPosition, cameraPosition - bounds.m_maxs), float3(0.0f)));
+
+        auto [it, inserted] = terrainDistances.try_emplace(terrainMeshInstance->GetTerrain(), distance);
+        if (!inserted)
+        {
+            it->second = std::min(it->second, distance);
+        }
+        streamedInstances.push_back(terrainMeshInstance);
+    }
+
+    // Tiles are released a little further than they are loaded, so that a camera on the threshold does not reload them every frame
+    constexpr float releaseDistanceScale = 1.25f;
+
+    bool residencyChanged = false;
+    for (const auto& [terrainMesh, distance] : terrainDistances)
+    {
+        if (m_FailedTerrainLoads.contains(terrainMesh))
+            continue;
+
+        auto load = m_TerrainLoads.find(terrainMesh);
+        const bool loading = load != m_TerrainLoads.end();
+        const bool resident = terrainMesh->HeightmapTexture != nullptr;
+        const bool keepResident = distance < terrainMesh->StreamingDistance * (resident || loading ? releaseDistanceScale : 1.0f);
+
+        if (loading)
+        {
+            if (load->second.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+                continue;
+
+            TerrainHeightmapLoad heightmap = load->second.get();
+            m_TerrainLoads.erase(load);
+
+            if (!keepResident)
+            {
+                // The camera moved away while the heightmap was loading
+                if (heightmap.Texture)
+                {
+                    m_TextureCache->UnloadTexture(std::static_pointer_cast<engine::TextureData>(heightmap.Texture));
+                }
+                continue;
             }
-	    }
+
+            if (heightmap.File)
+            {
+                if (heightmap.File->IsOpen())
+                {
+                    LoadTerrainFile(m_Device, *terrainMesh, *heightmap.File, commandList);
+                }
+            }
+            else if (heightmap.Texture)
+            {
+                // The texture was queued for the texture cache to create before the load completed
+                if (!heightmap.Texture->texture)
+                {
+                    m_TextureCache->ProcessRenderingThreadCommands(*m_CommonPasses, 0.0f);
+                }
+                terrainMesh->HeightmapTexture = std::move(heightmap.Texture);
+            }
+
+            // Nothing is created for a terrain without a heightmap, which stays out of the scene
+            if (!terrainMesh->HeightmapTexture || !terrainMesh->HeightmapTexture->texture)
+            {
+                log::error("Cannot load the heightmap '%s' of a streamed terrain, skipping it",
+                    terrainMesh->HeightmapTexturePath.generic_string().c_str());
+                ReleaseTerrainResources(*terrainMesh);
+                m_FailedTerrainLoads.insert(terrainMesh);
+                continue;
+            }
+
+            CreateTerrainResources(*terrainMesh, commandList);
+            for (const auto& terrainMeshInstance : streamedInstances)
+            {
+                if (terrainMeshInstance->GetTerrain() == terrainMesh)
+                {
+                    terrainMeshInstance->CreateBuffers(m_Device, commandList);
+                }
+            }
+            residencyChanged = true;
+            continue;
+        }
+
+        if (resident == keepResident)
+            continue;
+
+        if (keepResident)
+        {
+            // The heightmap is read from disk, and decoded, by a worker; the terrain is created once it is done
+            m_TerrainLoads.emplace(terrainMesh, std::async(std::launch::async,
+                [textureCache = m_TextureCache, path = terrainMesh->HeightmapTexturePath, terrainFile = terrainMesh->HeightmapTerrainFile]()
+                {
+                    TerrainHeightmapLoad heightmap;
+                    if (terrainFile)
+                    {
+                        heightmap.File = std::make_unique<TerrainFile>();
+                        if (heightmap.File->Open(path))
+                        {
+                            heightmap.File->Prefetch();
+                        }
+                    }
+                    else
+                    {
+                        // Queued for ProcessRenderingThreadCommands to create and upload
+                        heightmap.Texture = textureCache->LoadTextureFromFileDeferred(path, true);
+                    }
+                    return heightmap;
+                }));
+            continue;
+        }
+
+        for (const auto& terrainMeshInstance : streamedInstances)
+        {
+            if (terrainMeshInstance->GetTerrain() == terrainMesh)
+            {
+                terrainMeshInstance->ReleaseBuffers();
+            }
+        }
+        ReleaseTerrainResources(*terrainMesh);
+        residencyChanged = true;
     }
 
-    for (auto& meshInstance : m_SceneGraph->GetMeshInstances())
+    if (residencyChanged)
     {
-	    if (const auto& terrainMeshInstance = std::dynamic_pointer_cast<TerrainMeshInstance>(meshInstance))
-	    {
-		    terrainMeshInstance->CreateBuffers(m_Device, commandList);
-	    }
+        // Binding sets hold references to the resources of the released terrains
+        m_TerrainTessellationPass->ResetBindingCache();
+        m_SplitMergeTessellationPass->ResetBindingCache();
+        m_GeometricTessellationPass->ResetBindingCache();
+        m_DirectionalLightTessellationPass->ResetBindingCache();
+    }
+    return residencyChanged;
+}
+
+int LandscapesScene::GetShadowCascadeTerrainViewIndex(uint32_t cascade) const
+{
+    return cascade < m_ShadowCascadeTerrainViews.size() ? m_ShadowCascadeTerrainViews[cascade] : -1;
+}
+
+bool LandscapesScene::HasStreamedTerrains() const
+{
+    for (const auto& meshInstance : m_SceneGraph->GetMeshInstances())
+    {
+        if (const auto& terrainMeshInstance = std::dynamic_pointer_cast<TerrainMeshInstance>(meshInstance))
+        {
+            if (terrainMeshInstance->GetTerrain()->StreamingDistance > 0.0f)
+                return true;
+        }
+    }
+    return false;
+}
+
+bool LandscapesScene::HasVirtualHeightmaps() const
+{
+    for (const auto& mesh : m_SceneGraph->GetMeshes())
+    {
+        if (const auto& terrainMesh = std::dynamic_pointer_cast<TerrainMeshInfo>(mesh))
+        {
+            if (terrainMesh->VirtualHeightmap)
+                return true;
+        }
+    }
+    return false;
+}
+
+bool LandscapesScene::UpdateVirtualHeightmaps(nvrhi::ICommandList* commandList, std::vector<box3>& changedBounds)
+{
+    bool heightsChanged = false;
+    // Rectangles of each heightmap whose heights changed, in texture coordinates
+    std::unordered_map<const TerrainMeshInfo*, std::vector<box2>> changedRegions;
+    for (const auto& mesh : m_SceneGraph->GetMeshes())
+    {
+        if (const auto& terrainMesh = std::dynamic_pointer_cast<TerrainMeshInfo>(mesh))
+        {
+            if (terrainMesh->VirtualHeightmap)
+            {
+                std::vector<box2>& regions = changedRegions[terrainMesh.get()];
+                if (terrainMesh->VirtualHeightmap->Update(commandList, regions))
+                {
+                    UpdateTerrainNormalMap(commandList, *terrainMesh, regions);
+                    terrainMesh->HeightsVersion++;
+                    heightsChanged = true;
+                }
+            }
+        }
+    }
+
+    if (!heightsChanged)
+        return false;
+
+    for (const auto& meshInstance : m_SceneGraph->GetMeshInstances())
+    {
+        const auto& terrainMeshInstance = std::dynamic_pointer_cast<TerrainMeshInstance>(meshInstance);
+        if (!terrainMeshInstance)
+            continue;
+
+        auto it = changedRegions.find(terrainMeshInstance->GetTerrain());
+        if (it == changedRegions.end())
+            continue;
+
+        const TerrainMeshInfo& terrainMesh = *it->first;
+        const affine3 localToWorld = terrainMeshInstance->GetNode()->GetLocalToWorldTransformFloat();
+        for (const box2& region : it->second)
+        {
+            // Texture coordinates map to the local x and z of the terrain (see GetLocalBoundingBox), over its whole height
+            const float2 localMin = (region.m_mins - 0.5f) * terrainMesh.HeightmapExtents;
+            const float2 localMax = (region.m_maxs - 0.5f) * terrainMesh.HeightmapExtents;
+            const box3 localBounds(float3(localMin.x, 0.0f, localMin.y), float3(localMax.x, terrainMesh.HeightmapHeightScale, localMax.y));
+            changedBounds.push_back(localBounds * localToWorld);
+        }
+    }
+    return true;
+}
+
+void LandscapesScene::UpdateTerrainNormalMap(nvrhi::ICommandList* commandList, TerrainMeshInfo& terrainMesh,
+    const std::vector<box2>& regions)
+{
+    if (!terrainMesh.NormalMapTexture || !terrainMesh.HeightmapTexture || !terrainMesh.HeightmapTexture->texture)
+        return;
+
+    TerrainNormalMapPass::VirtualHeightmapInputs virtualInputs;
+    if (terrainMesh.VirtualHeightmap)
+    {
+        virtualInputs.pageTable = terrainMesh.HeightmapPageTable;
+        virtualInputs.atlas = terrainMesh.HeightmapAtlas;
+        virtualInputs.terrainCB = terrainMesh.TerrainCB;
+    }
+
+    const auto& normalMapDesc = terrainMesh.NormalMapTexture->getDesc();
+    const float2 size = float2(uint2(normalMapDesc.width, normalMapDesc.height));
+    for (const box2& region : regions)
+    {
+        const uint2 firstTexel = uint2(max(floor(region.m_mins * size), float2(0.0f)));
+        const uint2 lastTexel = uint2(max(ceil(region.m_maxs * size) - 1.0f, float2(firstTexel)));
+        m_NormalMapPass->Update(commandList, terrainMesh.HeightmapTexture->texture, terrainMesh.NormalMapTexture,
+            terrainMesh.HeightmapExtents, terrainMesh.HeightmapHeightScale, firstTexel, lastTexel,
+            terrainMesh.VirtualHeightmap ? &virtualInputs : nullptr);
+    }
+}
+
+bool LandscapesScene::SupportsAsyncTessellation() const
+{
+    bool anyTerrain = false;
+    for (const auto& meshInstance : m_SceneGraph->GetMeshInstances())
+    {
+        if (const auto& terrainMeshInstance = std::dynamic_pointer_cast<TerrainMeshInstance>(meshInstance))
+        {
+            for (size_t i = 0; i < terrainMeshInstance->GetNumTerrainViews(); i++)
+            {
+                if (!terrainMeshInstance->GetTerrainView(i)->IsDoubleBuffered())
+                    return false;
+            }
+            anyTerrain = true;
+        }
+    }
+    return anyTerrain;
+}
+
+void LandscapesScene::SwapTerrainBuffers()
+{
+    for (const auto& meshInstance : m_SceneGraph->GetMeshInstances())
+    {
+        if (const auto& terrainMeshInstance = std::dynamic_pointer_cast<TerrainMeshInstance>(meshInstance))
+        {
+            terrainMeshInstance->SwapBuffers();
+        }
     }
 }
 
@@ -130,6 +608,7 @@ void LandscapesScene::LoadTerrain(const Json::Value& terrainList, const std::fil
 	        std::string pathStr;
             path >> pathStr;
             terrainMesh->HeightmapTexturePath = fileName / pathStr;
+            terrainMesh->HeightmapTerrainFile = TerrainFile::HasExtension(terrainMesh->HeightmapTexturePath);
         }
 
         for (const auto& viewSrc : src["views"])
@@ -148,6 +627,70 @@ void LandscapesScene::LoadTerrain(const Json::Value& terrainList, const std::fil
             if (const auto& initDepth = viewSrc["initDepth"]; !initDepth.isNull())
                 initDepth >> view.InitDepth;
 
+            if (const auto& doubleBuffered = viewSrc["doubleBuffered"]; !doubleBuffered.isNull())
+                doubleBuffered >> view.DoubleBuffered;
+
+            const auto& sumReduction = viewSrc["sumReduction"];
+            if (!sumReduction.isNull() && sumReduction.isString())
+            {
+                if (sumReduction == "iterative")
+                {
+                    view.SumReductionMode = TerrainSumReductionMode::Iterative;
+                }
+                else if (sumReduction == "fused")
+                {
+                    view.SumReductionMode = TerrainSumReductionMode::Fused;
+                }
+                else
+                {
+                    log::warning("Unknown sum reduction mode: '%s'", sumReduction.asCString());
+                }
+            }
+
+            const auto& topology = viewSrc["topology"];
+            if (!topology.isNull() && topology.isString())
+            {
+                if (topology == "cbt")
+                {
+                    view.Topology = TerrainTopology::ConcurrentBinaryTree;
+                }
+                else if (topology == "bisectorPool")
+                {
+                    view.Topology = TerrainTopology::BisectorPool;
+                }
+                else
+                {
+                    log::warning("Unknown terrain topology: '%s'", topology.asCString());
+                }
+            }
+
+            if (const auto& poolCapacity = viewSrc["poolCapacity"]; !poolCapacity.isNull())
+                poolCapacity >> view.PoolCapacity;
+
+            const auto& renderMode = viewSrc["renderMode"];
+            if (!renderMode.isNull() && renderMode.isString())
+            {
+                if (renderMode == "instanced")
+                {
+                    view.RenderMode = TerrainRenderMode::Instanced;
+                }
+                else if (renderMode == "indexed")
+                {
+                    view.RenderMode = TerrainRenderMode::Indexed;
+                }
+                else if (renderMode == "patch")
+                {
+                    view.RenderMode = TerrainRenderMode::Patch;
+                }
+                else
+                {
+                    log::warning("Unknown terrain render mode: '%s'", renderMode.asCString());
+                }
+            }
+
+            if (const auto& materializedLeafCapacity = viewSrc["materializedLeafCapacity"]; !materializedLeafCapacity.isNull())
+                materializedLeafCapacity >> view.MaterializedLeafCapacity;
+
             const auto& tessellationScheme = viewSrc["tessellationScheme"];
             if (!tessellationScheme.isNull() && tessellationScheme.isString())
             {
@@ -155,13 +698,197 @@ void LandscapesScene::LoadTerrain(const Json::Value& terrainList, const std::fil
 	            {
 		            view.TessellationScheme = m_TerrainTessellationPass;
 	            }
+                else if (tessellationScheme == "primarySplitMerge")
+                {
+                    view.TessellationScheme = m_SplitMergeTessellationPass;
+                }
+                else if (tessellationScheme == "geometric")
+                {
+                    view.TessellationScheme = m_GeometricTessellationPass;
+                }
+                else if (tessellationScheme == "directionalLight")
+                {
+                    view.TessellationScheme = m_DirectionalLightTessellationPass;
+                }
                 else
                 {
 	                log::warning("Unknown tessellation scheme: '%s'", tessellationScheme.asCString());
                 }
             }
+
+            // A view with shadow cascades is repeated for each one, so that every cascade has a tessellation of its own
+            if (const auto& shadowCascades = viewSrc["shadowCascades"]; !shadowCascades.isNull())
+            {
+                int cascadeCount = 0;
+                shadowCascades >> cascadeCount;
+                if (cascadeCount > 0)
+                {
+                    view.ShadowCascade = 0;
+                    const TerrainMeshViewDesc cascadeView = view;
+                    for (int cascade = 1; cascade < cascadeCount; cascade++)
+                    {
+                        terrainMesh->TerrainViews.push_back(cascadeView);
+                        terrainMesh->TerrainViews.back().ShadowCascade = cascade;
+                    }
+                }
+            }
+        }
+
+        // The shadow map renders every terrain with the same view index per cascade
+        std::vector<int> shadowCascadeViews;
+        for (size_t viewIndex = 0; viewIndex < terrainMesh->TerrainViews.size(); viewIndex++)
+        {
+            const int cascade = terrainMesh->TerrainViews[viewIndex].ShadowCascade;
+            if (cascade < 0)
+                continue;
+            if (shadowCascadeViews.size() <= static_cast<size_t>(cascade))
+                shadowCascadeViews.resize(cascade + 1, -1);
+            shadowCascadeViews[cascade] = static_cast<int>(viewIndex);
+        }
+        if (!shadowCascadeViews.empty())
+        {
+            if (m_ShadowCascadeTerrainViews.empty())
+            {
+                m_ShadowCascadeTerrainViews = std::move(shadowCascadeViews);
+            }
+            else if (m_ShadowCascadeTerrainViews != shadowCascadeViews)
+            {
+                log::warning("Terrains have different shadow cascade views: only those of the first terrain are rendered");
+            }
+        }
+
+        // e.g. "virtualHeightmap": { "path": "dem.r16", "resolution": 65536, "pageSize": 128, "atlasPages": 32, "fallbackResolution": 2048 }
+        if (const auto& virtualHeightmap = src["virtualHeightmap"]; virtualHeightmap.isObject())
+        {
+            auto desc = std::make_shared<TerrainVirtualHeightmapDesc>();
+
+            if (const auto& path = virtualHeightmap["path"]; !path.isNull())
+            {
+                std::string pathStr;
+                path >> pathStr;
+                desc->Path = fileName / pathStr;
+            }
+
+            if (const auto& resolution = virtualHeightmap["resolution"]; !resolution.isNull())
+                resolution >> desc->Resolution;
+
+            if (const auto& pageSize = virtualHeightmap["pageSize"]; !pageSize.isNull())
+                pageSize >> desc->PageSize;
+
+            if (const auto& atlasPages = virtualHeightmap["atlasPages"]; !atlasPages.isNull())
+                atlasPages >> desc->AtlasPages;
+
+            if (const auto& fallbackResolution = virtualHeightmap["fallbackResolution"]; !fallbackResolution.isNull())
+                fallbackResolution >> desc->FallbackResolution;
+
+            if (const auto& uploadsPerFrame = virtualHeightmap["uploadsPerFrame"]; !uploadsPerFrame.isNull())
+                uploadsPerFrame >> desc->UploadsPerFrame;
+
+            if (const auto& workerCount = virtualHeightmap["workerCount"]; !workerCount.isNull())
+                workerCount >> desc->WorkerCount;
+
+            terrainMesh->VirtualHeightmapDesc = std::move(desc);
+        }
+
+        if (const auto& tiles = src["tiles"]; tiles.isObject())
+        {
+            if (terrainMesh->VirtualHeightmapDesc)
+            {
+                log::warning("Tiled terrains do not support virtual heightmaps: the tiles load their own heightmaps");
+                terrainMesh->VirtualHeightmapDesc = nullptr;
+            }
+
+            sceneGraph.AddTerrainTileGrid(LoadTerrainTiles(tiles, fileName, *terrainMesh));
+            continue;
         }
 
         sceneGraph.AddTerrainMesh(std::move(terrainMesh));
 	}
 }
+
+static void ReplaceAll(std::string& str, const std::string& token, const std::string& value)
+{
+    for (size_t pos = str.find(token); pos != std::string::npos; pos = str.find(token, pos + value.size()))
+    {
+        str.replace(pos, token.size(), value);
+    }
+}
+
+std::shared_ptr<TerrainTileGrid> LandscapesScene::LoadTerrainTiles(const Json::Value& tiles, const std::filesystem::path& fileName, const TerrainMeshInfo& terrainMesh)
+{
+    auto tileGrid = std::make_shared<TerrainTileGrid>();
+
+    if (const auto& grid = tiles["grid"]; !grid.isNull())
+        grid >> tileGrid->GridSize;
+    tileGrid->GridSize = max(tileGrid->GridSize, uint2(1));
+
+    // e.g. "tiles/heightmap_{x}_{y}.png"
+    std::string pathPattern;
+    if (const auto& path = tiles["path"]; !path.isNull())
+        path >> pathPattern;
+
+    float streamingDistance = 0.0f;
+    if (const auto& distance = tiles["streamingDistance"]; !distance.isNull())
+        distance >> streamingDistance;
+
+    // A tile covers 1 / (GridSize.x * GridSize.y) of the terrain, so its leaves shrink to the size of the finest leaves
+    // of the terrain that many fewer levels down; the levels are rounded down to an even count so that the leaves keep
+    // their shape, and no view goes below the depth it starts at nor the 5 levels libcbt requires
+    const uint tileLevels = (static_cast<uint>(std::bit_width(tileGrid->GridSize.x * tileGrid->GridSize.y)) - 1) & ~1u;
+    std::vector<TerrainMeshViewDesc> tileViews = terrainMesh.TerrainViews;
+    for (auto& view : tileViews)
+    {
+        const uint minDepth = std::min(view.MaxDepth, std::max(view.InitDepth, 5u));
+        view.MaxDepth = std::max(view.MaxDepth - std::min(view.MaxDepth, tileLevels), minDepth);
+    }
+
+    // Every view must be able to split down to the border depth, which defaults to the depth they start at
+    uint maxBorderDepth = BISECTOR_POOL_MAX_DEPTH;
+    uint borderDepth = maxBorderDepth;
+    for (const auto& view : tileViews)
+    {
+        maxBorderDepth = std::min(maxBorderDepth, view.MaxDepth);
+        borderDepth = std::min(borderDepth, view.InitDepth);
+    }
+    if (const auto& depth = tiles["borderDepth"]; !depth.isNull())
+        depth >> borderDepth;
+
+    if (borderDepth > maxBorderDepth)
+    {
+        log::warning("Tile border depth %u exceeds the maximum depth of a view of the terrain (%u), clamping", borderDepth, maxBorderDepth);
+        borderDepth = maxBorderDepth;
+    }
+    borderDepth = std::max(borderDepth, 1u);
+
+    // The buffers sized in leaves shrink with the area, but still hold every leaf along the borders of a tile
+    for (auto& view : tileViews)
+    {
+        const uint minLeaves = 1u << std::max(view.InitDepth, borderDepth);
+        view.PoolCapacity = std::max(view.PoolCapacity >> tileLevels, minLeaves);
+        view.MaterializedLeafCapacity = std::max(view.MaterializedLeafCapacity >> tileLevels, minLeaves);
+    }
+
+    // The extents are those of the whole grid
+    const float2 tileExtents = terrainMesh.HeightmapExtents / float2(tileGrid->GridSize);
+
+    for (uint y = 0; y < tileGrid->GridSize.y; y++)
+    {
+        for (uint x = 0; x < tileGrid->GridSize.x; x++)
+        {
+            std::string tilePath = pathPattern;
+            ReplaceAll(tilePath, "{x}", std::to_string(x));
+            ReplaceAll(tilePath, "{y}", std::to_string(y));
+
+            auto tile = std::make_shared<TerrainMeshInfo>(terrainMesh);
+            tile->HeightmapExtents = tileExtents;
+            tile->TerrainViews = tileViews;
+            tile->HeightmapTexturePath = fileName / tilePath;
+            tile->HeightmapTerrainFile = TerrainFile::HasExtension(tile->HeightmapTexturePath);
+            tile->TileBorderDepth = borderDepth;
+            tile->StreamingDistance = streamingDistance;
+            tileGrid->Tiles.push_back(std::move(tile));
+        }
+    }
+
+    return tileGrid;
+}
@@ -5,11 +5,23 @@
 #include <donut/engine/ShaderFactory.h>
 #include <donut/engine/Scene.h>
 
+#include <future>
+#include <unordered_map>
+#include <unordered_set>
+
 
 struct UIData;
 
 class LandscapesSceneGraph;
+struct TerrainMeshInfo;
+struct TerrainTileGrid;
 class PrimaryViewTerrainTessellationPass;
+class SplitMergeTerrainTessellationPass;
+class GeometricErrorTerrainTessellationPass;
+class DirectionalLightTerrainTessellationPass;
+class TerrainHeightBoundsPass;
+class TerrainNormalMapPass;
+class TerrainFile;
 
 
 class LandscapesScene : public donut::engine::Scene
@@ -24,6 +36,39 @@ public:
         std::shared_ptr<donut::engine::DescriptorTableManager> descriptorTable,
         std::shared_ptr<donut::engine::SceneTypeFactory> sceneTypeFactory,
         std::shared_ptr<donut::engine::CommonRenderPasses> commonPasses);
+    // Defined where TerrainHeightBoundsPass and TerrainNormalMapPass are complete
+    ~LandscapesScene() override;
+
+    // Tessellation can only run asynchronously to rendering if every terrain view is double buffered
+    [[nodiscard]] bool SupportsAsyncTessellation() const;
+
+    // Makes the last tessellation of each double buffered terrain view the one to render
+    void SwapTerrainBuffers();
+
+    // Creates the resources of the streamed terrains (see TerrainMeshInfo::StreamingDistance) within their streaming
+    // distance of the camera, and releases those of the terrains beyond it
+    //  The heightmap of a terrain coming into range is loaded by a worker, and the terrain is created by the first
+    //  update after it is done, so a terrain may appear a few frames after it came into range
+    //  Returns true if any terrain was created or released, in which case binding sets referencing terrain resources
+    //  must be recreated; the caches of the tessellation schemes of the scene are reset here
+    bool UpdateTerrainStreaming(nvrhi::ICommandList* commandList, const donut::math::float3& cameraPosition);
+    [[nodiscard]] bool HasStreamedTerrains() const;
+
+    // Streams the pages of the virtual heightmaps (see TerrainVirtualHeightmap::Update), before anything reads them
+    // this frame, and once every pass of the previous frame is done with them
+    //  Returns true if any heights changed, and appends the world space bounds of the terrain instances over them
+    bool UpdateVirtualHeightmaps(nvrhi::ICommandList* commandList, std::vector<donut::math::box3>& changedBounds);
+    [[nodiscard]] bool HasVirtualHeightmaps() const;
+
+    // Re-bakes the normal map of a terrain over rectangles of its heightmap in texture coordinates, to be recorded after
+    // anything that changes the heights there; the height bounds and height error pyramids are not updated
+    //  The normals of virtual heightmaps are baked from the finest pages resident once their page table is written
+    void UpdateTerrainNormalMap(nvrhi::ICommandList* commandList, TerrainMeshInfo& terrainMesh,
+        const std::vector<donut::math::box2>& regions);
+
+    // Index of the terrain view tessellated for a cascade of the directional light shadow map (see
+    // TerrainMeshViewDesc::ShadowCascade), or -1 if the terrains have none; read from the first terrain with shadow views
+    [[nodiscard]] int GetShadowCascadeTerrainViewIndex(uint32_t cascade) const;
 
 protected:
 
@@ -33,9 +78,42 @@ protected:
 
 private:
     void LoadTerrain(const Json::Value& terrainList, const std::filesystem::path& fileName, LandscapesSceneGraph& sceneGraph);
+    // Splits the terrain into a grid of tiles, whose views are those of the terrain scaled down to the area of a tile
+    std::shared_ptr<TerrainTileGrid> LoadTerrainTiles(const Json::Value& tiles, const std::filesystem::path& fileName, const TerrainMeshInfo& terrainMesh);
+
+    void CreateTerrainResources(TerrainMeshInfo& terrainMesh, nvrhi::ICommandList* commandList);
+    void ReleaseTerrainResources(TerrainMeshInfo& terrainMesh);
+
+    // Heightmap of a streamed terrain, read from disk by a worker of UpdateTerrainStreaming
+    struct TerrainHeightmapLoad
+    {
+        // Image heightmaps, decoded and queued for the texture cache to create
+        std::shared_ptr<donut::engine::LoadedTexture> Texture;
+        // Terrain files, mapped with every page read
+        std::unique_ptr<TerrainFile> File;
+    };
 
 private:
     UIData& m_UI;
 
     std::shared_ptr<PrimaryViewTerrainTessellationPass> m_TerrainTessellationPass;
+    std::shared_ptr<SplitMergeTerrainTessellationPass> m_SplitMergeTessellationPass;
+    std::shared_ptr<GeometricErrorTerrainTessellationPass> m_GeometricTessellationPass;
+    std::shared_ptr<DirectionalLightTerrainTessellationPass> m_DirectionalLightTessellationPass;
+
+    // Streamed terrains whose heightmap is being loaded, which are created once it is
+    std::unordered_map<TerrainMeshInfo*, std::future<TerrainHeightmapLoad>> m_TerrainLoads;
+    // Streamed terrains whose heightmap could not be loaded, which are not loaded again
+    std::unordered_set<TerrainMeshInfo*> m_FailedTerrainLoads;
+
+    // Terrain view index of each shadow cascade
+    std::vector<int> m_ShadowCascadeTerrainViews;
+
+    std::shared_ptr<donut::engine::CommonRenderPasses> m_CommonPasses;
+    std::unique_ptr<TerrainHeightBoundsPass> m_HeightBoundsPass;
+    std::unique_ptr<TerrainNormalMapPass> m_NormalMapPass;
+
+    // Bound in place of the page table and feedback of terrains without a virtual heightmap
+    nvrhi::TextureHandle m_PlaceholderPageTable;
+    nvrhi::BufferHandle m_PlaceholderHeightmapFeedback;
 };
@@ -1,6 +1,10 @@
 #include "UserInterface.h"
 
+#include <algorithm>
+#include <cfloat>
+
 #include "LandscapesApplication.h"
+#include "terrain/Terrain.h"
 
 
 UIRenderer::UIRenderer(donut::app::DeviceManager* deviceManager, std::shared_ptr<LandscapesApplication> app, UIData& ui)
@@ -34,12 +38,45 @@ void UIRenderer::buildUI()
 	ImGui::Separator();
 
 	ImGui::Checkbox("Wireframe", &m_UI.Wireframe);
+	ImGui::BeginDisabled(m_UI.Wireframe);
+	ImGui::Checkbox("Terrain Depth Prepass", &m_UI.DepthPrepass);
+	ImGui::EndDisabled();
 
 	ImGui::Separator();
 
 	ImGui::Checkbox("Draw Terrain", &m_UI.DrawTerrain);
 	ImGui::Checkbox("Update Terrain", &m_UI.UpdateTerrain);
 
+	// Requires a compute queue and double buffered terrain views
+	ImGui::BeginDisabled(!m_UI.AsyncTessellationSupported);
+	ImGui::Checkbox("Async Tessellation", &m_UI.AsyncTessellation);
+	ImGui::EndDisabled();
+
+	ImGui::Checkbox("Occlusion Culling", &m_UI.OcclusionCulling);
+	ImGui::BeginDisabled(!m_UI.OcclusionCulling);
+	ImGui::Checkbox("Occlusion Culled Subdivision", &m_UI.OcclusionCullSubdivision);
+	ImGui::EndDisabled();
+
+	ImGui::Checkbox("Shadows", &m_UI.Shadows);
+
+	ImGui::SliderInt("Triangle Budget", &m_UI.TriangleBudget, 0, 4 * 1024 * 1024, m_UI.TriangleBudget ? "%d" : "Unlimited", ImGuiSliderFlags_Logarithmic);
+	ImGui::Text("Terrain Triangles: %llu", static_cast<unsigned long long>(m_UI.TerrainTriangleCount));
+	ImGui::Text("Terrain Draws: %u", m_UI.TerrainDrawCount);
+	ImGui::Checkbox("GPU Timers", &m_UI.ShowGpuTimers);
+
+	if (ImGui::CollapsingHeader("Tessellation Statistics"))
+	{
+		BuildTessellationStats();
+	}
+
+	// Only tessellated views are captured, so the terrain must not have converged
+	ImGui::BeginDisabled(!m_UI.UpdateTerrain);
+	if (ImGui::Button("Validate Tessellation"))
+		m_UI.ValidateTessellation = true;
+	ImGui::EndDisabled();
+	if (!m_UI.TessellationValidationReport.empty())
+		ImGui::TextWrapped("%s", m_UI.TessellationValidationReport.c_str());
+
 	ImGui::Separator();
 
 	ImGui::Text("Camera Position: %.1f, %.1f, %.1f", m_UI.CameraPosition.x, m_UI.CameraPosition.y, m_UI.CameraPosition.z);
@@ -55,4 +92,101 @@ void UIRenderer::buildUI()
 	}
 
 	ImGui::End();
+
+	if (m_UI.ShowGpuTimers)
+	{
+		BuildGpuTimersWindow();
+	}
+}
+
+void UIRenderer::BuildTessellationStats()
+{
+	const TerrainTessellator& tessellator = m_App->GetTerrainTessellator();
+
+	std::vector<std::pair<std::string, const TerrainMeshView*>> terrainViews;
+	for (const TerrainMeshView* terrainView : tessellator.GetTerrainViews())
+	{
+		const auto* node = terrainView->GetInstance()->GetNode();
+		terrainViews.emplace_back(node ? node->GetName() : std::string("Terrain"), terrainView);
+	}
+	std::sort(terrainViews.begin(), terrainViews.end());
+
+	for (const auto& [name, terrainView] : terrainViews)
+	{
+		TerrainTessellationStats stats;
+		if (!tessellator.GetStats(terrainView, stats))
+			continue;
+
+		ImGui::PushID(terrainView);
+		if (ImGui::TreeNode("View", "%s%s", name.c_str(), stats.Converged ? " (converged)" : ""))
+		{
+			const uint32_t depthCount = std::min(stats.MaxDepth + 1, TerrainTessellationStats::DepthCount);
+			const uint32_t saturatedCount = stats.LeafCountPerDepth[depthCount - 1];
+			uint32_t evaluatedCount = 0;
+			float counts[TerrainTessellationStats::DepthCount];
+			for (uint32_t depth = 0; depth < depthCount; depth++)
+			{
+				counts[depth] = static_cast<float>(stats.LeafCountPerDepth[depth]);
+				evaluatedCount += stats.LeafCountPerDepth[depth];
+			}
+
+			ImGui::Text("Leaves: %u of %llu", stats.LeafCount, static_cast<unsigned long long>(stats.MaxLeafCount));
+			ImGui::Text("At Max Depth (%u): %u (%.1f%%)", stats.MaxDepth, saturatedCount,
+				evaluatedCount ? 100.0f * static_cast<float>(saturatedCount) / static_cast<float>(evaluatedCount) : 0.0f);
+			ImGui::Text("Splits: %u, Merges: %u", stats.SplitCount, stats.MergeCount);
+			ImGui::Text("Visible: %u, Occluded: %u, Outside Frustum: %u", stats.VisibleLeafCount, stats.OccludedLeafCount, stats.FrustumCulledLeafCount);
+			ImGui::PlotHistogram("Leaves per Depth", counts, static_cast<int>(depthCount), 0, nullptr, 0.0f, FLT_MAX, ImVec2(0.0f, 60.0f));
+
+			ImGui::TreePop();
+		}
+		ImGui::PopID();
+	}
+}
+
+void UIRenderer::BuildGpuTimersWindow()
+{
+	const GpuTimers& timers = m_App->GetGpuTimers();
+
+	ImGui::Begin("GPU Timers", &m_UI.ShowGpuTimers, ImGuiWindowFlags_AlwaysAutoResize);
+	ImGui::Text("Over the last %u frames (ms)", GpuTimers::HistoryLength);
+
+	if (ImGui::BeginTable("Stages", 5, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit))
+	{
+		ImGui::TableSetupColumn("Stage");
+		ImGui::TableSetupColumn("Last");
+		ImGui::TableSetupColumn("Min");
+		ImGui::TableSetupColumn("Avg");
+		ImGui::TableSetupColumn("Max");
+		ImGui::TableHeadersRow();
+
+		for (const std::string& name : timers.GetStageNames())
+		{
+			GpuTimers::Statistics statistics;
+			if (!timers.GetStatistics(name, statistics) || statistics.SampleCount == 0)
+				continue;
+
+			// Nested stages are indented under their parents, which precede them
+			const size_t separator = name.rfind('/');
+			const int depth = static_cast<int>(std::count(name.begin(), name.end(), '/'));
+			const char* label = name.c_str() + (separator == std::string::npos ? 0 : separator + 1);
+
+			ImGui::TableNextRow();
+			ImGui::TableNextColumn();
+			ImGui::Text("%*s%s", depth * 2, "", label);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.3f", statistics.Last);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.3f", statistics.Min);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.3f", statistics.Avg);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.3f", statistics.Max);
+		}
+		ImGui::EndTable();
+	}
+
+	if (ImGui::Button("Clear"))
+		m_App->GetGpuTimers().ClearHistory();
+
+	ImGui::End();
 }
@@ -3,6 +3,8 @@
 #include <donut/core/math/math.h>
 #include <donut/app/imgui_renderer.h>
 
+#include <string>
+
 
 class LandscapesApplication;
 
@@ -21,9 +23,37 @@ struct UIData
 
 	bool Wireframe = false;
 
+	// Render the depth of the terrain first, so that its G-buffer is filled once per pixel (ignored in wireframe)
+	bool DepthPrepass = false;
+
 	bool UpdateTerrain = true;
 	bool DrawTerrain = true;
 
+	// Tessellate on the compute queue while the previous tessellation is rendered
+	bool AsyncTessellation = false;
+	bool AsyncTessellationSupported = false;
+
+	// Cull terrain leaves hidden behind the depth of the previous frame, and retest them against the current one
+	bool OcclusionCulling = true;
+	// Also stop splitting (and merge) the occluded nodes
+	bool OcclusionCullSubdivision = false;
+
+	// Render the sun shadow map; terrains cast shadows from views of their own for each cascade, if they have any
+	bool Shadows = true;
+
+	// Upper bound on the number of terrain triangles (0 means unlimited)
+	int TriangleBudget = 0;
+	uint64_t TerrainTriangleCount = 0;
+	// Terrain draws recorded in the last frame
+	uint32_t TerrainDrawCount = 0;
+
+	// Measures the stages of the frame on the GPU, and shows their timings
+	bool ShowGpuTimers = false;
+
+	// Replays the next terrain subdivision on the CPU reference tessellator and compares the trees
+	bool ValidateTessellation = false;
+	std::string TessellationValidationReport;
+
 	donut::math::float3 CameraPosition;
 	donut::math::float3 LightDirection;
 
@@ -42,6 +72,10 @@ public:
 protected:
 	virtual void buildUI() override;
 
+private:
+	void BuildGpuTimersWindow();
+	void BuildTessellationStats();
+
 private:
 	std::shared_ptr<LandscapesApplication> m_App;
 	UIData& m_UI;
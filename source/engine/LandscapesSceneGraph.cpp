@@ -14,6 +14,10 @@ std::shared_ptr<donut::engine::SceneGraphLeaf> LandscapesSceneTypeFactory::Creat
 	{
 		return CreateTerrainMeshInstance();
 	}
+	if (type == "tiledTerrainInstance")
+	{
+		return CreateTerrainTileGridInstance();
+	}
 
 	return SceneTypeFactory::CreateLeaf(type);
 }
@@ -27,3 +31,8 @@ std::shared_ptr<TerrainMeshInstance> LandscapesSceneTypeFactory::CreateTerrainMe
 {
 	return std::make_shared<TerrainMeshInstance>();
 }
+
+std::shared_ptr<TerrainTileGridInstance> LandscapesSceneTypeFactory::CreateTerrainTileGridInstance()
+{
+	return std::make_shared<TerrainTileGridInstance>();
+}
\ No newline at end of file
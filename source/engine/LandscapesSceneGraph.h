@@ -11,7 +11,9 @@ enum struct SceneContentFlagsEx : uint32_t
 
 
 struct TerrainMeshInfo;
+struct TerrainTileGrid;
 class TerrainMeshInstance;
+class TerrainTileGridInstance;
 
 
 class LandscapesSceneGraph : public donut::engine::SceneGraph
@@ -20,12 +22,24 @@ public:
 	LandscapesSceneGraph() = default;
 	~LandscapesSceneGraph() = default;
 
+	// Both are indexed by the position of the terrain in the scene, and null where the terrain is of the other kind
 	[[nodiscard]] const std::vector<std::shared_ptr<TerrainMeshInfo>>& GetTerrainMeshes() const { return m_TerrainMeshes; }
-
-	void AddTerrainMesh(std::shared_ptr<TerrainMeshInfo> terrainMesh) { m_TerrainMeshes.emplace_back(std::move(terrainMesh)); }
+	[[nodiscard]] const std::vector<std::shared_ptr<TerrainTileGrid>>& GetTerrainTileGrids() const { return m_TerrainTileGrids; }
+
+	void AddTerrainMesh(std::shared_ptr<TerrainMeshInfo> terrainMesh)
+	{
+		m_TerrainMeshes.emplace_back(std::move(terrainMesh));
+		m_TerrainTileGrids.emplace_back();
+	}
+	void AddTerrainTileGrid(std::shared_ptr<TerrainTileGrid> tileGrid)
+	{
+		m_TerrainMeshes.emplace_back();
+		m_TerrainTileGrids.emplace_back(std::move(tileGrid));
+	}
 
 private:
 	std::vector<std::shared_ptr<TerrainMeshInfo>> m_TerrainMeshes;
+	std::vector<std::shared_ptr<TerrainTileGrid>> m_TerrainTileGrids;
 };
 
 
@@ -38,4 +52,5 @@ public:
 	// Terrain
 	virtual std::shared_ptr<TerrainMeshInfo> CreateTerrainMesh();
 	virtual std::shared_ptr<TerrainMeshInstance> CreateTerrainMeshInstance();
+	virtual std::shared_ptr<TerrainTileGridInstance> CreateTerrainTileGridInstance();
 };
@@ -13,4 +13,30 @@ void PlanarViewEx::FillPlanarViewExConstants(PlanarViewExConstants& constants) c
 		const auto& plane = m_ViewFrustum.planes[p];
 		constants.viewFrustum[p] = float4(plane.normal, plane.distance);
 	}
+
+	// occlusion
+	constants.matWorldToOcclusionClip = m_OcclusionWorldToClip;
+	constants.occlusionDepthSize = float2(m_OcclusionDepthSize);
+	constants.occlusionFlags = GetOcclusionFlags();
+	constants.occlusionPadding = 0;
+}
+
+void PlanarViewEx::SetOcclusionPyramid(nvrhi::ITexture* pyramid, const float4x4& pyramidWorldToClip, uint2 depthSize)
+{
+	m_OcclusionPyramid = pyramid;
+	m_OcclusionWorldToClip = pyramidWorldToClip;
+	m_OcclusionDepthSize = depthSize;
+}
+
+uint32_t PlanarViewEx::GetOcclusionFlags() const
+{
+	if (!m_OcclusionCulling || !m_OcclusionPyramid)
+		return 0;
+
+	uint32_t flags = OCCLUSION_FLAG_ENABLED;
+	if (IsReverseDepth())
+		flags |= OCCLUSION_FLAG_REVERSE_DEPTH;
+	if (m_OcclusionCullSubdivision)
+		flags |= OCCLUSION_FLAG_SUBDIVISION;
+	return flags;
 }
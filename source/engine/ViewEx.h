@@ -15,6 +15,21 @@ public:
 
 	inline void SetTerrainViewIndex(size_t index) { m_TerrainViewIndex = index; }
 
+	// Depth pyramid to test occlusion against, built from a depth buffer of the given size rendered with the given transform
+	//  The pyramid may come from an earlier frame, in which case it is reprojected
+	void SetOcclusionPyramid(nvrhi::ITexture* pyramid, const dm::float4x4& pyramidWorldToClip, dm::uint2 depthSize);
+	inline void SetOcclusionCulling(bool enable, bool cullSubdivision) { m_OcclusionCulling = enable; m_OcclusionCullSubdivision = cullSubdivision; }
+
+	[[nodiscard]] inline nvrhi::ITexture* GetOcclusionPyramid() const { return m_OcclusionPyramid; }
+	// OCCLUSION_FLAG_*, none unless occlusion culling is enabled and there is a pyramid
+	[[nodiscard]] uint32_t GetOcclusionFlags() const;
+
 protected:
 	size_t m_TerrainViewIndex = 0;
+
+	nvrhi::TextureHandle m_OcclusionPyramid;
+	dm::float4x4 m_OcclusionWorldToClip = dm::float4x4::identity();
+	dm::uint2 m_OcclusionDepthSize = 0;
+	bool m_OcclusionCulling = false;
+	bool m_OcclusionCullSubdivision = false;
 };
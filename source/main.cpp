@@ -3,6 +3,10 @@
 #include <donut/app/DeviceManager.h>
 #include <donut/core/log.h>
 
+#include <cstdlib>
+#include <cstring>
+
+#include "Benchmark.h"
 #include "LandscapesApplication.h"
 #include "UserInterface.h"
 
@@ -19,17 +23,52 @@ int main(int __argc, const char** __argv)
     app::DeviceManager* deviceManager = app::DeviceManager::Create(api);
 
     app::DeviceCreationParameters deviceParams;
+    // Used for asynchronous terrain tessellation
+    deviceParams.enableComputeQueue = true;
 #ifdef _DEBUG
     deviceParams.enableDebugRuntime = true; 
     deviceParams.enableNvrhiValidationLayer = true;
 #endif
 
-    if (!deviceManager->CreateWindowDeviceAndSwapChain(deviceParams, g_WindowTitle))
+    // --benchmark <path.json> renders the camera path offscreen without a window, see Benchmark
+    //  --csv <path> is where the statistics of the frames are written, and --adapter <index> selects the GPU
+    const char* benchmarkFileName = nullptr;
+    const char* csvFileName = "benchmark.csv";
+    for (int i = 1; i < __argc; i++)
+    {
+        if (!strcmp(__argv[i], "--benchmark") && i + 1 < __argc)
+            benchmarkFileName = __argv[++i];
+        else if (!strcmp(__argv[i], "--csv") && i + 1 < __argc)
+            csvFileName = __argv[++i];
+        else if (!strcmp(__argv[i], "--adapter") && i + 1 < __argc)
+            deviceParams.adapterIndex = atoi(__argv[++i]);
+    }
+
+    Benchmark benchmark;
+    if (benchmarkFileName && !benchmark.Load(benchmarkFileName))
+    {
+        log::fatal("Cannot load the benchmark '%s'", benchmarkFileName);
+        return 1;
+    }
+
+    const bool deviceCreated = benchmarkFileName
+        ? deviceManager->CreateHeadlessDevice(deviceParams)
+        : deviceManager->CreateWindowDeviceAndSwapChain(deviceParams, g_WindowTitle);
+    if (!deviceCreated)
     {
         log::fatal("Cannot initialize a graphics device with the requested parameters");
         return 1;
     }
-    
+
+    int exitCode = 0;
+    if (benchmarkFileName)
+    {
+        UIData m_UI;
+
+        auto application = std::make_shared<LandscapesApplication>(deviceManager, m_UI);
+        exitCode = benchmark.Run(*deviceManager, *application, m_UI, csvFileName);
+    }
+    else
     {
         UIData m_UI;
 
@@ -53,5 +92,5 @@ int main(int __argc, const char** __argv)
 
     delete deviceManager;
 
-    return 0;
+    return exitCode;
 }
@@ -0,0 +1,175 @@
+#include "GpuTimers.h"
+
+#include <algorithm>
+#include <cassert>
+
+
+GpuTimers::GpuTimers(nvrhi::IDevice* device, uint32_t depth)
+	: m_Device(device)
+{
+	assert(depth > 1);
+	m_Frames.resize(depth);
+}
+
+void GpuTimers::BeginFrame()
+{
+	assert(m_OpenScopes.empty());
+
+	Resolve();
+
+	m_FrameIndex = (m_FrameIndex + 1) % static_cast<uint32_t>(m_Frames.size());
+
+	// The frame recorded depth frames ago has still not finished; its measurements are dropped rather than waited for
+	Frame& frame = m_Frames[m_FrameIndex];
+	for (auto& pending : frame.queries)
+	{
+		m_OrphanedQueries.push_back(std::move(pending.query));
+	}
+	frame.queries.clear();
+}
+
+void GpuTimers::Resolve()
+{
+	for (size_t i = 0; i < m_OrphanedQueries.size();)
+	{
+		if (m_Device->pollTimerQuery(m_OrphanedQueries[i]))
+		{
+			RecycleQuery(m_OrphanedQueries[i]);
+			m_OrphanedQueries[i] = std::move(m_OrphanedQueries.back());
+			m_OrphanedQueries.pop_back();
+		}
+		else
+		{
+			i++;
+		}
+	}
+
+	// The current frame may still be recorded, so it is only read once every scope was closed
+	const uint32_t depth = static_cast<uint32_t>(m_Frames.size());
+	const uint32_t frameCount = m_OpenScopes.empty() ? depth : depth - 1;
+
+	std::vector<float> durations;
+	for (uint32_t i = 1; i <= frameCount; i++)
+	{
+		Frame& frame = m_Frames[(m_FrameIndex + i) % depth];
+		if (frame.queries.empty())
+			continue;
+
+		// Frames finish in order, so the later frames cannot have finished either
+		const bool finished = std::all_of(frame.queries.begin(), frame.queries.end(),
+			[this](const PendingQuery& pending) { return m_Device->pollTimerQuery(pending.query); });
+		if (!finished)
+			break;
+
+		durations.assign(m_Stages.size(), -1.0f);
+		for (const auto& pending : frame.queries)
+		{
+			float& duration = durations[pending.stageIndex];
+			duration = std::max(duration, 0.0f) + m_Device->getTimerQueryTime(pending.query) * 1e3f;
+			RecycleQuery(pending.query);
+		}
+		frame.queries.clear();
+
+		for (uint32_t stageIndex = 0; stageIndex < static_cast<uint32_t>(durations.size()); stageIndex++)
+		{
+			if (durations[stageIndex] < 0.0f)
+				continue;
+
+			Stage& stage = m_Stages[stageIndex];
+			stage.history[stage.writeIndex] = durations[stageIndex];
+			stage.writeIndex = (stage.writeIndex + 1) % HistoryLength;
+			stage.sampleCount = std::min(stage.sampleCount + 1, HistoryLength);
+		}
+	}
+}
+
+void GpuTimers::ClearHistory()
+{
+	for (auto& stage : m_Stages)
+	{
+		stage.writeIndex = 0;
+		stage.sampleCount = 0;
+	}
+}
+
+bool GpuTimers::GetStatistics(const std::string& name, Statistics& statistics) const
+{
+	auto it = m_StageIndices.find(name);
+	if (it == m_StageIndices.end())
+		return false;
+
+	const Stage& stage = m_Stages[it->second];
+	statistics = Statistics();
+	statistics.SampleCount = stage.sampleCount;
+	if (stage.sampleCount == 0)
+		return true;
+
+	statistics.Last = stage.history[(stage.writeIndex + HistoryLength - 1) % HistoryLength];
+	statistics.Min = stage.history[0];
+	statistics.Max = stage.history[0];
+	float sum = 0.0f;
+	// Until the history is full, the samples are at its start
+	for (uint32_t i = 0; i < stage.sampleCount; i++)
+	{
+		statistics.Min = std::min(statistics.Min, stage.history[i]);
+		statistics.Max = std::max(statistics.Max, stage.history[i]);
+		sum += stage.history[i];
+	}
+	statistics.Avg = sum / static_cast<float>(stage.sampleCount);
+	return true;
+}
+
+void GpuTimers::BeginScope(nvrhi::ICommandList* commandList, const char* name)
+{
+	OpenScope scope{};
+	scope.timed = m_Enabled;
+	if (scope.timed)
+	{
+		scope.name = m_OpenScopes.empty() ? std::string(name) : m_OpenScopes.back().name + "/" + name;
+		scope.stageIndex = FindOrAddStage(scope.name);
+		scope.query = AllocateQuery();
+		commandList->beginTimerQuery(scope.query);
+	}
+	m_OpenScopes.push_back(std::move(scope));
+}
+
+void GpuTimers::EndScope(nvrhi::ICommandList* commandList)
+{
+	assert(!m_OpenScopes.empty());
+
+	OpenScope scope = std::move(m_OpenScopes.back());
+	m_OpenScopes.pop_back();
+
+	if (!scope.timed)
+		return;
+
+	commandList->endTimerQuery(scope.query);
+	m_Frames[m_FrameIndex].queries.push_back({ scope.stageIndex, std::move(scope.query) });
+}
+
+uint32_t GpuTimers::FindOrAddStage(const std::string& name)
+{
+	auto [it, inserted] = m_StageIndices.try_emplace(name, static_cast<uint32_t>(m_Stages.size()));
+	if (inserted)
+	{
+		m_StageNames.push_back(name);
+		m_Stages.emplace_back();
+	}
+	return it->second;
+}
+
+nvrhi::TimerQueryHandle GpuTimers::AllocateQuery()
+{
+	if (m_FreeQueries.empty())
+		return m_Device->createTimerQuery();
+
+	nvrhi::TimerQueryHandle query = std::move(m_FreeQueries.back());
+	m_FreeQueries.pop_back();
+	return query;
+}
+
+void GpuTimers::RecycleQuery(nvrhi::ITimerQuery* query)
+{
+	m_Device->resetTimerQuery(query);
+	m_FreeQueries.push_back(query);
+}
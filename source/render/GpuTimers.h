@@ -0,0 +1,135 @@
+#pragma once
+
+#include <nvrhi/nvrhi.h>
+
+#include <array>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+// Measures named GPU stages with timer queries, without ever waiting for the GPU
+//  The queries of a frame are only read once they have finished, and are then reused by later frames
+//  Scopes nest, and are named after their parents ("Primary View/Tessellation/Subdivision"), so the same stage is
+//  measured separately for each view; a stage recorded several times in a frame is measured as the sum of its scopes
+//  The terrain passes nest a scope per terrain view in each of their stages ("Primary View/Tessellation/Subdivision/
+//  Terrain"); the dispatches of a batched stage are not separated by barriers, so the GPU may overlap those of different
+//  terrain views, and their times are then each view's share rather than an exact split of the stage
+//  The duration of each stage is kept for the last HistoryLength frames it was recorded in
+class GpuTimers
+{
+public:
+    static constexpr uint32_t DefaultDepth = 4;
+    static constexpr uint32_t HistoryLength = 64;
+
+    // In milliseconds, over the frames in the history of the stage
+    struct Statistics
+    {
+        float Last = 0.0f;
+        float Min = 0.0f;
+        float Avg = 0.0f;
+        float Max = 0.0f;
+        uint32_t SampleCount = 0;
+    };
+
+    // The depth must be greater than the number of frames in flight, or the measurements of some frames are dropped
+    GpuTimers(nvrhi::IDevice* device, uint32_t depth = DefaultDepth);
+
+    // Scopes are ignored while disabled
+    inline void SetEnabled(bool enabled) { m_Enabled = enabled; }
+    [[nodiscard]] inline bool IsEnabled() const { return m_Enabled; }
+
+    // Called once per frame before any scope is recorded
+    void BeginFrame();
+
+    // Reads the frames whose queries have all finished, oldest first; called by BeginFrame
+    //  Once the device is idle, this reads every frame recorded so far
+    void Resolve();
+
+    // Forgets about the measurements, e.g. once the settings being measured changed
+    void ClearHistory();
+
+    // Stages in the order they were first recorded, parents before their nested stages
+    [[nodiscard]] inline const std::vector<std::string>& GetStageNames() const { return m_StageNames; }
+    // Returns false if the stage was never measured
+    [[nodiscard]] bool GetStatistics(const std::string& name, Statistics& statistics) const;
+
+    void BeginScope(nvrhi::ICommandList* commandList, const char* name);
+    void EndScope(nvrhi::ICommandList* commandList);
+
+private:
+    struct Stage
+    {
+        std::array<float, HistoryLength> history{};
+        uint32_t writeIndex = 0;
+        uint32_t sampleCount = 0;
+    };
+
+    struct PendingQuery
+    {
+        uint32_t stageIndex;
+        nvrhi::TimerQueryHandle query;
+    };
+
+    struct Frame
+    {
+        std::vector<PendingQuery> queries;
+    };
+
+    [[nodiscard]] uint32_t FindOrAddStage(const std::string& name);
+    [[nodiscard]] nvrhi::TimerQueryHandle AllocateQuery();
+    void RecycleQuery(nvrhi::ITimerQuery* query);
+
+private:
+    nvrhi::DeviceHandle m_Device;
+    bool m_Enabled = false;
+
+    std::vector<Frame> m_Frames;
+    uint32_t m_FrameIndex = 0;
+
+    std::vector<nvrhi::TimerQueryHandle> m_FreeQueries;
+    // Queries of frames that were dropped before they finished, recycled once they have
+    std::vector<nvrhi::TimerQueryHandle> m_OrphanedQueries;
+
+    std::vector<std::string> m_StageNames;
+    std::vector<Stage> m_Stages;
+    std::unordered_map<std::string, uint32_t> m_StageIndices;
+
+    // Scopes being recorded, with the full name of each one
+    struct OpenScope
+    {
+        std::string name;
+        uint32_t stageIndex;
+        nvrhi::TimerQueryHandle query;
+        // False if the scope was begun while disabled
+        bool timed;
+    };
+    std::vector<OpenScope> m_OpenScopes;
+};
+
+
+// Measures the commands recorded during its lifetime; the timers may be null
+class GpuTimerScope
+{
+public:
+    GpuTimerScope(GpuTimers* timers, nvrhi::ICommandList* commandList, const char* name)
+        : m_Timers(timers)
+        , m_CommandList(commandList)
+    {
+        if (m_Timers)
+            m_Timers->BeginScope(m_CommandList, name);
+    }
+
+    ~GpuTimerScope()
+    {
+        if (m_Timers)
+            m_Timers->EndScope(m_CommandList);
+    }
+
+    GpuTimerScope(const GpuTimerScope&) = delete;
+    GpuTimerScope& operator=(const GpuTimerScope&) = delete;
+
+private:
+    GpuTimers* m_Timers;
+    nvrhi::ICommandList* m_CommandList;
+};
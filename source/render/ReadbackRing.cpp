@@ -0,0 +1,65 @@
+#include "ReadbackRing.h"
+
+#include <cassert>
+#include <cstring>
+
+
+ReadbackRing::ReadbackRing(nvrhi::IDevice* device, size_t byteSize, const char* debugName, uint32_t depth)
+	: m_Device(device)
+	, m_ByteSize(byteSize)
+{
+	assert(depth > 1);
+
+	nvrhi::BufferDesc bufferDesc;
+	bufferDesc.setByteSize(byteSize)
+		.setCpuAccess(nvrhi::CpuAccessMode::Read)
+		.setInitialState(nvrhi::ResourceStates::CopyDest)
+		.setKeepInitialState(true)
+		.setDebugName(debugName);
+
+	m_Buffers.resize(depth);
+	for (auto& buffer : m_Buffers)
+	{
+		buffer = m_Device->createBuffer(bufferDesc);
+	}
+	m_Tags.resize(depth, 0);
+}
+
+void ReadbackRing::Write(nvrhi::ICommandList* commandList, nvrhi::IBuffer* source, uint64_t sourceOffset, uint64_t tag)
+{
+	const uint32_t depth = static_cast<uint32_t>(m_Buffers.size());
+
+	// The oldest unread data is overwritten if it was never read
+	if (m_PendingCount == depth)
+		m_PendingCount--;
+
+	commandList->copyBuffer(m_Buffers[m_WriteIndex], 0, source, sourceOffset, m_ByteSize);
+	m_Tags[m_WriteIndex] = tag;
+
+	m_WriteIndex = (m_WriteIndex + 1) % depth;
+	m_PendingCount++;
+}
+
+bool ReadbackRing::Read(void* dest, uint64_t* tag)
+{
+	const uint32_t depth = static_cast<uint32_t>(m_Buffers.size());
+
+	// The most recent writes may still be in flight
+	if (m_PendingCount < depth - 1)
+		return false;
+
+	const uint32_t readIndex = (m_WriteIndex + depth - m_PendingCount) % depth;
+
+	const void* data = m_Device->mapBuffer(m_Buffers[readIndex], nvrhi::CpuAccessMode::Read);
+	if (!data)
+		return false;
+
+	std::memcpy(dest, data, m_ByteSize);
+	m_Device->unmapBuffer(m_Buffers[readIndex]);
+
+	if (tag)
+		*tag = m_Tags[readIndex];
+
+	m_PendingCount--;
+	return true;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <nvrhi/nvrhi.h>
+
+#include <vector>
+
+
+// Reads data back from the GPU without stalling
+//  Each write copies the source buffer into the next staging buffer of the ring
+//  A staging buffer is only read once enough writes have followed it that the GPU must have finished with it,
+//  so the depth of the ring must be greater than the number of frames in flight
+class ReadbackRing
+{
+public:
+    static constexpr uint32_t DefaultDepth = 4;
+
+    ReadbackRing(nvrhi::IDevice* device, size_t byteSize, const char* debugName, uint32_t depth = DefaultDepth);
+
+    // Copies GetByteSize() bytes starting at sourceOffset
+    // The tag is returned alongside the data when it is read, e.g. to identify the inputs the data was produced with
+    void Write(nvrhi::ICommandList* commandList, nvrhi::IBuffer* source, uint64_t sourceOffset = 0, uint64_t tag = 0);
+
+    // Returns false if no data is ready to be read
+    [[nodiscard]] bool Read(void* dest, uint64_t* tag = nullptr);
+
+    // Forgets about all writes that have not been read yet
+    void Reset() { m_PendingCount = 0; }
+
+    [[nodiscard]] inline size_t GetByteSize() const { return m_ByteSize; }
+
+private:
+    nvrhi::DeviceHandle m_Device;
+    size_t m_ByteSize;
+
+    std::vector<nvrhi::BufferHandle> m_Buffers;
+    std::vector<uint64_t> m_Tags;
+
+    uint32_t m_WriteIndex = 0;
+    uint32_t m_PendingCount = 0;
+};
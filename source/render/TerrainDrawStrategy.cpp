@@ -29,7 +29,9 @@ void TerrainDrawStrategy::PrepareForView(const std::shared_ptr<donut::engine::Sc
 
 			if (nodeContentsRelevant)
 			{
-				if (auto terrainInstance = dynamic_cast<TerrainMeshInstance*>(m_Walker->GetLeaf().get()))
+				// Streamed out tiles have no buffers to tessellate or draw, and terrains without the view are skipped
+				auto terrainInstance = dynamic_cast<TerrainMeshInstance*>(m_Walker->GetLeaf().get());
+				if (terrainInstance && terrainInstance->IsResident() && viewEx.GetTerrainViewIndex() < terrainInstance->GetNumTerrainViews())
 				{
 					donut::render::DrawItem& drawItem = m_DrawItems.emplace_back();
 					drawItem.instance = terrainInstance;
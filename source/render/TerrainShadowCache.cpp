@@ -0,0 +1,382 @@
+#include "TerrainShadowCache.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+
+#include <donut/engine/ShaderFactory.h>
+
+
+using namespace donut::math;
+
+#include "TerrainShadowCache_cb.h"
+
+
+// Regions beyond this are merged into their bounding box
+static constexpr size_t c_MaxDirtyRegions = 8;
+
+static int FloorDiv(int a, int b)
+{
+	return a >= 0 ? a / b : -((b - 1 - a) / b);
+}
+
+static int2 Wrap(int2 texel, int size)
+{
+	return int2(texel.x - FloorDiv(texel.x, size) * size, texel.y - FloorDiv(texel.y, size) * size);
+}
+
+
+TerrainShadowCache::TerrainShadowCache(nvrhi::IDevice* device, uint32_t resolution, uint32_t cascadeCount)
+	: m_Device(device)
+	, m_Resolution(resolution)
+{
+	assert(cascadeCount > 0);
+
+	nvrhi::TextureDesc textureDesc;
+	textureDesc.dimension = nvrhi::TextureDimension::Texture2DArray;
+	textureDesc.format = nvrhi::Format::D32;
+	textureDesc.width = resolution;
+	textureDesc.height = resolution;
+	textureDesc.arraySize = cascadeCount;
+	textureDesc.isRenderTarget = true;
+	textureDesc.isTypeless = true;
+	textureDesc.useClearValue = true;
+	textureDesc.clearValue = nvrhi::Color(1.0f);
+	textureDesc.initialState = nvrhi::ResourceStates::ShaderResource;
+	textureDesc.keepInitialState = true;
+	textureDesc.debugName = "TerrainShadowCache";
+	m_Texture = m_Device->createTexture(textureDesc);
+
+	m_Cascades.resize(cascadeCount);
+	for (uint32_t i = 0; i < cascadeCount; i++)
+	{
+		m_Cascades[i].framebuffer = m_Device->createFramebuffer(nvrhi::FramebufferDesc()
+			.setDepthAttachment(nvrhi::FramebufferAttachment().setTexture(m_Texture).setArraySlice(i)));
+	}
+}
+
+void TerrainShadowCache::Init(donut::engine::ShaderFactory& shaderFactory)
+{
+	const char* sourceFileName = "app/TerrainShadowCache.hlsl";
+
+	m_VertexShader = shaderFactory.CreateAutoShader(sourceFileName, "shadow_cache_vs",
+		DONUT_MAKE_PLATFORM_SHADER(g_shadow_cache_vs), nullptr, nvrhi::ShaderType::Vertex);
+	m_ComposePixelShader = shaderFactory.CreateAutoShader(sourceFileName, "shadow_cache_compose_ps",
+		DONUT_MAKE_PLATFORM_SHADER(g_shadow_cache_compose_ps), nullptr, nvrhi::ShaderType::Pixel);
+
+	// The clear renders into the cache, so it must not bind it
+	{
+		nvrhi::BindingLayoutDesc layoutDesc;
+		layoutDesc.setVisibility(nvrhi::ShaderType::Vertex | nvrhi::ShaderType::Pixel)
+			.setRegisterSpace(0)
+			.setRegisterSpaceIsDescriptorSet(true)
+			.addItem(nvrhi::BindingLayoutItem::PushConstants(0, sizeof(TerrainShadowCacheConstants)));
+		m_ClearBindingLayout = m_Device->createBindingLayout(layoutDesc);
+
+		layoutDesc.addItem(nvrhi::BindingLayoutItem::Texture_SRV(0));
+		m_ComposeBindingLayout = m_Device->createBindingLayout(layoutDesc);
+	}
+
+	{
+		nvrhi::BindingSetDesc setDesc;
+		setDesc.addItem(nvrhi::BindingSetItem::PushConstants(0, sizeof(TerrainShadowCacheConstants)));
+		m_ClearBindingSet = m_Device->createBindingSet(setDesc, m_ClearBindingLayout);
+
+		setDesc.addItem(nvrhi::BindingSetItem::Texture_SRV(0, m_Texture));
+		m_ComposeBindingSet = m_Device->createBindingSet(setDesc, m_ComposeBindingLayout);
+	}
+}
+
+void TerrainShadowCache::SetMaxDistance(float distance)
+{
+	m_MaxDistance = distance;
+	Invalidate();
+}
+
+void TerrainShadowCache::Invalidate()
+{
+	m_Valid = false;
+}
+
+void TerrainShadowCache::InvalidateBounds(const box3& bounds)
+{
+	// Every cascade is rendered again anyway
+	if (!m_Valid || bounds.isempty())
+		return;
+
+	float2 lightMin = FLT_MAX;
+	float2 lightMax = -FLT_MAX;
+	for (int corner = 0; corner < 8; corner++)
+	{
+		const float3 lightPos = m_WorldToLight.transformPoint(bounds.getCorner(corner));
+		lightMin = min(lightMin, lightPos.xy());
+		lightMax = max(lightMax, lightPos.xy());
+	}
+
+	const int2 size = int2(static_cast<int>(m_Resolution));
+	for (uint32_t i = 0; i < GetCascadeCount(); i++)
+	{
+		Cascade& cascade = m_Cascades[i];
+
+		// Rows go down while the light space y goes up
+		const float texelSize = GetTexelSize(i);
+		const int2 regionMin(
+			static_cast<int>(std::floor(lightMin.x / texelSize)),
+			static_cast<int>(std::floor(-lightMax.y / texelSize)));
+		const int2 regionMax(
+			static_cast<int>(std::ceil(lightMax.x / texelSize)),
+			static_cast<int>(std::ceil(-lightMin.y / texelSize)));
+
+		const Region clipped{ max(regionMin, cascade.origin), min(regionMax, cascade.origin + size) };
+		if (all(clipped.min < clipped.max))
+			AddDirtyRegion(cascade, clipped);
+	}
+}
+
+float TerrainShadowCache::GetTexelSize(uint32_t cascade) const
+{
+	const float halfWidth = m_MaxDistance / static_cast<float>(1u << (GetCascadeCount() - 1 - cascade));
+	return 2.0f * halfWidth / static_cast<float>(m_Resolution);
+}
+
+float4x4 TerrainShadowCache::GetProjection(uint32_t cascade, const Region& region) const
+{
+	const float texelSize = GetTexelSize(cascade);
+	return orthoProjD3DStyle(
+		static_cast<float>(region.min.x) * texelSize, static_cast<float>(region.max.x) * texelSize,
+		-static_cast<float>(region.max.y) * texelSize, -static_cast<float>(region.min.y) * texelSize,
+		m_DepthNear, m_DepthFar);
+}
+
+void TerrainShadowCache::Update(const float3& lightDirection, const float3& cameraPosition, const box3& sceneBounds)
+{
+	const float3 direction = normalize(lightDirection);
+	if (!m_Valid || std::acos(std::clamp(dot(direction, m_LightDirection), -1.0f, 1.0f)) > m_LightAngleThreshold)
+	{
+		m_LightDirection = direction;
+		const float3 up = std::abs(direction.y) < 0.99f ? float3(0.0f, 1.0f, 0.0f) : float3(1.0f, 0.0f, 0.0f);
+		const float3 right = normalize(cross(up, direction));
+		m_WorldToLight = affine3(transpose(float3x3(right, cross(direction, right), direction)), float3(0.0f));
+		m_Valid = false;
+	}
+
+	// The depth range only grows while the cache is valid, e.g. as terrains are streamed in
+	if (!sceneBounds.isempty())
+	{
+		float zMin = FLT_MAX;
+		float zMax = -FLT_MAX;
+		for (int corner = 0; corner < 8; corner++)
+		{
+			const float z = m_WorldToLight.transformPoint(sceneBounds.getCorner(corner)).z;
+			zMin = std::min(zMin, z);
+			zMax = std::max(zMax, z);
+		}
+
+		if (!m_Valid || zMin < m_DepthNear || zMax > m_DepthFar)
+		{
+			const float margin = 0.01f * (zMax - zMin) + 1.0f;
+			m_DepthNear = zMin - margin;
+			m_DepthFar = zMax + margin;
+			m_Valid = false;
+		}
+	}
+
+	const int2 size = int2(static_cast<int>(m_Resolution));
+	const float3 center = m_WorldToLight.transformPoint(cameraPosition);
+	for (uint32_t i = 0; i < GetCascadeCount(); i++)
+	{
+		Cascade& cascade = m_Cascades[i];
+
+		// Rows go down while the light space y goes up
+		const float texelSize = GetTexelSize(i);
+		const int2 origin = int2(
+			static_cast<int>(std::floor(center.x / texelSize)),
+			static_cast<int>(std::floor(-center.y / texelSize))) - size / 2;
+
+		const Region current{ origin, origin + size };
+		if (!m_Valid)
+		{
+			cascade.origin = origin;
+			cascade.dirtyRegions = { current };
+			continue;
+		}
+
+		if (all(origin == cascade.origin))
+			continue;
+
+		const Region previous{ cascade.origin, cascade.origin + size };
+		cascade.origin = origin;
+
+		// The regions still to render that scrolled out are dropped
+		std::vector<Region> dirtyRegions;
+		for (const auto& region : cascade.dirtyRegions)
+		{
+			const Region clipped{ max(region.min, current.min), min(region.max, current.max) };
+			if (all(clipped.min < clipped.max))
+				dirtyRegions.push_back(clipped);
+		}
+		cascade.dirtyRegions = std::move(dirtyRegions);
+
+		const int2 overlapMin = max(previous.min, current.min);
+		const int2 overlapMax = min(previous.max, current.max);
+		if (any(overlapMin >= overlapMax))
+		{
+			cascade.dirtyRegions = { current };
+			continue;
+		}
+
+		// The texels that scrolled in: columns over the whole height, then rows over the columns that were covered
+		if (current.min.x < overlapMin.x)
+			AddDirtyRegion(cascade, { current.min, int2(overlapMin.x, current.max.y) });
+		if (current.max.x > overlapMax.x)
+			AddDirtyRegion(cascade, { int2(overlapMax.x, current.min.y), current.max });
+		if (current.min.y < overlapMin.y)
+			AddDirtyRegion(cascade, { int2(overlapMin.x, current.min.y), int2(overlapMax.x, overlapMin.y) });
+		if (current.max.y > overlapMax.y)
+			AddDirtyRegion(cascade, { int2(overlapMin.x, overlapMax.y), int2(overlapMax.x, current.max.y) });
+	}
+
+	m_Valid = true;
+}
+
+void TerrainShadowCache::AddDirtyRegion(Cascade& cascade, const Region& region)
+{
+	cascade.dirtyRegions.push_back(region);
+	if (cascade.dirtyRegions.size() <= c_MaxDirtyRegions)
+		return;
+
+	Region bounds = cascade.dirtyRegions.front();
+	for (const auto& dirtyRegion : cascade.dirtyRegions)
+	{
+		bounds.min = min(bounds.min, dirtyRegion.min);
+		bounds.max = max(bounds.max, dirtyRegion.max);
+	}
+	cascade.dirtyRegions = { bounds };
+}
+
+void TerrainShadowCache::GetCascadeMatrices(uint32_t cascade, affine3& worldToView, float4x4& viewToClip) const
+{
+	const int2 origin = m_Cascades[cascade].origin;
+	worldToView = m_WorldToLight;
+	viewToClip = GetProjection(cascade, { origin, origin + int2(static_cast<int>(m_Resolution)) });
+}
+
+void TerrainShadowCache::SplitRegion(const Region& region, std::vector<Region>& parts) const
+{
+	const int size = static_cast<int>(m_Resolution);
+	for (int y = region.min.y; y < region.max.y;)
+	{
+		const int yEnd = std::min((FloorDiv(y, size) + 1) * size, region.max.y);
+		for (int x = region.min.x; x < region.max.x;)
+		{
+			const int xEnd = std::min((FloorDiv(x, size) + 1) * size, region.max.x);
+			parts.push_back({ int2(x, y), int2(xEnd, yEnd) });
+			x = xEnd;
+		}
+		y = yEnd;
+	}
+}
+
+std::vector<PlanarViewEx> TerrainShadowCache::GetUpdateViews(uint32_t cascade) const
+{
+	std::vector<Region> parts;
+	for (const auto& region : m_Cascades[cascade].dirtyRegions)
+	{
+		SplitRegion(region, parts);
+	}
+
+	std::vector<PlanarViewEx> views(parts.size());
+	for (size_t i = 0; i < parts.size(); i++)
+	{
+		// Each part is within a single copy of the cache, so it maps to a rectangle of the cache
+		const int2 cacheMin = Wrap(parts[i].min, static_cast<int>(m_Resolution));
+		const int2 cacheMax = cacheMin + (parts[i].max - parts[i].min);
+
+		PlanarViewEx& view = views[i];
+		view.SetViewport(nvrhi::Viewport(
+			static_cast<float>(cacheMin.x), static_cast<float>(cacheMax.x),
+			static_cast<float>(cacheMin.y), static_cast<float>(cacheMax.y),
+			0.0f, 1.0f));
+		view.SetMatrices(m_WorldToLight, GetProjection(cascade, parts[i]));
+		view.SetArraySlice(static_cast<int>(cascade));
+		view.UpdateCache();
+	}
+	return views;
+}
+
+void TerrainShadowCache::ClearUpdateRegions(nvrhi::ICommandList* commandList, uint32_t cascade)
+{
+	Cascade& cascadeData = m_Cascades[cascade];
+	if (cascadeData.dirtyRegions.empty())
+		return;
+
+	if (!m_ClearPipeline)
+	{
+		nvrhi::GraphicsPipelineDesc pipelineDesc;
+		pipelineDesc.VS = m_VertexShader;
+		pipelineDesc.bindingLayouts = { m_ClearBindingLayout };
+		pipelineDesc.primType = nvrhi::PrimitiveType::TriangleList;
+		pipelineDesc.renderState.rasterState
+			.setCullMode(nvrhi::RasterCullMode::None)
+			.setDepthClipEnable(false);
+		pipelineDesc.renderState.depthStencilState
+			.setDepthWriteEnable(true)
+			.setDepthFunc(nvrhi::ComparisonFunc::Always);
+		m_ClearPipeline = m_Device->createGraphicsPipeline(pipelineDesc, cascadeData.framebuffer->getFramebufferInfo());
+	}
+
+	commandList->beginMarker("Clear Terrain Shadow Cache");
+	// The cascades are orthographic, so the far plane is at 1
+	for (const auto& view : GetUpdateViews(cascade))
+	{
+		Draw(commandList, m_ClearPipeline, m_ClearBindingSet, cascadeData.framebuffer, view.GetViewport(), cascade, 0, 1.0f);
+	}
+	commandList->endMarker();
+}
+
+void TerrainShadowCache::Compose(nvrhi::ICommandList* commandList, uint32_t cascade, nvrhi::IFramebuffer* framebuffer)
+{
+	if (!m_ComposePipeline)
+	{
+		nvrhi::GraphicsPipelineDesc pipelineDesc;
+		pipelineDesc.VS = m_VertexShader;
+		pipelineDesc.PS = m_ComposePixelShader;
+		pipelineDesc.bindingLayouts = { m_ComposeBindingLayout };
+		pipelineDesc.primType = nvrhi::PrimitiveType::TriangleList;
+		pipelineDesc.renderState.rasterState
+			.setCullMode(nvrhi::RasterCullMode::None);
+		pipelineDesc.renderState.depthStencilState
+			.setDepthWriteEnable(true)
+			.setDepthFunc(nvrhi::ComparisonFunc::Always);
+		m_ComposePipeline = m_Device->createGraphicsPipeline(pipelineDesc, framebuffer->getFramebufferInfo());
+	}
+
+	const float size = static_cast<float>(m_Resolution);
+	commandList->beginMarker("Compose Terrain Shadow Cache");
+	Draw(commandList, m_ComposePipeline, m_ComposeBindingSet, framebuffer, nvrhi::Viewport(size, size), cascade,
+		Wrap(m_Cascades[cascade].origin, static_cast<int>(m_Resolution)), 0.0f);
+	commandList->endMarker();
+}
+
+void TerrainShadowCache::Draw(nvrhi::ICommandList* commandList, nvrhi::IGraphicsPipeline* pipeline, nvrhi::IBindingSet* bindingSet,
+	nvrhi::IFramebuffer* framebuffer, const nvrhi::Viewport& viewport, uint32_t cascade, int2 cacheOffset, float clearDepth)
+{
+	TerrainShadowCacheConstants constants{};
+	constants.cacheOffset = uint2(cacheOffset);
+	constants.cacheSize = m_Resolution;
+	constants.cascade = cascade;
+	constants.clearDepth = clearDepth;
+
+	nvrhi::GraphicsState state;
+	state.pipeline = pipeline;
+	state.bindings = { bindingSet };
+	state.framebuffer = framebuffer;
+	state.viewport.addViewportAndScissorRect(viewport);
+	commandList->setGraphicsState(state);
+	commandList->setPushConstants(&constants, sizeof(constants));
+
+	nvrhi::DrawArguments args;
+	args.vertexCount = 3;
+	commandList->draw(args);
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <nvrhi/nvrhi.h>
+
+#include <donut/core/math/math.h>
+
+#include <vector>
+
+#include "engine/ViewEx.h"
+
+
+namespace donut::engine
+{
+    class ShaderFactory;
+}
+
+
+// Caches the terrain depth of the cascades of a directional light shadow map, so that the static terrain is only
+// rendered again where the cached depth is missing or stale
+//  The cascades are clipmaps: each one has a fixed extent, follows the camera in steps of its texels, and has a depth
+//  range fixed by the scene bounds, so a texel of the cache holds the same depth wherever the camera moves
+//  The cache of a cascade is addressed toroidally; when the cascade scrolls, only the texels that scrolled into it are
+//  rendered, and the light turning by more than a threshold renders the whole cascade again
+//  Every frame, the cached depth is copied into the shadow map, and the dynamic objects are drawn on top of it
+class TerrainShadowCache
+{
+public:
+    static constexpr float DefaultLightAngleThreshold = 0.005f;
+
+    TerrainShadowCache(nvrhi::IDevice* device, uint32_t resolution, uint32_t cascadeCount);
+
+    void Init(donut::engine::ShaderFactory& shaderFactory);
+
+    // Below this angle (in radians), the cascades keep the light direction they were rendered with
+    inline void SetLightAngleThreshold(float angle) { m_LightAngleThreshold = angle; }
+    // Half the width of the last cascade; each cascade is half as wide as the next
+    void SetMaxDistance(float distance);
+
+    [[nodiscard]] inline uint32_t GetCascadeCount() const { return static_cast<uint32_t>(m_Cascades.size()); }
+
+    // Every cascade is rendered again by the next updates, e.g. once terrains were loaded or released
+    void Invalidate();
+    // The texels of the cascades the bounds cast shadows into are rendered again by the next updates, e.g. once the
+    // heights within them changed
+    void InvalidateBounds(const dm::box3& bounds);
+
+    // Scrolls the cascades to the camera, and renders them again if the light turned by more than the threshold
+    //  The depth range covers the scene bounds, which must contain every shadow caster
+    void Update(const dm::float3& lightDirection, const dm::float3& cameraPosition, const dm::box3& sceneBounds);
+
+    // Transform of the whole cascade, which the shadow map and the terrain tessellation of the cascade are set up with
+    void GetCascadeMatrices(uint32_t cascade, dm::affine3& worldToView, dm::float4x4& viewToClip) const;
+
+    // Views of the cache texture over the regions of the cascade to render, empty once the cascade is up to date
+    //  A region wrapping around the cache is split into one view per part
+    [[nodiscard]] std::vector<PlanarViewEx> GetUpdateViews(uint32_t cascade) const;
+    // Clears the regions of the cascade to render, before the terrain is rendered into them
+    void ClearUpdateRegions(nvrhi::ICommandList* commandList, uint32_t cascade);
+    // The terrain rendered into the regions is final (e.g. its tessellation had converged), so they are up to date
+    inline void MarkUpdated(uint32_t cascade) { m_Cascades[cascade].dirtyRegions.clear(); }
+
+    // Depth target of the cache of a cascade, for the update views
+    [[nodiscard]] inline nvrhi::IFramebuffer* GetFramebuffer(uint32_t cascade) const { return m_Cascades[cascade].framebuffer; }
+
+    // Copies the cached depth of the cascade into a framebuffer with the resolution of the cache
+    void Compose(nvrhi::ICommandList* commandList, uint32_t cascade, nvrhi::IFramebuffer* framebuffer);
+
+private:
+    // Texels of the grid of a cascade, from min (inclusive) to max (exclusive); rows go down in light space
+    struct Region
+    {
+        dm::int2 min;
+        dm::int2 max;
+    };
+
+    struct Cascade
+    {
+        nvrhi::FramebufferHandle framebuffer;
+        // First texel of the grid covered by the cascade
+        dm::int2 origin = 0;
+        std::vector<Region> dirtyRegions;
+    };
+
+    [[nodiscard]] float GetTexelSize(uint32_t cascade) const;
+    [[nodiscard]] dm::float4x4 GetProjection(uint32_t cascade, const Region& region) const;
+    // Parts of the region, split where they wrap around the cache
+    void SplitRegion(const Region& region, std::vector<Region>& parts) const;
+    void AddDirtyRegion(Cascade& cascade, const Region& region);
+    void Draw(nvrhi::ICommandList* commandList, nvrhi::IGraphicsPipeline* pipeline, nvrhi::IBindingSet* bindingSet,
+        nvrhi::IFramebuffer* framebuffer, const nvrhi::Viewport& viewport, uint32_t cascade, dm::int2 cacheOffset, float clearDepth);
+
+private:
+    nvrhi::DeviceHandle m_Device;
+    uint32_t m_Resolution;
+
+    nvrhi::TextureHandle m_Texture;
+    std::vector<Cascade> m_Cascades;
+
+    nvrhi::ShaderHandle m_VertexShader;
+    nvrhi::ShaderHandle m_ComposePixelShader;
+    nvrhi::BindingLayoutHandle m_ClearBindingLayout;
+    nvrhi::BindingSetHandle m_ClearBindingSet;
+    nvrhi::BindingLayoutHandle m_ComposeBindingLayout;
+    nvrhi::BindingSetHandle m_ComposeBindingSet;
+    // Created for the first framebuffer each one draws into
+    nvrhi::GraphicsPipelineHandle m_ClearPipeline;
+    nvrhi::GraphicsPipelineHandle m_ComposePipeline;
+
+    float m_LightAngleThreshold = DefaultLightAngleThreshold;
+    float m_MaxDistance = 500.0f;
+
+    // Light direction and depth range the cache was rendered with
+    bool m_Valid = false;
+    dm::float3 m_LightDirection = 0.0f;
+    dm::affine3 m_WorldToLight = dm::affine3::identity();
+    float m_DepthNear = 0.0f;
+    float m_DepthFar = 1.0f;
+};
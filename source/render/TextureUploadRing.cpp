@@ -0,0 +1,90 @@
+#include "TextureUploadRing.h"
+
+#include <cassert>
+#include <cstring>
+
+
+TextureUploadRing::TextureUploadRing(nvrhi::IDevice* device, nvrhi::Format format, dm::uint2 blockSize, uint32_t blocksPerFrame,
+	const char* debugName, uint32_t depth)
+	: m_Device(device)
+	, m_BlockSize(blockSize)
+	, m_BlocksPerFrame(blocksPerFrame)
+	, m_BytesPerTexel(nvrhi::getFormatInfo(format).bytesPerBlock)
+{
+	assert(depth > 1);
+	assert(blocksPerFrame > 0);
+
+	nvrhi::TextureDesc textureDesc;
+	textureDesc.setWidth(blockSize.x * blocksPerFrame)
+		.setHeight(blockSize.y)
+		.setFormat(format)
+		.setDebugName(debugName);
+
+	m_StagingTextures.resize(depth);
+	for (auto& texture : m_StagingTextures)
+	{
+		texture = m_Device->createStagingTexture(textureDesc, nvrhi::CpuAccessMode::Write);
+	}
+}
+
+bool TextureUploadRing::BeginFrame()
+{
+	assert(!m_MappedData);
+
+	m_MappedData = static_cast<uint8_t*>(m_Device->mapStagingTexture(m_StagingTextures[m_WriteIndex], nvrhi::TextureSlice(),
+		nvrhi::CpuAccessMode::Write, &m_MappedRowPitch));
+	m_PendingCopies.clear();
+
+	return m_MappedData != nullptr;
+}
+
+bool TextureUploadRing::WriteBlock(const void* data, size_t rowPitch, nvrhi::ITexture* dest, dm::uint2 destOffset, uint32_t destMipLevel)
+{
+	assert(m_MappedData);
+
+	if (m_PendingCopies.size() >= m_BlocksPerFrame)
+		return false;
+
+	const uint32_t block = static_cast<uint32_t>(m_PendingCopies.size());
+	const size_t blockRowBytes = static_cast<size_t>(m_BlockSize.x) * m_BytesPerTexel;
+
+	const uint8_t* src = static_cast<const uint8_t*>(data);
+	uint8_t* dst = m_MappedData + block * blockRowBytes;
+	for (uint32_t row = 0; row < m_BlockSize.y; row++)
+	{
+		std::memcpy(dst + row * m_MappedRowPitch, src + row * rowPitch, blockRowBytes);
+	}
+
+	PendingCopy& copy = m_PendingCopies.emplace_back();
+	copy.dest = dest;
+	copy.destSlice.setOrigin(destOffset.x, destOffset.y)
+		.setWidth(m_BlockSize.x)
+		.setHeight(m_BlockSize.y)
+		.setMipLevel(destMipLevel);
+	copy.srcSlice.setOrigin(block * m_BlockSize.x, 0)
+		.setWidth(m_BlockSize.x)
+		.setHeight(m_BlockSize.y);
+
+	return true;
+}
+
+void TextureUploadRing::EndFrame(nvrhi::ICommandList* commandList)
+{
+	assert(m_MappedData);
+
+	nvrhi::IStagingTexture* stagingTexture = m_StagingTextures[m_WriteIndex];
+	m_Device->unmapStagingTexture(stagingTexture);
+	m_MappedData = nullptr;
+
+	for (const PendingCopy& copy : m_PendingCopies)
+	{
+		commandList->copyTexture(copy.dest, copy.destSlice, stagingTexture, copy.srcSlice);
+	}
+
+	// The staging texture is left alone if it holds nothing to copy
+	if (!m_PendingCopies.empty())
+	{
+		m_WriteIndex = (m_WriteIndex + 1) % static_cast<uint32_t>(m_StagingTextures.size());
+	}
+	m_PendingCopies.clear();
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <nvrhi/nvrhi.h>
+
+#include <donut/core/math/math.h>
+
+#include <vector>
+
+
+// Uploads blocks of texels to textures without stalling
+//  The blocks of a frame are written side by side into the next staging texture of the ring, then copied into their
+//  destination textures; a staging texture is only written again once enough frames have followed it that the GPU must
+//  have finished copying from it, so the depth of the ring must be greater than the number of frames in flight
+class TextureUploadRing
+{
+public:
+    static constexpr uint32_t DefaultDepth = 4;
+
+    TextureUploadRing(nvrhi::IDevice* device, nvrhi::Format format, dm::uint2 blockSize, uint32_t blocksPerFrame,
+        const char* debugName, uint32_t depth = DefaultDepth);
+
+    // Maps the next staging texture of the ring; returns false if it cannot be mapped
+    [[nodiscard]] bool BeginFrame();
+
+    // Copies a block of texels, in rows of rowPitch bytes, into the staging texture of the frame, and queues its copy
+    // to the given texel of the destination; returns false once the frame holds as many blocks as it can
+    bool WriteBlock(const void* data, size_t rowPitch, nvrhi::ITexture* dest, dm::uint2 destOffset, uint32_t destMipLevel = 0);
+
+    // Unmaps the staging texture of the frame, and records the copies of the blocks written since BeginFrame
+    void EndFrame(nvrhi::ICommandList* commandList);
+
+    [[nodiscard]] inline dm::uint2 GetBlockSize() const { return m_BlockSize; }
+    [[nodiscard]] inline uint32_t GetBlocksPerFrame() const { return m_BlocksPerFrame; }
+
+private:
+    struct PendingCopy
+    {
+        nvrhi::TextureHandle dest;
+        nvrhi::TextureSlice destSlice;
+        nvrhi::TextureSlice srcSlice;
+    };
+
+    nvrhi::DeviceHandle m_Device;
+    dm::uint2 m_BlockSize;
+    uint32_t m_BlocksPerFrame;
+    uint32_t m_BytesPerTexel;
+
+    std::vector<nvrhi::StagingTextureHandle> m_StagingTextures;
+    uint32_t m_WriteIndex = 0;
+
+    // Staging texture of the frame while it is mapped
+    uint8_t* m_MappedData = nullptr;
+    size_t m_MappedRowPitch = 0;
+    std::vector<PendingCopy> m_PendingCopies;
+};
@@ -0,0 +1,137 @@
+#include "DepthPyramidPass.h"
+
+#include <bit>
+
+#include <donut/engine/View.h>
+#include <donut/engine/ShaderFactory.h>
+
+
+using namespace donut::math;
+
+#include "DepthPyramid_cb.h"
+
+
+DepthPyramidPass::DepthPyramidPass(nvrhi::IDevice* device)
+	: m_Device(device)
+	, m_BindingSets(device)
+{
+}
+
+void DepthPyramidPass::Init(const std::shared_ptr<donut::engine::ShaderFactory>& shaderFactory)
+{
+	{
+		nvrhi::BindingLayoutDesc layoutDesc;
+		layoutDesc.setVisibility(nvrhi::ShaderType::Compute)
+			.setRegisterSpace(0)
+			.setRegisterSpaceIsDescriptorSet(true)
+			.addItem(nvrhi::BindingLayoutItem::PushConstants(0, sizeof(DepthPyramidConstants)))
+			.addItem(nvrhi::BindingLayoutItem::Texture_SRV(0))
+			.addItem(nvrhi::BindingLayoutItem::Texture_UAV(0));
+		m_BindingLayout = m_Device->createBindingLayout(layoutDesc);
+	}
+
+	m_Shader = shaderFactory->CreateAutoShader("app/DepthPyramid.hlsl", "depth_pyramid_cs",
+		DONUT_MAKE_PLATFORM_SHADER(g_depth_pyramid_cs), nullptr, nvrhi::ShaderType::Compute);
+
+	nvrhi::ComputePipelineDesc psoDesc;
+	psoDesc.bindingLayouts = { m_BindingLayout };
+	psoDesc.CS = m_Shader;
+	m_Pipeline = m_Device->createComputePipeline(psoDesc);
+}
+
+void DepthPyramidPass::CreatePyramids(uint2 depthSize)
+{
+	const uint2 size = max(depthSize / 2u, uint2(1u));
+
+	nvrhi::TextureDesc textureDesc;
+	textureDesc.dimension = nvrhi::TextureDimension::Texture2D;
+	textureDesc.format = nvrhi::Format::R32_FLOAT;
+	textureDesc.width = size.x;
+	textureDesc.height = size.y;
+	textureDesc.mipLevels = static_cast<uint32_t>(std::bit_width(std::max(size.x, size.y)));
+	textureDesc.isUAV = true;
+	// Read by the tessellation, which may be on the compute queue
+	textureDesc.initialState = nvrhi::ResourceStates::ShaderResource;
+	textureDesc.keepInitialState = true;
+
+	for (uint32_t i = 0; i < m_Pyramids.size(); i++)
+	{
+		textureDesc.debugName = i == 0 ? "DepthPyramid0" : "DepthPyramid1";
+		m_Pyramids[i] = m_Device->createTexture(textureDesc);
+	}
+
+	m_BindingSets.Clear();
+	m_Valid = false;
+}
+
+void DepthPyramidPass::Build(nvrhi::ICommandList* commandList, const donut::engine::IView& view, nvrhi::ITexture* depth)
+{
+	assert(depth);
+
+	const auto& depthDesc = depth->getDesc();
+	const uint2 depthSize = uint2(depthDesc.width, depthDesc.height);
+	if (!m_Pyramids[0] || any(depthSize != m_DepthSize))
+	{
+		CreatePyramids(depthSize);
+	}
+
+	commandList->beginMarker("DepthPyramid");
+
+	// The other pyramid may still be read by work submitted for the previous frame
+	const uint32_t next = m_Valid ? 1 - m_Latest : m_Latest;
+	nvrhi::ITexture* pyramid = m_Pyramids[next];
+	const auto& pyramidDesc = pyramid->getDesc();
+
+	DepthPyramidConstants constants = {};
+	constants.reverseDepth = view.IsReverseDepth() ? 1 : 0;
+	constants.inputSize = depthSize;
+
+	for (uint32_t mip = 0; mip < pyramidDesc.mipLevels; mip++)
+	{
+		constants.outputSize = uint2(std::max(pyramidDesc.width >> mip, 1u), std::max(pyramidDesc.height >> mip, 1u));
+
+		nvrhi::BindingSetDesc bindingSetDesc;
+		bindingSetDesc.bindings = {
+			nvrhi::BindingSetItem::PushConstants(0, sizeof(DepthPyramidConstants)),
+			mip == 0
+				? nvrhi::BindingSetItem::Texture_SRV(0, depth, nvrhi::Format::UNKNOWN, view.GetSubresources())
+				: nvrhi::BindingSetItem::Texture_SRV(0, pyramid, nvrhi::Format::UNKNOWN, nvrhi::TextureSubresourceSet(mip - 1, 1, 0, 1)),
+			nvrhi::BindingSetItem::Texture_UAV(0, pyramid, nvrhi::Format::UNKNOWN, nvrhi::TextureSubresourceSet(mip, 1, 0, 1))
+		};
+
+		nvrhi::ComputeState state;
+		state.pipeline = m_Pipeline;
+		state.bindings = { m_BindingSets.GetOrCreateBindingSet(bindingSetDesc, m_BindingLayout) };
+		commandList->setComputeState(state);
+
+		commandList->setPushConstants(&constants, sizeof(constants));
+
+		commandList->dispatch(
+			dm::div_ceil(constants.outputSize.x, 8),
+			dm::div_ceil(constants.outputSize.y, 8));
+
+		constants.inputSize = constants.outputSize;
+	}
+
+	commandList->endMarker();
+
+	m_Latest = next;
+	m_Valid = true;
+	m_WorldToClip = view.GetViewProjectionMatrix();
+	m_DepthSize = depthSize;
+}
+
+void DepthPyramidPass::Invalidate()
+{
+	m_Valid = false;
+}
+
+nvrhi::ITexture* DepthPyramidPass::GetPyramid() const
+{
+	return m_Valid ? m_Pyramids[m_Latest].Get() : nullptr;
+}
+
+void DepthPyramidPass::ResetBindingCache()
+{
+	m_BindingSets.Clear();
+}
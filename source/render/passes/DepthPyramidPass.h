@@ -0,0 +1,58 @@
+#pragma once
+
+#include <nvrhi/nvrhi.h>
+
+#include <donut/engine/BindingCache.h>
+
+
+namespace donut::engine
+{
+	class IView;
+	class ShaderFactory;
+}
+
+
+// Builds a hierarchical depth pyramid for occlusion culling
+//  Every texel holds the farthest depth of the texels it covers; mip 0 is half the resolution of the depth buffer (rounded down)
+//  Two pyramids are alternated, so the previous one can still be read (e.g. by the compute queue) while the next is built
+class DepthPyramidPass
+{
+public:
+	DepthPyramidPass(nvrhi::IDevice* device);
+    virtual ~DepthPyramidPass() = default;
+
+	void Init(const std::shared_ptr<donut::engine::ShaderFactory>& shaderFactory);
+
+    // Builds the next pyramid from the depth buffer of the view, which then becomes the latest one
+    void Build(nvrhi::ICommandList* commandList, const donut::engine::IView& view, nvrhi::ITexture* depth);
+
+    // Forgets the latest pyramid, e.g. when occlusion culling is disabled and its depth would get stale
+    void Invalidate();
+
+    // The latest pyramid, or null if none was built since the last invalidation
+    [[nodiscard]] nvrhi::ITexture* GetPyramid() const;
+    // World-to-clip transform of the view the latest pyramid was built for
+    [[nodiscard]] inline const dm::float4x4& GetWorldToClip() const { return m_WorldToClip; }
+    [[nodiscard]] inline dm::uint2 GetDepthSize() const { return m_DepthSize; }
+
+    void ResetBindingCache();
+
+private:
+    void CreatePyramids(dm::uint2 depthSize);
+
+private:
+    nvrhi::DeviceHandle m_Device;
+
+    nvrhi::ShaderHandle m_Shader;
+    nvrhi::ComputePipelineHandle m_Pipeline;
+
+    nvrhi::BindingLayoutHandle m_BindingLayout;
+    donut::engine::BindingCache m_BindingSets;
+
+    std::array<nvrhi::TextureHandle, 2> m_Pyramids;
+    uint32_t m_Latest = 0;
+    bool m_Valid = false;
+
+    dm::float4x4 m_WorldToClip = dm::float4x4::identity();
+    dm::uint2 m_DepthSize = 0;
+};
@@ -6,8 +6,10 @@
 #include <nvrhi/utils.h>
 
 #include "engine/ViewEx.h"
+#include "render/GpuTimers.h"
 #include "render/TerrainDrawStrategy.h"
 #include "terrain/Terrain.h"
+#include "terrain/TerrainTessellation.h"
 
 using namespace donut;
 using namespace math;
@@ -16,28 +18,6 @@ using namespace math;
 #include "TerrainShaders.h"
 
 
-TerrainGBufferFillPass::TerrainGBufferFillPass(nvrhi::IDevice* device, std::shared_ptr<engine::CommonRenderPasses> commonPasses)
-	: m_Device(device)
-	, m_CommonPasses(std::move(commonPasses))
-{
-	assert(m_Device->getGraphicsAPI() != nvrhi::GraphicsAPI::D3D11);
-	assert(m_CommonPasses);
-}
-
-void TerrainGBufferFillPass::Init(engine::ShaderFactory& shaderFactory)
-{
-	m_VertexShader = CreateVertexShader(shaderFactory);
-	m_PixelShader = CreatePixelShader(shaderFactory);
-
-	m_GBufferCB = m_Device->createBuffer(nvrhi::utils::CreateVolatileConstantBufferDesc(
-		sizeof(GBufferFillConstants), "GBufferFillConstants", 16
-	));
-
-	CreateViewBindings(m_ViewBindingLayout, m_ViewBindingSet);
-	m_InputBindingLayout = CreateInputBindingLayout();
-	m_TerrainBindingLayout = CreateTerrainBindingLayout();
-}
-
 template <typename Key>
 static nvrhi::BindingSetHandle FindOrCreateBindingSet(
 	Key key,
@@ -59,63 +39,77 @@ static nvrhi::BindingSetHandle FindOrCreateBindingSet(
 }
 
 
-void TerrainGBufferFillPass::SetupView(TerrainPassContext& abstractContext, nvrhi::ICommandList* commandList, 
-										const engine::IView* view, const engine::IView* viewPrev)
+TerrainGeometryPass::TerrainGeometryPass(nvrhi::IDevice* device, std::shared_ptr<engine::CommonRenderPasses> commonPasses, bool pixelShader)
+	: m_Device(device)
+	, m_CommonPasses(std::move(commonPasses))
+	, m_PixelShaderStage(pixelShader)
 {
-	Context& context = reinterpret_cast<Context&>(abstractContext);
-
-	// Update view constant buffer
-	GBufferFillConstants gbufferConstants = {};
-	view->FillPlanarViewConstants(gbufferConstants.view);
-	viewPrev->FillPlanarViewConstants(gbufferConstants.viewPrev);
-	commandList->writeBuffer(m_GBufferCB, &gbufferConstants, sizeof(gbufferConstants));
-
-	context.keyTemplate.value = 0;
-	context.keyTemplate.bits.frontCounterClockwise = view->IsMirrored();
-	context.keyTemplate.bits.reverseDepth = view->IsReverseDepth();
-	context.keyTemplate.bits.wireframe = context.wireframe;
+	assert(m_Device->getGraphicsAPI() != nvrhi::GraphicsAPI::D3D11);
+	assert(m_CommonPasses);
 }
 
-void TerrainGBufferFillPass::SetupPipeline(TerrainPassContext& abstractContext, nvrhi::RasterCullMode cullMode, nvrhi::GraphicsState& state)
+void TerrainGeometryPass::InitGeometry(engine::ShaderFactory& shaderFactory, const char* constantsName)
 {
-	Context& context = reinterpret_cast<Context&>(abstractContext);
-
-	PipelineKey key = context.keyTemplate;
-	key.bits.cullMode = cullMode;
+	m_VertexShader = CreateVertexShader(shaderFactory);
+	m_IndexedVertexShader = CreateIndexedVertexShader(shaderFactory);
+	m_PatchVertexShader = CreatePatchVertexShader(shaderFactory);
 
-	// Get graphics pipeline
-	nvrhi::GraphicsPipelineHandle& pipeline = m_Pipelines[key.value];
+	m_ViewCB = m_Device->createBuffer(nvrhi::utils::CreateVolatileConstantBufferDesc(
+		sizeof(GBufferFillConstants), constantsName, 16
+	));
 
-	if (!pipeline)
-	{
-		std::lock_guard lock(m_Mutex);
+	CreateViewBindings(m_ViewBindingLayout, m_ViewBindingSet);
+	m_InputBindingLayout = CreateInputBindingLayout();
+	m_TerrainBindingLayout = CreateTerrainBindingLayout();
+}
 
-		if (!pipeline)
-		{
-			pipeline = CreateGraphicsPipeline(key, state.framebuffer);
-		}
+void TerrainGeometryPass::WriteViewConstants(nvrhi::ICommandList* commandList, const engine::IView* view, const engine::IView* viewPrev)
+{
+	GBufferFillConstants viewConstants = {};
+	view->FillPlanarViewConstants(viewConstants.view);
+	viewPrev->FillPlanarViewConstants(viewConstants.viewPrev);
+	commandList->writeBuffer(m_ViewCB, &viewConstants, sizeof(viewConstants));
+}
 
-		if (!pipeline)
-		{
-			return;
-		}
+nvrhi::IShader* TerrainGeometryPass::GetVertexShader(TerrainRenderMode renderMode) const
+{
+	switch (renderMode)
+	{
+	case TerrainRenderMode::Indexed:
+		return m_IndexedVertexShader;
+	case TerrainRenderMode::Patch:
+		return m_PatchVertexShader;
+	default:
+		return m_VertexShader;
 	}
+}
 
-	assert(pipeline->getFramebufferInfo() == state.framebuffer->getFramebufferInfo());
-
-	state.pipeline = pipeline;
+nvrhi::ShaderType TerrainGeometryPass::GetBindingVisibility() const
+{
+	return m_PixelShaderStage ? nvrhi::ShaderType::Vertex | nvrhi::ShaderType::Pixel : nvrhi::ShaderType::Vertex;
 }
 
-void TerrainGBufferFillPass::SetupBindings(TerrainPassContext& context, const engine::BufferGroup* buffers,
-											const TerrainMeshView* terrainView, nvrhi::GraphicsState& state)
+void TerrainGeometryPass::SetupBindings(TerrainPassContext& context, const engine::BufferGroup* buffers,
+										const TerrainMeshView* terrainView, nvrhi::GraphicsState& state)
 {
-	// No index buffer is used for terrain
-	state.indexBuffer = {};
+	// Only the materialized mesh of indexed terrain views has an index buffer
+	if (terrainView->GetRenderMode() == TerrainRenderMode::Indexed)
+	{
+		state.indexBuffer = nvrhi::IndexBufferBinding()
+			.setBuffer(terrainView->GetMaterializedIndexBuffer())
+			.setFormat(nvrhi::Format::R32_UINT);
+	}
+	else
+	{
+		state.indexBuffer = {};
+	}
 
 	nvrhi::BindingSetHandle inputBindingSet = FindOrCreateBindingSet<const engine::BufferGroup*>(buffers, m_InputBindingSets,
 		[this](const engine::BufferGroup* buffers) { return CreateInputBindingSet(buffers); });
-	nvrhi::BindingSetHandle terrainBindingSet = FindOrCreateBindingSet<const TerrainMeshView*>(terrainView, m_TerrainBindingSets,
-		[this](const TerrainMeshView* terrainView) { return CreateTerrainBindingSet(terrainView); });
+	// Keyed by the culled nodes buffer, as double buffered terrain views alternate between two, and the disoccluded leaves have their own
+	nvrhi::IBuffer* culledNodes = context.disoccluded ? terrainView->GetDisoccludedNodesBuffer() : terrainView->GetCulledNodesBuffer();
+	nvrhi::BindingSetHandle terrainBindingSet = FindOrCreateBindingSet<const nvrhi::IBuffer*>(culledNodes, m_TerrainBindingSets,
+		[this, terrainView, culledNodes](const nvrhi::IBuffer*) { return CreateTerrainBindingSet(terrainView, culledNodes); });
 
 	state.bindings = {
 		m_ViewBindingSet,
@@ -124,7 +118,14 @@ void TerrainGBufferFillPass::SetupBindings(TerrainPassContext& context, const en
 	};
 }
 
-nvrhi::ShaderHandle TerrainGBufferFillPass::CreateVertexShader(engine::ShaderFactory& shaderFactory)
+void TerrainGeometryPass::ResetBindingCache()
+{
+	// The instance buffers of the scene may have been recreated as well
+	m_InputBindingSets.clear();
+	m_TerrainBindingSets.clear();
+}
+
+nvrhi::ShaderHandle TerrainGeometryPass::CreateVertexShader(engine::ShaderFactory& shaderFactory)
 {
 	char const* sourceFileName = "app/terrain/TerrainShaders.hlsl";
 
@@ -132,19 +133,26 @@ nvrhi::ShaderHandle TerrainGBufferFillPass::CreateVertexShader(engine::ShaderFac
 		DONUT_MAKE_PLATFORM_SHADER(g_landscape_shaders_gbuffer_vs), nullptr, nvrhi::ShaderType::Vertex);
 }
 
-nvrhi::ShaderHandle TerrainGBufferFillPass::CreatePixelShader(engine::ShaderFactory& shaderFactory)
+nvrhi::ShaderHandle TerrainGeometryPass::CreateIndexedVertexShader(engine::ShaderFactory& shaderFactory)
 {
 	char const* sourceFileName = "app/terrain/TerrainShaders.hlsl";
 
-	return shaderFactory.CreateAutoShader(sourceFileName, "gbuffer_ps", 
-		DONUT_MAKE_PLATFORM_SHADER(g_landscape_shaders_gbuffer_ps), nullptr, nvrhi::ShaderType::Pixel);
+	return shaderFactory.CreateAutoShader(sourceFileName, "gbuffer_indexed_vs",
+		DONUT_MAKE_PLATFORM_SHADER(g_landscape_shaders_gbuffer_indexed_vs), nullptr, nvrhi::ShaderType::Vertex);
+}
+
+nvrhi::ShaderHandle TerrainGeometryPass::CreatePatchVertexShader(engine::ShaderFactory& shaderFactory)
+{
+	char const* sourceFileName = "app/terrain/TerrainShaders.hlsl";
 
+	return shaderFactory.CreateAutoShader(sourceFileName, "gbuffer_patch_vs",
+		DONUT_MAKE_PLATFORM_SHADER(g_landscape_shaders_gbuffer_patch_vs), nullptr, nvrhi::ShaderType::Vertex);
 }
 
-nvrhi::BindingLayoutHandle TerrainGBufferFillPass::CreateInputBindingLayout()
+nvrhi::BindingLayoutHandle TerrainGeometryPass::CreateInputBindingLayout()
 {
 	auto bindingLayoutDesc = nvrhi::BindingLayoutDesc()
-		.setVisibility(nvrhi::ShaderType::Vertex | nvrhi::ShaderType::Pixel)
+		.setVisibility(GetBindingVisibility())
 		.setRegisterSpace(GBUFFER_SPACE_INPUT)
 		.setRegisterSpaceIsDescriptorSet(true)
 		.addItem(nvrhi::BindingLayoutItem::StructuredBuffer_SRV(GBUFFER_BINDING_INSTANCE_BUFFER))
@@ -153,23 +161,34 @@ nvrhi::BindingLayoutHandle TerrainGBufferFillPass::CreateInputBindingLayout()
 	return m_Device->createBindingLayout(bindingLayoutDesc);
 }
 
-nvrhi::BindingLayoutHandle TerrainGBufferFillPass::CreateTerrainBindingLayout()
+nvrhi::BindingLayoutHandle TerrainGeometryPass::CreateTerrainBindingLayout()
 {
 	auto bindingLayoutDesc = nvrhi::BindingLayoutDesc()
-		.setVisibility(nvrhi::ShaderType::Vertex | nvrhi::ShaderType::Pixel)
+		.setVisibility(GetBindingVisibility())
 		.setRegisterSpace(GBUFFER_SPACE_TERRAIN)
 		.setRegisterSpaceIsDescriptorSet(true)
 		.addItem(nvrhi::BindingLayoutItem::ConstantBuffer(GBUFFER_BINDING_TERRAIN_CONSTANTS))
 		.addItem(nvrhi::BindingLayoutItem::StructuredBuffer_SRV(GBUFFER_BINDING_TERRAIN_CBT))
-		.addItem(nvrhi::BindingLayoutItem::Texture_SRV(GBUFFER_BINDING_TERRAIN_HEIGHTMAP_TEXTURE));
+		.addItem(nvrhi::BindingLayoutItem::Texture_SRV(GBUFFER_BINDING_TERRAIN_HEIGHTMAP_TEXTURE))
+		.addItem(nvrhi::BindingLayoutItem::StructuredBuffer_SRV(GBUFFER_BINDING_TERRAIN_CULLED_NODES))
+		.addItem(nvrhi::BindingLayoutItem::StructuredBuffer_SRV(GBUFFER_BINDING_TERRAIN_VERTICES))
+		.addItem(nvrhi::BindingLayoutItem::Texture_SRV(GBUFFER_BINDING_TERRAIN_HEIGHTMAP_PAGE_TABLE))
+		.addItem(nvrhi::BindingLayoutItem::Texture_SRV(GBUFFER_BINDING_TERRAIN_HEIGHTMAP_ATLAS))
+		.addItem(nvrhi::BindingLayoutItem::Texture_SRV(GBUFFER_BINDING_TERRAIN_NORMAL_MAP));
+
+	// The page requests are written by the pixel shader
+	if (m_PixelShaderStage)
+	{
+		bindingLayoutDesc.addItem(nvrhi::BindingLayoutItem::StructuredBuffer_UAV(GBUFFER_BINDING_TERRAIN_HEIGHTMAP_FEEDBACK));
+	}
 
 	return m_Device->createBindingLayout(bindingLayoutDesc);
 }
 
-void TerrainGBufferFillPass::CreateViewBindings(nvrhi::BindingLayoutHandle& layout, nvrhi::BindingSetHandle& set)
+void TerrainGeometryPass::CreateViewBindings(nvrhi::BindingLayoutHandle& layout, nvrhi::BindingSetHandle& set)
 {
 	auto bindingLayoutDesc = nvrhi::BindingLayoutDesc()
-		.setVisibility(nvrhi::ShaderType::Vertex | nvrhi::ShaderType::Pixel)
+		.setVisibility(GetBindingVisibility())
 		.setRegisterSpace(GBUFFER_SPACE_VIEW)
 		.setRegisterSpaceIsDescriptorSet(true)
 		.addItem(nvrhi::BindingLayoutItem::VolatileConstantBuffer(GBUFFER_BINDING_VIEW_CONSTANTS))
@@ -179,17 +198,123 @@ void TerrainGBufferFillPass::CreateViewBindings(nvrhi::BindingLayoutHandle& layo
 
 	auto bindingSetDesc = nvrhi::BindingSetDesc()
 		.setTrackLiveness(true)
-		.addItem(nvrhi::BindingSetItem::ConstantBuffer(GBUFFER_BINDING_VIEW_CONSTANTS, m_GBufferCB))
+		.addItem(nvrhi::BindingSetItem::ConstantBuffer(GBUFFER_BINDING_VIEW_CONSTANTS, m_ViewCB))
 		.addItem(nvrhi::BindingSetItem::Sampler(GBUFFER_BINDING_TERRAIN_HEIGHTMAP_SAMPLER, m_CommonPasses->m_LinearClampSampler));
 
 	set = m_Device->createBindingSet(bindingSetDesc, layout);
 }
 
+nvrhi::BindingSetHandle TerrainGeometryPass::CreateInputBindingSet(const donut::engine::BufferGroup* buffers)
+{
+	auto bindingSetDesc = nvrhi::BindingSetDesc()
+		.addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(GBUFFER_BINDING_INSTANCE_BUFFER, buffers->instanceBuffer))
+		.addItem(nvrhi::BindingSetItem::PushConstants(GBUFFER_BINDING_PUSH_CONSTANTS, sizeof(TerrainPushConstants)));
+
+	return m_Device->createBindingSet(bindingSetDesc, m_InputBindingLayout);
+}
+
+nvrhi::BindingSetHandle TerrainGeometryPass::CreateTerrainBindingSet(const TerrainMeshView* terrainView, nvrhi::IBuffer* culledNodes)
+{
+	const TerrainMeshInfo* parent = terrainView->GetInstance()->GetTerrain();
+
+	auto bindingSetDesc = nvrhi::BindingSetDesc()
+		.addItem(nvrhi::BindingSetItem::ConstantBuffer(GBUFFER_BINDING_TERRAIN_CONSTANTS, parent->TerrainCB))
+		.addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(GBUFFER_BINDING_TERRAIN_CBT, terrainView->GetCBTBuffer()))
+		.addItem(nvrhi::BindingSetItem::Texture_SRV(GBUFFER_BINDING_TERRAIN_HEIGHTMAP_TEXTURE, parent->HeightmapTexture->texture))
+		.addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(GBUFFER_BINDING_TERRAIN_CULLED_NODES, culledNodes))
+		// Only read by the indexed vertex shader, but something must be bound for instanced views
+		.addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(GBUFFER_BINDING_TERRAIN_VERTICES,
+			terrainView->GetMaterializedVertexBuffer() ? terrainView->GetMaterializedVertexBuffer() : culledNodes))
+		.addItem(nvrhi::BindingSetItem::Texture_SRV(GBUFFER_BINDING_TERRAIN_HEIGHTMAP_PAGE_TABLE, parent->HeightmapPageTable))
+		.addItem(nvrhi::BindingSetItem::Texture_SRV(GBUFFER_BINDING_TERRAIN_HEIGHTMAP_ATLAS, parent->HeightmapAtlas))
+		.addItem(nvrhi::BindingSetItem::Texture_SRV(GBUFFER_BINDING_TERRAIN_NORMAL_MAP, parent->NormalMapTexture));
+
+	if (m_PixelShaderStage)
+	{
+		bindingSetDesc.addItem(nvrhi::BindingSetItem::StructuredBuffer_UAV(GBUFFER_BINDING_TERRAIN_HEIGHTMAP_FEEDBACK, parent->HeightmapFeedback));
+	}
+
+	return m_Device->createBindingSet(bindingSetDesc, m_TerrainBindingLayout);
+}
+
+
+TerrainGBufferFillPass::TerrainGBufferFillPass(nvrhi::IDevice* device, std::shared_ptr<engine::CommonRenderPasses> commonPasses)
+	: TerrainGeometryPass(device, std::move(commonPasses), true)
+{
+}
+
+void TerrainGBufferFillPass::Init(engine::ShaderFactory& shaderFactory)
+{
+	InitGeometry(shaderFactory, "GBufferFillConstants");
+	m_PixelShader = CreatePixelShader(shaderFactory);
+}
+
+void TerrainGBufferFillPass::SetupView(TerrainPassContext& abstractContext, nvrhi::ICommandList* commandList, 
+										const engine::IView* view, const engine::IView* viewPrev)
+{
+	Context& context = reinterpret_cast<Context&>(abstractContext);
+
+	// Update view constant buffer
+	WriteViewConstants(commandList, view, viewPrev);
+
+	context.keyTemplate.value = 0;
+	context.keyTemplate.bits.frontCounterClockwise = view->IsMirrored();
+	context.keyTemplate.bits.reverseDepth = view->IsReverseDepth();
+	context.keyTemplate.bits.wireframe = context.wireframe;
+	context.keyTemplate.bits.depthEqual = context.depthPrepassed;
+}
+
+void TerrainGBufferFillPass::SetupPipeline(TerrainPassContext& abstractContext, nvrhi::RasterCullMode cullMode,
+											const TerrainMeshView* terrainView, nvrhi::GraphicsState& state)
+{
+	Context& context = reinterpret_cast<Context&>(abstractContext);
+
+	PipelineKey key = context.keyTemplate;
+	key.bits.cullMode = cullMode;
+	key.bits.renderMode = terrainView->GetRenderMode();
+
+	// Get graphics pipeline
+	nvrhi::GraphicsPipelineHandle& pipeline = m_Pipelines[key.value];
+
+	if (!pipeline)
+	{
+		std::lock_guard lock(m_Mutex);
+
+		if (!pipeline)
+		{
+			pipeline = CreateGraphicsPipeline(key, state.framebuffer);
+		}
+
+		if (!pipeline)
+		{
+			return;
+		}
+	}
+
+	assert(pipeline->getFramebufferInfo() == state.framebuffer->getFramebufferInfo());
+
+	state.pipeline = pipeline;
+}
+
+nvrhi::ShaderHandle TerrainGBufferFillPass::CreatePixelShader(engine::ShaderFactory& shaderFactory)
+{
+	char const* sourceFileName = "app/terrain/TerrainShaders.hlsl";
+
+	return shaderFactory.CreateAutoShader(sourceFileName, "gbuffer_ps", 
+		DONUT_MAKE_PLATFORM_SHADER(g_landscape_shaders_gbuffer_ps), nullptr, nvrhi::ShaderType::Pixel);
+
+}
+
 nvrhi::GraphicsPipelineHandle TerrainGBufferFillPass::CreateGraphicsPipeline(PipelineKey key, nvrhi::IFramebuffer* sampleFramebuffer)
+{
+	return m_Device->createGraphicsPipeline(GetGraphicsPipelineDesc(key), sampleFramebuffer->getFramebufferInfo());
+}
+
+nvrhi::GraphicsPipelineDesc TerrainGBufferFillPass::GetGraphicsPipelineDesc(PipelineKey key) const
 {
 	nvrhi::GraphicsPipelineDesc pipelineDesc;
 	pipelineDesc.inputLayout = nullptr;
-	pipelineDesc.VS = m_VertexShader;
+	pipelineDesc.VS = GetVertexShader(key.bits.renderMode);
 	pipelineDesc.PS = m_PixelShader;
 	pipelineDesc.bindingLayouts = {
 		m_ViewBindingLayout,
@@ -204,39 +329,112 @@ nvrhi::GraphicsPipelineHandle TerrainGBufferFillPass::CreateGraphicsPipeline(Pip
 		.setCullMode(key.bits.cullMode)
 		.setFillMode(key.bits.wireframe ? nvrhi::RasterFillMode::Wireframe : nvrhi::RasterFillMode::Solid);
 
-	pipelineDesc.renderState.depthStencilState
-		.setDepthWriteEnable(true)
-		.setDepthFunc(key.bits.reverseDepth
-			? nvrhi::ComparisonFunc::GreaterOrEqual
-			: nvrhi::ComparisonFunc::LessOrEqual);
+	if (key.bits.depthEqual)
+	{
+		// Each pixel is shaded once, by the leaf that wrote its depth in the prepass
+		pipelineDesc.renderState.depthStencilState
+			.setDepthWriteEnable(false)
+			.setDepthFunc(nvrhi::ComparisonFunc::Equal);
+	}
+	else
+	{
+		pipelineDesc.renderState.depthStencilState
+			.setDepthWriteEnable(true)
+			.setDepthFunc(key.bits.reverseDepth
+				? nvrhi::ComparisonFunc::GreaterOrEqual
+				: nvrhi::ComparisonFunc::LessOrEqual);
+	}
 
-	return m_Device->createGraphicsPipeline(pipelineDesc, sampleFramebuffer->getFramebufferInfo());
+	return pipelineDesc;
 }
 
 
-nvrhi::BindingSetHandle TerrainGBufferFillPass::CreateInputBindingSet(const donut::engine::BufferGroup* buffers)
+TerrainDepthOnlyPass::TerrainDepthOnlyPass(nvrhi::IDevice* device, std::shared_ptr<engine::CommonRenderPasses> commonPasses)
+	: TerrainGeometryPass(device, std::move(commonPasses), false)
 {
-	auto bindingSetDesc = nvrhi::BindingSetDesc()
-		.addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(GBUFFER_BINDING_INSTANCE_BUFFER, buffers->instanceBuffer))
-		.addItem(nvrhi::BindingSetItem::PushConstants(GBUFFER_BINDING_PUSH_CONSTANTS, sizeof(TerrainPushConstants)));
+}
 
-	return m_Device->createBindingSet(bindingSetDesc, m_InputBindingLayout);
+void TerrainDepthOnlyPass::Init(engine::ShaderFactory& shaderFactory, const CreateParameters& params)
+{
+	m_Params = params;
+
+	InitGeometry(shaderFactory, "TerrainDepthConstants");
 }
 
-nvrhi::BindingSetHandle TerrainGBufferFillPass::CreateTerrainBindingSet(const TerrainMeshView* terrainView)
+void TerrainDepthOnlyPass::SetupView(TerrainPassContext& abstractContext, nvrhi::ICommandList* commandList,
+										const engine::IView* view, const engine::IView* viewPrev)
 {
-	const TerrainMeshInfo* parent = terrainView->GetInstance()->GetTerrain();
+	Context& context = reinterpret_cast<Context&>(abstractContext);
 
-	auto bindingSetDesc = nvrhi::BindingSetDesc()
-		.addItem(nvrhi::BindingSetItem::ConstantBuffer(GBUFFER_BINDING_TERRAIN_CONSTANTS, parent->TerrainCB))
-		.addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(GBUFFER_BINDING_TERRAIN_CBT, terrainView->GetCBTBuffer()))
-		.addItem(nvrhi::BindingSetItem::Texture_SRV(GBUFFER_BINDING_TERRAIN_HEIGHTMAP_TEXTURE, parent->HeightmapTexture->texture));
+	WriteViewConstants(commandList, view, viewPrev);
 
-	return m_Device->createBindingSet(bindingSetDesc, m_TerrainBindingLayout);
+	context.keyTemplate.value = 0;
+	context.keyTemplate.bits.frontCounterClockwise = view->IsMirrored();
+	context.keyTemplate.bits.reverseDepth = view->IsReverseDepth();
+}
+
+void TerrainDepthOnlyPass::SetupPipeline(TerrainPassContext& abstractContext, nvrhi::RasterCullMode cullMode,
+											const TerrainMeshView* terrainView, nvrhi::GraphicsState& state)
+{
+	Context& context = reinterpret_cast<Context&>(abstractContext);
+
+	PipelineKey key = context.keyTemplate;
+	key.bits.cullMode = cullMode;
+	key.bits.renderMode = terrainView->GetRenderMode();
+
+	nvrhi::GraphicsPipelineHandle& pipeline = m_Pipelines[key.value];
+
+	if (!pipeline)
+	{
+		std::lock_guard lock(m_Mutex);
+
+		if (!pipeline)
+		{
+			pipeline = CreateGraphicsPipeline(key, state.framebuffer);
+		}
+
+		if (!pipeline)
+		{
+			return;
+		}
+	}
+
+	assert(pipeline->getFramebufferInfo() == state.framebuffer->getFramebufferInfo());
+
+	state.pipeline = pipeline;
+}
+
+nvrhi::GraphicsPipelineHandle TerrainDepthOnlyPass::CreateGraphicsPipeline(PipelineKey key, nvrhi::IFramebuffer* sampleFramebuffer)
+{
+	nvrhi::GraphicsPipelineDesc pipelineDesc;
+	pipelineDesc.inputLayout = nullptr;
+	pipelineDesc.VS = GetVertexShader(key.bits.renderMode);
+	pipelineDesc.bindingLayouts = {
+		m_ViewBindingLayout,
+		m_InputBindingLayout,
+		m_TerrainBindingLayout
+	};
+
+	pipelineDesc.primType = nvrhi::PrimitiveType::TriangleList;
+
+	pipelineDesc.renderState.rasterState
+		.setFrontCounterClockwise(key.bits.frontCounterClockwise)
+		.setCullMode(key.bits.cullMode)
+		.setDepthBias(m_Params.depthBias)
+		.setDepthBiasClamp(m_Params.depthBiasClamp)
+		.setSlopeScaleDepthBias(m_Params.slopeScaledDepthBias);
+
+	pipelineDesc.renderState.depthStencilState
+		.setDepthWriteEnable(true)
+		.setDepthFunc(key.bits.reverseDepth
+			? nvrhi::ComparisonFunc::GreaterOrEqual
+			: nvrhi::ComparisonFunc::LessOrEqual);
+
+	return m_Device->createGraphicsPipeline(pipelineDesc, sampleFramebuffer->getFramebufferInfo());
 }
 
 
-void RenderTerrainView(
+uint32_t RenderTerrainView(
 	nvrhi::ICommandList* commandList,
 	const donut::engine::IView* view,
 	const donut::engine::IView* viewPrev,
@@ -244,7 +442,8 @@ void RenderTerrainView(
 	const std::shared_ptr<engine::SceneGraphNode>& rootNode,
 	donut::render::IDrawStrategy& drawStrategy,
 	ITerrainPass& pass,
-	TerrainPassContext& passContext)
+	TerrainPassContext& passContext,
+	GpuTimers* gpuTimers)
 {
 	commandList->beginMarker("Render Terrain View");
 
@@ -257,6 +456,7 @@ void RenderTerrainView(
 	state.viewport = view->GetViewportState();
 	state.shadingRateState = view->GetVariableRateShadingState();
 
+	uint32_t drawCount = 0;
 	while (auto drawItem = drawStrategy.GetNextItem())
 	{
 		if (!drawItem->userData)
@@ -267,19 +467,40 @@ void RenderTerrainView(
 		if (!terrainInstance)
 			continue;
 
-		pass.SetupPipeline(passContext, drawItem->cullMode, state);
+		GpuTimerScope viewScope(gpuTimers, commandList, terrainView->GetName());
+
+		pass.SetupPipeline(passContext, drawItem->cullMode, terrainView, state);
 		pass.SetupBindings(passContext, drawItem->buffers, terrainView, state);
 
-		state.indirectParams = terrainView->GetIndirectArgsBuffer();
+		// Only the leaves that survived culling are drawn
+		const bool indexed = terrainView->GetRenderMode() == TerrainRenderMode::Indexed;
+		state.indirectParams = indexed ? terrainView->GetMaterializedIndirectArgsBuffer() : terrainView->GetCulledIndirectArgsBuffer();
 
 		commandList->setGraphicsState(state);
 
 		TerrainPushConstants constants{};
 		constants.startInstanceLocation = drawItem->instance->GetInstanceIndex();
+		if (terrainView->GetRenderMode() == TerrainRenderMode::Patch)
+		{
+			// The patches match the size the tessellation scheme gave the leaves
+			if (auto scheme = terrainView->GetTessellationScheme().lock())
+				constants.patchLevel = scheme->GetSubdivisionLevel();
+		}
 
 		commandList->setPushConstants(&constants, sizeof(constants));
-		commandList->drawIndirect(TerrainMeshView::GetIndirectArgsDrawOffset());
+
+		const uint culledDraw = passContext.disoccluded ? CULLED_DRAW_DISOCCLUDED : CULLED_DRAW_VISIBLE;
+		if (indexed)
+		{
+			commandList->drawIndexedIndirect(TerrainMeshView::GetMaterializedDrawOffset(culledDraw));
+		}
+		else
+		{
+			commandList->drawIndirect(TerrainMeshView::GetCulledDrawOffset(culledDraw));
+		}
+		drawCount++;
 	}
 
 	commandList->endMarker();
+	return drawCount;
 }
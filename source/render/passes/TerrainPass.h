@@ -7,10 +7,14 @@
 
 #include "terrain/Terrain.h"
 
+class GpuTimers;
+
 
 struct TerrainPassContext
 {
     bool wireframe = false;
+    // Draws the leaves that passed the occlusion retest, instead of those that passed the first culling pass
+    bool disoccluded = false;
 };
 
 class ITerrainPass
@@ -20,13 +24,72 @@ public:
 
     virtual void SetupView(TerrainPassContext& context, nvrhi::ICommandList* commandList, 
 							const donut::engine::IView* view, const donut::engine::IView* viewPrev) = 0;
-    virtual void SetupPipeline(TerrainPassContext& context, nvrhi::RasterCullMode cullMode, nvrhi::GraphicsState& state) = 0;
+    virtual void SetupPipeline(TerrainPassContext& context, nvrhi::RasterCullMode cullMode,
+								const TerrainMeshView* terrainView, nvrhi::GraphicsState& state) = 0;
     virtual void SetupBindings(TerrainPassContext& context, const donut::engine::BufferGroup* buffers, 
 								const TerrainMeshView* terrainView, nvrhi::GraphicsState& state) = 0;
 };
 
 
-class TerrainGBufferFillPass : public ITerrainPass
+// Shared by the passes that rasterize terrain leaves: the vertex shaders, the view, input and terrain bindings, and
+// their caches, so that every such pass computes exactly the same vertices
+class TerrainGeometryPass : public ITerrainPass
+{
+public:
+    // The binding layouts are visible to the pixel stage, and the page requests of virtual heightmaps are bound, only
+    // for passes with a pixel shader
+    TerrainGeometryPass(nvrhi::IDevice* device, std::shared_ptr<donut::engine::CommonRenderPasses> commonPasses, bool pixelShader);
+    virtual ~TerrainGeometryPass() = default;
+
+    void SetupBindings(TerrainPassContext& context, const donut::engine::BufferGroup* buffers,
+						const TerrainMeshView* terrainView, nvrhi::GraphicsState& state) override;
+
+    void ResetBindingCache();
+
+protected:
+    // Creates the vertex shaders, the view constants and the binding layouts
+    void InitGeometry(donut::engine::ShaderFactory& shaderFactory, const char* constantsName);
+    void WriteViewConstants(nvrhi::ICommandList* commandList, const donut::engine::IView* view, const donut::engine::IView* viewPrev);
+    [[nodiscard]] nvrhi::IShader* GetVertexShader(TerrainRenderMode renderMode) const;
+    [[nodiscard]] nvrhi::ShaderType GetBindingVisibility() const;
+
+    virtual nvrhi::ShaderHandle CreateVertexShader(donut::engine::ShaderFactory& shaderFactory);
+    virtual nvrhi::ShaderHandle CreateIndexedVertexShader(donut::engine::ShaderFactory& shaderFactory);
+    virtual nvrhi::ShaderHandle CreatePatchVertexShader(donut::engine::ShaderFactory& shaderFactory);
+
+    virtual nvrhi::BindingLayoutHandle CreateInputBindingLayout();
+    virtual nvrhi::BindingLayoutHandle CreateTerrainBindingLayout();
+    virtual void CreateViewBindings(nvrhi::BindingLayoutHandle& layout, nvrhi::BindingSetHandle& set);
+
+    virtual nvrhi::BindingSetHandle CreateInputBindingSet(const donut::engine::BufferGroup* buffers);
+    virtual nvrhi::BindingSetHandle CreateTerrainBindingSet(const TerrainMeshView* terrainView, nvrhi::IBuffer* culledNodes);
+
+protected:
+    nvrhi::DeviceHandle m_Device;
+    std::shared_ptr<donut::engine::CommonRenderPasses> m_CommonPasses;
+    bool m_PixelShaderStage;
+
+    nvrhi::ShaderHandle m_VertexShader;
+    nvrhi::ShaderHandle m_IndexedVertexShader;
+    nvrhi::ShaderHandle m_PatchVertexShader;
+
+    nvrhi::BindingLayoutHandle m_InputBindingLayout;
+    nvrhi::BindingLayoutHandle m_TerrainBindingLayout;
+
+    nvrhi::BindingLayoutHandle m_ViewBindingLayout;
+    nvrhi::BindingSetHandle m_ViewBindingSet;
+
+    // GBufferFillConstants, which the vertex shaders read the view from
+    nvrhi::BufferHandle m_ViewCB;
+
+    std::mutex m_Mutex;
+
+    std::unordered_map<const donut::engine::BufferGroup*, nvrhi::BindingSetHandle> m_InputBindingSets;
+    std::unordered_map<const nvrhi::IBuffer*, nvrhi::BindingSetHandle> m_TerrainBindingSets;
+};
+
+
+class TerrainGBufferFillPass : public TerrainGeometryPass
 {
 public:
     union PipelineKey
@@ -37,10 +100,12 @@ public:
             bool frontCounterClockwise : 1;
             bool wireframe : 1;
             bool reverseDepth : 1;
+            bool depthEqual : 1;
+            TerrainRenderMode renderMode : 2;
 	    } bits;
         uint32_t value;
 
-        static constexpr size_t Count = 1 << 5;
+        static constexpr size_t Count = 1 << 8;
     };
 
     struct Context : TerrainPassContext
@@ -50,6 +115,11 @@ public:
         {
             keyTemplate.value = 0;
         }
+
+        // The depth of the leaves was rendered by a depth prepass (see TerrainDepthOnlyPass), so only the fragments at
+        // that depth are shaded, and depth is not written
+        bool depthPrepassed = false;
+
     private:
 
         PipelineKey keyTemplate;
@@ -63,53 +133,93 @@ public:
 
     virtual void SetupView(TerrainPassContext& context, nvrhi::ICommandList* commandList, 
 							const donut::engine::IView* view, const donut::engine::IView* viewPrev) override;
-    virtual void SetupPipeline(TerrainPassContext& context, nvrhi::RasterCullMode cullMode, nvrhi::GraphicsState& state) override;
-    void SetupBindings(TerrainPassContext& context, const donut::engine::BufferGroup* buffers,
-						const TerrainMeshView* terrainView, nvrhi::GraphicsState& state) override;
+    virtual void SetupPipeline(TerrainPassContext& context, nvrhi::RasterCullMode cullMode,
+								const TerrainMeshView* terrainView, nvrhi::GraphicsState& state) override;
 
 protected:
 
-    virtual nvrhi::ShaderHandle CreateVertexShader(donut::engine::ShaderFactory& shaderFactory);
     virtual nvrhi::ShaderHandle CreatePixelShader(donut::engine::ShaderFactory& shaderFactory);
 
-    virtual nvrhi::BindingLayoutHandle CreateInputBindingLayout();
-    virtual nvrhi::BindingLayoutHandle CreateTerrainBindingLayout();
-    virtual void CreateViewBindings(nvrhi::BindingLayoutHandle& layout, nvrhi::BindingSetHandle& set);
-
 	virtual nvrhi::GraphicsPipelineHandle CreateGraphicsPipeline(PipelineKey key, nvrhi::IFramebuffer* sampleFramebuffer);
-
-    virtual nvrhi::BindingSetHandle CreateInputBindingSet(const donut::engine::BufferGroup* buffers);
-    virtual nvrhi::BindingSetHandle CreateTerrainBindingSet(const TerrainMeshView* terrainView);
+    // Shaders, layouts and render state of the pipeline for the key
+    [[nodiscard]] nvrhi::GraphicsPipelineDesc GetGraphicsPipelineDesc(PipelineKey key) const;
 
 protected:
-    nvrhi::DeviceHandle m_Device;
-    std::shared_ptr<donut::engine::CommonRenderPasses> m_CommonPasses;
-
-    nvrhi::ShaderHandle m_VertexShader;
     nvrhi::ShaderHandle m_PixelShader;
 
-    nvrhi::BindingLayoutHandle m_InputBindingLayout;
-    nvrhi::BindingLayoutHandle m_TerrainBindingLayout;
+    // Sparse array of graphics pipelines
+    std::array<nvrhi::GraphicsPipelineHandle, PipelineKey::Count> m_Pipelines{};
+};
 
-    nvrhi::BindingLayoutHandle m_ViewBindingLayout;
-    nvrhi::BindingSetHandle m_ViewBindingSet;
 
-    nvrhi::BufferHandle m_GBufferCB;
+// Renders the depth of terrains only: as a prepass of the G-buffer fill pass, into the cascades of a shadow map, or
+// into the depth of occlusion views
+//  Same vertex shaders and bindings as the G-buffer fill pass (see TerrainGeometryPass), without a pixel shader, so
+//  that both passes produce exactly the same depth and the G-buffer fill pass can test it for equality
+class TerrainDepthOnlyPass : public TerrainGeometryPass
+{
+public:
+    union PipelineKey
+    {
+        struct
+        {
+            nvrhi::RasterCullMode cullMode : 2;
+            bool frontCounterClockwise : 1;
+            bool reverseDepth : 1;
+            TerrainRenderMode renderMode : 2;
+        } bits;
+        uint32_t value;
+
+        static constexpr size_t Count = 1 << 6;
+    };
+
+    struct Context : TerrainPassContext
+    {
+        friend TerrainDepthOnlyPass;
+        Context()
+        {
+            keyTemplate.value = 0;
+        }
+    private:
+
+        PipelineKey keyTemplate;
+    };
+
+    struct CreateParameters
+    {
+        int depthBias = 0;
+        float depthBiasClamp = 0.0f;
+        float slopeScaledDepthBias = 0.0f;
+    };
+
+public:
+    TerrainDepthOnlyPass(nvrhi::IDevice* device, std::shared_ptr<donut::engine::CommonRenderPasses> commonPasses);
+    virtual ~TerrainDepthOnlyPass() = default;
+
+    virtual void Init(donut::engine::ShaderFactory& shaderFactory, const CreateParameters& params);
+
+    virtual void SetupView(TerrainPassContext& context, nvrhi::ICommandList* commandList,
+							const donut::engine::IView* view, const donut::engine::IView* viewPrev) override;
+    virtual void SetupPipeline(TerrainPassContext& context, nvrhi::RasterCullMode cullMode,
+								const TerrainMeshView* terrainView, nvrhi::GraphicsState& state) override;
+
+protected:
+    virtual nvrhi::GraphicsPipelineHandle CreateGraphicsPipeline(PipelineKey key, nvrhi::IFramebuffer* sampleFramebuffer);
+
+protected:
+    CreateParameters m_Params;
 
     // Sparse array of graphics pipelines
     std::array<nvrhi::GraphicsPipelineHandle, PipelineKey::Count> m_Pipelines{};
-    std::mutex m_Mutex;
-
-    std::unordered_map<const donut::engine::BufferGroup*, nvrhi::BindingSetHandle> m_InputBindingSets;
-    std::unordered_map<const TerrainMeshView*, nvrhi::BindingSetHandle> m_TerrainBindingSets;
 };
 
-
 // Renders terrains for a given view
 //  The draw strategy feeds the terrain instances
 //  The terrain pass knows how to draw the terrain
 //  The pass context contains data that the pass needs to cache for how to draw the terrain
-void RenderTerrainView(
+//  Returns the number of draws recorded
+//  Each terrain view is timed in its own scope, named after it, if timers are given
+uint32_t RenderTerrainView(
     nvrhi::ICommandList* commandList,
     const donut::engine::IView* view,
     const donut::engine::IView* viewPrev,
@@ -117,5 +227,6 @@ void RenderTerrainView(
     const std::shared_ptr<donut::engine::SceneGraphNode>& rootNode,
     donut::render::IDrawStrategy& drawStrategy,
     ITerrainPass& pass,
-    TerrainPassContext& passContext
+    TerrainPassContext& passContext,
+    GpuTimers* gpuTimers = nullptr
 );
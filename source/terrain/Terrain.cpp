@@ -17,15 +17,99 @@ TerrainMeshView::TerrainMeshView(const TerrainMeshInstance* parent, const Terrai
 	: m_Instance(parent)
 	, m_MaxDepth(desc.MaxDepth)
 	, m_InitDepth(desc.InitDepth)
+	, m_SumReductionMode(desc.SumReductionMode)
+	, m_Topology(desc.Topology)
+	, m_PoolCapacity(desc.PoolCapacity)
+	, m_DoubleBuffered(desc.DoubleBuffered)
+	, m_RenderMode(desc.RenderMode)
+	, m_MaterializedLeafCapacity(std::max(desc.MaterializedLeafCapacity, 1u))
 	, m_TessellationScheme(desc.TessellationScheme)
 {
+	if (m_RenderMode == TerrainRenderMode::Indexed && m_MaxDepth > MATERIALIZE_MAX_DEPTH)
+	{
+		log::warning("Indexed terrain rendering supports a maximum depth of %d (got %u), falling back to instanced rendering",
+			MATERIALIZE_MAX_DEPTH, m_MaxDepth);
+		m_RenderMode = TerrainRenderMode::Instanced;
+	}
+
+	if (m_Topology == TerrainTopology::BisectorPool)
+	{
+		if (m_MaxDepth > BISECTOR_POOL_MAX_DEPTH)
+		{
+			log::warning("The bisector pool topology supports a maximum depth of %d (got %u), clamping",
+				BISECTOR_POOL_MAX_DEPTH, m_MaxDepth);
+			m_MaxDepth = BISECTOR_POOL_MAX_DEPTH;
+			m_InitDepth = std::min(m_InitDepth, m_MaxDepth);
+		}
+
+		// The pool must hold the initial leaves, and its allocation bitfield is made of whole words
+		m_PoolCapacity = std::max(m_PoolCapacity, 1u << m_InitDepth);
+		m_PoolCapacity = (m_PoolCapacity + 31u) & ~31u;
+	}
 }
 
 void TerrainMeshView::CreateBuffers(nvrhi::IDevice* device, nvrhi::ICommandList* commandList)
 {
-	cbt_Tree* cbt = cbt_CreateAtDepth(m_MaxDepth, m_InitDepth);
+	// The initial leaves are every node at the initial depth, in the order the CBT decodes them
+	const uint nodeCount = 1u << m_InitDepth;
+	std::vector<uint> initialLeaves(nodeCount);
+	for (uint i = 0; i < nodeCount; i++)
+	{
+		initialLeaves[i] = nodeCount + i;
+	}
 
+	if (m_Topology == TerrainTopology::BisectorPool)
 	{
+		// Enough entries for the hash table to stay at most half full
+		uint hashCapacity = 1;
+		while (hashCapacity < 2 * m_PoolCapacity)
+		{
+			hashCapacity <<= 1;
+		}
+
+		std::vector<uint> pool(BISECTOR_POOL_HEADER_SIZE + m_PoolCapacity / 32 + m_PoolCapacity, 0);
+		pool[BISECTOR_POOL_HEADER_MAX_DEPTH] = m_MaxDepth;
+		pool[BISECTOR_POOL_HEADER_CAPACITY] = m_PoolCapacity;
+		pool[BISECTOR_POOL_HEADER_HASH_CAPACITY] = hashCapacity;
+		pool[BISECTOR_POOL_HEADER_COUNT] = nodeCount;
+		pool[BISECTOR_POOL_HEADER_HIGH_WATER] = nodeCount;
+		for (uint slot = 0; slot < nodeCount; slot++)
+		{
+			pool[BISECTOR_POOL_HEADER_SIZE + slot / 32] |= 1u << (slot % 32);
+			pool[BISECTOR_POOL_HEADER_SIZE + m_PoolCapacity / 32 + slot] = initialLeaves[slot];
+		}
+
+		nvrhi::BufferDesc bufferDesc;
+		bufferDesc.setByteSize(sizeof(uint) * pool.size())
+			.setCanHaveTypedViews(true)
+			.setStructStride(sizeof(uint))
+			.setCanHaveUAVs(true)
+			.setInitialState(nvrhi::ResourceStates::ShaderResource)
+			.setKeepInitialState(true)
+			.setDebugName("BisectorPool");
+		m_CBTBuffer = device->createBuffer(bufferDesc);
+
+		commandList->writeBuffer(m_CBTBuffer, pool.data(), sizeof(uint) * pool.size());
+
+		if (m_DoubleBuffered)
+		{
+			bufferDesc.setDebugName("BisectorPool_Back");
+			m_BackCBTBuffer = device->createBuffer(bufferDesc);
+
+			commandList->writeBuffer(m_BackCBTBuffer, pool.data(), sizeof(uint) * pool.size());
+		}
+
+		// Only used within a subdivision, so it is never double buffered
+		bufferDesc.setByteSize(sizeof(uint) * (2ull * hashCapacity + 2ull * m_PoolCapacity))
+			.setInitialState(nvrhi::ResourceStates::UnorderedAccess)
+			.setDebugName("BisectorPool_Scratch");
+		m_BisectorScratchBuffer = device->createBuffer(bufferDesc);
+	}
+	else
+	{
+		cbt_Tree* cbt = cbt_CreateAtDepth(m_MaxDepth, m_InitDepth);
+		assert(cbt_NodeCount(cbt) == nodeCount);
+
 		nvrhi::BufferDesc bufferDesc;
 		bufferDesc.setByteSize(cbt_HeapByteSize(cbt))
 			.setCanHaveTypedViews(true)
@@ -37,6 +121,16 @@ void TerrainMeshView::CreateBuffers(nvrhi::IDevice* device, nvrhi::ICommandList*
 		m_CBTBuffer = device->createBuffer(bufferDesc);
 
 		commandList->writeBuffer(m_CBTBuffer, cbt_GetHeap(cbt), cbt_HeapByteSize(cbt));
+
+		if (m_DoubleBuffered)
+		{
+			bufferDesc.setDebugName("CBT_Back");
+			m_BackCBTBuffer = device->createBuffer(bufferDesc);
+
+			commandList->writeBuffer(m_BackCBTBuffer, cbt_GetHeap(cbt), cbt_HeapByteSize(cbt));
+		}
+
+		cbt_Release(cbt);
 	}
 
 	{
@@ -57,17 +151,207 @@ void TerrainMeshView::CreateBuffers(nvrhi::IDevice* device, nvrhi::ICommandList*
 			.setDebugName("CBT_IndirectArgs");
 		m_IndirectArgsBuffer = device->createBuffer(bufferDesc);
 
-		uint nodeCount = static_cast<uint>(cbt_NodeCount(cbt));
-
 		IndirectArgs initialIndirectArgs;
 		initialIndirectArgs.dispatchArgs.groupsX = nodeCount;
 		initialIndirectArgs.drawArgs.vertexCount = 3;
 		initialIndirectArgs.drawArgs.instanceCount = nodeCount;
 		commandList->writeBuffer(m_IndirectArgsBuffer, &initialIndirectArgs, sizeof(initialIndirectArgs));
+
+		if (m_DoubleBuffered)
+		{
+			bufferDesc.setDebugName("CBT_IndirectArgs_Back");
+			m_BackIndirectArgsBuffer = device->createBuffer(bufferDesc);
+
+			commandList->writeBuffer(m_BackIndirectArgsBuffer, &initialIndirectArgs, sizeof(initialIndirectArgs));
+		}
 	}
 
 
-	cbt_Release(cbt);
+	{
+		nvrhi::BufferDesc bufferDesc;
+		bufferDesc.setByteSize(sizeof(TessellationFeedback))
+			.setCanHaveTypedViews(true)
+			.setStructStride(sizeof(TessellationFeedback))
+			.setCanHaveUAVs(true)
+			.setInitialState(nvrhi::ResourceStates::UnorderedAccess)
+			.setKeepInitialState(true)
+			.setDebugName("CBT_Feedback");
+		m_FeedbackBuffer = device->createBuffer(bufferDesc);
+	}
+
+	{
+		// Until the first culling, every leaf is drawn
+		nvrhi::BufferDesc bufferDesc;
+		bufferDesc.setByteSize(sizeof(uint) * GetMaxLeafCount())
+			.setCanHaveTypedViews(true)
+			.setStructStride(sizeof(uint))
+			.setCanHaveUAVs(true)
+			.setInitialState(nvrhi::ResourceStates::ShaderResource)
+			.setKeepInitialState(true)
+			.setDebugName("CBT_CulledNodes");
+		m_CulledNodesBuffer = device->createBuffer(bufferDesc);
+		commandList->writeBuffer(m_CulledNodesBuffer, initialLeaves.data(), sizeof(uint) * nodeCount);
+
+		if (m_DoubleBuffered)
+		{
+			bufferDesc.setDebugName("CBT_CulledNodes_Back");
+			m_BackCulledNodesBuffer = device->createBuffer(bufferDesc);
+			commandList->writeBuffer(m_BackCulledNodesBuffer, initialLeaves.data(), sizeof(uint) * nodeCount);
+		}
+
+		// Only written and drawn on the graphics queue, so it is never double buffered
+		bufferDesc.setDebugName("CBT_DisoccludedNodes");
+		m_DisoccludedNodesBuffer = device->createBuffer(bufferDesc);
+
+		bufferDesc.setByteSize(sizeof(nvrhi::DrawIndirectArguments) * CULLED_DRAW_COUNT)
+			.setIsDrawIndirectArgs(true)
+			.setStructStride(sizeof(nvrhi::DrawIndirectArguments))
+			.setInitialState(nvrhi::ResourceStates::IndirectArgument)
+			.setDebugName("CBT_CulledIndirectArgs");
+		m_CulledIndirectArgsBuffer = device->createBuffer(bufferDesc);
+
+		std::array<nvrhi::DrawIndirectArguments, CULLED_DRAW_COUNT> initialDrawArgs;
+		for (auto& drawArgs : initialDrawArgs)
+		{
+			drawArgs.vertexCount = 3;
+			drawArgs.instanceCount = 0;
+		}
+		initialDrawArgs[CULLED_DRAW_VISIBLE].instanceCount = nodeCount;
+		commandList->writeBuffer(m_CulledIndirectArgsBuffer, initialDrawArgs.data(), sizeof(initialDrawArgs));
+
+		if (m_DoubleBuffered)
+		{
+			bufferDesc.setDebugName("CBT_CulledIndirectArgs_Back");
+			m_BackCulledIndirectArgsBuffer = device->createBuffer(bufferDesc);
+			commandList->writeBuffer(m_BackCulledIndirectArgsBuffer, initialDrawArgs.data(), sizeof(initialDrawArgs));
+		}
+	}
+
+	if (m_RenderMode == TerrainRenderMode::Indexed)
+	{
+		// The visible and disoccluded leaves together are clamped to the capacity (see materialize_prepare_cs), and each
+		// of them adds at most 3 vertices
+		const uint64_t maxLeafCount = GetMaterializedLeafCapacity();
+
+		nvrhi::BufferDesc bufferDesc;
+		bufferDesc.setByteSize(sizeof(TerrainVertex) * 3 * maxLeafCount)
+			.setStructStride(sizeof(TerrainVertex))
+			.setCanHaveUAVs(true)
+			.setInitialState(nvrhi::ResourceStates::ShaderResource)
+			.setKeepInitialState(true)
+			.setDebugName("Terrain_MaterializedVertices");
+		m_MaterializedVertexBuffer = device->createBuffer(bufferDesc);
+
+		bufferDesc = nvrhi::BufferDesc();
+		bufferDesc.setByteSize(sizeof(uint) * 3 * maxLeafCount)
+			.setStructStride(sizeof(uint))
+			.setIsIndexBuffer(true)
+			.setCanHaveUAVs(true)
+			.setInitialState(nvrhi::ResourceStates::IndexBuffer)
+			.setKeepInitialState(true)
+			.setDebugName("Terrain_MaterializedIndices");
+		m_MaterializedIndexBuffer = device->createBuffer(bufferDesc);
+
+		// (key, vertex) pairs; a mesh has about half as many vertices as triangles, so twice as many slots as leaves keeps the table sparse
+		bufferDesc = nvrhi::BufferDesc();
+		bufferDesc.setByteSize(sizeof(uint) * 2 * (2 * maxLeafCount))
+			.setCanHaveTypedViews(true)
+			.setStructStride(sizeof(uint))
+			.setCanHaveUAVs(true)
+			.setInitialState(nvrhi::ResourceStates::UnorderedAccess)
+			.setKeepInitialState(true)
+			.setDebugName("Terrain_VertexHash");
+		m_VertexHashBuffer = device->createBuffer(bufferDesc);
+
+		bufferDesc = nvrhi::BufferDesc();
+		bufferDesc.setByteSize(sizeof(nvrhi::DrawIndexedIndirectArguments) * CULLED_DRAW_COUNT)
+			.setIsDrawIndirectArgs(true)
+			.setStructStride(sizeof(nvrhi::DrawIndexedIndirectArguments))
+			.setCanHaveUAVs(true)
+			.setInitialState(nvrhi::ResourceStates::IndirectArgument)
+			.setKeepInitialState(true)
+			.setDebugName("Terrain_MaterializedIndirectArgs");
+		m_MaterializedIndirectArgsBuffer = device->createBuffer(bufferDesc);
+
+		// Nothing is drawn until the first materialization
+		std::array<nvrhi::DrawIndexedIndirectArguments, CULLED_DRAW_COUNT> initialDrawArgs{};
+		commandList->writeBuffer(m_MaterializedIndirectArgsBuffer, initialDrawArgs.data(), sizeof(initialDrawArgs));
+
+		bufferDesc = nvrhi::BufferDesc();
+		bufferDesc.setByteSize(sizeof(MaterializeState))
+			.setStructStride(sizeof(MaterializeState))
+			.setCanHaveUAVs(true)
+			.setInitialState(nvrhi::ResourceStates::UnorderedAccess)
+			.setKeepInitialState(true)
+			.setDebugName("Terrain_MaterializeState");
+		m_MaterializeStateBuffer = device->createBuffer(bufferDesc);
+
+		bufferDesc = nvrhi::BufferDesc();
+		bufferDesc.setByteSize(sizeof(nvrhi::DispatchIndirectArguments))
+			.setIsDrawIndirectArgs(true)
+			.setInitialState(nvrhi::ResourceStates::IndirectArgument)
+			.setKeepInitialState(true)
+			.setDebugName("Terrain_MaterializeDispatchArgs");
+		m_MaterializeDispatchArgsBuffer = device->createBuffer(bufferDesc);
+	}
+}
+
+void TerrainMeshView::ReleaseBuffers()
+{
+	m_CBTBuffer = nullptr;
+	m_IndirectArgsBuffer = nullptr;
+	m_BackCBTBuffer = nullptr;
+	m_BackIndirectArgsBuffer = nullptr;
+	m_FeedbackBuffer = nullptr;
+	m_BisectorScratchBuffer = nullptr;
+	m_CulledNodesBuffer = nullptr;
+	m_CulledIndirectArgsBuffer = nullptr;
+	m_BackCulledNodesBuffer = nullptr;
+	m_BackCulledIndirectArgsBuffer = nullptr;
+	m_DisoccludedNodesBuffer = nullptr;
+	m_MaterializedVertexBuffer = nullptr;
+	m_MaterializedIndexBuffer = nullptr;
+	m_MaterializedIndirectArgsBuffer = nullptr;
+	m_VertexHashBuffer = nullptr;
+	m_MaterializeStateBuffer = nullptr;
+	m_MaterializeDispatchArgsBuffer = nullptr;
+}
+
+const char* TerrainMeshView::GetName() const
+{
+	const donut::engine::SceneGraphNode* node = m_Instance->GetNode();
+	return node && !node->GetName().empty() ? node->GetName().c_str() : "Terrain";
+}
+
+void TerrainMeshView::SwapBuffers()
+{
+	if (!m_DoubleBuffered)
+		return;
+
+	std::swap(m_CBTBuffer, m_BackCBTBuffer);
+	std::swap(m_IndirectArgsBuffer, m_BackIndirectArgsBuffer);
+	std::swap(m_CulledNodesBuffer, m_BackCulledNodesBuffer);
+	std::swap(m_CulledIndirectArgsBuffer, m_BackCulledIndirectArgsBuffer);
+}
+
+
+void TerrainMeshInfo::FillTerrainConstants(TerrainConstants& constants, uint2 heightmapResolution) const
+{
+	const float2 resolution = float2(heightmapResolution);
+
+	constants.TerrainExtentsAndInvExtents = float4(HeightmapExtents, 1.0f / HeightmapExtents);
+	constants.HeightmapResolutionAndInvResolution = float4(resolution, 1.0f / resolution);
+	constants.HeightScaleAndInvScale = float2(HeightmapHeightScale, 1.0f / HeightmapHeightScale);
+	// Edges are halved every other level, from a single segment at depth 1
+	constants.TileBorderDepth = TileBorderDepth;
+	constants.TileBorderSegments = TileBorderDepth > 0 ? static_cast<float>(1u << ((TileBorderDepth - 1) / 2)) : 0.0f;
+	// The pyramids are built from the heightmap itself; virtual heightmaps override these (see TerrainVirtualHeightmap)
+	constants.HeightPyramidResolution = resolution;
+	constants.HeightBoundsMargin = 0.0f;
+	constants.VirtualPageSize = 0;
+	constants.VirtualPageTableSize = uint2(0);
+	constants.VirtualLevelCount = 0;
+	constants.VirtualAtlasInvSize = 0.0f;
 }
 
 
@@ -108,7 +392,7 @@ void TerrainMeshInstance::Load(const Json::Value& node)
 			
 	// check valid
 	const auto& terrainMeshes = graph->GetTerrainMeshes();
-	if (terrainMeshIndex >= terrainMeshes.size())
+	if (terrainMeshIndex >= terrainMeshes.size() || !terrainMeshes.at(terrainMeshIndex))
 	{
 		log::error("Failed to load terrain mesh instance: terrain mesh index was invalid (Index = %d)", terrainMeshIndex);
 		return;
@@ -145,6 +429,24 @@ void TerrainMeshInstance::CreateBuffers(nvrhi::IDevice* device, nvrhi::ICommandL
 	{
 		view.CreateBuffers(device, commandList);
 	}
+	m_Resident = true;
+}
+
+void TerrainMeshInstance::ReleaseBuffers()
+{
+	for (auto& view : m_TerrainViews)
+	{
+		view.ReleaseBuffers();
+	}
+	m_Resident = false;
+}
+
+void TerrainMeshInstance::SwapBuffers()
+{
+	for (auto& view : m_TerrainViews)
+	{
+		view.SwapBuffers();
+	}
 }
 
 box3 TerrainMeshInstance::GetLocalBoundingBox()
@@ -167,3 +469,72 @@ engine::SceneContentFlags TerrainMeshInstance::GetContentFlags() const
 {
 	return static_cast<engine::SceneContentFlags>(SceneContentFlagsEx::Terrain);
 }
+
+
+TerrainTileGridInstance::TerrainTileGridInstance(std::shared_ptr<TerrainTileGrid> grid)
+	: m_Grid(std::move(grid))
+{
+}
+
+void TerrainTileGridInstance::Load(const Json::Value& node)
+{
+	size_t gridIndex = 0;
+	const auto& terrainIndex = node["terrain"];
+	if (!terrainIndex.empty())
+	{
+		gridIndex = terrainIndex.asUInt64();
+	}
+
+	auto nodePtr = GetNodeSharedPtr();
+	if (!nodePtr)
+	{
+		log::fatal("Failed to get node!");
+		return;
+	}
+
+	auto graph = std::dynamic_pointer_cast<LandscapesSceneGraph>(nodePtr->GetGraph());
+	if (!graph)
+	{
+		log::fatal("Failed to get graph!");
+	}
+
+	const auto& tileGrids = graph->GetTerrainTileGrids();
+	if (gridIndex >= tileGrids.size() || !tileGrids.at(gridIndex))
+	{
+		log::error("Failed to load tiled terrain instance: terrain index was not a tiled terrain (Index = %d)", gridIndex);
+		return;
+	}
+	m_Grid = tileGrids.at(gridIndex);
+
+	CreateTiles();
+}
+
+void TerrainTileGridInstance::CreateTiles()
+{
+	auto nodePtr = GetNodeSharedPtr();
+	const float2 tileExtents = m_Grid->GetTileExtents();
+	const float2 gridCenter = 0.5f * float2(m_Grid->GridSize);
+
+	for (uint y = 0; y < m_Grid->GridSize.y; y++)
+	{
+		for (uint x = 0; x < m_Grid->GridSize.x; x++)
+		{
+			const auto& tile = m_Grid->Tiles.at(y * m_Grid->GridSize.x + x);
+
+			// Terrains are centered on their node, with texture coordinates along x and z
+			float2 tileCenter = (float2(float(x), float(y)) + 0.5f - gridCenter) * tileExtents;
+
+			auto tileNode = std::make_shared<engine::SceneGraphNode>();
+			tileNode->SetName(nodePtr->GetName() + "_" + std::to_string(x) + "_" + std::to_string(y));
+			tileNode->SetTranslation(double3(tileCenter.x, 0.0, tileCenter.y));
+			tileNode->SetLeaf(std::make_shared<TerrainMeshInstance>(tile));
+			nodePtr->GetGraph()->Attach(nodePtr, tileNode);
+		}
+	}
+}
+
+std::shared_ptr<engine::SceneGraphLeaf> TerrainTileGridInstance::Clone()
+{
+	// Cloning the node copies the tile nodes under it, so the clone does not create them again
+	return std::make_shared<TerrainTileGridInstance>(m_Grid);
+}
@@ -2,6 +2,8 @@
 
 #include <nvrhi/nvrhi.h>
 
+#include <algorithm>
+
 #include <donut/core/math/math.h>
 #include <donut/engine/SceneGraph.h>
 #include <donut/engine/TextureCache.h>
@@ -11,14 +13,63 @@ using namespace donut::math;
 
 class TerrainMeshInstance;
 class ITerrainTessellationPass;
+struct TerrainConstants;
+class TerrainVirtualHeightmap;
+struct TerrainVirtualHeightmapDesc;
+
+enum class TerrainSumReductionMode : uint8_t
+{
+	// One dispatch per level of the tree
+	Iterative = 0,
+	// Upper levels are reduced in groupshared memory; also writes the indirect arguments
+	Fused
+};
+
+enum class TerrainTopology : uint8_t
+{
+	// Concurrent binary tree over every node down to the maximum depth; memory and reduction scale with 2^MaxDepth
+	ConcurrentBinaryTree = 0,
+	// Pool of the heap IDs of the leaves, with an allocation bitfield; memory and work scale with the pool capacity
+	BisectorPool
+};
+
+enum class TerrainRenderMode : uint8_t
+{
+	// Each leaf is drawn as an instance of a triangle, decoded from its heap ID in the vertex shader
+	Instanced = 0,
+	// The culled leaves are decoded once per frame into an indexed mesh with shared vertices (see TerrainMaterializePass)
+	Indexed,
+	// Each leaf is drawn as an instance of a grid of triangles, with 2^level subdivisions per edge
+	//  The level is the subdivision level of the tessellation scheme, so a shallower tree gives the same density
+	Patch
+};
 
 struct TerrainMeshViewDesc
 {
 	uint MaxDepth = 8;
 	uint InitDepth = 1;
 
+	TerrainSumReductionMode SumReductionMode = TerrainSumReductionMode::Iterative;
+
+	// The bisector pool supports MaxDepth <= BISECTOR_POOL_MAX_DEPTH, and splits stop once it holds PoolCapacity leaves
+	TerrainTopology Topology = TerrainTopology::ConcurrentBinaryTree;
+	uint PoolCapacity = 1u << 20;
+
+	// Keep a second copy of the CBT and indirect arguments, so the next tessellation can run (e.g. on a compute queue)
+	// while the current one is being rendered
+	bool DoubleBuffered = false;
+
+	// Indexed rendering requires MaxDepth <= MATERIALIZE_MAX_DEPTH, and falls back to instanced rendering otherwise
+	TerrainRenderMode RenderMode = TerrainRenderMode::Instanced;
+	// Indexed rendering only: the materialized mesh holds at most this many leaves, which sizes its buffers; leaves
+	// beyond it are not drawn
+	uint MaterializedLeafCapacity = 1u << 20;
+
 	// Optional - if null, tessellation of terrain mesh will not be updated
 	std::weak_ptr<ITerrainTessellationPass> TessellationScheme;
+
+	// Cascade of the directional light shadow map this view is tessellated and rendered for, or -1 for a camera view
+	int ShadowCascade = -1;
 };
 
 class TerrainMeshView
@@ -27,15 +78,62 @@ public:
 	explicit TerrainMeshView(const TerrainMeshInstance* parent, const TerrainMeshViewDesc& desc);
 
 	void CreateBuffers(nvrhi::IDevice* device, nvrhi::ICommandList* commandList);
+	// Drops every buffer, which CreateBuffers recreates in their initial state
+	void ReleaseBuffers();
 
 	[[nodiscard]] inline const TerrainMeshInstance* GetInstance() const { return m_Instance; }
+	// Name of the node of the instance, which tells apart the terrain views of a view (e.g. in the GPU timers)
+	[[nodiscard]] const char* GetName() const;
+	// Buffers to render from
+	//  The CBT buffers hold the bisector pool instead with the bisector pool topology (see TerrainShaders.h)
 	[[nodiscard]] inline nvrhi::IBuffer* GetCBTBuffer() const { return m_CBTBuffer; }
 	[[nodiscard]] inline uint GetMaxDepth() const { return m_MaxDepth; }
+	[[nodiscard]] inline TerrainSumReductionMode GetSumReductionMode() const { return m_SumReductionMode; }
+	[[nodiscard]] inline TerrainTopology GetTopology() const { return m_Topology; }
+	// Upper bound on the number of leaves, which sizes the culled nodes and the materialized mesh
+	[[nodiscard]] inline uint64_t GetMaxLeafCount() const { return m_Topology == TerrainTopology::BisectorPool ? m_PoolCapacity : 1ull << m_MaxDepth; }
 
 	[[nodiscard]] inline nvrhi::IBuffer* GetIndirectArgsBuffer() const { return m_IndirectArgsBuffer; }
 
+	// Written by the subdivision passes (see TessellationFeedback)
+	[[nodiscard]] inline nvrhi::IBuffer* GetFeedbackBuffer() const { return m_FeedbackBuffer; }
+	// Hash table, split commands and free slots of the bisector pool, rebuilt for each subdivision (bisector pool only)
+	[[nodiscard]] inline nvrhi::IBuffer* GetBisectorScratchBuffer() const { return m_BisectorScratchBuffer; }
+
+	// Buffers to tessellate into; the same as the render buffers unless double buffered
+	[[nodiscard]] inline nvrhi::IBuffer* GetTessellationCBTBuffer() const { return m_DoubleBuffered ? m_BackCBTBuffer : m_CBTBuffer; }
+	[[nodiscard]] inline nvrhi::IBuffer* GetTessellationIndirectArgsBuffer() const { return m_DoubleBuffered ? m_BackIndirectArgsBuffer : m_IndirectArgsBuffer; }
+	[[nodiscard]] inline bool IsDoubleBuffered() const { return m_DoubleBuffered; }
+
+	// Makes the result of the last tessellation the one to render from
+	void SwapBuffers();
+
 	[[nodiscard]] inline std::weak_ptr<ITerrainTessellationPass> GetTessellationScheme() const { return m_TessellationScheme; }
 
+	// Heap IDs of the leaves that survived culling, drawn with the culled indirect arguments (see CULLED_DRAW_*)
+	[[nodiscard]] inline nvrhi::IBuffer* GetCulledNodesBuffer() const { return m_CulledNodesBuffer; }
+	[[nodiscard]] inline nvrhi::IBuffer* GetCulledIndirectArgsBuffer() const { return m_CulledIndirectArgsBuffer; }
+	[[nodiscard]] inline nvrhi::IBuffer* GetTessellationCulledNodesBuffer() const { return m_DoubleBuffered ? m_BackCulledNodesBuffer : m_CulledNodesBuffer; }
+	[[nodiscard]] inline nvrhi::IBuffer* GetTessellationCulledIndirectArgsBuffer() const { return m_DoubleBuffered ? m_BackCulledIndirectArgsBuffer : m_CulledIndirectArgsBuffer; }
+	// Heap IDs of the occluded leaves that passed the occlusion retest of the current frame
+	[[nodiscard]] inline nvrhi::IBuffer* GetDisoccludedNodesBuffer() const { return m_DisoccludedNodesBuffer; }
+
+	[[nodiscard]] inline static uint GetCulledDrawOffset(uint culledDraw) { return sizeof(nvrhi::DrawIndirectArguments) * culledDraw; }
+
+	[[nodiscard]] inline TerrainRenderMode GetRenderMode() const { return m_RenderMode; }
+	// Indexed mesh of the culled leaves, drawn with the materialized indirect arguments (indexed by CULLED_DRAW_*)
+	//  Only created for indexed rendering, and rewritten every frame from the culled leaves of the render buffers
+	[[nodiscard]] inline nvrhi::IBuffer* GetMaterializedVertexBuffer() const { return m_MaterializedVertexBuffer; }
+	[[nodiscard]] inline nvrhi::IBuffer* GetMaterializedIndexBuffer() const { return m_MaterializedIndexBuffer; }
+	[[nodiscard]] inline nvrhi::IBuffer* GetMaterializedIndirectArgsBuffer() const { return m_MaterializedIndirectArgsBuffer; }
+	[[nodiscard]] inline nvrhi::IBuffer* GetVertexHashBuffer() const { return m_VertexHashBuffer; }
+	[[nodiscard]] inline nvrhi::IBuffer* GetMaterializeStateBuffer() const { return m_MaterializeStateBuffer; }
+	// Copy of the dispatch arguments of the state, as the state is written while the passes it dispatches run
+	[[nodiscard]] inline nvrhi::IBuffer* GetMaterializeDispatchArgsBuffer() const { return m_MaterializeDispatchArgsBuffer; }
+	[[nodiscard]] inline uint64_t GetMaterializedLeafCapacity() const { return std::min<uint64_t>(m_MaterializedLeafCapacity, GetMaxLeafCount()); }
+
+	[[nodiscard]] inline static uint GetMaterializedDrawOffset(uint culledDraw) { return sizeof(nvrhi::DrawIndexedIndirectArguments) * culledDraw; }
+
 	[[nodiscard]] inline static uint GetIndirectArgsDispatchOffset() { return 0; }
 	[[nodiscard]] inline static uint GetIndirectArgsDrawOffset() { return sizeof(nvrhi::DispatchIndirectArguments); }
 
@@ -44,8 +142,29 @@ protected:
 
 	uint m_MaxDepth = 8;
 	uint m_InitDepth = 1;
+	TerrainSumReductionMode m_SumReductionMode = TerrainSumReductionMode::Iterative;
+	TerrainTopology m_Topology = TerrainTopology::ConcurrentBinaryTree;
+	uint m_PoolCapacity = 0;
+	bool m_DoubleBuffered = false;
 	nvrhi::BufferHandle m_CBTBuffer;
 	nvrhi::BufferHandle m_IndirectArgsBuffer;
+	nvrhi::BufferHandle m_BackCBTBuffer;
+	nvrhi::BufferHandle m_BackIndirectArgsBuffer;
+	nvrhi::BufferHandle m_FeedbackBuffer;
+	nvrhi::BufferHandle m_BisectorScratchBuffer;
+	nvrhi::BufferHandle m_CulledNodesBuffer;
+	nvrhi::BufferHandle m_CulledIndirectArgsBuffer;
+	nvrhi::BufferHandle m_BackCulledNodesBuffer;
+	nvrhi::BufferHandle m_BackCulledIndirectArgsBuffer;
+	nvrhi::BufferHandle m_DisoccludedNodesBuffer;
+	TerrainRenderMode m_RenderMode = TerrainRenderMode::Instanced;
+	uint m_MaterializedLeafCapacity = 0;
+	nvrhi::BufferHandle m_MaterializedVertexBuffer;
+	nvrhi::BufferHandle m_MaterializedIndexBuffer;
+	nvrhi::BufferHandle m_MaterializedIndirectArgsBuffer;
+	nvrhi::BufferHandle m_VertexHashBuffer;
+	nvrhi::BufferHandle m_MaterializeStateBuffer;
+	nvrhi::BufferHandle m_MaterializeDispatchArgsBuffer;
 
 	std::weak_ptr<ITerrainTessellationPass> m_TessellationScheme;
 };
@@ -58,14 +177,45 @@ struct TerrainMeshInfo : public donut::engine::MeshInfo
 	float HeightmapHeightScale{ 1.0f };
 
 	std::filesystem::path HeightmapTexturePath;
+	// The heightmap is a terrain file (see TerrainFile) rather than an image, detected from the extension of its path
+	bool HeightmapTerrainFile = false;
+	// If set, the heightmap is streamed as a virtual texture instead of loaded from HeightmapTexturePath
+	//  Tiled terrains do not support virtual heightmaps
+	std::shared_ptr<const TerrainVirtualHeightmapDesc> VirtualHeightmapDesc;
 
 	// The terrain effectively requires a different mesh for different types of view as different views will use different tessellation schemes
 	// We store the descriptions of the views we want to create
 	std::vector<TerrainMeshViewDesc> TerrainViews;
 
+	// Tiles of a tiled terrain only (see TerrainTileGrid): the leaves on the edges of the tile are kept at least at this
+	// depth, so that the edges stitch with those of the neighbouring tiles; 0 for terrains that are not tiled
+	uint TileBorderDepth = 0;
+	// Beyond this distance from the camera, the heightmap and the tessellation of the terrain are released until it
+	// comes back within it (see LandscapesScene::UpdateTerrainStreaming); 0 keeps them resident
+	float StreamingDistance = 0.0f;
+
+	// Constants of the terrain shaders, for a heightmap of the given resolution
+	void FillTerrainConstants(TerrainConstants& constants, uint2 heightmapResolution) const;
+
 	// GPU resources
 	std::shared_ptr<donut::engine::LoadedTexture> HeightmapTexture;
+	// Min/max pyramid of the heightmap (see TerrainHeightBoundsPass)
+	nvrhi::TextureHandle HeightBoundsTexture;
+	// Pyramid of the deviation of the heightmap from bilinear patches, same layout as the bounds
+	nvrhi::TextureHandle HeightErrorTexture;
+	// Octahedral normals of the heightmap, with mips (see TerrainNormalMapPass)
+	nvrhi::TextureHandle NormalMapTexture;
 	nvrhi::BufferHandle TerrainCB;
+	// Virtual heightmaps only, whose fallback level is the heightmap texture
+	std::shared_ptr<TerrainVirtualHeightmap> VirtualHeightmap;
+	// Page table, atlas and feedback of the virtual heightmap, or placeholders that the shaders never access otherwise
+	nvrhi::TextureHandle HeightmapPageTable;
+	nvrhi::TextureHandle HeightmapAtlas;
+	// Written by the render passes and by the subdivision, which may run on another queue
+	nvrhi::BufferHandle HeightmapFeedback;
+	nvrhi::BufferHandle HeightmapTessellationFeedback;
+	// Incremented whenever the resident pages of the virtual heightmap change the heights
+	uint64_t HeightsVersion = 0;
 };
 
 
@@ -81,6 +231,13 @@ public:
 
 	void CreateBuffers(nvrhi::IDevice* device, nvrhi::ICommandList* commandList);
 
+	void ReleaseBuffers();
+	// Non-resident instances are neither tessellated nor drawn (see TerrainDrawStrategy)
+	[[nodiscard]] inline bool IsResident() const { return m_Resident; }
+
+	// Swaps the render and tessellation buffers of all double buffered terrain views
+	void SwapBuffers();
+
 	[[nodiscard]] dm::box3 GetLocalBoundingBox() override;
 	[[nodiscard]] std::shared_ptr<SceneGraphLeaf> Clone() override;
 	[[nodiscard]] donut::engine::SceneContentFlags GetContentFlags() const override;
@@ -101,4 +258,40 @@ private:
 
 protected:
 	std::vector<TerrainMeshView> m_TerrainViews;
+	bool m_Resident = false;
+};
+
+
+// A terrain made of a grid of tiles, each a terrain mesh with its own heightmap and tessellation
+//  Neighbouring heightmaps must share their edge texels: the last column of tile (x, y) is the first of tile (x + 1, y),
+//  and its last row the first of tile (x, y + 1)
+struct TerrainTileGrid
+{
+	uint2 GridSize{ 1, 1 };
+	// Row-major, tile (x, y) at index y * GridSize.x + x
+	std::vector<std::shared_ptr<TerrainMeshInfo>> Tiles;
+
+	[[nodiscard]] inline float2 GetTileExtents() const { return Tiles.empty() ? float2(0.0f) : Tiles.front()->HeightmapExtents; }
+};
+
+
+// Instantiates a tiled terrain: loading it attaches a child node with a terrain mesh instance for each tile,
+// placed so that the grid is centered on this node
+class TerrainTileGridInstance : public donut::engine::SceneGraphLeaf
+{
+public:
+	TerrainTileGridInstance() = default;
+	explicit TerrainTileGridInstance(std::shared_ptr<TerrainTileGrid> grid);
+
+	virtual void Load(const Json::Value& node) override;
+
+	[[nodiscard]] std::shared_ptr<SceneGraphLeaf> Clone() override;
+
+	[[nodiscard]] inline const std::shared_ptr<TerrainTileGrid>& GetGrid() const { return m_Grid; }
+
+private:
+	void CreateTiles();
+
+private:
+	std::shared_ptr<TerrainTileGrid> m_Grid;
 };
@@ -0,0 +1,643 @@
+#include "TerrainCpuTessellator.h"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <unordered_map>
+
+#include "libcbt/cbt.h"
+#define LEB_IMPLEMENTATION
+#include "libleb/leb.h"
+
+
+TerrainHeightfield::TerrainHeightfield(uint2 resolution, std::vector<float> heights)
+	: m_Resolution(resolution)
+	, m_Heights(std::move(heights))
+{
+	assert(resolution.x > 0 && resolution.y > 0);
+	assert(m_Heights.size() == static_cast<size_t>(resolution.x) * resolution.y);
+
+	BuildHeightBounds();
+	BuildHeightError();
+}
+
+float TerrainHeightfield::Load(int2 texel) const
+{
+	const int x = std::clamp(texel.x, 0, static_cast<int>(m_Resolution.x) - 1);
+	const int y = std::clamp(texel.y, 0, static_cast<int>(m_Resolution.y) - 1);
+	return m_Heights[static_cast<size_t>(y) * m_Resolution.x + x];
+}
+
+float TerrainHeightfield::Sample(float2 texCoord) const
+{
+	// Texel centers are at half integers, and the addressing clamps to the edge texels
+	const float u = texCoord.x * static_cast<float>(m_Resolution.x) - 0.5f;
+	const float v = texCoord.y * static_cast<float>(m_Resolution.y) - 0.5f;
+	const float x0 = std::floor(u);
+	const float y0 = std::floor(v);
+	const float fx = u - x0;
+	const float fy = v - y0;
+
+	const int2 texel(static_cast<int>(x0), static_cast<int>(y0));
+	const float h00 = Load(texel);
+	const float h10 = Load(int2(texel.x + 1, texel.y));
+	const float h01 = Load(int2(texel.x, texel.y + 1));
+	const float h11 = Load(int2(texel.x + 1, texel.y + 1));
+
+	return lerp(lerp(h00, h10, fx), lerp(h01, h11, fx), fy);
+}
+
+uint2 TerrainHeightfield::GetPyramidSize(uint32_t level) const
+{
+	const uint2 size = max(m_Resolution / 2u, uint2(1u));
+	return uint2(std::max(size.x >> level, 1u), std::max(size.y >> level, 1u));
+}
+
+float2 TerrainHeightfield::LoadHeightBounds(int2 texel, uint32_t level) const
+{
+	const uint2 size = GetPyramidSize(level);
+	return m_BoundsLevels[level][static_cast<size_t>(texel.y) * size.x + texel.x];
+}
+
+float TerrainHeightfield::LoadHeightError(int2 texel, uint32_t level) const
+{
+	const uint2 size = GetPyramidSize(level);
+	return m_ErrorLevels[level][static_cast<size_t>(texel.y) * size.x + texel.x];
+}
+
+void TerrainHeightfield::GetInputTexels(uint2 inputSize, uint2 outputSize, uint2 outputCoord, uint2& firstCoord, uint2& lastCoord)
+{
+	firstCoord = outputCoord * 2u;
+	lastCoord = firstCoord + 1u;
+	if ((inputSize.x & 1) && outputCoord.x == outputSize.x - 1)
+		lastCoord.x++;
+	if ((inputSize.y & 1) && outputCoord.y == outputSize.y - 1)
+		lastCoord.y++;
+	lastCoord = min(lastCoord, inputSize - 1u);
+}
+
+// Same levels as TerrainHeightBoundsPass::BuildPyramid, see HeightBounds.hlsl
+void TerrainHeightfield::BuildHeightBounds()
+{
+	const uint2 size = GetPyramidSize(0);
+	const uint32_t levelCount = static_cast<uint32_t>(std::bit_width(std::max(size.x, size.y)));
+	m_BoundsLevels.resize(levelCount);
+
+	for (uint32_t level = 0; level < levelCount; level++)
+	{
+		const uint2 inputSize = level == 0 ? m_Resolution : GetPyramidSize(level - 1);
+		const uint2 outputSize = GetPyramidSize(level);
+		auto& output = m_BoundsLevels[level];
+		output.resize(static_cast<size_t>(outputSize.x) * outputSize.y);
+
+		const int rowCount = static_cast<int>(outputSize.y);
+#pragma omp parallel for
+		for (int row = 0; row < rowCount; row++)
+		{
+			for (uint32_t column = 0; column < outputSize.x; column++)
+			{
+				uint2 firstCoord, lastCoord;
+				GetInputTexels(inputSize, outputSize, uint2(column, row), firstCoord, lastCoord);
+
+				float2 bounds(std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest());
+				for (uint32_t y = firstCoord.y; y <= lastCoord.y; y++)
+				{
+					for (uint32_t x = firstCoord.x; x <= lastCoord.x; x++)
+					{
+						const float2 input = level == 0
+							? float2(Load(int2(x, y)))
+							: m_BoundsLevels[level - 1][static_cast<size_t>(y) * inputSize.x + x];
+						bounds = float2(std::min(bounds.x, input.x), std::max(bounds.y, input.y));
+					}
+				}
+				output[static_cast<size_t>(row) * outputSize.x + column] = bounds;
+			}
+		}
+	}
+}
+
+void TerrainHeightfield::GetRegionCorners(uint2 outputSize, uint32_t level, uint2 outputCoord, int2& p0, int2& p1) const
+{
+	const int2 heightmapMax = int2(m_Resolution) - 1;
+
+	const int step = 2 << level;
+	p0 = min(int2(outputCoord) * step, heightmapMax);
+	p1 = min(p0 + step, heightmapMax);
+	if (outputCoord.x == outputSize.x - 1)
+		p1.x = heightmapMax.x;
+	if (outputCoord.y == outputSize.y - 1)
+		p1.y = heightmapMax.y;
+}
+
+float TerrainHeightfield::GetDeviation(int2 p0, int2 p1, int2 p) const
+{
+	const float4 corners(Load(p0), Load(int2(p1.x, p0.y)), Load(int2(p0.x, p1.y)), Load(p1));
+	const float2 f = float2(p - p0) / max(float2(p1 - p0), float2(1.0f));
+	const float planar = lerp(lerp(corners.x, corners.y, f.x), lerp(corners.z, corners.w, f.x), f.y);
+	return std::abs(Load(p) - planar);
+}
+
+// Same levels as TerrainHeightBoundsPass::BuildError, see HeightError.hlsl
+void TerrainHeightfield::BuildHeightError()
+{
+	const uint32_t levelCount = GetPyramidLevels();
+	m_ErrorLevels.resize(levelCount);
+
+	for (uint32_t level = 0; level < levelCount; level++)
+	{
+		const uint2 inputSize = level == 0 ? m_Resolution : GetPyramidSize(level - 1);
+		const uint2 outputSize = GetPyramidSize(level);
+		auto& output = m_ErrorLevels[level];
+		output.resize(static_cast<size_t>(outputSize.x) * outputSize.y);
+
+		const int rowCount = static_cast<int>(outputSize.y);
+#pragma omp parallel for
+		for (int row = 0; row < rowCount; row++)
+		{
+			for (uint32_t column = 0; column < outputSize.x; column++)
+			{
+				int2 p0, p1;
+				GetRegionCorners(outputSize, level, uint2(column, row), p0, p1);
+
+				float error = 0.0f;
+				if (level == 0)
+				{
+					for (int y = p0.y; y <= p1.y; y++)
+					{
+						for (int x = p0.x; x <= p1.x; x++)
+						{
+							error = std::max(error, GetDeviation(p0, p1, int2(x, y)));
+						}
+					}
+				}
+				else
+				{
+					uint2 firstCoord, lastCoord;
+					GetInputTexels(inputSize, outputSize, uint2(column, row), firstCoord, lastCoord);
+
+					float childError = 0.0f;
+					for (uint32_t y = firstCoord.y; y <= lastCoord.y; y++)
+					{
+						for (uint32_t x = firstCoord.x; x <= lastCoord.x; x++)
+						{
+							childError = std::max(childError, m_ErrorLevels[level - 1][static_cast<size_t>(y) * inputSize.x + x]);
+						}
+					}
+
+					const int2 mid = (p0 + p1) / 2;
+					error = std::max(error, GetDeviation(p0, p1, int2(mid.x, p0.y)));
+					error = std::max(error, GetDeviation(p0, p1, int2(p0.x, mid.y)));
+					error = std::max(error, GetDeviation(p0, p1, mid));
+					error = std::max(error, GetDeviation(p0, p1, int2(p1.x, mid.y)));
+					error = std::max(error, GetDeviation(p0, p1, int2(mid.x, p1.y)));
+					error += childError;
+				}
+				output[static_cast<size_t>(row) * outputSize.x + column] = error;
+			}
+		}
+	}
+}
+
+
+// The functions below mirror those of the same names in the subdivision shaders (see LEBHelpers.hlsli and
+// TerrainHelpers.hlsli), which they must be kept in sync with
+
+static float GetTerrainHeight(const TerrainHeightfield& heightfield, const TerrainConstants& terrain, float2 texCoord)
+{
+	return heightfield.Sample(texCoord) * terrain.HeightScaleAndInvScale.x;
+}
+
+static float GetTerrainVertexHeight(const TerrainHeightfield& heightfield, const TerrainConstants& terrain, float2 texCoord)
+{
+	if (terrain.TileBorderDepth > 0)
+	{
+		const float epsilon = 1e-6f;
+		const bool onBorderX = texCoord.x <= epsilon || texCoord.x >= 1.0f - epsilon;
+		const bool onBorderY = texCoord.y <= epsilon || texCoord.y >= 1.0f - epsilon;
+
+		if (onBorderX != onBorderY)
+		{
+			const float t = (onBorderX ? texCoord.y : texCoord.x) * terrain.TileBorderSegments;
+			const float segment = std::min(std::floor(t), terrain.TileBorderSegments - 1.0f);
+
+			float2 start = texCoord;
+			float2 end = texCoord;
+			if (onBorderX)
+			{
+				start.y = segment / terrain.TileBorderSegments;
+				end.y = (segment + 1.0f) / terrain.TileBorderSegments;
+			}
+			else
+			{
+				start.x = segment / terrain.TileBorderSegments;
+				end.x = (segment + 1.0f) / terrain.TileBorderSegments;
+			}
+			return lerp(GetTerrainHeight(heightfield, terrain, start), GetTerrainHeight(heightfield, terrain, end), t - segment);
+		}
+	}
+	return GetTerrainHeight(heightfield, terrain, texCoord);
+}
+
+static float3 LEBSpaceToLocalSpace(const TerrainHeightfield& heightfield, const TerrainConstants& terrain, float2 lebPos)
+{
+	const float2 pos = (lebPos - 0.5f) * terrain.TerrainExtentsAndInvExtents.xy();
+	return float3(pos.x, GetTerrainVertexHeight(heightfield, terrain, lebPos), pos.y);
+}
+
+static void DecodeFaceTexCoords(const cbt_Node& node, float2 texCoords[3])
+{
+	// One row per attribute, one column per vertex: (0, 1), (0, 0) and (1, 0)
+	float attributeArray[2][3] = {
+		{ 0.0f, 0.0f, 1.0f },
+		{ 1.0f, 0.0f, 0.0f }
+	};
+	leb_DecodeNodeAttributeArray(node, 2, attributeArray);
+
+	for (int i = 0; i < 3; i++)
+	{
+		texCoords[i] = float2(attributeArray[0][i], attributeArray[1][i]);
+	}
+}
+
+static void DecodeNodeTexCoordBounds(const cbt_Node& node, float2& lebMin, float2& lebMax)
+{
+	float2 texCoords[3];
+	DecodeFaceTexCoords(node, texCoords);
+
+	lebMin = min(min(texCoords[0], texCoords[1]), texCoords[2]);
+	lebMax = max(max(texCoords[0], texCoords[1]), texCoords[2]);
+}
+
+static bool TouchesTileBorder(const TerrainConstants& terrain, float2 lebMin, float2 lebMax)
+{
+	return terrain.TileBorderDepth > 0 && (lebMin.x <= 0.0f || lebMin.y <= 0.0f || lebMax.x >= 1.0f || lebMax.y >= 1.0f);
+}
+
+static bool IsTileBorderNode(const TerrainConstants& terrain, const cbt_Node& node)
+{
+	if (static_cast<uint32_t>(node.depth) >= terrain.TileBorderDepth)
+		return false;
+
+	float2 lebMin, lebMax;
+	DecodeNodeTexCoordBounds(node, lebMin, lebMax);
+	return TouchesTileBorder(terrain, lebMin, lebMax);
+}
+
+static uint32_t GetHeightPyramidTexels(const TerrainHeightfield& heightfield, const TerrainConstants& terrain,
+	float2 texCoordMin, float2 texCoordMax, int2& texelMin, int2& texelMax)
+{
+	const int2 resolution = int2(terrain.HeightPyramidResolution);
+	const float2 resolutionF = float2(resolution);
+
+	texelMin = clamp(int2(floor(texCoordMin * resolutionF - 0.5f)), int2(0), resolution - 1);
+	texelMax = clamp(int2(floor(texCoordMax * resolutionF - 0.5f)) + 1, int2(0), resolution - 1);
+
+	// Mip 0 of the pyramids is half the resolution of the heightmap
+	texelMin = int2(texelMin.x >> 1, texelMin.y >> 1);
+	texelMax = int2(texelMax.x >> 1, texelMax.y >> 1);
+
+	// See GetPyramidLevel (PyramidHelpers.hlsli)
+	const int2 texelExtent = texelMax - texelMin;
+	const uint32_t extent = static_cast<uint32_t>(std::max(std::max(texelExtent.x, texelExtent.y), 1) - 1);
+	const uint32_t level = std::min(static_cast<uint32_t>(std::bit_width(extent)), heightfield.GetPyramidLevels() - 1);
+	texelMin = int2(texelMin.x >> level, texelMin.y >> level);
+	texelMax = int2(texelMax.x >> level, texelMax.y >> level);
+
+	// The last texel of a level covers the remainder of an odd size
+	const int2 maxTexel = int2(heightfield.GetPyramidSize(level)) - 1;
+	texelMin = min(texelMin, maxTexel);
+	texelMax = min(texelMax, maxTexel);
+
+	return level;
+}
+
+static float2 GetTerrainHeightBounds(const TerrainHeightfield& heightfield, const TerrainConstants& terrain, float2 texCoordMin, float2 texCoordMax)
+{
+	int2 texelMin, texelMax;
+	const uint32_t level = GetHeightPyramidTexels(heightfield, terrain, texCoordMin, texCoordMax, texelMin, texelMax);
+
+	const float2 b0 = heightfield.LoadHeightBounds(int2(texelMin.x, texelMin.y), level);
+	const float2 b1 = heightfield.LoadHeightBounds(int2(texelMax.x, texelMin.y), level);
+	const float2 b2 = heightfield.LoadHeightBounds(int2(texelMin.x, texelMax.y), level);
+	const float2 b3 = heightfield.LoadHeightBounds(int2(texelMax.x, texelMax.y), level);
+
+	const float2 bounds = float2(std::min(std::min(b0.x, b1.x), std::min(b2.x, b3.x)), std::max(std::max(b0.y, b1.y), std::max(b2.y, b3.y)))
+		+ float2(-terrain.HeightBoundsMargin, terrain.HeightBoundsMargin);
+	return bounds * terrain.HeightScaleAndInvScale.x;
+}
+
+static void DecodeNodeBounds(const TerrainHeightfield& heightfield, const TerrainConstants& terrain, const cbt_Node& node,
+	const affine3& transform, float3& bmin, float3& bmax)
+{
+	float2 lebMin, lebMax;
+	DecodeNodeTexCoordBounds(node, lebMin, lebMax);
+
+	float2 heightMin = lebMin, heightMax = lebMax;
+	if (TouchesTileBorder(terrain, lebMin, lebMax))
+	{
+		heightMin = floor(lebMin * terrain.TileBorderSegments) / terrain.TileBorderSegments;
+		heightMax = ceil(lebMax * terrain.TileBorderSegments) / terrain.TileBorderSegments;
+	}
+	const float2 heightBounds = GetTerrainHeightBounds(heightfield, terrain, heightMin, heightMax);
+
+	const float2 localMin = (lebMin - 0.5f) * terrain.TerrainExtentsAndInvExtents.xy();
+	const float2 localMax = (lebMax - 0.5f) * terrain.TerrainExtentsAndInvExtents.xy();
+	const float3 localCenter = 0.5f * float3(localMin.x + localMax.x, heightBounds.x + heightBounds.y, localMin.y + localMax.y);
+	const float3 localExtent = 0.5f * float3(localMax.x - localMin.x, heightBounds.y - heightBounds.x, localMax.y - localMin.y);
+
+	const float3 center = localCenter * transform.m_linear + transform.m_translation;
+	const float3 extent = localExtent.x * abs(transform.m_linear[0]) + localExtent.y * abs(transform.m_linear[1]) + localExtent.z * abs(transform.m_linear[2]);
+
+	bmin = center - extent;
+	bmax = center + extent;
+}
+
+// See FrustumCulling.hlsli
+static bool FrustumCullingTest(const float4 planes[6], const float3& bmin, const float3& bmax)
+{
+	for (int i = 0; i < 6; ++i)
+	{
+		const float4& plane = planes[i];
+		const float3 p(plane.x >= 0.0f ? bmin.x : bmax.x, plane.y >= 0.0f ? bmin.y : bmax.y, plane.z >= 0.0f ? bmin.z : bmax.z);
+
+		if (dot(p, plane.xyz()) > plane.w)
+			return false;
+	}
+
+	return true;
+}
+
+static float TriangleLevelOfDetail_Perspective(const TerrainCpuTessellator::Parameters& parameters, const float3 faceVertices[3])
+{
+	const float4x4& worldToView = parameters.Subdivision.view.matWorldToView;
+	const float3 v0 = (float4(faceVertices[0], 1.0f) * worldToView).xyz();
+	const float3 v2 = (float4(faceVertices[2], 1.0f) * worldToView).xyz();
+
+	const float sqrMagSum = dot(v0, v0) + dot(v2, v2);
+	const float twoDotAC = 2.0f * dot(v0, v2);
+	const float distanceToEdgeSqr = sqrMagSum + twoDotAC;
+	const float edgeLengthSqr = sqrMagSum - twoDotAC;
+
+	return parameters.Subdivision.lodFactor + std::log2(edgeLengthSqr / distanceToEdgeSqr);
+}
+
+static float TriangleLevelOfDetail_Orthographic(const TerrainCpuTessellator::Parameters& parameters, const float3 faceVertices[3])
+{
+	const float4x4& worldToView = parameters.Subdivision.view.matWorldToView;
+	const float2 v0 = (float4(faceVertices[0], 1.0f) * worldToView).xy();
+	const float2 v2 = (float4(faceVertices[2], 1.0f) * worldToView).xy();
+	const float2 edgeVector = v2 - v0;
+
+	return parameters.Subdivision.lodFactor + std::log2(dot(edgeVector, edgeVector));
+}
+
+static float TriangleLevelOfDetail_Geometric(const TerrainHeightfield& heightfield, const TerrainCpuTessellator::Parameters& parameters,
+	const cbt_Node& node, const float3& bmin, const float3& bmax)
+{
+	const TerrainConstants& terrain = parameters.Terrain;
+
+	float2 lebMin, lebMax;
+	DecodeNodeTexCoordBounds(node, lebMin, lebMax);
+
+	const float2 texelExtent = (lebMax - lebMin) * terrain.HeightmapResolutionAndInvResolution.xy();
+	if (std::max(texelExtent.x, texelExtent.y) <= 1.0f)
+	{
+		return 1.0f;
+	}
+
+	int2 texelMin, texelMax;
+	const uint32_t level = GetHeightPyramidTexels(heightfield, terrain, lebMin, lebMax, texelMin, texelMax);
+	float error = std::max(
+		std::max(heightfield.LoadHeightError(int2(texelMin.x, texelMin.y), level), heightfield.LoadHeightError(int2(texelMax.x, texelMin.y), level)),
+		std::max(heightfield.LoadHeightError(int2(texelMin.x, texelMax.y), level), heightfield.LoadHeightError(int2(texelMax.x, texelMax.y), level)));
+
+	// The vertical axis of the instance is the second row of the linear part
+	error *= terrain.HeightScaleAndInvScale.x * length(parameters.LocalToWorld.m_linear[1]);
+
+	const float3 cameraPosition = parameters.Subdivision.view.matViewToWorld[3].xyz();
+	const float3 offset = max(max(bmin - cameraPosition, cameraPosition - bmax), float3(0.0f));
+	const float distance = std::max(length(offset), 1e-3f);
+
+	return parameters.Subdivision.lodFactor + std::log2(error / distance);
+}
+
+static float LevelOfDetail(const TerrainHeightfield& heightfield, const TerrainCpuTessellator::Parameters& parameters, const cbt_Node& node)
+{
+	const TerrainConstants& terrain = parameters.Terrain;
+
+	if (IsTileBorderNode(terrain, node))
+	{
+		return 2.0f;
+	}
+
+	float3 bmin, bmax;
+	DecodeNodeBounds(heightfield, terrain, node, parameters.LocalToWorld, bmin, bmax);
+
+	if (!FrustumCullingTest(parameters.Subdivision.viewEx.viewFrustum, bmin, bmax))
+	{
+		return 0.0f;
+	}
+
+	if (parameters.LodScheme == LOD_SCHEME_GEOMETRIC)
+	{
+		return TriangleLevelOfDetail_Geometric(heightfield, parameters, node, bmin, bmax);
+	}
+
+	float2 texCoords[3];
+	DecodeFaceTexCoords(node, texCoords);
+
+	float3 faceVertices[3];
+	for (int i = 0; i < 3; i++)
+	{
+		faceVertices[i] = LEBSpaceToLocalSpace(heightfield, terrain, texCoords[i]) * parameters.LocalToWorld.m_linear + parameters.LocalToWorld.m_translation;
+	}
+	return parameters.LodScheme == LOD_SCHEME_ORTHOGRAPHIC
+		? TriangleLevelOfDetail_Orthographic(parameters, faceVertices)
+		: TriangleLevelOfDetail_Perspective(parameters, faceVertices);
+}
+
+
+TerrainCpuTessellator::TerrainCpuTessellator(uint32_t maxDepth, uint32_t initDepth)
+{
+	m_Tree = cbt_CreateAtDepth(maxDepth, initDepth);
+}
+
+TerrainCpuTessellator::~TerrainCpuTessellator()
+{
+	cbt_Release(m_Tree);
+}
+
+void TerrainCpuTessellator::Reset(uint32_t initDepth)
+{
+	cbt_ResetToDepth(m_Tree, initDepth);
+}
+
+bool TerrainCpuTessellator::SetHeap(const void* heap, size_t byteSize)
+{
+	if (byteSize != GetHeapByteSize())
+		return false;
+
+	// The heap holds the sum reduction as well, so the tree is complete once copied
+	std::memcpy(const_cast<char*>(cbt_GetHeap(m_Tree)), heap, byteSize);
+	return true;
+}
+
+const void* TerrainCpuTessellator::GetHeap() const
+{
+	return cbt_GetHeap(m_Tree);
+}
+
+size_t TerrainCpuTessellator::GetHeapByteSize() const
+{
+	return static_cast<size_t>(cbt_HeapByteSize(m_Tree));
+}
+
+uint32_t TerrainCpuTessellator::GetMaxDepth() const
+{
+	return static_cast<uint32_t>(cbt_MaxDepth(m_Tree));
+}
+
+uint64_t TerrainCpuTessellator::GetLeafCount() const
+{
+	return static_cast<uint64_t>(cbt_NodeCount(m_Tree));
+}
+
+std::vector<uint64_t> TerrainCpuTessellator::GetLeafHeapIDs() const
+{
+	const int nodeCount = static_cast<int>(cbt_NodeCount(m_Tree));
+	std::vector<uint64_t> heapIDs(nodeCount);
+
+#pragma omp parallel for
+	for (int handle = 0; handle < nodeCount; handle++)
+	{
+		heapIDs[handle] = cbt_DecodeNode(m_Tree, handle).id;
+	}
+
+	return heapIDs;
+}
+
+bool TerrainCpuTessellator::Split(const TerrainHeightfield& heightfield, const Parameters& parameters)
+{
+	const int nodeCount = static_cast<int>(cbt_NodeCount(m_Tree));
+	std::vector<cbt_Node> nodes(nodeCount);
+	std::vector<uint8_t> splits(nodeCount);
+
+	// The decisions only read the tree, so they are made concurrently as on the GPU
+#pragma omp parallel for schedule(dynamic, 256)
+	for (int handle = 0; handle < nodeCount; handle++)
+	{
+		const cbt_Node node = cbt_DecodeNode(m_Tree, handle);
+		nodes[handle] = node;
+		splits[handle] = LevelOfDetail(heightfield, parameters, node) > 1.0f && !cbt_IsCeilNode(m_Tree, node);
+	}
+
+	// Splits only set bits of the heap, so their order does not change the result
+	bool changed = false;
+	for (int handle = 0; handle < nodeCount; handle++)
+	{
+		if (splits[handle])
+		{
+			leb_SplitNode(m_Tree, nodes[handle]);
+			changed = true;
+		}
+	}
+
+	cbt_ComputeSumReduction(m_Tree);
+	return changed;
+}
+
+// Same test as leb_MergeNode, which leaves a diamond as it is unless the four children of its parents are all leaves
+//  The test reads the sums of the last reduction, which the merges of a pass do not update, so the decisions of the
+//  pass can be made before any of its merges
+static bool IsDiamondMergeable(const cbt_Tree* tree, const cbt_Node& node, const leb_DiamondParent& diamondParent)
+{
+	const cbt_Node sibling = cbt_CreateNode(node.id ^ 1u, node.depth);
+	const cbt_Node topChild = cbt_CreateNode(diamondParent.top.id << 1u, node.depth);
+	const cbt_Node topSibling = cbt_CreateNode((diamondParent.top.id << 1u) | 1u, node.depth);
+
+	return cbt_HeapRead(tree, sibling) == 1u && cbt_HeapRead(tree, topChild) == 1u && cbt_HeapRead(tree, topSibling) == 1u;
+}
+
+bool TerrainCpuTessellator::Merge(const TerrainHeightfield& heightfield, const Parameters& parameters)
+{
+	const int nodeCount = static_cast<int>(cbt_NodeCount(m_Tree));
+	std::vector<cbt_Node> nodes(nodeCount);
+	std::vector<leb_DiamondParent> diamondParents(nodeCount);
+	std::vector<uint8_t> merges(nodeCount);
+
+#pragma omp parallel for schedule(dynamic, 256)
+	for (int handle = 0; handle < nodeCount; handle++)
+	{
+		const cbt_Node node = cbt_DecodeNode(m_Tree, handle);
+		const leb_DiamondParent diamondParent = leb_DecodeDiamondParent(node);
+		nodes[handle] = node;
+		diamondParents[handle] = diamondParent;
+
+		const bool mergeBase = LevelOfDetail(heightfield, parameters, diamondParent.base) < 1.0f;
+		const bool mergeTop = LevelOfDetail(heightfield, parameters, diamondParent.top) < 1.0f;
+		merges[handle] = mergeTop && mergeBase && !cbt_IsRootNode(node) && IsDiamondMergeable(m_Tree, node, diamondParent);
+	}
+
+	// Only merges that leb_MergeNode carries out are kept, so a diamond blocked by a deeper child is not a change, as
+	// on the GPU (see IsDiamondMergeable in Subdivision.hlsl)
+	bool changed = false;
+	for (int handle = 0; handle < nodeCount; handle++)
+	{
+		if (merges[handle])
+		{
+			leb_MergeNode(m_Tree, nodes[handle], diamondParents[handle]);
+			changed = true;
+		}
+	}
+
+	cbt_ComputeSumReduction(m_Tree);
+	return changed;
+}
+
+uint32_t TerrainCpuTessellator::Converge(const TerrainHeightfield& heightfield, const Parameters& parameters, uint32_t maxIterations)
+{
+	uint32_t iteration = 0;
+	while (iteration < maxIterations)
+	{
+		const bool split = Split(heightfield, parameters);
+		const bool merged = Merge(heightfield, parameters);
+		if (!split && !merged)
+			break;
+
+		iteration++;
+	}
+	return iteration;
+}
+
+void TerrainCpuTessellator::BuildMesh(const TerrainHeightfield& heightfield, const TerrainConstants& terrain, std::vector<float3>& vertices, std::vector<uint32_t>& indices) const
+{
+	const int64_t nodeCount = cbt_NodeCount(m_Tree);
+
+	vertices.clear();
+	indices.clear();
+	indices.reserve(3 * nodeCount);
+
+	// LEB vertices are dyadic fractions, so a shared vertex decodes to the same bits from every leaf
+	std::unordered_map<uint64_t, uint32_t> vertexIndices;
+	vertexIndices.reserve(nodeCount);
+
+	for (int64_t handle = 0; handle < nodeCount; handle++)
+	{
+		float2 texCoords[3];
+		DecodeFaceTexCoords(cbt_DecodeNode(m_Tree, handle), texCoords);
+
+		for (const float2& texCoord : texCoords)
+		{
+			const uint64_t key = (static_cast<uint64_t>(std::bit_cast<uint32_t>(texCoord.x)) << 32) | std::bit_cast<uint32_t>(texCoord.y);
+			auto [it, inserted] = vertexIndices.try_emplace(key, static_cast<uint32_t>(vertices.size()));
+			if (inserted)
+			{
+				vertices.push_back(LEBSpaceToLocalSpace(heightfield, terrain, texCoord));
+			}
+			indices.push_back(it->second);
+		}
+	}
+}
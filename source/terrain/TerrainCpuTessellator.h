@@ -0,0 +1,104 @@
+#pragma once
+
+#include <donut/core/math/math.h>
+
+#include <cstdint>
+#include <vector>
+
+using namespace donut::math;
+
+#include "TerrainShaders.h"
+
+
+struct cbt_Tree;
+
+
+// Heights of a terrain on the CPU, read the way the subdivision shaders read the heightmap and its pyramids
+//  Heights are normalized (as sampled from the heightmap texture), and sampled bilinearly with clamping
+//  The height bounds and height error pyramids have the same layout as those of TerrainHeightBoundsPass
+class TerrainHeightfield
+{
+public:
+    TerrainHeightfield(uint2 resolution, std::vector<float> heights);
+
+    [[nodiscard]] inline uint2 GetResolution() const { return m_Resolution; }
+
+    [[nodiscard]] float Load(int2 texel) const;
+    [[nodiscard]] float Sample(float2 texCoord) const;
+
+    [[nodiscard]] inline uint32_t GetPyramidLevels() const { return static_cast<uint32_t>(m_BoundsLevels.size()); }
+    [[nodiscard]] uint2 GetPyramidSize(uint32_t level) const;
+    [[nodiscard]] float2 LoadHeightBounds(int2 texel, uint32_t level) const;
+    [[nodiscard]] float LoadHeightError(int2 texel, uint32_t level) const;
+
+private:
+    void BuildHeightBounds();
+    void BuildHeightError();
+
+    // Range of texels of the level below reduced into a texel, see GetInputTexels (HeightPyramidHelpers.hlsli)
+    static void GetInputTexels(uint2 inputSize, uint2 outputSize, uint2 outputCoord, uint2& firstCoord, uint2& lastCoord);
+    void GetRegionCorners(uint2 outputSize, uint32_t level, uint2 outputCoord, int2& p0, int2& p1) const;
+    [[nodiscard]] float GetDeviation(int2 p0, int2 p1, int2 p) const;
+
+private:
+    uint2 m_Resolution;
+    std::vector<float> m_Heights;
+
+    std::vector<std::vector<float2>> m_BoundsLevels;
+    std::vector<std::vector<float>> m_ErrorLevels;
+};
+
+
+// Runs the subdivision of Subdivision.hlsl on a CBT in system memory, with the libcbt and libleb C implementations
+//  The level of detail of the nodes is evaluated on all cores, against the tree as it was before the pass like the
+//  GPU, and the splits and merges are applied once every node was evaluated
+//  Serves as a reference for the GPU tessellation, and tessellates terrains for the CPU, e.g. collision or navigation
+// Only the CBT topology is implemented, and nodes are never occlusion culled as the CPU has no occlusion pyramid
+class TerrainCpuTessellator
+{
+public:
+    // Everything the subdivision depends on besides the heights, as bound to the subdivision shaders
+    struct Parameters
+    {
+        SubdivisionConstants Subdivision{};
+        TerrainConstants Terrain{};
+        // The transform of the instance
+        affine3 LocalToWorld = affine3::identity();
+        // LOD_SCHEME_*
+        uint32_t LodScheme = LOD_SCHEME_PERSPECTIVE;
+    };
+
+public:
+    // Same depths as TerrainMeshViewDesc
+    TerrainCpuTessellator(uint32_t maxDepth, uint32_t initDepth);
+    ~TerrainCpuTessellator();
+
+    TerrainCpuTessellator(const TerrainCpuTessellator&) = delete;
+    TerrainCpuTessellator& operator=(const TerrainCpuTessellator&) = delete;
+
+    void Reset(uint32_t initDepth);
+
+    // The heap of a CBT buffer, e.g. read back from the GPU; returns false if its size does not match the tree
+    bool SetHeap(const void* heap, size_t byteSize);
+    [[nodiscard]] const void* GetHeap() const;
+    [[nodiscard]] size_t GetHeapByteSize() const;
+
+    [[nodiscard]] uint32_t GetMaxDepth() const;
+    [[nodiscard]] uint64_t GetLeafCount() const;
+    [[nodiscard]] std::vector<uint64_t> GetLeafHeapIDs() const;
+
+    // One subdivision pass, as split_cs and merge_cs followed by the sum reduction
+    //  Returns true if any node was split or merged, as the TessellationFeedback of the GPU
+    bool Split(const TerrainHeightfield& heightfield, const Parameters& parameters);
+    bool Merge(const TerrainHeightfield& heightfield, const Parameters& parameters);
+
+    // Alternates splits and merges until a split and a merge leave the tree unchanged, or maxIterations of each ran
+    //  Returns the number of iterations that changed the tree
+    uint32_t Converge(const TerrainHeightfield& heightfield, const Parameters& parameters, uint32_t maxIterations = 64);
+
+    // Triangle mesh of the leaves in the local space of the terrain, with the vertices shared between leaves
+    void BuildMesh(const TerrainHeightfield& heightfield, const TerrainConstants& terrain, std::vector<float3>& vertices, std::vector<uint32_t>& indices) const;
+
+private:
+    cbt_Tree* m_Tree = nullptr;
+};
@@ -0,0 +1,340 @@
+#include "TerrainFile.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include <donut/core/log.h>
+
+#ifdef WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace donut;
+
+
+TerrainFile::~TerrainFile()
+{
+	Close();
+}
+
+bool TerrainFile::HasExtension(const std::filesystem::path& path)
+{
+	return path.extension() == Extension;
+}
+
+nvrhi::Format TerrainFile::GetTextureFormat(TerrainFileFormat format)
+{
+	switch (format)
+	{
+	case TerrainFileFormat::R16_UNORM: return nvrhi::Format::R16_UNORM;
+	case TerrainFileFormat::R32_FLOAT: return nvrhi::Format::R32_FLOAT;
+	case TerrainFileFormat::RG32_FLOAT: return nvrhi::Format::RG32_FLOAT;
+	case TerrainFileFormat::RG16_SNORM: return nvrhi::Format::RG16_SNORM;
+	default: return nvrhi::Format::UNKNOWN;
+	}
+}
+
+bool TerrainFile::Open(const std::filesystem::path& path)
+{
+	Close();
+
+#ifdef WIN32
+	HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	LARGE_INTEGER size;
+	if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &size))
+	{
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+		log::warning("Cannot open the terrain file '%s'", path.generic_string().c_str());
+		return false;
+	}
+	m_File = file;
+	m_Size = static_cast<uint64_t>(size.QuadPart);
+
+	m_Mapping = m_Size > 0 ? CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+	m_Data = m_Mapping ? static_cast<const uint8_t*>(MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+#else
+	m_File = open(path.c_str(), O_RDONLY);
+	struct stat status;
+	if (m_File < 0 || fstat(m_File, &status) != 0)
+	{
+		log::warning("Cannot open the terrain file '%s'", path.generic_string().c_str());
+		Close();
+		return false;
+	}
+	m_Size = static_cast<uint64_t>(status.st_size);
+
+	if (m_Size > 0)
+	{
+		void* data = mmap(nullptr, m_Size, PROT_READ, MAP_PRIVATE, m_File, 0);
+		if (data != MAP_FAILED)
+		{
+			// The tiles are read once, in order
+			madvise(data, m_Size, MADV_SEQUENTIAL);
+			m_Data = static_cast<const uint8_t*>(data);
+		}
+	}
+#endif
+
+	if (!m_Data)
+	{
+		log::warning("Cannot map the terrain file '%s'", path.generic_string().c_str());
+		Close();
+		return false;
+	}
+
+	if (!Validate(path))
+	{
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+void TerrainFile::Prefetch() const
+{
+	// A read per page faults it in; storing their sum keeps the reads from being optimized away
+	uint8_t sum = 0;
+	for (uint64_t offset = 0; offset < m_Size; offset += TerrainFileAlignment)
+	{
+		sum ^= m_Data[offset];
+	}
+	[[maybe_unused]] volatile uint8_t sink = sum;
+}
+
+void TerrainFile::Close()
+{
+#ifdef WIN32
+	if (m_Data)
+		UnmapViewOfFile(m_Data);
+	if (m_Mapping)
+		CloseHandle(m_Mapping);
+	if (m_File)
+		CloseHandle(m_File);
+	m_Mapping = nullptr;
+	m_File = nullptr;
+#else
+	if (m_Data)
+		munmap(const_cast<uint8_t*>(m_Data), m_Size);
+	if (m_File >= 0)
+		close(m_File);
+	m_File = -1;
+#endif
+	m_Data = nullptr;
+	m_Size = 0;
+}
+
+std::span<const TerrainFileLayerDesc> TerrainFile::GetLayers() const
+{
+	return { reinterpret_cast<const TerrainFileLayerDesc*>(m_Data + sizeof(TerrainFileHeader)), GetHeader().LayerCount };
+}
+
+const TerrainFileLayerDesc* TerrainFile::FindLayer(TerrainFileLayer layer) const
+{
+	for (const TerrainFileLayerDesc& desc : GetLayers())
+	{
+		if (desc.Layer == layer)
+			return &desc;
+	}
+	return nullptr;
+}
+
+std::span<const TerrainFileTile> TerrainFile::GetTiles(const TerrainFileLayerDesc& layer) const
+{
+	const auto* tiles = reinterpret_cast<const TerrainFileTile*>(m_Data + sizeof(TerrainFileHeader)
+		+ static_cast<size_t>(GetHeader().LayerCount) * sizeof(TerrainFileLayerDesc));
+	return { tiles + layer.FirstTile, layer.TileCount };
+}
+
+bool TerrainFile::Validate(const std::filesystem::path& path) const
+{
+	const std::string pathStr = path.generic_string();
+
+	if (m_Size < sizeof(TerrainFileHeader))
+	{
+		log::warning("The terrain file '%s' is truncated", pathStr.c_str());
+		return false;
+	}
+
+	const TerrainFileHeader& header = GetHeader();
+	if (header.Magic != TerrainFileMagic)
+	{
+		log::warning("'%s' is not a terrain file", pathStr.c_str());
+		return false;
+	}
+
+	if (header.Version != TerrainFileVersion)
+	{
+		log::warning("The terrain file '%s' has version %u, only version %u is supported", pathStr.c_str(), header.Version, TerrainFileVersion);
+		return false;
+	}
+
+	if (header.TileSize == 0 || header.LayerCount > static_cast<uint32_t>(TerrainFileLayer::Count))
+	{
+		log::warning("The terrain file '%s' has an invalid header (tiles of %u, %u layers)", pathStr.c_str(), header.TileSize, header.LayerCount);
+		return false;
+	}
+
+	if (sizeof(TerrainFileHeader) + static_cast<uint64_t>(header.LayerCount) * sizeof(TerrainFileLayerDesc) > m_Size)
+	{
+		log::warning("The layers of the terrain file '%s' are truncated", pathStr.c_str());
+		return false;
+	}
+
+	if (!FindLayer(TerrainFileLayer::Height))
+	{
+		log::warning("The terrain file '%s' has no heights", pathStr.c_str());
+		return false;
+	}
+
+	uint64_t tileCount = 0;
+	for (const TerrainFileLayerDesc& layer : GetLayers())
+	{
+		tileCount = std::max(tileCount, static_cast<uint64_t>(layer.FirstTile) + layer.TileCount);
+	}
+
+	if (sizeof(TerrainFileHeader) + header.LayerCount * sizeof(TerrainFileLayerDesc) + tileCount * sizeof(TerrainFileTile) > m_Size)
+	{
+		log::warning("The tile index of the terrain file '%s' is truncated", pathStr.c_str());
+		return false;
+	}
+
+	for (const TerrainFileLayerDesc& layer : GetLayers())
+	{
+		if (!ValidateLayer(pathStr, layer))
+			return false;
+	}
+
+	return true;
+}
+
+bool TerrainFile::ValidateLayer(const std::string& path, const TerrainFileLayerDesc& layer) const
+{
+	const TerrainFileHeader& header = GetHeader();
+	const uint32_t layerIndex = static_cast<uint32_t>(layer.Layer);
+
+	const uint32_t bytesPerTexel = GetTerrainFileBytesPerTexel(layer.Format);
+	if (layer.Layer >= TerrainFileLayer::Count || bytesPerTexel == 0)
+	{
+		log::warning("The terrain file '%s' has an unknown layer (%u) or format (%u)", path.c_str(), layerIndex, static_cast<uint32_t>(layer.Format));
+		return false;
+	}
+
+	// A full mip chain ends at a single texel
+	uint32_t maxMipLevels = 1;
+	while ((std::max(layer.Width, layer.Height) >> maxMipLevels) > 0)
+		maxMipLevels++;
+
+	if (layer.Width == 0 || layer.Height == 0 || layer.MipLevels == 0 || layer.MipLevels > maxMipLevels)
+	{
+		log::warning("Layer %u of the terrain file '%s' has an invalid size (%ux%u, %u mip levels)",
+			layerIndex, path.c_str(), layer.Width, layer.Height, layer.MipLevels);
+		return false;
+	}
+
+	// Texels covered in each mip level; tiles do not overlap as long as they are aligned to the tile grid
+	std::vector<uint64_t> coverage(layer.MipLevels, 0);
+	for (const TerrainFileTile& tile : GetTiles(layer))
+	{
+		const uint32_t mipWidth = std::max(layer.Width >> tile.MipLevel, 1u);
+		const uint32_t mipHeight = std::max(layer.Height >> tile.MipLevel, 1u);
+		const uint64_t byteSize = static_cast<uint64_t>(tile.Width) * tile.Height * bytesPerTexel;
+
+		const bool valid = tile.MipLevel < layer.MipLevels
+			&& tile.X % header.TileSize == 0 && tile.Y % header.TileSize == 0
+			&& tile.Width > 0 && tile.Width <= header.TileSize && tile.X + tile.Width <= mipWidth
+			&& tile.Height > 0 && tile.Height <= header.TileSize && tile.Y + tile.Height <= mipHeight
+			&& tile.Offset % TerrainFileAlignment == 0 && tile.Offset <= m_Size && byteSize <= m_Size - tile.Offset;
+		if (!valid)
+		{
+			log::warning("Layer %u of the terrain file '%s' has an invalid tile (mip %u at %u, %u)",
+				layerIndex, path.c_str(), tile.MipLevel, tile.X, tile.Y);
+			return false;
+		}
+
+		coverage[tile.MipLevel] += static_cast<uint64_t>(tile.Width) * tile.Height;
+	}
+
+	for (uint32_t mip = 0; mip < layer.MipLevels; mip++)
+	{
+		const uint64_t mipTexels = static_cast<uint64_t>(std::max(layer.Width >> mip, 1u)) * std::max(layer.Height >> mip, 1u);
+		if (coverage[mip] != mipTexels)
+		{
+			log::warning("The tiles of layer %u of the terrain file '%s' do not cover mip level %u", layerIndex, path.c_str(), mip);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+nvrhi::TextureHandle TerrainFile::CreateTexture(nvrhi::IDevice* device, nvrhi::ICommandList* commandList,
+	const TerrainFileLayerDesc& layer, const char* debugName, bool isUAV) const
+{
+	const uint32_t bytesPerTexel = GetTerrainFileBytesPerTexel(layer.Format);
+
+	nvrhi::TextureDesc textureDesc;
+	textureDesc.setWidth(layer.Width)
+		.setHeight(layer.Height)
+		.setMipLevels(layer.MipLevels)
+		.setFormat(GetTextureFormat(layer.Format))
+		.setDebugName(debugName);
+
+	nvrhi::StagingTextureHandle stagingTexture = device->createStagingTexture(textureDesc, nvrhi::CpuAccessMode::Write);
+	if (!stagingTexture)
+		return nullptr;
+
+	textureDesc.setInitialState(nvrhi::ResourceStates::ShaderResource)
+		.setKeepInitialState(true)
+		.setIsUAV(isUAV);
+	nvrhi::TextureHandle texture = device->createTexture(textureDesc);
+	if (!texture)
+		return nullptr;
+
+	const std::span<const TerrainFileTile> tiles = GetTiles(layer);
+	for (uint32_t mip = 0; mip < layer.MipLevels; mip++)
+	{
+		const nvrhi::TextureSlice slice = nvrhi::TextureSlice().setMipLevel(mip);
+
+		size_t rowPitch = 0;
+		uint8_t* mapped = static_cast<uint8_t*>(device->mapStagingTexture(stagingTexture, slice, nvrhi::CpuAccessMode::Write, &rowPitch));
+		if (!mapped)
+			return nullptr;
+
+		// Touching the pages of the file is what loading costs, so the tiles are copied in parallel
+		const int tileCount = static_cast<int>(tiles.size());
+#pragma omp parallel for
+		for (int tileIndex = 0; tileIndex < tileCount; tileIndex++)
+		{
+			const TerrainFileTile& tile = tiles[tileIndex];
+			if (tile.MipLevel != mip)
+				continue;
+
+			const size_t tileRowBytes = static_cast<size_t>(tile.Width) * bytesPerTexel;
+			const uint8_t* src = static_cast<const uint8_t*>(GetTileData(tile));
+			uint8_t* dst = mapped + tile.Y * rowPitch + static_cast<size_t>(tile.X) * bytesPerTexel;
+			for (uint32_t row = 0; row < tile.Height; row++)
+			{
+				std::memcpy(dst + row * rowPitch, src + row * tileRowBytes, tileRowBytes);
+			}
+		}
+
+		device->unmapStagingTexture(stagingTexture);
+		commandList->copyTexture(texture, slice, stagingTexture, slice);
+	}
+
+	return texture;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <nvrhi/nvrhi.h>
+
+#include <filesystem>
+#include <span>
+#include <string>
+
+#include "TerrainFileFormat.h"
+
+
+// Read-only mapping of a terrain file (see TerrainFileFormat.h)
+class TerrainFile
+{
+public:
+    static constexpr const char* Extension = ".terrain";
+
+    TerrainFile() = default;
+    ~TerrainFile();
+
+    TerrainFile(const TerrainFile&) = delete;
+    TerrainFile& operator=(const TerrainFile&) = delete;
+
+    [[nodiscard]] static bool HasExtension(const std::filesystem::path& path);
+    [[nodiscard]] static nvrhi::Format GetTextureFormat(TerrainFileFormat format);
+
+    // Maps the file, then checks its header and that the tiles of each layer cover each of its mip levels within the file
+    //  Returns false, after logging why, if the file cannot be mapped or is invalid
+    bool Open(const std::filesystem::path& path);
+    void Close();
+    // Reads every page of the mapping, e.g. on a worker thread, so that creating the textures does not wait on the disk
+    void Prefetch() const;
+
+    [[nodiscard]] inline bool IsOpen() const { return m_Data != nullptr; }
+    [[nodiscard]] inline const TerrainFileHeader& GetHeader() const { return *reinterpret_cast<const TerrainFileHeader*>(m_Data); }
+    [[nodiscard]] std::span<const TerrainFileLayerDesc> GetLayers() const;
+    // Returns null if the file has no such layer
+    [[nodiscard]] const TerrainFileLayerDesc* FindLayer(TerrainFileLayer layer) const;
+    [[nodiscard]] std::span<const TerrainFileTile> GetTiles(const TerrainFileLayerDesc& layer) const;
+    [[nodiscard]] inline const void* GetTileData(const TerrainFileTile& tile) const { return m_Data + tile.Offset; }
+
+    // Creates a texture with every mip level of the layer, and records the copy of its tiles into it through a staging
+    // texture, which is the only copy the texels go through after the file
+    [[nodiscard]] nvrhi::TextureHandle CreateTexture(nvrhi::IDevice* device, nvrhi::ICommandList* commandList,
+        const TerrainFileLayerDesc& layer, const char* debugName, bool isUAV = false) const;
+
+private:
+    bool Validate(const std::filesystem::path& path) const;
+    bool ValidateLayer(const std::string& path, const TerrainFileLayerDesc& layer) const;
+
+    const uint8_t* m_Data = nullptr;
+    uint64_t m_Size = 0;
+#ifdef WIN32
+    void* m_File = nullptr;
+    void* m_Mapping = nullptr;
+#else
+    int m_File = -1;
+#endif
+};
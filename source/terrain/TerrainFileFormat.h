@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+
+
+// Native terrain container, little-endian, read by TerrainFile and written by the bake tool (tools/bake)
+//  The header is followed by the descriptions of the layers, then by the index of the tiles of every layer, each
+//  layer's tiles being ordered by mip level then by rows
+//  Each tile holds the texels of a rectangle of its mip level in tightly packed rows, at an offset aligned to
+//  TerrainFileAlignment, so that a tile of a mapped file can be copied to the GPU as is
+//  Heights are normalized, i.e. in [0, 1] before the height scale of the terrain, in either format
+
+static constexpr uint32_t TerrainFileMagic = 0x4E52544C; // "LTRN"
+// Version 3 folds the octahedral normals around +y instead of +z, so the normal layers of older files do not decode
+static constexpr uint32_t TerrainFileVersion = 3;
+static constexpr uint64_t TerrainFileAlignment = 4096;
+
+enum class TerrainFileFormat : uint32_t
+{
+    R16_UNORM = 0,
+    R32_FLOAT = 1,
+    RG32_FLOAT = 2,
+    RG16_SNORM = 3
+};
+
+enum class TerrainFileLayer : uint32_t
+{
+    // R16_UNORM or R32_FLOAT, with any number of mip levels
+    Height = 0,
+    // Min/max pyramid of the heights, RG32_FLOAT, laid out as built by TerrainHeightBoundsPass::Build
+    HeightBounds = 1,
+    // Geometric error pyramid, R32_FLOAT, laid out as built by TerrainHeightBoundsPass::BuildError
+    HeightError = 2,
+    // Octahedral normals in the space of the terrain, folded around +y (see EncodeTerrainNormal in TerrainNormals.hlsli),
+    // RG16_SNORM, for the extents and height scale of the header, laid out as built by TerrainNormalMapPass::Build
+    Normal = 3,
+
+    Count
+};
+
+struct TerrainFileHeader
+{
+    uint32_t Magic = TerrainFileMagic;
+    uint32_t Version = TerrainFileVersion;
+    // Tiles are TileSize x TileSize texels, except on the right and bottom edges of each mip level
+    uint32_t TileSize = 0;
+    uint32_t LayerCount = 0;
+    // Terrain the normal layer was baked for (see TerrainMeshInfo)
+    float NormalExtents[2] = { 1.0f, 1.0f };
+    float NormalHeightScale = 1.0f;
+    uint32_t Reserved = 0;
+};
+static_assert(sizeof(TerrainFileHeader) == 32);
+
+struct TerrainFileLayerDesc
+{
+    TerrainFileLayer Layer = TerrainFileLayer::Height;
+    TerrainFileFormat Format = TerrainFileFormat::R16_UNORM;
+    // Of mip level 0, in texels
+    uint32_t Width = 0;
+    uint32_t Height = 0;
+    uint32_t MipLevels = 0;
+    // Range of the tiles of the layer in the index
+    uint32_t FirstTile = 0;
+    uint32_t TileCount = 0;
+    uint32_t Reserved = 0;
+};
+static_assert(sizeof(TerrainFileLayerDesc) == 32);
+
+struct TerrainFileTile
+{
+    uint32_t MipLevel = 0;
+    // Texel of the mip level at the top left corner of the tile
+    uint32_t X = 0;
+    uint32_t Y = 0;
+    uint32_t Width = 0;
+    uint32_t Height = 0;
+    uint32_t Reserved = 0;
+    // From the start of the file
+    uint64_t Offset = 0;
+};
+static_assert(sizeof(TerrainFileTile) == 32);
+
+inline uint32_t GetTerrainFileBytesPerTexel(TerrainFileFormat format)
+{
+    switch (format)
+    {
+    case TerrainFileFormat::R16_UNORM: return 2;
+    case TerrainFileFormat::R32_FLOAT: return 4;
+    case TerrainFileFormat::RG32_FLOAT: return 8;
+    case TerrainFileFormat::RG16_SNORM: return 4;
+    default: return 0;
+    }
+}
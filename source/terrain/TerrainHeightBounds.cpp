@@ -0,0 +1,131 @@
+#include "TerrainHeightBounds.h"
+
+#include <bit>
+
+#include <donut/engine/ShaderFactory.h>
+
+using namespace donut::math;
+
+#include "TerrainShaders.h"
+
+
+TerrainHeightBoundsPass::TerrainHeightBoundsPass(nvrhi::IDevice* device)
+	: m_Device(device)
+{
+}
+
+void TerrainHeightBoundsPass::Init(donut::engine::ShaderFactory& shaderFactory)
+{
+	m_InitShader = shaderFactory.CreateAutoShader("app/terrain/HeightBounds.hlsl", "height_bounds_init_cs",
+		DONUT_MAKE_PLATFORM_SHADER(g_height_bounds_init_cs), nullptr, nvrhi::ShaderType::Compute);
+	m_ReduceShader = shaderFactory.CreateAutoShader("app/terrain/HeightBounds.hlsl", "height_bounds_reduce_cs",
+		DONUT_MAKE_PLATFORM_SHADER(g_height_bounds_reduce_cs), nullptr, nvrhi::ShaderType::Compute);
+	m_ErrorInitShader = shaderFactory.CreateAutoShader("app/terrain/HeightError.hlsl", "height_error_init_cs",
+		DONUT_MAKE_PLATFORM_SHADER(g_height_error_init_cs), nullptr, nvrhi::ShaderType::Compute);
+	m_ErrorReduceShader = shaderFactory.CreateAutoShader("app/terrain/HeightError.hlsl", "height_error_reduce_cs",
+		DONUT_MAKE_PLATFORM_SHADER(g_height_error_reduce_cs), nullptr, nvrhi::ShaderType::Compute);
+
+	{
+		nvrhi::BindingLayoutDesc layoutDesc;
+		layoutDesc.setVisibility(nvrhi::ShaderType::Compute)
+			.setRegisterSpace(0)
+			.setRegisterSpaceIsDescriptorSet(true)
+			.addItem(nvrhi::BindingLayoutItem::PushConstants(0, sizeof(HeightBoundsConstants)))
+			.addItem(nvrhi::BindingLayoutItem::Texture_SRV(0))
+			.addItem(nvrhi::BindingLayoutItem::Texture_SRV(1))
+			.addItem(nvrhi::BindingLayoutItem::Texture_UAV(0));
+		m_BindingLayout = m_Device->createBindingLayout(layoutDesc);
+	}
+
+	nvrhi::ComputePipelineDesc psoDesc;
+	psoDesc.bindingLayouts = { m_BindingLayout };
+
+	psoDesc.CS = m_InitShader;
+	m_InitPipeline = m_Device->createComputePipeline(psoDesc);
+
+	psoDesc.CS = m_ReduceShader;
+	m_ReducePipeline = m_Device->createComputePipeline(psoDesc);
+
+	psoDesc.CS = m_ErrorInitShader;
+	m_ErrorInitPipeline = m_Device->createComputePipeline(psoDesc);
+
+	psoDesc.CS = m_ErrorReduceShader;
+	m_ErrorReducePipeline = m_Device->createComputePipeline(psoDesc);
+}
+
+nvrhi::TextureHandle TerrainHeightBoundsPass::Build(nvrhi::ICommandList* commandList, nvrhi::ITexture* heightmap)
+{
+	return BuildPyramid(commandList, heightmap, nvrhi::Format::RG32_FLOAT, m_InitPipeline, m_ReducePipeline, "TerrainHeightBounds");
+}
+
+nvrhi::TextureHandle TerrainHeightBoundsPass::BuildError(nvrhi::ICommandList* commandList, nvrhi::ITexture* heightmap)
+{
+	return BuildPyramid(commandList, heightmap, nvrhi::Format::R32_FLOAT, m_ErrorInitPipeline, m_ErrorReducePipeline, "TerrainHeightError");
+}
+
+nvrhi::TextureHandle TerrainHeightBoundsPass::BuildPyramid(
+	nvrhi::ICommandList* commandList,
+	nvrhi::ITexture* heightmap,
+	nvrhi::Format format,
+	nvrhi::IComputePipeline* initPipeline,
+	nvrhi::IComputePipeline* reducePipeline,
+	const char* name)
+{
+	assert(heightmap);
+
+	const auto& heightmapDesc = heightmap->getDesc();
+	const uint2 heightmapSize = uint2(heightmapDesc.width, heightmapDesc.height);
+	const uint2 size = max(heightmapSize / 2u, uint2(1u));
+
+	nvrhi::TextureDesc textureDesc;
+	textureDesc.dimension = nvrhi::TextureDimension::Texture2D;
+	textureDesc.format = format;
+	textureDesc.width = size.x;
+	textureDesc.height = size.y;
+	textureDesc.mipLevels = static_cast<uint32_t>(std::bit_width(std::max(size.x, size.y)));
+	textureDesc.isUAV = true;
+	// Read by the tessellation, which may be on the compute queue
+	textureDesc.initialState = nvrhi::ResourceStates::ShaderResource;
+	textureDesc.keepInitialState = true;
+	textureDesc.debugName = name;
+	nvrhi::TextureHandle pyramid = m_Device->createTexture(textureDesc);
+
+	commandList->beginMarker(name);
+
+	HeightBoundsConstants constants = {};
+	constants.inputSize = heightmapSize;
+
+	for (uint32_t mip = 0; mip < textureDesc.mipLevels; mip++)
+	{
+		constants.outputSize = uint2(std::max(size.x >> mip, 1u), std::max(size.y >> mip, 1u));
+		constants.outputLevel = mip;
+
+		// Mip 0 only reads the heightmap, which is also bound in place of the level below it
+		nvrhi::BindingSetDesc bindingSetDesc;
+		bindingSetDesc.bindings = {
+			nvrhi::BindingSetItem::PushConstants(0, sizeof(HeightBoundsConstants)),
+			nvrhi::BindingSetItem::Texture_SRV(0, heightmap, nvrhi::Format::UNKNOWN, nvrhi::TextureSubresourceSet(0, 1, 0, 1)),
+			mip == 0
+				? nvrhi::BindingSetItem::Texture_SRV(1, heightmap, nvrhi::Format::UNKNOWN, nvrhi::TextureSubresourceSet(0, 1, 0, 1))
+				: nvrhi::BindingSetItem::Texture_SRV(1, pyramid, nvrhi::Format::UNKNOWN, nvrhi::TextureSubresourceSet(mip - 1, 1, 0, 1)),
+			nvrhi::BindingSetItem::Texture_UAV(0, pyramid, nvrhi::Format::UNKNOWN, nvrhi::TextureSubresourceSet(mip, 1, 0, 1))
+		};
+
+		nvrhi::ComputeState state;
+		state.pipeline = mip == 0 ? initPipeline : reducePipeline;
+		state.bindings = { m_Device->createBindingSet(bindingSetDesc, m_BindingLayout) };
+		commandList->setComputeState(state);
+
+		commandList->setPushConstants(&constants, sizeof(constants));
+
+		commandList->dispatch(
+			dm::div_ceil(constants.outputSize.x, 8),
+			dm::div_ceil(constants.outputSize.y, 8));
+
+		constants.inputSize = constants.outputSize;
+	}
+
+	commandList->endMarker();
+
+	return pyramid;
+}
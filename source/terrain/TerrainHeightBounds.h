@@ -0,0 +1,49 @@
+#pragma once
+
+#include <nvrhi/nvrhi.h>
+
+#include <donut/engine/BindingCache.h>
+
+
+namespace donut::engine
+{
+	class ShaderFactory;
+}
+
+
+// Builds a min/max pyramid of a heightmap, from which conservative bounds of the terrain under a node can be read
+//  Mip 0 is half the resolution of the heightmap (rounded down), and every texel holds the normalized height range
+//  of the heightmap texels it covers
+// Also builds the height error pyramid with the same layout, where every texel holds the largest normalized deviation
+//  of the heightmap texels it covers from the bilinear patch through the corners of the region
+class TerrainHeightBoundsPass
+{
+public:
+    TerrainHeightBoundsPass(nvrhi::IDevice* device);
+
+    void Init(donut::engine::ShaderFactory& shaderFactory);
+
+    // The heightmap must be resident; the pyramid is ready for the commands recorded after this one
+    [[nodiscard]] nvrhi::TextureHandle Build(nvrhi::ICommandList* commandList, nvrhi::ITexture* heightmap);
+    [[nodiscard]] nvrhi::TextureHandle BuildError(nvrhi::ICommandList* commandList, nvrhi::ITexture* heightmap);
+
+private:
+    nvrhi::TextureHandle BuildPyramid(
+        nvrhi::ICommandList* commandList,
+        nvrhi::ITexture* heightmap,
+        nvrhi::Format format,
+        nvrhi::IComputePipeline* initPipeline,
+        nvrhi::IComputePipeline* reducePipeline,
+        const char* name);
+
+private:
+    nvrhi::DeviceHandle m_Device;
+
+    nvrhi::ShaderHandle m_InitShader, m_ReduceShader;
+    nvrhi::ComputePipelineHandle m_InitPipeline, m_ReducePipeline;
+
+    nvrhi::ShaderHandle m_ErrorInitShader, m_ErrorReduceShader;
+    nvrhi::ComputePipelineHandle m_ErrorInitPipeline, m_ErrorReducePipeline;
+
+    nvrhi::BindingLayoutHandle m_BindingLayout;
+};
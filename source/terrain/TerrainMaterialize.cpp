@@ -0,0 +1,168 @@
+#include "TerrainMaterialize.h"
+
+#include <donut/engine/ShaderFactory.h>
+#include <donut/render/DrawStrategy.h>
+
+#include "Terrain.h"
+#include "render/GpuTimers.h"
+
+using namespace donut::math;
+
+#include "TerrainShaders.h"
+
+
+TerrainMaterializePass::TerrainMaterializePass(nvrhi::IDevice* device, std::shared_ptr<donut::engine::CommonRenderPasses> commonPasses)
+	: m_Device(device)
+	, m_CommonPasses(std::move(commonPasses))
+{
+}
+
+void TerrainMaterializePass::Init(donut::engine::ShaderFactory& shaderFactory)
+{
+	m_PrepareShader = shaderFactory.CreateAutoShader("app/terrain/Materialize.hlsl", "materialize_prepare_cs",
+		DONUT_MAKE_PLATFORM_SHADER(g_terrain_materialize_prepare_cs), nullptr, nvrhi::ShaderType::Compute);
+	m_VerticesShader = shaderFactory.CreateAutoShader("app/terrain/Materialize.hlsl", "materialize_vertices_cs",
+		DONUT_MAKE_PLATFORM_SHADER(g_terrain_materialize_vertices_cs), nullptr, nvrhi::ShaderType::Compute);
+	m_IndicesShader = shaderFactory.CreateAutoShader("app/terrain/Materialize.hlsl", "materialize_indices_cs",
+		DONUT_MAKE_PLATFORM_SHADER(g_terrain_materialize_indices_cs), nullptr, nvrhi::ShaderType::Compute);
+
+	{
+		nvrhi::BindingLayoutDesc layoutDesc;
+		layoutDesc.setVisibility(nvrhi::ShaderType::Compute)
+			.setRegisterSpace(0)
+			.setRegisterSpaceIsDescriptorSet(true)
+			.addItem(nvrhi::BindingLayoutItem::PushConstants(MATERIALIZE_BINDING_PUSH_CONSTANTS, sizeof(MaterializePushConstants)))
+			.addItem(nvrhi::BindingLayoutItem::ConstantBuffer(MATERIALIZE_BINDING_TERRAIN_CONSTANTS))
+			.addItem(nvrhi::BindingLayoutItem::StructuredBuffer_SRV(MATERIALIZE_BINDING_CBT))
+			.addItem(nvrhi::BindingLayoutItem::Texture_SRV(MATERIALIZE_BINDING_HEIGHTMAP))
+			.addItem(nvrhi::BindingLayoutItem::StructuredBuffer_SRV(MATERIALIZE_BINDING_CULLED_NODES))
+			.addItem(nvrhi::BindingLayoutItem::StructuredBuffer_SRV(MATERIALIZE_BINDING_CULLED_INDIRECT_ARGS))
+			.addItem(nvrhi::BindingLayoutItem::Texture_SRV(MATERIALIZE_BINDING_HEIGHTMAP_PAGE_TABLE))
+			.addItem(nvrhi::BindingLayoutItem::Texture_SRV(MATERIALIZE_BINDING_HEIGHTMAP_ATLAS))
+			.addItem(nvrhi::BindingLayoutItem::Sampler(MATERIALIZE_BINDING_HEIGHTMAP_SAMPLER))
+			.addItem(nvrhi::BindingLayoutItem::StructuredBuffer_UAV(MATERIALIZE_BINDING_VERTICES))
+			.addItem(nvrhi::BindingLayoutItem::StructuredBuffer_UAV(MATERIALIZE_BINDING_INDICES))
+			.addItem(nvrhi::BindingLayoutItem::StructuredBuffer_UAV(MATERIALIZE_BINDING_VERTEX_HASH))
+			.addItem(nvrhi::BindingLayoutItem::StructuredBuffer_UAV(MATERIALIZE_BINDING_INDEXED_ARGS))
+			.addItem(nvrhi::BindingLayoutItem::StructuredBuffer_UAV(MATERIALIZE_BINDING_STATE));
+		m_BindingLayout = m_Device->createBindingLayout(layoutDesc);
+	}
+
+	nvrhi::ComputePipelineDesc psoDesc;
+	psoDesc.bindingLayouts = { m_BindingLayout };
+
+	psoDesc.CS = m_PrepareShader;
+	m_PreparePipeline = m_Device->createComputePipeline(psoDesc);
+
+	psoDesc.CS = m_VerticesShader;
+	m_VerticesPipeline = m_Device->createComputePipeline(psoDesc);
+
+	psoDesc.CS = m_IndicesShader;
+	m_IndicesPipeline = m_Device->createComputePipeline(psoDesc);
+}
+
+void TerrainMaterializePass::Execute(nvrhi::ICommandList* commandList, const TerrainMeshView* terrainView, uint32_t culledDraw)
+{
+	assert(terrainView->GetRenderMode() == TerrainRenderMode::Indexed);
+	assert(culledDraw == CULLED_DRAW_VISIBLE || culledDraw == CULLED_DRAW_DISOCCLUDED);
+
+	// The disoccluded leaves share the vertices of the visible ones, so the table is only cleared once per frame
+	if (culledDraw == CULLED_DRAW_VISIBLE)
+	{
+		commandList->clearBufferUInt(terrainView->GetVertexHashBuffer(), MATERIALIZE_HASH_EMPTY);
+	}
+
+	MaterializePushConstants constants{};
+	constants.culledDraw = culledDraw;
+
+	nvrhi::ComputeState state;
+	state.bindings = { FindOrCreateBindingSet(terrainView, culledDraw) };
+
+	state.pipeline = m_PreparePipeline;
+	commandList->setComputeState(state);
+	commandList->setPushConstants(&constants, sizeof(constants));
+	commandList->dispatch(1);
+
+	// The state is bound for writing while the passes run, so they are dispatched from a copy of its arguments
+	commandList->copyBuffer(terrainView->GetMaterializeDispatchArgsBuffer(), 0, terrainView->GetMaterializeStateBuffer(), 0,
+		sizeof(nvrhi::DispatchIndirectArguments));
+
+	// Every vertex must be written before the indices referencing it by hash slot are resolved
+	state.indirectParams = terrainView->GetMaterializeDispatchArgsBuffer();
+
+	state.pipeline = m_VerticesPipeline;
+	commandList->setComputeState(state);
+	commandList->setPushConstants(&constants, sizeof(constants));
+	commandList->dispatchIndirect(0);
+
+	state.pipeline = m_IndicesPipeline;
+	commandList->setComputeState(state);
+	commandList->setPushConstants(&constants, sizeof(constants));
+	commandList->dispatchIndirect(0);
+}
+
+void TerrainMaterializePass::ResetBindingCache()
+{
+	m_BindingSets.clear();
+	m_DisoccludedBindingSets.clear();
+}
+
+nvrhi::BindingSetHandle TerrainMaterializePass::FindOrCreateBindingSet(const TerrainMeshView* terrainView, uint32_t culledDraw)
+{
+	const bool disoccluded = culledDraw == CULLED_DRAW_DISOCCLUDED;
+	nvrhi::BindingSetHandle& bindingSet = (disoccluded ? m_DisoccludedBindingSets : m_BindingSets)[terrainView->GetCulledIndirectArgsBuffer()];
+	if (!bindingSet)
+	{
+		nvrhi::IBuffer* culledNodes = disoccluded ? terrainView->GetDisoccludedNodesBuffer() : terrainView->GetCulledNodesBuffer();
+		const TerrainMeshInfo* terrainMesh = terrainView->GetInstance()->GetTerrain();
+
+		nvrhi::BindingSetDesc setDesc;
+		setDesc.addItem(nvrhi::BindingSetItem::PushConstants(MATERIALIZE_BINDING_PUSH_CONSTANTS, sizeof(MaterializePushConstants)))
+			.addItem(nvrhi::BindingSetItem::ConstantBuffer(MATERIALIZE_BINDING_TERRAIN_CONSTANTS, terrainMesh->TerrainCB))
+			.addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(MATERIALIZE_BINDING_CBT, terrainView->GetCBTBuffer()))
+			.addItem(nvrhi::BindingSetItem::Texture_SRV(MATERIALIZE_BINDING_HEIGHTMAP, terrainMesh->HeightmapTexture->texture))
+			.addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(MATERIALIZE_BINDING_CULLED_NODES, culledNodes))
+			.addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(MATERIALIZE_BINDING_CULLED_INDIRECT_ARGS, terrainView->GetCulledIndirectArgsBuffer()))
+			.addItem(nvrhi::BindingSetItem::Texture_SRV(MATERIALIZE_BINDING_HEIGHTMAP_PAGE_TABLE, terrainMesh->HeightmapPageTable))
+			.addItem(nvrhi::BindingSetItem::Texture_SRV(MATERIALIZE_BINDING_HEIGHTMAP_ATLAS, terrainMesh->HeightmapAtlas))
+			.addItem(nvrhi::BindingSetItem::Sampler(MATERIALIZE_BINDING_HEIGHTMAP_SAMPLER, m_CommonPasses->m_LinearClampSampler))
+			.addItem(nvrhi::BindingSetItem::StructuredBuffer_UAV(MATERIALIZE_BINDING_VERTICES, terrainView->GetMaterializedVertexBuffer()))
+			.addItem(nvrhi::BindingSetItem::StructuredBuffer_UAV(MATERIALIZE_BINDING_INDICES, terrainView->GetMaterializedIndexBuffer()))
+			.addItem(nvrhi::BindingSetItem::StructuredBuffer_UAV(MATERIALIZE_BINDING_VERTEX_HASH, terrainView->GetVertexHashBuffer()))
+			.addItem(nvrhi::BindingSetItem::StructuredBuffer_UAV(MATERIALIZE_BINDING_INDEXED_ARGS, terrainView->GetMaterializedIndirectArgsBuffer()))
+			.addItem(nvrhi::BindingSetItem::StructuredBuffer_UAV(MATERIALIZE_BINDING_STATE, terrainView->GetMaterializeStateBuffer()));
+
+		bindingSet = m_Device->createBindingSet(setDesc, m_BindingLayout);
+	}
+	return bindingSet;
+}
+
+
+void MaterializeTerrainView(
+	nvrhi::ICommandList* commandList,
+	const donut::engine::IView* view,
+	const std::shared_ptr<donut::engine::SceneGraphNode>& rootNode,
+	donut::render::IDrawStrategy& drawStrategy,
+	TerrainMaterializePass& pass,
+	bool disoccluded,
+	GpuTimers* gpuTimers)
+{
+	commandList->beginMarker("Materialize Terrain View");
+
+	drawStrategy.PrepareForView(rootNode, *view);
+
+	while (auto drawItem = drawStrategy.GetNextItem())
+	{
+		if (!drawItem->userData)
+			continue;
+		auto terrainView = static_cast<const TerrainMeshView*>(drawItem->userData);
+
+		if (terrainView->GetRenderMode() == TerrainRenderMode::Indexed)
+		{
+			GpuTimerScope viewScope(gpuTimers, commandList, terrainView->GetName());
+			pass.Execute(commandList, terrainView, disoccluded ? CULLED_DRAW_DISOCCLUDED : CULLED_DRAW_VISIBLE);
+		}
+	}
+
+	commandList->endMarker();
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <nvrhi/nvrhi.h>
+
+#include <donut/engine/CommonRenderPasses.h>
+
+
+namespace donut::engine
+{
+	class IView;
+	class SceneGraphNode;
+	class ShaderFactory;
+}
+
+namespace donut::render
+{
+	class IDrawStrategy;
+}
+
+class GpuTimers;
+class TerrainMeshView;
+
+
+// Decodes the culled leaves of terrain views with indexed rendering once per frame, into a mesh with shared vertices
+//  Vertices are deduplicated through a hash table of their LEB coordinates, so neighbouring leaves index the same vertex
+//  The disoccluded leaves are appended after the visible ones, and must be materialized after them in the same frame
+class TerrainMaterializePass
+{
+public:
+    TerrainMaterializePass(nvrhi::IDevice* device, std::shared_ptr<donut::engine::CommonRenderPasses> commonPasses);
+
+    void Init(donut::engine::ShaderFactory& shaderFactory);
+
+    // Materializes the leaves of the given culled draw (CULLED_DRAW_VISIBLE or CULLED_DRAW_DISOCCLUDED)
+    void Execute(nvrhi::ICommandList* commandList, const TerrainMeshView* terrainView, uint32_t culledDraw);
+
+    void ResetBindingCache();
+
+private:
+    nvrhi::BindingSetHandle FindOrCreateBindingSet(const TerrainMeshView* terrainView, uint32_t culledDraw);
+
+private:
+    nvrhi::DeviceHandle m_Device;
+    std::shared_ptr<donut::engine::CommonRenderPasses> m_CommonPasses;
+
+    nvrhi::ShaderHandle m_PrepareShader, m_VerticesShader, m_IndicesShader;
+    nvrhi::ComputePipelineHandle m_PreparePipeline, m_VerticesPipeline, m_IndicesPipeline;
+
+    nvrhi::BindingLayoutHandle m_BindingLayout;
+
+    // Keyed by the culled indirect args buffer, as double buffered terrain views swap it along with the CBT and the culled
+    // nodes; the disoccluded leaves have their own nodes buffer, which is not swapped, so their sets are kept apart
+    std::unordered_map<const nvrhi::IBuffer*, nvrhi::BindingSetHandle> m_BindingSets;
+    std::unordered_map<const nvrhi::IBuffer*, nvrhi::BindingSetHandle> m_DisoccludedBindingSets;
+};
+
+
+// Materializes the terrains with indexed rendering for a given view (see TerrainMaterializePass)
+//  Each terrain view is timed in its own scope, named after it, if timers are given
+void MaterializeTerrainView(
+    nvrhi::ICommandList* commandList,
+    const donut::engine::IView* view,
+    const std::shared_ptr<donut::engine::SceneGraphNode>& rootNode,
+    donut::render::IDrawStrategy& drawStrategy,
+    TerrainMaterializePass& pass,
+    bool disoccluded,
+    GpuTimers* gpuTimers = nullptr
+);
@@ -0,0 +1,167 @@
+#include "TerrainNormalMap.h"
+
+#include <bit>
+
+#include <donut/engine/ShaderFactory.h>
+
+using namespace donut::math;
+
+#include "TerrainShaders.h"
+
+
+TerrainNormalMapPass::TerrainNormalMapPass(nvrhi::IDevice* device)
+	: m_Device(device)
+{
+}
+
+void TerrainNormalMapPass::Init(donut::engine::ShaderFactory& shaderFactory)
+{
+	m_InitShader = shaderFactory.CreateAutoShader("app/terrain/NormalMap.hlsl", "normal_map_init_cs",
+		DONUT_MAKE_PLATFORM_SHADER(g_normal_map_init_cs), nullptr, nvrhi::ShaderType::Compute);
+	m_VirtualInitShader = shaderFactory.CreateAutoShader("app/terrain/NormalMap.hlsl", "normal_map_virtual_init_cs",
+		DONUT_MAKE_PLATFORM_SHADER(g_normal_map_virtual_init_cs), nullptr, nvrhi::ShaderType::Compute);
+	m_ReduceShader = shaderFactory.CreateAutoShader("app/terrain/NormalMap.hlsl", "normal_map_reduce_cs",
+		DONUT_MAKE_PLATFORM_SHADER(g_normal_map_reduce_cs), nullptr, nvrhi::ShaderType::Compute);
+
+	nvrhi::BindingLayoutDesc layoutDesc;
+	layoutDesc.setVisibility(nvrhi::ShaderType::Compute)
+		.setRegisterSpace(0)
+		.setRegisterSpaceIsDescriptorSet(true)
+		.addItem(nvrhi::BindingLayoutItem::PushConstants(0, sizeof(NormalMapConstants)))
+		.addItem(nvrhi::BindingLayoutItem::Texture_SRV(0))
+		.addItem(nvrhi::BindingLayoutItem::Texture_SRV(1))
+		.addItem(nvrhi::BindingLayoutItem::Texture_UAV(0));
+	m_BindingLayout = m_Device->createBindingLayout(layoutDesc);
+
+	nvrhi::BindingLayoutDesc virtualLayoutDesc;
+	virtualLayoutDesc.setVisibility(nvrhi::ShaderType::Compute)
+		.setRegisterSpace(0)
+		.setRegisterSpaceIsDescriptorSet(true)
+		.addItem(nvrhi::BindingLayoutItem::PushConstants(0, sizeof(NormalMapConstants)))
+		.addItem(nvrhi::BindingLayoutItem::ConstantBuffer(1))
+		.addItem(nvrhi::BindingLayoutItem::Texture_SRV(0))
+		.addItem(nvrhi::BindingLayoutItem::Texture_SRV(2))
+		.addItem(nvrhi::BindingLayoutItem::Texture_SRV(3))
+		.addItem(nvrhi::BindingLayoutItem::Sampler(0))
+		.addItem(nvrhi::BindingLayoutItem::Texture_UAV(0));
+	m_VirtualBindingLayout = m_Device->createBindingLayout(virtualLayoutDesc);
+
+	// As the linear clamp sampler the terrain passes sample heightmaps with
+	nvrhi::SamplerDesc samplerDesc;
+	samplerDesc.setAllFilters(true)
+		.setAllAddressModes(nvrhi::SamplerAddressMode::Clamp);
+	m_HeightmapSampler = m_Device->createSampler(samplerDesc);
+
+	nvrhi::ComputePipelineDesc psoDesc;
+	psoDesc.bindingLayouts = { m_BindingLayout };
+
+	psoDesc.CS = m_InitShader;
+	m_InitPipeline = m_Device->createComputePipeline(psoDesc);
+
+	psoDesc.CS = m_ReduceShader;
+	m_ReducePipeline = m_Device->createComputePipeline(psoDesc);
+
+	psoDesc.bindingLayouts = { m_VirtualBindingLayout };
+	psoDesc.CS = m_VirtualInitShader;
+	m_VirtualInitPipeline = m_Device->createComputePipeline(psoDesc);
+}
+
+nvrhi::TextureHandle TerrainNormalMapPass::Build(nvrhi::ICommandList* commandList, nvrhi::ITexture* heightmap,
+	float2 extents, float heightScale)
+{
+	assert(heightmap);
+
+	const auto& heightmapDesc = heightmap->getDesc();
+
+	nvrhi::TextureDesc textureDesc;
+	textureDesc.dimension = nvrhi::TextureDimension::Texture2D;
+	textureDesc.format = nvrhi::Format::RG16_SNORM;
+	textureDesc.width = heightmapDesc.width;
+	textureDesc.height = heightmapDesc.height;
+	textureDesc.mipLevels = static_cast<uint32_t>(std::bit_width(std::max(heightmapDesc.width, heightmapDesc.height)));
+	textureDesc.isUAV = true;
+	textureDesc.initialState = nvrhi::ResourceStates::ShaderResource;
+	textureDesc.keepInitialState = true;
+	textureDesc.debugName = "TerrainNormalMap";
+	nvrhi::TextureHandle normalMap = m_Device->createTexture(textureDesc);
+
+	Update(commandList, heightmap, normalMap, extents, heightScale, uint2(0u), uint2(heightmapDesc.width, heightmapDesc.height) - 1u);
+
+	return normalMap;
+}
+
+void TerrainNormalMapPass::Update(nvrhi::ICommandList* commandList, nvrhi::ITexture* heightmap, nvrhi::ITexture* normalMap,
+	float2 extents, float heightScale, uint2 firstTexel, uint2 lastTexel, const VirtualHeightmapInputs* virtualHeightmap)
+{
+	assert(heightmap && normalMap);
+
+	const auto& normalMapDesc = normalMap->getDesc();
+	const uint2 size = uint2(normalMapDesc.width, normalMapDesc.height);
+
+	// The central differences of the texels next to the region read the heights of its edges
+	firstTexel = uint2(max(int2(firstTexel) - 1, int2(0)));
+	lastTexel = min(lastTexel + 1u, size - 1u);
+
+	commandList->beginMarker("TerrainNormalMap");
+
+	NormalMapConstants constants = {};
+	constants.inputSize = size;
+	constants.heightScale = heightScale;
+	constants.worldTexelSpan = 2.0f * extents / float2(size);
+
+	for (uint32_t mip = 0; mip < normalMapDesc.mipLevels; mip++)
+	{
+		const uint2 mipSize = uint2(std::max(size.x >> mip, 1u), std::max(size.y >> mip, 1u));
+		const uint2 regionFirst = min(uint2(firstTexel.x >> mip, firstTexel.y >> mip), mipSize - 1u);
+		const uint2 regionLast = min(uint2(lastTexel.x >> mip, lastTexel.y >> mip), mipSize - 1u);
+		constants.regionOffset = regionFirst;
+		constants.regionSize = regionLast - regionFirst + 1u;
+		constants.outputLevel = mip;
+
+		// Mip 0 only reads the heightmap, which is also bound in place of the level above it
+		nvrhi::BindingSetDesc bindingSetDesc;
+		bindingSetDesc.bindings = {
+			nvrhi::BindingSetItem::PushConstants(0, sizeof(NormalMapConstants)),
+			nvrhi::BindingSetItem::Texture_SRV(0, heightmap, nvrhi::Format::UNKNOWN, nvrhi::TextureSubresourceSet(0, 1, 0, 1)),
+			mip == 0
+				? nvrhi::BindingSetItem::Texture_SRV(1, heightmap, nvrhi::Format::UNKNOWN, nvrhi::TextureSubresourceSet(0, 1, 0, 1))
+				: nvrhi::BindingSetItem::Texture_SRV(1, normalMap, nvrhi::Format::UNKNOWN, nvrhi::TextureSubresourceSet(mip - 1, 1, 0, 1)),
+			nvrhi::BindingSetItem::Texture_UAV(0, normalMap, nvrhi::Format::UNKNOWN, nvrhi::TextureSubresourceSet(mip, 1, 0, 1))
+		};
+
+		nvrhi::ComputeState state;
+		if (mip == 0 && virtualHeightmap)
+		{
+			nvrhi::BindingSetDesc virtualSetDesc;
+			virtualSetDesc.bindings = {
+				nvrhi::BindingSetItem::PushConstants(0, sizeof(NormalMapConstants)),
+				nvrhi::BindingSetItem::ConstantBuffer(1, virtualHeightmap->terrainCB),
+				nvrhi::BindingSetItem::Texture_SRV(0, heightmap, nvrhi::Format::UNKNOWN, nvrhi::TextureSubresourceSet(0, 1, 0, 1)),
+				nvrhi::BindingSetItem::Texture_SRV(2, virtualHeightmap->pageTable),
+				nvrhi::BindingSetItem::Texture_SRV(3, virtualHeightmap->atlas),
+				nvrhi::BindingSetItem::Sampler(0, m_HeightmapSampler),
+				nvrhi::BindingSetItem::Texture_UAV(0, normalMap, nvrhi::Format::UNKNOWN, nvrhi::TextureSubresourceSet(0, 1, 0, 1))
+			};
+
+			state.pipeline = m_VirtualInitPipeline;
+			state.bindings = { m_Device->createBindingSet(virtualSetDesc, m_VirtualBindingLayout) };
+		}
+		else
+		{
+			state.pipeline = mip == 0 ? m_InitPipeline : m_ReducePipeline;
+			state.bindings = { m_Device->createBindingSet(bindingSetDesc, m_BindingLayout) };
+		}
+		commandList->setComputeState(state);
+
+		commandList->setPushConstants(&constants, sizeof(constants));
+
+		commandList->dispatch(
+			dm::div_ceil(constants.regionSize.x, 8),
+			dm::div_ceil(constants.regionSize.y, 8));
+
+		// Each level reduces the one above it
+		constants.inputSize = mipSize;
+	}
+
+	commandList->endMarker();
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <nvrhi/nvrhi.h>
+
+#include <donut/core/math/math.h>
+
+
+namespace donut::engine
+{
+	class ShaderFactory;
+}
+
+
+// Bakes the normals of a heightmap into an octahedral RG16_SNORM normal map with a full mip chain, so that shading
+// a pixel of the terrain takes a single fetch rather than the four of the central differences of GetTerrainNormal
+//  Mip 0 has the resolution of the heightmap, and each level is the normalized average of the level above
+class TerrainNormalMapPass
+{
+public:
+    TerrainNormalMapPass(nvrhi::IDevice* device);
+
+    void Init(donut::engine::ShaderFactory& shaderFactory);
+
+    // The heightmap must be resident; the normal map is ready for the commands recorded after this one
+    //  The normals are those of a terrain of the given extents and height scale
+    [[nodiscard]] nvrhi::TextureHandle Build(nvrhi::ICommandList* commandList, nvrhi::ITexture* heightmap,
+        dm::float2 extents, float heightScale);
+
+    // Page table, atlas and terrain constants of a virtual heightmap, whose normal map mip 0 is then baked from the
+    // finest resident pages rather than from the fallback level bound as the heightmap
+    struct VirtualHeightmapInputs
+    {
+        nvrhi::ITexture* pageTable = nullptr;
+        nvrhi::ITexture* atlas = nullptr;
+        nvrhi::IBuffer* terrainCB = nullptr;
+    };
+
+    // Re-bakes the texels of every level over the heightmap texels from firstTexel to lastTexel, after they changed
+    void Update(nvrhi::ICommandList* commandList, nvrhi::ITexture* heightmap, nvrhi::ITexture* normalMap,
+        dm::float2 extents, float heightScale, dm::uint2 firstTexel, dm::uint2 lastTexel,
+        const VirtualHeightmapInputs* virtualHeightmap = nullptr);
+
+private:
+    nvrhi::DeviceHandle m_Device;
+
+    nvrhi::ShaderHandle m_InitShader, m_VirtualInitShader, m_ReduceShader;
+    nvrhi::ComputePipelineHandle m_InitPipeline, m_VirtualInitPipeline, m_ReducePipeline;
+
+    nvrhi::BindingLayoutHandle m_BindingLayout, m_VirtualBindingLayout;
+    nvrhi::SamplerHandle m_HeightmapSampler;
+};
@@ -1,15 +1,48 @@
 #include "TerrainTessellation.h"
 
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <string>
+
 #include <nvrhi/utils.h>
 
+#include <donut/core/log.h>
+
 #include "donut/render/DrawStrategy.h"
 
 #include "Terrain.h"
+#include "TerrainCpuTessellator.h"
 #include "TerrainShaders.h"
 #include "engine/ViewEx.h"
+#include "render/GpuTimers.h"
 #include "render/TerrainDrawStrategy.h"
 
 
+static_assert(TerrainTessellationStats::DepthCount == TESSELLATION_FEEDBACK_DEPTH_COUNT);
+
+struct TerrainTessellator::ValidationCapture
+{
+	// The job being recorded, only set until EndValidationCapture
+	const Job* job = nullptr;
+
+	std::string name;
+	uint maxDepth = 0;
+	nvrhi::BufferHandle heapBefore;
+	nvrhi::BufferHandle heapAfter;
+	nvrhi::StagingTextureHandle heightmap;
+
+	TerrainCpuTessellator::Parameters parameters;
+	std::vector<ITerrainTessellationPass::SubdivisionPassTypes> passes;
+	bool parametersCaptured = false;
+};
+
+
 ITerrainTessellationPass::ITerrainTessellationPass(nvrhi::DeviceHandle device)
 	: m_Device(std::move(device))
 {
@@ -21,6 +54,8 @@ TerrainTessellator::TerrainTessellator(nvrhi::DeviceHandle device)
 {
 }
 
+TerrainTessellator::~TerrainTessellator() = default;
+
 void TerrainTessellator::Init(donut::engine::ShaderFactory& shaderFactory)
 {
 	// Create shaders
@@ -32,6 +67,14 @@ void TerrainTessellator::Init(donut::engine::ShaderFactory& shaderFactory)
 		DONUT_MAKE_PLATFORM_SHADER(g_terrain_tessellation_sum_reduction_prepass_cs), nullptr, nvrhi::ShaderType::Compute);
 	m_Shaders[Shaders_SumReduction] = shaderFactory.CreateAutoShader("app/terrain/tessellation/SumReduction.hlsl", "sum_reduction_cs",
 		DONUT_MAKE_PLATFORM_SHADER(g_terrain_tessellation_sum_reduction_cs), nullptr, nvrhi::ShaderType::Compute);
+	m_Shaders[Shaders_SumReductionFused] = shaderFactory.CreateAutoShader("app/terrain/tessellation/SumReduction.hlsl", "sum_reduction_fused_cs",
+		DONUT_MAKE_PLATFORM_SHADER(g_terrain_tessellation_sum_reduction_fused_cs), nullptr, nvrhi::ShaderType::Compute);
+	m_Shaders[Shaders_PoolPrepare] = shaderFactory.CreateAutoShader("app/terrain/tessellation/BisectorPool.hlsl", "pool_prepare_cs",
+		DONUT_MAKE_PLATFORM_SHADER(g_terrain_tessellation_pool_prepare_cs), nullptr, nvrhi::ShaderType::Compute);
+	m_Shaders[Shaders_PoolBisect] = shaderFactory.CreateAutoShader("app/terrain/tessellation/BisectorPool.hlsl", "pool_bisect_cs",
+		DONUT_MAKE_PLATFORM_SHADER(g_terrain_tessellation_pool_bisect_cs), nullptr, nvrhi::ShaderType::Compute);
+	m_Shaders[Shaders_PoolDispatch] = shaderFactory.CreateAutoShader("app/terrain/tessellation/BisectorPool.hlsl", "pool_dispatcher_cs",
+		DONUT_MAKE_PLATFORM_SHADER(g_terrain_tessellation_pool_dispatcher_cs), nullptr, nvrhi::ShaderType::Compute);
 
 	// Create binding layouts
 	{
@@ -51,6 +94,21 @@ void TerrainTessellator::Init(donut::engine::ShaderFactory& shaderFactory)
 			nvrhi::BindingLayoutItem::StructuredBuffer_UAV(TESSELLATION_BINDING_CBT)
 		};
 		m_BindingLayouts[Bindings_CBTReadWrite] = m_Device->createBindingLayout(layoutDesc);
+
+		layoutDesc.bindings = {
+			nvrhi::BindingLayoutItem::PushConstants(TESSELLATION_BINDING_PUSH_CONSTANTS, sizeof(TessellationSumReductionPushConstants)),
+			nvrhi::BindingLayoutItem::StructuredBuffer_UAV(TESSELLATION_BINDING_CBT),
+			nvrhi::BindingLayoutItem::StructuredBuffer_UAV(TESSELLATION_BINDING_INDIRECT_ARGS),
+			nvrhi::BindingLayoutItem::StructuredBuffer_UAV(TESSELLATION_BINDING_REDUCTION_SCRATCH)
+		};
+		m_BindingLayouts[Bindings_CBTReduceFused] = m_Device->createBindingLayout(layoutDesc);
+
+		layoutDesc.bindings = {
+			nvrhi::BindingLayoutItem::StructuredBuffer_UAV(TESSELLATION_BINDING_CBT),
+			nvrhi::BindingLayoutItem::StructuredBuffer_UAV(TESSELLATION_BINDING_INDIRECT_ARGS),
+			nvrhi::BindingLayoutItem::StructuredBuffer_UAV(TESSELLATION_BINDING_POOL_SCRATCH)
+		};
+		m_BindingLayouts[Bindings_BisectorPool] = m_Device->createBindingLayout(layoutDesc);
 	}
 
 	// Create pipelines
@@ -78,288 +136,1552 @@ void TerrainTessellator::Init(donut::engine::ShaderFactory& shaderFactory)
 			.addBindingLayout(m_BindingLayouts[Bindings_CBTReadWrite]);
 		m_Pipelines[Shaders_SumReduction] = m_Device->createComputePipeline(psoDesc);
 	}
+	{
+		nvrhi::ComputePipelineDesc psoDesc;
+		psoDesc.setComputeShader(m_Shaders[Shaders_SumReductionFused])
+			.addBindingLayout(m_BindingLayouts[Bindings_CBTReduceFused]);
+		m_Pipelines[Shaders_SumReductionFused] = m_Device->createComputePipeline(psoDesc);
+	}
+	for (Shaders shader : { Shaders_PoolPrepare, Shaders_PoolBisect, Shaders_PoolDispatch })
+	{
+		nvrhi::ComputePipelineDesc psoDesc;
+		psoDesc.setComputeShader(m_Shaders[shader])
+			.addBindingLayout(m_BindingLayouts[Bindings_BisectorPool]);
+		m_Pipelines[shader] = m_Device->createComputePipeline(psoDesc);
+	}
 }
 
-void TerrainTessellator::ExecutePassForTerrainView(
+void TerrainTessellator::ExecutePassForTerrainViews(
 	nvrhi::ICommandList* commandList,
 	const donut::engine::IView* view,
-	ITerrainTessellationPass& pass,
-	const TerrainMeshView* terrainView)
+	const std::vector<Item>& items,
+	bool subdivide)
 {
-	auto& cachedData = m_TerrainCache[terrainView];
-	auto& bindings = cachedData.bindings;
+	if (items.empty())
+		return;
 
 	commandList->beginMarker("ExecuteTerrainTessellation");
 
-	// Create binding sets if there are none for this terrain view
-	if (!bindings[Bindings_CBTReadOnly] || !bindings[Bindings_CBTReadWrite])
-	{
-		nvrhi::BindingSetDesc setDesc;
-		setDesc.bindings = {
-			nvrhi::BindingSetItem::StructuredBuffer_SRV(TESSELLATION_BINDING_CBT, terrainView->GetCBTBuffer()),
-			nvrhi::BindingSetItem::StructuredBuffer_UAV(TESSELLATION_BINDING_INDIRECT_ARGS, terrainView->GetIndirectArgsBuffer())
-		};
-		bindings[Bindings_CBTReadOnly] = m_Device->createBindingSet(setDesc, m_BindingLayouts[Bindings_CBTReadOnly]);
-
-		setDesc.bindings = {
-			nvrhi::BindingSetItem::PushConstants(TESSELLATION_BINDING_PUSH_CONSTANTS, sizeof(TessellationSumReductionPushConstants)),
-			nvrhi::BindingSetItem::StructuredBuffer_UAV(TESSELLATION_BINDING_CBT, terrainView->GetCBTBuffer())
-		};
-		bindings[Bindings_CBTReadWrite] = m_Device->createBindingSet(setDesc, m_BindingLayouts[Bindings_CBTReadWrite]);
-	}
+	UpdateLodBiases(view, items);
 
-	// Run compute shader dispatcher
+	std::vector<Job> jobs;
+	jobs.reserve(items.size());
+	// Views that are not subdivided this frame, whose leaves are culled all the same
+	std::vector<Job> cullingJobs;
+	cullingJobs.reserve(items.size());
+	for (const auto& item : items)
 	{
-		commandList->beginMarker("CBT Dispatch");
+		auto& cachedData = m_TerrainCache[item.TerrainView];
 
-		nvrhi::ComputeState state;
-		state.pipeline = m_Pipelines[Shaders_CBTDispatch];
-		state.bindings = { bindings[Bindings_CBTReadOnly] };
-		commandList->setComputeState(state);
+		ReadCullingStats(cachedData);
+		bool tessellate = false;
+		if (subdivide)
+		{
+			tessellate = UpdateConvergence(view, item, cachedData);
+			cachedData.stats.Converged = !tessellate;
+		}
+		if (!tessellate)
+		{
+			// The rendered buffers are about to be swapped with the back buffers, which must hold the same mesh
+			if (item.TerrainView->IsDoubleBuffered() && !cachedData.backBuffersInSync)
+			{
+				CopyRenderBuffersToTessellationBuffers(commandList, item.TerrainView);
+				cachedData.backBuffersInSync = true;
+			}
+
+			if (!cachedData.cullingReadback)
+			{
+				cachedData.cullingReadback = std::make_unique<ReadbackRing>(m_Device,
+					sizeof(nvrhi::DrawIndirectArguments) * CULLED_DRAW_COUNT, "CBT_CullingReadback");
+			}
+
+			// The culling only binds the sets of the pass
+			cullingJobs.push_back({ item.Pass, item.TerrainView, &cachedData, nullptr, false, ITerrainTessellationPass::Subdivision_Split });
+			continue;
+		}
+		cachedData.backBuffersInSync = false;
 
-		commandList->dispatch(1);
-		commandList->endMarker();
-	}
+		auto& bindings = m_BindingSets[item.TerrainView->GetTessellationCBTBuffer()];
+		CreateBindingSets(item.TerrainView, bindings);
 
-	// Execute (indirectly) the tessellation pass
-	{
-		commandList->beginMarker("Subdivision");
+		// The fused reduction writes the indirect arguments itself, so the dispatchers are not required
+		const bool fusedReduction = item.TerrainView->GetTopology() == TerrainTopology::ConcurrentBinaryTree
+									&& item.TerrainView->GetSumReductionMode() == TerrainSumReductionMode::Fused
+									&& SupportsFusedSumReduction(item.TerrainView->GetMaxDepth());
+		if (fusedReduction)
+		{
+			CreateReductionScratch(commandList, item.TerrainView, cachedData, bindings);
+		}
 
-		pass.SetupView(commandList, terrainView, view);
+		// A double buffered view continues from the mesh being rendered, which is the result of its last tessellation
+		if (item.TerrainView->IsDoubleBuffered())
+		{
+			CopyRenderBuffersToTessellationBuffers(commandList, item.TerrainView);
+		}
 
-		nvrhi::ComputeState state;
-		pass.SetupSubdivisionState(terrainView, static_cast<ITerrainTessellationPass::SubdivisionPassTypes>(cachedData.split), state);
+		if (!cachedData.leafCountReadback)
+		{
+			cachedData.leafCountReadback = std::make_unique<ReadbackRing>(m_Device, sizeof(uint), "CBT_LeafCountReadback");
+		}
+		if (!cachedData.cullingReadback)
+		{
+			cachedData.cullingReadback = std::make_unique<ReadbackRing>(m_Device,
+				sizeof(nvrhi::DrawIndirectArguments) * CULLED_DRAW_COUNT, "CBT_CullingReadback");
+		}
 
-		state.setIndirectParams(terrainView->GetIndirectArgsBuffer());
-		commandList->setComputeState(state);
+		// The readback tells the convergence and the adaptive schedule which pass the feedback is of
+		const ITerrainTessellationPass::SubdivisionPassTypes subdivisionPass = ChooseSubdivisionPass(*item.Pass, cachedData);
+		const uint32_t passes = 1u << subdivisionPass;
+		commandList->clearBufferUInt(item.TerrainView->GetFeedbackBuffer(), 0);
+		commandList->writeBuffer(item.TerrainView->GetFeedbackBuffer(), &passes, sizeof(passes), offsetof(TessellationFeedback, Passes));
 
-		pass.SetupPushConstants(commandList, terrainView);
+		jobs.push_back({ item.Pass, item.TerrainView, &cachedData, &bindings, fusedReduction, subdivisionPass });
+	}
 
-		commandList->dispatchIndirect(TerrainMeshView::GetIndirectArgsDispatchOffset());
+	// The leaves of the views that are not subdivided are culled from the mesh they already have
+	std::vector<Job*> culledJobs;
+	for (auto& job : cullingJobs)
+	{
+		culledJobs.push_back(&job);
+	}
+
+	if (jobs.empty())
+	{
+		ExecuteCulling(commandList, view, culledJobs);
+		for (const Job* job : culledJobs)
+		{
+			job->cachedData->cullingReadback->Write(commandList, job->terrainView->GetTessellationCulledIndirectArgsBuffer());
+		}
 
-		cachedData.split = !cachedData.split;
 		commandList->endMarker();
+		return;
 	}
 
-	// Run sum reduction
+	if (m_ValidationRequested && !m_Validation)
 	{
-		commandList->beginMarker("Sum Reduction");
+		BeginValidationCapture(commandList, jobs);
+	}
 
-		int it = static_cast<int>(terrainView->GetMaxDepth());
+	std::vector<Job*> allJobs;
+	// The CBT and bisector pool topologies only share the subdivision and the culling
+	std::vector<Job*> cbtJobs;
+	std::vector<Job*> poolJobs;
+	for (auto& job : jobs)
+	{
+		allJobs.push_back(&job);
+		(job.terrainView->GetTopology() == TerrainTopology::BisectorPool ? poolJobs : cbtJobs).push_back(&job);
+	}
 
-		nvrhi::ComputeState state;
-		{
-			state.pipeline = m_Pipelines[Shaders_SumReductionPrePass];
-			state.bindings = { bindings[Bindings_CBTReadWrite] };
-			commandList->setComputeState(state);
+	// Every view either splits or merges
+	ExecuteCBTDispatch(commandList, cbtJobs);
+	ExecuteBisectorPoolPrepare(commandList, poolJobs);
+	ExecuteSubdivision(commandList, view, allJobs);
+	ExecuteSumReduction(commandList, cbtJobs);
+	ExecuteBisectorPoolUpdate(commandList, poolJobs);
 
-			int cnt = ((1 << it) >> 5);
-			int numGroup = (cnt >= 256) ? (cnt >> 8) : 1;
+	if (m_Validation && m_Validation->job)
+	{
+		EndValidationCapture(commandList);
+	}
 
-			TessellationSumReductionPushConstants constants = { static_cast<uint>(it) };
-			commandList->setPushConstants(&constants, sizeof(constants));
+	for (const Job* job : allJobs)
+	{
+		job->cachedData->feedbackReadback->Write(commandList, job->terrainView->GetFeedbackBuffer(), 0, job->cachedData->inputsVersion);
+	}
 
-			nvrhi::utils::BufferUavBarrier(commandList, terrainView->GetCBTBuffer());
-			commandList->commitBarriers();
+	// The pool dispatcher already wrote the indirect arguments of the bisector pool views
+	ExecuteLEBDispatch(commandList, cbtJobs);
 
-			commandList->dispatch(static_cast<uint32_t>(numGroup));
+	// The instance count of the draw arguments is the leaf count
+	for (const Job* job : allJobs)
+	{
+		job->cachedData->leafCountReadback->Write(commandList, job->terrainView->GetTessellationIndirectArgsBuffer(),
+			TerrainMeshView::GetIndirectArgsDrawOffset() + offsetof(nvrhi::DrawIndirectArguments, instanceCount));
+	}
 
-			it -= 5;
-		}
+	culledJobs.insert(culledJobs.end(), allJobs.begin(), allJobs.end());
+	ExecuteCulling(commandList, view, culledJobs);
 
-		state.pipeline = m_Pipelines[Shaders_SumReduction];
-		state.bindings = { bindings[Bindings_CBTReadWrite] };
-		commandList->setComputeState(state);
+	for (const Job* job : culledJobs)
+	{
+		job->cachedData->cullingReadback->Write(commandList, job->terrainView->GetTessellationCulledIndirectArgsBuffer());
+	}
 
-		while (--it >= 0)
-		{
-			int cnt = 1 << it;
-			int numGroup = (cnt >= 256) ? (cnt >> 8) : 1;
+	commandList->endMarker();
+	// Now the terrains can be rendered with drawIndirect
+}
 
-			TessellationSumReductionPushConstants constants = { static_cast<uint>(it) };
-			commandList->setPushConstants(&constants, sizeof(constants));
+void TerrainTessellator::ExecutePassForTerrainView(
+	nvrhi::ICommandList* commandList,
+	const donut::engine::IView* view,
+	ITerrainTessellationPass& pass,
+	const TerrainMeshView* terrainView)
+{
+	ExecutePassForTerrainViews(commandList, view, { Item{ &pass, terrainView } });
+}
+
+void TerrainTessellator::ExecuteOcclusionRetest(
+	nvrhi::ICommandList* commandList,
+	const donut::engine::IView* view,
+	const std::vector<Item>& items)
+{
+	if (items.empty())
+		return;
 
-			nvrhi::utils::BufferUavBarrier(commandList, terrainView->GetCBTBuffer());
-			commandList->commitBarriers();
+	commandList->beginMarker("Occlusion Retest");
+	GpuTimerScope timerScope(m_GpuTimers, commandList, "Occlusion Retest");
 
-			commandList->dispatch(static_cast<uint32_t>(numGroup));
-		}
+	// Only the instance count is reset, as the vertex count written by the culling depends on the render mode
+	const uint32_t disoccludedInstanceCount = 0;
 
-		commandList->endMarker();
+	for (const auto& item : items)
+	{
+		commandList->writeBuffer(item.TerrainView->GetCulledIndirectArgsBuffer(), &disoccludedInstanceCount, sizeof(disoccludedInstanceCount),
+			TerrainMeshView::GetCulledDrawOffset(CULLED_DRAW_DISOCCLUDED) + offsetof(nvrhi::DrawIndirectArguments, instanceCount));
 	}
 
-	// Run draw indirect dispatcher
+	for (const auto& item : items)
 	{
-		commandList->beginMarker("LEB Dispatch");
+		GpuTimerScope viewScope(m_GpuTimers, commandList, item.TerrainView->GetName());
+
+		// Same LOD bias as the last tessellation, though the retest does not depend on it
+		auto it = m_TerrainCache.find(item.TerrainView);
+		const float lodBias = it != m_TerrainCache.end() ? it->second.lodBias : 0.0f;
+		item.Pass->SetupView(commandList, item.TerrainView, view, lodBias);
 
 		nvrhi::ComputeState state;
-		state.pipeline = m_Pipelines[Shaders_LEBDispatch];
-		state.bindings = { bindings[Bindings_CBTReadOnly] };
+		item.Pass->SetupCullingState(item.TerrainView, ITerrainTessellationPass::Culling_OcclusionRetest, state);
+
+		// Dispatched for the leaf count of the rendered mesh, which bounds the occluded leaf count
+		state.setIndirectParams(item.TerrainView->GetIndirectArgsBuffer());
 		commandList->setComputeState(state);
 
-		commandList->dispatch(1);
-		commandList->endMarker();
+		item.Pass->SetupPushConstants(commandList, item.TerrainView);
+
+		commandList->dispatchIndirect(TerrainMeshView::GetIndirectArgsDispatchOffset());
 	}
 
 	commandList->endMarker();
-	// Now the terrain can be rendered with drawIndirect
 }
 
+bool TerrainTessellator::GetStats(const TerrainMeshView* terrainView, TerrainTessellationStats& stats) const
+{
+	auto it = m_TerrainCache.find(terrainView);
+	if (it == m_TerrainCache.end())
+		return false;
+
+	const TerrainCachedData& cachedData = it->second;
+	stats = cachedData.stats;
+	stats.MaxDepth = terrainView->GetMaxDepth();
+	stats.MaxLeafCount = terrainView->GetMaxLeafCount();
+	stats.LeafCount = cachedData.leafCount;
+	// The culling ran on the leaves that were counted, as both were read back from the same tessellation
+	stats.FrustumCulledLeafCount = stats.LeafCount - std::min(stats.LeafCount, stats.VisibleLeafCount + stats.OccludedLeafCount);
+	return true;
+}
 
-PrimaryViewTerrainTessellationPass::PrimaryViewTerrainTessellationPass(nvrhi::DeviceHandle device, std::shared_ptr<donut::engine::CommonRenderPasses> commonPasses)
-	: ITerrainTessellationPass(std::move(device))
-	, m_CommonPasses(std::move(commonPasses))
+std::vector<const TerrainMeshView*> TerrainTessellator::GetTerrainViews() const
 {
+	std::vector<const TerrainMeshView*> terrainViews;
+	terrainViews.reserve(m_TerrainCache.size());
+	for (const auto& [terrainView, cachedData] : m_TerrainCache)
+	{
+		terrainViews.push_back(terrainView);
+	}
+	return terrainViews;
 }
 
-void PrimaryViewTerrainTessellationPass::Init(donut::engine::ShaderFactory& shaderFactory)
+void TerrainTessellator::ReadCullingStats(TerrainCachedData& cachedData)
 {
-	m_SplitShader = shaderFactory.CreateAutoShader("app/terrain/tessellation/Subdivision.hlsl", "split_cs",
-		DONUT_MAKE_PLATFORM_SHADER(g_terrain_tessellation_split_cs), nullptr, nvrhi::ShaderType::Compute);
-	m_MergeShader = shaderFactory.CreateAutoShader("app/terrain/tessellation/Subdivision.hlsl", "merge_cs",
-		DONUT_MAKE_PLATFORM_SHADER(g_terrain_tessellation_merge_cs), nullptr, nvrhi::ShaderType::Compute);
+	if (!cachedData.cullingReadback)
+		return;
 
+	nvrhi::DrawIndirectArguments culledDrawArgs[CULLED_DRAW_COUNT];
+	while (cachedData.cullingReadback->Read(culledDrawArgs))
 	{
-		nvrhi::BindingLayoutDesc layoutDesc;
-		layoutDesc.setVisibility(nvrhi::ShaderType::Compute)
-			.setRegisterSpaceIsDescriptorSet(true)
-			.setRegisterSpace(TESSELLATION_SPACE_VIEW)
-			.addItem(nvrhi::BindingLayoutItem::VolatileConstantBuffer(TESSELLATION_BINDING_SUBDIVISION_CONSTANTS))
-			.addItem(nvrhi::BindingLayoutItem::Sampler(TESSELLATION_BINDING_SUBDIVISION_HEIGHTMAP_SAMPLER));
-
-		m_ViewBindingLayout = m_Device->createBindingLayout(layoutDesc);
+		cachedData.stats.VisibleLeafCount = culledDrawArgs[CULLED_DRAW_VISIBLE].instanceCount;
+		cachedData.stats.OccludedLeafCount = culledDrawArgs[CULLED_DRAW_OCCLUDED].instanceCount;
 	}
-	{
-		nvrhi::BindingLayoutDesc layoutDesc;
-		layoutDesc.setVisibility(nvrhi::ShaderType::Compute)
-			.setRegisterSpaceIsDescriptorSet(true)
-			.setRegisterSpace(TESSELLATION_SPACE_TERRAIN)
-			.addItem(nvrhi::BindingLayoutItem::PushConstants(TESSELLATION_BINDING_PUSH_CONSTANTS, sizeof(TerrainPushConstants)))
-			.addItem(nvrhi::BindingLayoutItem::ConstantBuffer(TESSELLATION_BINDING_TERRAIN_CONSTANTS))
-			.addItem(nvrhi::BindingLayoutItem::StructuredBuffer_UAV(TESSELLATION_BINDING_CBT))
-			.addItem(nvrhi::BindingLayoutItem::StructuredBuffer_SRV(TESSELLATION_BINDING_INSTANCE_BUFFER))
-			.addItem(nvrhi::BindingLayoutItem::Texture_SRV(TESSELLATION_BINDING_SUBDIVISION_HEIGHTMAP));
+}
 
-		m_TerrainBindingLayout = m_Device->createBindingLayout(layoutDesc);
-	}
+void TerrainTessellator::ResetTerrainCache()
+{
+	m_BindingSets.clear();
+	m_TerrainCache.clear();
+}
 
+void TerrainTessellator::BeginValidationCapture(nvrhi::ICommandList* commandList, const std::vector<Job>& jobs)
+{
+	for (const Job& job : jobs)
 	{
-		nvrhi::ComputePipelineDesc psoDesc;
-		psoDesc.bindingLayouts = { m_TerrainBindingLayout, m_ViewBindingLayout };
+		float lodFactor;
+		uint32_t lodScheme;
+		if (job.terrainView->GetTopology() != TerrainTopology::ConcurrentBinaryTree || !job.pass->GetSubdivisionReference(lodFactor, lodScheme))
+			continue;
 
-		psoDesc.setComputeShader(m_SplitShader);
-		m_SplitPipeline = m_Device->createComputePipeline(psoDesc);
+		const TerrainMeshInfo* terrain = job.terrainView->GetInstance()->GetTerrain();
+		// The reference tessellator needs every texel of the heightmap, which virtual heightmaps never hold
+		if (!terrain || !terrain->HeightmapTexture || !terrain->HeightmapTexture->texture || terrain->VirtualHeightmap)
+			continue;
 
-		psoDesc.setComputeShader(m_MergeShader);
-		m_MergePipeline = m_Device->createComputePipeline(psoDesc);
+		m_ValidationRequested = false;
+		m_Validation = std::make_unique<ValidationCapture>();
+		m_Validation->job = &job;
+		m_Validation->maxDepth = job.terrainView->GetMaxDepth();
+		if (const auto* node = job.terrainView->GetInstance()->GetNode())
+		{
+			m_Validation->name = node->GetPath().generic_string();
+			m_Validation->parameters.LocalToWorld = node->GetLocalToWorldTransformFloat();
+		}
+
+		nvrhi::IBuffer* cbtBuffer = job.terrainView->GetTessellationCBTBuffer();
+		nvrhi::BufferDesc bufferDesc;
+		bufferDesc.setByteSize(cbtBuffer->getDesc().byteSize)
+			.setCpuAccess(nvrhi::CpuAccessMode::Read)
+			.setInitialState(nvrhi::ResourceStates::CopyDest)
+			.setKeepInitialState(true)
+			.setDebugName("CBT_ValidationBefore");
+		m_Validation->heapBefore = m_Device->createBuffer(bufferDesc);
+		bufferDesc.setDebugName("CBT_ValidationAfter");
+		m_Validation->heapAfter = m_Device->createBuffer(bufferDesc);
+
+		commandList->copyBuffer(m_Validation->heapBefore, 0, cbtBuffer, 0, bufferDesc.byteSize);
+
+		nvrhi::ITexture* heightmap = terrain->HeightmapTexture->texture;
+		nvrhi::TextureDesc stagingDesc;
+		stagingDesc.width = heightmap->getDesc().width;
+		stagingDesc.height = heightmap->getDesc().height;
+		stagingDesc.format = heightmap->getDesc().format;
+		stagingDesc.initialState = nvrhi::ResourceStates::CopyDest;
+		stagingDesc.keepInitialState = true;
+		stagingDesc.debugName = "HeightmapValidation";
+		m_Validation->heightmap = m_Device->createStagingTexture(stagingDesc, nvrhi::CpuAccessMode::Read);
+
+		commandList->copyTexture(m_Validation->heightmap, nvrhi::TextureSlice(), heightmap, nvrhi::TextureSlice());
+
+		terrain->FillTerrainConstants(m_Validation->parameters.Terrain, uint2(stagingDesc.width, stagingDesc.height));
+		return;
 	}
+}
 
+void TerrainTessellator::CaptureValidationPass(const donut::engine::IView* view, const Job& job)
+{
+	m_Validation->passes.push_back(job.subdivisionPass);
+	if (m_Validation->parametersCaptured)
+		return;
+
+	// The same constants as written by SetupView, which the pass does not keep
+	auto& parameters = m_Validation->parameters;
+	view->FillPlanarViewConstants(parameters.Subdivision.view);
+	if (const auto* viewEx = dynamic_cast<const PlanarViewEx*>(view))
 	{
-		m_ViewCB = m_Device->createBuffer(nvrhi::utils::CreateVolatileConstantBufferDesc(
-			sizeof(SubdivisionConstants), "SubdivisionConstants", 16
-		));
+		viewEx->FillPlanarViewExConstants(parameters.Subdivision.viewEx);
 	}
+	job.pass->GetSubdivisionReference(parameters.Subdivision.lodFactor, parameters.LodScheme);
+	m_Validation->parametersCaptured = true;
+}
 
+void TerrainTessellator::EndValidationCapture(nvrhi::ICommandList* commandList)
+{
+	nvrhi::IBuffer* cbtBuffer = m_Validation->job->terrainView->GetTessellationCBTBuffer();
+	commandList->copyBuffer(m_Validation->heapAfter, 0, cbtBuffer, 0, cbtBuffer->getDesc().byteSize);
+
+	// The job does not outlive the batch
+	m_Validation->job = nullptr;
+}
+
+bool TerrainTessellator::HasValidationCapture() const
+{
+	return m_Validation && !m_Validation->job;
+}
+
+// Normalized heights as the heightmap is sampled, i.e. the red channel (linear for sRGB formats)
+static bool DecodeHeightmap(nvrhi::Format format, uint2 size, const uint8_t* data, size_t rowPitch, std::vector<float>& heights)
+{
+	heights.resize(static_cast<size_t>(size.x) * size.y);
+
+	for (uint32_t y = 0; y < size.y; y++)
 	{
-		nvrhi::BindingSetDesc setDesc;
-		setDesc.addItem(nvrhi::BindingSetItem::ConstantBuffer(TESSELLATION_BINDING_SUBDIVISION_CONSTANTS, m_ViewCB));
-		setDesc.addItem(nvrhi::BindingSetItem::Sampler(TESSELLATION_BINDING_SUBDIVISION_HEIGHTMAP_SAMPLER, m_CommonPasses->m_LinearClampSampler));
+		const uint8_t* row = data + y * rowPitch;
+		float* output = heights.data() + static_cast<size_t>(y) * size.x;
 
-		m_ViewBindingSet = m_Device->createBindingSet(setDesc, m_ViewBindingLayout);
+		for (uint32_t x = 0; x < size.x; x++)
+		{
+			switch (format)
+			{
+			case nvrhi::Format::R8_UNORM:
+				output[x] = static_cast<float>(row[x]) / 255.0f;
+				break;
+			case nvrhi::Format::RGBA8_UNORM:
+			case nvrhi::Format::BGRA8_UNORM:
+				output[x] = static_cast<float>(row[4 * x + (format == nvrhi::Format::BGRA8_UNORM ? 2 : 0)]) / 255.0f;
+				break;
+			case nvrhi::Format::SRGBA8_UNORM:
+			{
+				const float value = static_cast<float>(row[4 * x]) / 255.0f;
+				output[x] = value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+				break;
+			}
+			case nvrhi::Format::R16_UNORM:
+			{
+				uint16_t value;
+				std::memcpy(&value, row + 2 * x, sizeof(value));
+				output[x] = static_cast<float>(value) / 65535.0f;
+				break;
+			}
+			case nvrhi::Format::R32_FLOAT:
+				std::memcpy(&output[x], row + 4 * x, sizeof(float));
+				break;
+			default:
+				return false;
+			}
+		}
 	}
+	return true;
 }
 
-void PrimaryViewTerrainTessellationPass::SetupView(nvrhi::ICommandList* commandList, const TerrainMeshView* terrainView, const donut::engine::IView* view)
+std::string TerrainTessellator::ResolveValidation()
 {
-	SubdivisionConstants constants;
-	view->FillPlanarViewConstants(constants.view);
-	if (auto viewEx = dynamic_cast<const PlanarViewEx*>(view))
+	assert(HasValidationCapture());
+	const std::unique_ptr<ValidationCapture> capture = std::move(m_Validation);
+
+	const nvrhi::TextureDesc& heightmapDesc = capture->heightmap->getDesc();
+	const uint2 heightmapSize(heightmapDesc.width, heightmapDesc.height);
+	std::vector<float> heights;
 	{
-		viewEx->FillPlanarViewExConstants(constants.viewEx);
+		size_t rowPitch = 0;
+		const void* data = m_Device->mapStagingTexture(capture->heightmap, nvrhi::TextureSlice(), nvrhi::CpuAccessMode::Read, &rowPitch);
+		const bool decoded = data && DecodeHeightmap(heightmapDesc.format, heightmapSize, static_cast<const uint8_t*>(data), rowPitch, heights);
+		if (data)
+		{
+			m_Device->unmapStagingTexture(capture->heightmap);
+		}
+		if (!decoded)
+		{
+			const std::string report = "Tessellation validation of " + capture->name + ": unsupported heightmap format";
+			donut::log::warning("%s", report.c_str());
+			return report;
+		}
 	}
-	else
+	const TerrainHeightfield heightfield(heightmapSize, std::move(heights));
+
+	TerrainCpuTessellator cpuTessellator(capture->maxDepth, 1);
+	TerrainCpuTessellator gpuTree(capture->maxDepth, 1);
+	const size_t heapByteSize = capture->heapBefore->getDesc().byteSize;
+	auto readHeap = [&](nvrhi::IBuffer* buffer, TerrainCpuTessellator& tree)
 	{
-		// Tessellation pipeline will not work correctly
-		assert(false);
+		const void* data = m_Device->mapBuffer(buffer, nvrhi::CpuAccessMode::Read);
+		const bool read = data && tree.SetHeap(data, heapByteSize);
+		if (data)
+		{
+			m_Device->unmapBuffer(buffer);
+		}
+		return read;
+	};
+	if (!readHeap(capture->heapBefore, cpuTessellator) || !readHeap(capture->heapAfter, gpuTree))
+	{
+		const std::string report = "Tessellation validation of " + capture->name + ": the CBT could not be read back";
+		donut::log::warning("%s", report.c_str());
+		return report;
 	}
 
-	// Calculate LOD factor
+	const auto start = std::chrono::steady_clock::now();
+	for (const auto pass : capture->passes)
 	{
-		// constants.view.matViewToClip.m11 == tan(fovy / 2)
-		float tmp = (2.0f / constants.view.matViewToClip.m11)
-			/ constants.view.viewportSize.y * static_cast<float>(1 << m_SubdivisionLevel)
-			* m_PrimitivePixelLength;
-
-		constants.lodFactor = -2.0f * std::log2(tmp) + 2.0f;
+		if (pass == ITerrainTessellationPass::Subdivision_Split)
+			cpuTessellator.Split(heightfield, capture->parameters);
+		else
+			cpuTessellator.Merge(heightfield, capture->parameters);
 	}
+	const double cpuMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
 
-	commandList->writeBuffer(m_ViewCB, &constants, sizeof(constants));
-}
+	const bool matches = std::memcmp(cpuTessellator.GetHeap(), gpuTree.GetHeap(), heapByteSize) == 0;
 
-void PrimaryViewTerrainTessellationPass::SetupSubdivisionState(const TerrainMeshView* terrainView, SubdivisionPassTypes subdivisionPass, nvrhi::ComputeState& state)
-{
-	state.bindings = { FindOrCreateBindingSet(terrainView), m_ViewBindingSet };
-	state.pipeline = subdivisionPass == Subdivision_Split ? m_SplitPipeline : m_MergePipeline;
-}
+	// Leaves of either tree that are not leaves of the other
+	std::vector<uint64_t> cpuLeaves = cpuTessellator.GetLeafHeapIDs();
+	std::vector<uint64_t> gpuLeaves = gpuTree.GetLeafHeapIDs();
+	std::sort(cpuLeaves.begin(), cpuLeaves.end());
+	std::sort(gpuLeaves.begin(), gpuLeaves.end());
+	std::vector<uint64_t> differingLeaves;
+	std::set_symmetric_difference(cpuLeaves.begin(), cpuLeaves.end(), gpuLeaves.begin(), gpuLeaves.end(), std::back_inserter(differingLeaves));
 
-void PrimaryViewTerrainTessellationPass::SetupPushConstants(nvrhi::ICommandList* commandList, const TerrainMeshView* terrainView)
-{
-	TerrainPushConstants constants;
-	constants.startInstanceLocation = terrainView->GetInstance()->GetInstanceIndex();
-	commandList->setPushConstants(&constants, sizeof(constants));
+	char report[512];
+	std::snprintf(report, sizeof(report), "Tessellation validation of %s (%zu pass%s, %.2f ms on the CPU): %s, %zu GPU leaves, %zu CPU leaves, %zu differing",
+		capture->name.c_str(), capture->passes.size(), capture->passes.size() == 1 ? "" : "es", cpuMilliseconds,
+		matches ? "bit-exact" : "MISMATCH", gpuLeaves.size(), cpuLeaves.size(), differingLeaves.size());
+
+	if (matches)
+	{
+		donut::log::info("%s", report);
+	}
+	else
+	{
+		donut::log::warning("%s", report);
+		// Nodes at the LOD threshold may differ with the precision of the texture filtering of the GPU, and the
+		// occlusion culling of the subdivision is not replayed
+		if (capture->parameters.Subdivision.viewEx.occlusionFlags & OCCLUSION_FLAG_SUBDIVISION)
+		{
+			donut::log::warning("The subdivision was occlusion culled, which the CPU does not replay");
+		}
+	}
+	return report;
 }
 
-nvrhi::BindingSetHandle PrimaryViewTerrainTessellationPass::FindOrCreateBindingSet(const TerrainMeshView* key)
+void TerrainTessellator::CreateBindingSets(const TerrainMeshView* terrainView, BindingSets& bindings)
 {
-	nvrhi::BindingSetHandle bindingSet = m_TerrainBindingSets[key];
-	if (!bindingSet)
+	if (terrainView->GetTopology() == TerrainTopology::BisectorPool)
 	{
-		const TerrainMeshInfo* terrainMesh = key->GetInstance()->GetTerrain();
+		if (!bindings[Bindings_BisectorPool])
+		{
+			nvrhi::BindingSetDesc setDesc;
+			setDesc.bindings = {
+				nvrhi::BindingSetItem::StructuredBuffer_UAV(TESSELLATION_BINDING_CBT, terrainView->GetTessellationCBTBuffer()),
+				nvrhi::BindingSetItem::StructuredBuffer_UAV(TESSELLATION_BINDING_INDIRECT_ARGS, terrainView->GetTessellationIndirectArgsBuffer()),
+				nvrhi::BindingSetItem::StructuredBuffer_UAV(TESSELLATION_BINDING_POOL_SCRATCH, terrainView->GetBisectorScratchBuffer())
+			};
+			bindings[Bindings_BisectorPool] = m_Device->createBindingSet(setDesc, m_BindingLayouts[Bindings_BisectorPool]);
+		}
+		return;
+	}
 
+	// Create binding sets if there are none for this terrain view
+	if (!bindings[Bindings_CBTReadOnly] || !bindings[Bindings_CBTReadWrite])
+	{
 		nvrhi::BindingSetDesc setDesc;
-		setDesc.addItem(nvrhi::BindingSetItem::PushConstants(TESSELLATION_BINDING_PUSH_CONSTANTS, sizeof(TerrainPushConstants)))
-			.addItem(nvrhi::BindingSetItem::ConstantBuffer(TESSELLATION_BINDING_TERRAIN_CONSTANTS, terrainMesh->TerrainCB))
-			.addItem(nvrhi::BindingSetItem::StructuredBuffer_UAV(TESSELLATION_BINDING_CBT, key->GetCBTBuffer()))
-			.addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(TESSELLATION_BINDING_INSTANCE_BUFFER, terrainMesh->buffers->instanceBuffer.Get()))
-			.addItem(nvrhi::BindingSetItem::Texture_SRV(TESSELLATION_BINDING_SUBDIVISION_HEIGHTMAP, terrainMesh->HeightmapTexture->texture));
-
-		bindingSet = m_Device->createBindingSet(setDesc, m_TerrainBindingLayout);
+		setDesc.bindings = {
+			nvrhi::BindingSetItem::StructuredBuffer_SRV(TESSELLATION_BINDING_CBT, terrainView->GetTessellationCBTBuffer()),
+			nvrhi::BindingSetItem::StructuredBuffer_UAV(TESSELLATION_BINDING_INDIRECT_ARGS, terrainView->GetTessellationIndirectArgsBuffer())
+		};
+		bindings[Bindings_CBTReadOnly] = m_Device->createBindingSet(setDesc, m_BindingLayouts[Bindings_CBTReadOnly]);
 
-		m_TerrainBindingSets[key] = bindingSet;
+		setDesc.bindings = {
+			nvrhi::BindingSetItem::PushConstants(TESSELLATION_BINDING_PUSH_CONSTANTS, sizeof(TessellationSumReductionPushConstants)),
+			nvrhi::BindingSetItem::StructuredBuffer_UAV(TESSELLATION_BINDING_CBT, terrainView->GetTessellationCBTBuffer())
+		};
+		bindings[Bindings_CBTReadWrite] = m_Device->createBindingSet(setDesc, m_BindingLayouts[Bindings_CBTReadWrite]);
 	}
-	return bindingSet;
 }
 
+void TerrainTessellator::BeginFrame()
+{
+	m_LeafCount = m_FrameLeafCount;
+	m_LastFrameCoverage = m_FrameCoverage;
+	m_FrameLeafCount = 0;
+	m_FrameCoverage = 0.0f;
+}
 
-void TessellateTerrainView(
-	nvrhi::ICommandList* commandList,
-	const donut::engine::IView* view,
-	const std::shared_ptr<donut::engine::SceneGraphNode>& rootNode,
-	donut::render::IDrawStrategy& drawStrategy,
-	TerrainTessellator& tessellator
-)
+void TerrainTessellator::UpdateLodBiases(const donut::engine::IView* view, const std::vector<Item>& items)
 {
-	commandList->beginMarker("Tessellate Terrain View");
+	// Each step moves the LOD bias by a fraction of the error, as the leaf counts lag a few frames behind
+	constexpr float controllerGain = 0.25f;
+	// The bias is only relaxed once the leaf count is well under the budget, so it does not oscillate around it
+	constexpr float relaxThreshold = 0.9f;
+	constexpr float minLodBias = -16.0f;
 
-	drawStrategy.PrepareForView(rootNode, *view);
+	std::vector<float> coverages(items.size());
+	std::vector<bool> leafCountsRead(items.size());
 
-	while (auto drawItem = drawStrategy.GetNextItem())
+	for (size_t i = 0; i < items.size(); i++)
 	{
-		if (!drawItem->userData)
-			continue;
-		auto terrainView = static_cast<const TerrainMeshView*>(drawItem->userData);
+		auto& cachedData = m_TerrainCache[items[i].TerrainView];
 
-		// If tessellation scheme of terrain view was never set, then the returned shared_ptr will be empty (and evaluate to false)
-		if (auto pass = terrainView->GetTessellationScheme().lock())
+		if (cachedData.leafCountReadback)
+		{
+			uint leafCount;
+			while (cachedData.leafCountReadback->Read(&leafCount))
+			{
+				cachedData.leafCount = leafCount;
+				leafCountsRead[i] = true;
+			}
+		}
+		m_FrameLeafCount += cachedData.leafCount;
+
+		if (const auto* node = items[i].TerrainView->GetInstance()->GetNode())
 		{
-			tessellator.ExecutePassForTerrainView(
-				commandList,
-				view,
-				*pass,
-				terrainView
-			);
+			coverages[i] = ComputeScreenCoverage(view, node->GetGlobalBoundingBox());
 		}
+		m_FrameCoverage += coverages[i];
 	}
 
-	commandList->endMarker();
+	// The budget is shared among the views of every batch of the frame, whose coverage is only known once the last
+	// batch is recorded, so the shares are taken from that of the last frame (or of the batches so far on the first)
+	const float totalCoverage = std::max(m_LastFrameCoverage, m_FrameCoverage);
+
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		auto& cachedData = m_TerrainCache[items[i].TerrainView];
+
+		if (m_TriangleBudget == 0)
+		{
+			cachedData.lodBias = 0.0f;
+			continue;
+		}
+
+		// Only react to new leaf counts, otherwise the same error would be integrated over and over
+		if (!leafCountsRead[i] || cachedData.leafCount == 0)
+			continue;
+
+		// Terrains covering more of the screen get a larger share of the budget
+		const float share = totalCoverage > 0.0f ? std::min(coverages[i] / totalCoverage, 1.0f) : 1.0f / static_cast<float>(items.size());
+		const float viewBudget = std::max(share * static_cast<float>(m_TriangleBudget), 1.0f);
+		const float leafCount = static_cast<float>(cachedData.leafCount);
+
+		// The leaf count roughly doubles for each unit of LOD bias
+		const float error = std::log2(viewBudget / leafCount);
+		if (leafCount > viewBudget || (leafCount < relaxThreshold * viewBudget && cachedData.lodBias < 0.0f))
+		{
+			cachedData.lodBias = std::clamp(cachedData.lodBias + controllerGain * error, minLodBias, 0.0f);
+		}
+	}
+}
+
+float TerrainTessellator::ComputeScreenCoverage(const donut::engine::IView* view, const dm::box3& bounds)
+{
+	const dm::float4x4 viewProjection = view->GetViewProjectionMatrix(false);
+
+	dm::float2 minNdc{ 1.0f }, maxNdc{ -1.0f };
+	for (int corner = 0; corner < 8; corner++)
+	{
+		dm::float4 clip = dm::float4(bounds.getCorner(corner), 1.0f) * viewProjection;
+
+		// Part of the bounds is behind the camera, which is likely inside or very close to them
+		if (clip.w <= 0.0f)
+			return 1.0f;
+
+		dm::float2 ndc = clip.xy() / clip.w;
+		minNdc = dm::min(minNdc, ndc);
+		maxNdc = dm::max(maxNdc, ndc);
+	}
+
+	minNdc = dm::clamp(minNdc, dm::float2(-1.0f), dm::float2(1.0f));
+	maxNdc = dm::clamp(maxNdc, dm::float2(-1.0f), dm::float2(1.0f));
+	const dm::float2 extent = dm::max(maxNdc - minNdc, dm::float2(0.0f)) * 0.5f;
+	return extent.x * extent.y;
+}
+
+void TerrainTessellator::CopyRenderBuffersToTessellationBuffers(nvrhi::ICommandList* commandList, const TerrainMeshView* terrainView)
+{
+	commandList->copyBuffer(terrainView->GetTessellationCBTBuffer(), 0, terrainView->GetCBTBuffer(), 0,
+		terrainView->GetCBTBuffer()->getDesc().byteSize);
+	commandList->copyBuffer(terrainView->GetTessellationIndirectArgsBuffer(), 0, terrainView->GetIndirectArgsBuffer(), 0,
+		terrainView->GetIndirectArgsBuffer()->getDesc().byteSize);
+}
+
+bool TerrainTessellator::UpdateConvergence(const donut::engine::IView* view, const Item& item, TerrainCachedData& cachedData)
+{
+	TerrainCachedData::Inputs inputs;
+	// Zero the padding as well, as the inputs are compared bitwise
+	std::memset(&inputs, 0, sizeof(inputs));
+	inputs.worldToView = view->GetViewMatrix();
+	inputs.viewToClip = view->GetProjectionMatrix(false);
+	inputs.viewExtent = view->GetViewExtent();
+	if (const auto* node = item.TerrainView->GetInstance()->GetNode())
+	{
+		inputs.instanceTransform = node->GetLocalToWorldTransform();
+	}
+	inputs.pass = item.Pass;
+	inputs.passParameterVersion = item.Pass->GetParameterVersion();
+	inputs.lodBias = cachedData.lodBias;
+	// Enabling or disabling occlusion culling changes which leaves the culling keeps
+	if (const auto* viewEx = dynamic_cast<const PlanarViewEx*>(view))
+	{
+		inputs.occlusionFlags = viewEx->GetOcclusionFlags();
+	}
+	// Pages of a virtual heightmap becoming resident or evicted change the heights the subdivision sees
+	inputs.heightsVersion = item.TerrainView->GetInstance()->GetTerrain()->HeightsVersion;
+
+	if (std::memcmp(&inputs, &cachedData.inputs, sizeof(inputs)) != 0)
+	{
+		std::memcpy(&cachedData.inputs, &inputs, sizeof(inputs));
+		cachedData.inputsVersion++;
+		cachedData.unchangedPasses = 0;
+	}
+
+	if (!cachedData.feedbackReadback)
+	{
+		cachedData.feedbackReadback = std::make_unique<ReadbackRing>(m_Device, sizeof(TessellationFeedback), "CBT_FeedbackReadback");
+	}
+
+	TessellationFeedback feedback;
+	uint64_t inputsVersion;
+	while (cachedData.feedbackReadback->Read(&feedback, &inputsVersion))
+	{
+		cachedData.stats.SplitCount = feedback.SplitCount;
+		cachedData.stats.MergeCount = feedback.MergeCount;
+		std::copy(std::begin(feedback.LeafCountPerDepth), std::end(feedback.LeafCountPerDepth), cachedData.stats.LeafCountPerDepth.begin());
+
+		// Whether a pass is still needed does not depend much on small changes of the inputs, e.g. a moving camera
+		if (feedback.Passes & (1u << ITerrainTessellationPass::Subdivision_Split))
+			cachedData.splitActive = feedback.SplitCount > 0;
+		if (feedback.Passes & (1u << ITerrainTessellationPass::Subdivision_Merge))
+			cachedData.mergeActive = feedback.MergeCount > 0;
+
+		// Feedback from subdivisions with older inputs says nothing about the current ones
+		if (inputsVersion != cachedData.inputsVersion)
+			continue;
+
+		cachedData.unchangedPasses = feedback.Changed ? 0 : cachedData.unchangedPasses | feedback.Passes;
+	}
+
+	// Both a split and a merge must have changed nothing
+	constexpr uint32_t allPasses = (1u << ITerrainTessellationPass::Subdivision_Split) | (1u << ITerrainTessellationPass::Subdivision_Merge);
+	return cachedData.unchangedPasses != allPasses;
+}
+
+ITerrainTessellationPass::SubdivisionPassTypes TerrainTessellator::ChooseSubdivisionPass(const ITerrainTessellationPass& pass, TerrainCachedData& cachedData)
+{
+	// Frames the adaptive schedule repeats a pass before trying the other one again
+	constexpr uint32_t maxRepeatCount = 3;
+
+	bool split = cachedData.split;
+	if (pass.GetSubdivisionSchedule() == ITerrainTessellationPass::SubdivisionSchedule::Adaptive
+		&& cachedData.splitActive != cachedData.mergeActive && cachedData.repeatCount < maxRepeatCount)
+	{
+		split = cachedData.splitActive;
+		cachedData.repeatCount++;
+	}
+	else
+	{
+		cachedData.repeatCount = 0;
+	}
+
+	// Alternation resumes with the pass that was not run
+	cachedData.split = !split;
+	return split ? ITerrainTessellationPass::Subdivision_Split : ITerrainTessellationPass::Subdivision_Merge;
+}
+
+void TerrainTessellator::BatchedUavBarrier(nvrhi::ICommandList* commandList, const std::vector<nvrhi::IBuffer*>& buffers)
+{
+	for (auto buffer : buffers)
+	{
+		// Disabling UAV barriers re-arms nvrhi to place exactly one barrier on the next UAV use
+		commandList->setEnableUavBarriersForBuffer(buffer, false);
+		nvrhi::utils::BufferUavBarrier(commandList, buffer);
+	}
+	commandList->commitBarriers();
+}
+
+void TerrainTessellator::EndBatchedBarriers(nvrhi::ICommandList* commandList, const std::vector<nvrhi::IBuffer*>& buffers)
+{
+	for (auto buffer : buffers)
+	{
+		commandList->setEnableUavBarriersForBuffer(buffer, true);
+	}
+}
+
+void TerrainTessellator::ExecuteCBTDispatch(nvrhi::ICommandList* commandList, const std::vector<Job*>& jobs)
+{
+	commandList->beginMarker("CBT Dispatch");
+	GpuTimerScope timerScope(m_GpuTimers, commandList, "CBT Dispatch");
+
+	nvrhi::ComputeState state;
+	state.pipeline = m_Pipelines[Shaders_CBTDispatch];
+
+	for (const Job* job : jobs)
+	{
+		if (job->fusedReduction)
+			continue;
+
+		GpuTimerScope viewScope(m_GpuTimers, commandList, job->terrainView->GetName());
+
+		state.bindings = { (*job->bindings)[Bindings_CBTReadOnly] };
+		commandList->setComputeState(state);
+
+		commandList->dispatch(1);
+	}
+
+	commandList->endMarker();
+}
+
+void TerrainTessellator::ExecuteSubdivision(nvrhi::ICommandList* commandList, const donut::engine::IView* view, const std::vector<Job*>& jobs)
+{
+	// Execute (indirectly) the tessellation pass
+	commandList->beginMarker("Subdivision");
+	GpuTimerScope timerScope(m_GpuTimers, commandList, "Subdivision");
+
+	// Transition every view up-front so that the subdivision dispatches are not separated by barriers
+	for (const Job* job : jobs)
+	{
+		commandList->setBufferState(job->terrainView->GetTessellationIndirectArgsBuffer(), nvrhi::ResourceStates::IndirectArgument);
+		commandList->setBufferState(job->terrainView->GetTessellationCBTBuffer(), nvrhi::ResourceStates::UnorderedAccess);
+	}
+	commandList->commitBarriers();
+
+	for (Job* job : jobs)
+	{
+		GpuTimerScope viewScope(m_GpuTimers, commandList, job->terrainView->GetName());
+
+		// The pass constants are volatile, so they must be written immediately before each dispatch
+		job->pass->SetupView(commandList, job->terrainView, view, job->cachedData->lodBias);
+
+		if (m_Validation && m_Validation->job == job)
+		{
+			CaptureValidationPass(view, *job);
+		}
+
+		nvrhi::ComputeState state;
+		job->pass->SetupSubdivisionState(job->terrainView, job->subdivisionPass, state);
+
+		state.setIndirectParams(job->terrainView->GetTessellationIndirectArgsBuffer());
+		commandList->setComputeState(state);
+
+		job->pass->SetupPushConstants(commandList, job->terrainView);
+
+		commandList->dispatchIndirect(TerrainMeshView::GetIndirectArgsDispatchOffset());
+	}
+
+	commandList->endMarker();
+}
+
+void TerrainTessellator::ExecuteSumReduction(nvrhi::ICommandList* commandList, const std::vector<Job*>& jobs)
+{
+	commandList->beginMarker("Sum Reduction");
+	GpuTimerScope timerScope(m_GpuTimers, commandList, "Sum Reduction");
+
+	std::vector<nvrhi::IBuffer*> cbtBuffers;
+	int maxIterativeLevel = -1;
+	for (const Job* job : jobs)
+	{
+		cbtBuffers.push_back(job->terrainView->GetTessellationCBTBuffer());
+		if (!job->fusedReduction)
+		{
+			maxIterativeLevel = std::max(maxIterativeLevel, static_cast<int>(job->terrainView->GetMaxDepth()) - 6);
+		}
+	}
+
+	// The prepass reduces the bottom 5 levels for every view, as it operates on whole words of the bitfield
+	{
+		nvrhi::ComputeState state;
+		state.pipeline = m_Pipelines[Shaders_SumReductionPrePass];
+
+		BatchedUavBarrier(commandList, cbtBuffers);
+
+		for (const Job* job : jobs)
+		{
+			GpuTimerScope viewScope(m_GpuTimers, commandList, job->terrainView->GetName());
+
+			const uint maxDepth = job->terrainView->GetMaxDepth();
+
+			state.bindings = { (*job->bindings)[Bindings_CBTReadWrite] };
+			commandList->setComputeState(state);
+
+			uint cnt = (1u << maxDepth) >> 5;
+			uint numGroup = (cnt >= 256) ? (cnt >> 8) : 1;
+
+			TessellationSumReductionPushConstants constants = { maxDepth };
+			commandList->setPushConstants(&constants, sizeof(constants));
+
+			commandList->dispatch(numGroup);
+		}
+	}
+
+	// Views using the fused reduction finish in a single dispatch
+	{
+		nvrhi::ComputeState state;
+		state.pipeline = m_Pipelines[Shaders_SumReductionFused];
+
+		std::vector<nvrhi::IBuffer*> fusedBuffers;
+		for (const Job* job : jobs)
+		{
+			if (job->fusedReduction)
+				fusedBuffers.push_back(job->terrainView->GetTessellationCBTBuffer());
+		}
+
+		if (!fusedBuffers.empty())
+		{
+			BatchedUavBarrier(commandList, fusedBuffers);
+		}
+
+		for (const Job* job : jobs)
+		{
+			if (!job->fusedReduction)
+				continue;
+
+			GpuTimerScope viewScope(m_GpuTimers, commandList, job->terrainView->GetName());
+
+			// Depth of the deepest level written by the prepass
+			const uint depth = job->terrainView->GetMaxDepth() - 5;
+			const uint levelNodeCount = 1u << depth;
+			const uint groupCount = levelNodeCount / std::min(levelNodeCount, static_cast<uint>(SUM_REDUCTION_FUSED_GROUP_SIZE));
+
+			state.bindings = { (*job->bindings)[Bindings_CBTReduceFused] };
+			commandList->setComputeState(state);
+
+			TessellationSumReductionPushConstants constants = { depth };
+			commandList->setPushConstants(&constants, sizeof(constants));
+
+			commandList->dispatch(groupCount);
+		}
+	}
+
+	// Remaining views are reduced one level at a time; all views share the barrier between levels
+	{
+		nvrhi::ComputeState state;
+		state.pipeline = m_Pipelines[Shaders_SumReduction];
+
+		for (int step = 0; step <= maxIterativeLevel; step++)
+		{
+			std::vector<nvrhi::IBuffer*> levelBuffers;
+			for (const Job* job : jobs)
+			{
+				if (!job->fusedReduction && static_cast<int>(job->terrainView->GetMaxDepth()) - 6 - step >= 0)
+					levelBuffers.push_back(job->terrainView->GetTessellationCBTBuffer());
+			}
+
+			BatchedUavBarrier(commandList, levelBuffers);
+
+			for (const Job* job : jobs)
+			{
+				if (job->fusedReduction)
+					continue;
+
+				// Views of different depths are aligned by their deepest level
+				int it = static_cast<int>(job->terrainView->GetMaxDepth()) - 6 - step;
+				if (it < 0)
+					continue;
+
+				GpuTimerScope viewScope(m_GpuTimers, commandList, job->terrainView->GetName());
+
+				int cnt = 1 << it;
+				int numGroup = (cnt >= 256) ? (cnt >> 8) : 1;
+
+				state.bindings = { (*job->bindings)[Bindings_CBTReadWrite] };
+				commandList->setComputeState(state);
+
+				TessellationSumReductionPushConstants constants = { static_cast<uint>(it) };
+				commandList->setPushConstants(&constants, sizeof(constants));
+
+				commandList->dispatch(static_cast<uint32_t>(numGroup));
+			}
+		}
+	}
+
+	EndBatchedBarriers(commandList, cbtBuffers);
+
+	commandList->endMarker();
+}
+
+void TerrainTessellator::ExecuteLEBDispatch(nvrhi::ICommandList* commandList, const std::vector<Job*>& jobs)
+{
+	// Run draw indirect dispatcher
+	commandList->beginMarker("LEB Dispatch");
+	GpuTimerScope timerScope(m_GpuTimers, commandList, "LEB Dispatch");
+
+	nvrhi::ComputeState state;
+	state.pipeline = m_Pipelines[Shaders_LEBDispatch];
+
+	for (const Job* job : jobs)
+	{
+		if (job->fusedReduction)
+			continue;
+
+		GpuTimerScope viewScope(m_GpuTimers, commandList, job->terrainView->GetName());
+
+		state.bindings = { (*job->bindings)[Bindings_CBTReadOnly] };
+		commandList->setComputeState(state);
+
+		commandList->dispatch(1);
+	}
+
+	commandList->endMarker();
+}
+
+void TerrainTessellator::ExecuteBisectorPoolPrepare(nvrhi::ICommandList* commandList, const std::vector<Job*>& jobs)
+{
+	if (jobs.empty())
+		return;
+
+	commandList->beginMarker("Bisector Pool Prepare");
+	GpuTimerScope timerScope(m_GpuTimers, commandList, "Bisector Pool Prepare");
+
+	// Clears the hash table and the commands
+	for (const Job* job : jobs)
+	{
+		commandList->clearBufferUInt(job->terrainView->GetBisectorScratchBuffer(), BISECTOR_POOL_NULL);
+	}
+
+	nvrhi::ComputeState state;
+	state.pipeline = m_Pipelines[Shaders_PoolPrepare];
+
+	for (const Job* job : jobs)
+	{
+		GpuTimerScope viewScope(m_GpuTimers, commandList, job->terrainView->GetName());
+
+		state.bindings = { (*job->bindings)[Bindings_BisectorPool] };
+		// Written by the pool dispatcher for the slots below the high water mark
+		state.setIndirectParams(job->terrainView->GetTessellationIndirectArgsBuffer());
+		commandList->setComputeState(state);
+
+		commandList->dispatchIndirect(TerrainMeshView::GetIndirectArgsDispatchOffset());
+	}
+
+	commandList->endMarker();
+}
+
+void TerrainTessellator::ExecuteBisectorPoolUpdate(nvrhi::ICommandList* commandList, const std::vector<Job*>& jobs)
+{
+	if (jobs.empty())
+		return;
+
+	commandList->beginMarker("Bisector Pool Update");
+	GpuTimerScope timerScope(m_GpuTimers, commandList, "Bisector Pool Update");
+
+	// The splits were only claimed by the subdivision, the merges are already done
+	{
+		nvrhi::ComputeState state;
+		state.pipeline = m_Pipelines[Shaders_PoolBisect];
+
+		for (const Job* job : jobs)
+		{
+			if (job->subdivisionPass != ITerrainTessellationPass::Subdivision_Split)
+				continue;
+
+			GpuTimerScope viewScope(m_GpuTimers, commandList, job->terrainView->GetName());
+
+			state.bindings = { (*job->bindings)[Bindings_BisectorPool] };
+			state.setIndirectParams(job->terrainView->GetTessellationIndirectArgsBuffer());
+			commandList->setComputeState(state);
+
+			commandList->dispatchIndirect(TerrainMeshView::GetIndirectArgsDispatchOffset());
+		}
+	}
+
+	{
+		nvrhi::ComputeState state;
+		state.pipeline = m_Pipelines[Shaders_PoolDispatch];
+
+		for (const Job* job : jobs)
+		{
+			GpuTimerScope viewScope(m_GpuTimers, commandList, job->terrainView->GetName());
+
+			state.bindings = { (*job->bindings)[Bindings_BisectorPool] };
+			commandList->setComputeState(state);
+
+			commandList->dispatch(1);
+		}
+	}
+
+	commandList->endMarker();
+}
+
+void TerrainTessellator::ExecuteCulling(nvrhi::ICommandList* commandList, const donut::engine::IView* view, const std::vector<Job*>& jobs)
+{
+	commandList->beginMarker("Culling");
+	GpuTimerScope timerScope(m_GpuTimers, commandList, "Culling");
+
+	// Only the instance counts are modified by the culling
+	std::array<nvrhi::DrawIndirectArguments, CULLED_DRAW_COUNT> culledDrawArgs;
+	for (auto& drawArgs : culledDrawArgs)
+	{
+		drawArgs.vertexCount = 3;
+		drawArgs.instanceCount = 0;
+	}
+
+	for (const Job* job : jobs)
+	{
+		commandList->writeBuffer(job->terrainView->GetTessellationCulledIndirectArgsBuffer(), culledDrawArgs.data(), sizeof(culledDrawArgs));
+	}
+
+	for (const Job* job : jobs)
+	{
+		GpuTimerScope viewScope(m_GpuTimers, commandList, job->terrainView->GetName());
+
+		// The pass constants are volatile, so they must be written immediately before each dispatch
+		job->pass->SetupView(commandList, job->terrainView, view, job->cachedData->lodBias);
+
+		nvrhi::ComputeState state;
+		job->pass->SetupCullingState(job->terrainView, ITerrainTessellationPass::Culling_Initial, state);
+
+		// The dispatch arguments were written for the final node count by the LEB dispatcher or the fused reduction
+		state.setIndirectParams(job->terrainView->GetTessellationIndirectArgsBuffer());
+		commandList->setComputeState(state);
+
+		job->pass->SetupPushConstants(commandList, job->terrainView);
+
+		commandList->dispatchIndirect(TerrainMeshView::GetIndirectArgsDispatchOffset());
+	}
+
+	commandList->endMarker();
+}
+
+void TerrainTessellator::CreateReductionScratch(nvrhi::ICommandList* commandList, const TerrainMeshView* terrainView, TerrainCachedData& cachedData, BindingSets& bindings)
+{
+	// Depth of the deepest level written by the prepass
+	const uint depth = terrainView->GetMaxDepth() - 5;
+	const uint levelNodeCount = 1u << depth;
+	const uint groupCount = levelNodeCount / std::min(levelNodeCount, static_cast<uint>(SUM_REDUCTION_FUSED_GROUP_SIZE));
+
+	if (!cachedData.reductionScratch)
+	{
+		nvrhi::BufferDesc bufferDesc;
+		bufferDesc.setByteSize(sizeof(uint) * (1 + groupCount))
+			.setCanHaveTypedViews(true)
+			.setStructStride(sizeof(uint))
+			.setCanHaveUAVs(true)
+			.setInitialState(nvrhi::ResourceStates::UnorderedAccess)
+			.setKeepInitialState(true)
+			.setDebugName("CBT_ReductionScratch");
+		cachedData.reductionScratch = m_Device->createBuffer(bufferDesc);
+
+		// The group counter must start at zero; the last group resets it after each reduction
+		commandList->clearBufferUInt(cachedData.reductionScratch, 0);
+	}
+
+	if (!bindings[Bindings_CBTReduceFused])
+	{
+		nvrhi::BindingSetDesc setDesc;
+		setDesc.bindings = {
+			nvrhi::BindingSetItem::PushConstants(TESSELLATION_BINDING_PUSH_CONSTANTS, sizeof(TessellationSumReductionPushConstants)),
+			nvrhi::BindingSetItem::StructuredBuffer_UAV(TESSELLATION_BINDING_CBT, terrainView->GetTessellationCBTBuffer()),
+			nvrhi::BindingSetItem::StructuredBuffer_UAV(TESSELLATION_BINDING_INDIRECT_ARGS, terrainView->GetTessellationIndirectArgsBuffer()),
+			nvrhi::BindingSetItem::StructuredBuffer_UAV(TESSELLATION_BINDING_REDUCTION_SCRATCH, cachedData.reductionScratch)
+		};
+		bindings[Bindings_CBTReduceFused] = m_Device->createBindingSet(setDesc, m_BindingLayouts[Bindings_CBTReduceFused]);
+	}
+}
+
+bool TerrainTessellator::SupportsFusedSumReduction(uint maxDepth)
+{
+	// The prepass reduces 5 levels, each group 8 more, and the last group must hold every group sum
+	constexpr uint maxGroupLevels = 8;
+	const uint maxPartialLevels = static_cast<uint>(std::countr_zero(static_cast<uint>(SUM_REDUCTION_FUSED_MAX_PARTIALS)));
+	return maxDepth >= 5 && maxDepth <= 5 + maxGroupLevels + maxPartialLevels;
+}
+
+PrimaryViewTerrainTessellationPass::PrimaryViewTerrainTessellationPass(nvrhi::DeviceHandle device, std::shared_ptr<donut::engine::CommonRenderPasses> commonPasses)
+	: ITerrainTessellationPass(std::move(device))
+	, m_CommonPasses(std::move(commonPasses))
+{
+}
+
+void PrimaryViewTerrainTessellationPass::Init(donut::engine::ShaderFactory& shaderFactory)
+{
+	std::vector<donut::engine::ShaderMacro> subdivisionMacros = GetSubdivisionMacros();
+	std::vector<donut::engine::ShaderMacro> poolSubdivisionMacros = subdivisionMacros;
+	subdivisionMacros.emplace_back("TERRAIN_TOPOLOGY", std::to_string(TERRAIN_TOPOLOGY_CBT));
+	poolSubdivisionMacros.emplace_back("TERRAIN_TOPOLOGY", std::to_string(TERRAIN_TOPOLOGY_BISECTOR_POOL));
+	const std::vector<donut::engine::ShaderMacro> cullingMacros = { donut::engine::ShaderMacro("TERRAIN_TOPOLOGY", std::to_string(TERRAIN_TOPOLOGY_CBT)) };
+	const std::vector<donut::engine::ShaderMacro> poolCullingMacros = { donut::engine::ShaderMacro("TERRAIN_TOPOLOGY", std::to_string(TERRAIN_TOPOLOGY_BISECTOR_POOL)) };
+
+	m_SplitShader = shaderFactory.CreateAutoShader("app/terrain/tessellation/Subdivision.hlsl", "split_cs",
+		DONUT_MAKE_PLATFORM_SHADER(g_terrain_tessellation_split_cs), &subdivisionMacros, nvrhi::ShaderType::Compute);
+	m_MergeShader = shaderFactory.CreateAutoShader("app/terrain/tessellation/Subdivision.hlsl", "merge_cs",
+		DONUT_MAKE_PLATFORM_SHADER(g_terrain_tessellation_merge_cs), &subdivisionMacros, nvrhi::ShaderType::Compute);
+	m_CullingShader = shaderFactory.CreateAutoShader("app/terrain/tessellation/Culling.hlsl", "leaf_culling_cs",
+		DONUT_MAKE_PLATFORM_SHADER(g_terrain_tessellation_leaf_culling_cs), &cullingMacros, nvrhi::ShaderType::Compute);
+	m_PoolSplitShader = shaderFactory.CreateAutoShader("app/terrain/tessellation/Subdivision.hlsl", "split_cs",
+		DONUT_MAKE_PLATFORM_SHADER(g_terrain_tessellation_split_cs), &poolSubdivisionMacros, nvrhi::ShaderType::Compute);
+	m_PoolMergeShader = shaderFactory.CreateAutoShader("app/terrain/tessellation/Subdivision.hlsl", "merge_cs",
+		DONUT_MAKE_PLATFORM_SHADER(g_terrain_tessellation_merge_cs), &poolSubdivisionMacros, nvrhi::ShaderType::Compute);
+	m_PoolCullingShader = shaderFactory.CreateAutoShader("app/terrain/tessellation/Culling.hlsl", "leaf_culling_cs",
+		DONUT_MAKE_PLATFORM_SHADER(g_terrain_tessellation_leaf_culling_cs), &poolCullingMacros, nvrhi::ShaderType::Compute);
+	m_RetestShader = shaderFactory.CreateAutoShader("app/terrain/tessellation/Culling.hlsl", "leaf_occlusion_retest_cs",
+		DONUT_MAKE_PLATFORM_SHADER(g_terrain_tessellation_leaf_occlusion_retest_cs), nullptr, nvrhi::ShaderType::Compute);
+
+	{
+		nvrhi::BindingLayoutDesc layoutDesc;
+		layoutDesc.setVisibility(nvrhi::ShaderType::Compute)
+			.setRegisterSpaceIsDescriptorSet(true)
+			.setRegisterSpace(TESSELLATION_SPACE_VIEW)
+			.addItem(nvrhi::BindingLayoutItem::VolatileConstantBuffer(TESSELLATION_BINDING_SUBDIVISION_CONSTANTS))
+			.addItem(nvrhi::BindingLayoutItem::Sampler(TESSELLATION_BINDING_SUBDIVISION_HEIGHTMAP_SAMPLER))
+			.addItem(nvrhi::BindingLayoutItem::Texture_SRV(TESSELLATION_BINDING_OCCLUSION_PYRAMID));
+
+		m_ViewBindingLayout = m_Device->createBindingLayout(layoutDesc);
+	}
+	{
+		nvrhi::BindingLayoutDesc layoutDesc;
+		layoutDesc.setVisibility(nvrhi::ShaderType::Compute)
+			.setRegisterSpaceIsDescriptorSet(true)
+			.setRegisterSpace(TESSELLATION_SPACE_TERRAIN)
+			.addItem(nvrhi::BindingLayoutItem::PushConstants(TESSELLATION_BINDING_PUSH_CONSTANTS, sizeof(TerrainPushConstants)))
+			.addItem(nvrhi::BindingLayoutItem::ConstantBuffer(TESSELLATION_BINDING_TERRAIN_CONSTANTS))
+			.addItem(nvrhi::BindingLayoutItem::StructuredBuffer_UAV(TESSELLATION_BINDING_CBT))
+			.addItem(nvrhi::BindingLayoutItem::StructuredBuffer_SRV(TESSELLATION_BINDING_INSTANCE_BUFFER))
+			.addItem(nvrhi::BindingLayoutItem::Texture_SRV(TESSELLATION_BINDING_SUBDIVISION_HEIGHTMAP))
+			.addItem(nvrhi::BindingLayoutItem::Texture_SRV(TESSELLATION_BINDING_HEIGHT_BOUNDS))
+			.addItem(nvrhi::BindingLayoutItem::Texture_SRV(TESSELLATION_BINDING_HEIGHT_ERROR))
+			.addItem(nvrhi::BindingLayoutItem::Texture_SRV(TESSELLATION_BINDING_HEIGHTMAP_PAGE_TABLE))
+			.addItem(nvrhi::BindingLayoutItem::Texture_SRV(TESSELLATION_BINDING_HEIGHTMAP_ATLAS))
+			.addItem(nvrhi::BindingLayoutItem::StructuredBuffer_UAV(TESSELLATION_BINDING_FEEDBACK))
+			.addItem(nvrhi::BindingLayoutItem::StructuredBuffer_UAV(TESSELLATION_BINDING_HEIGHTMAP_FEEDBACK));
+
+		m_TerrainBindingLayout = m_Device->createBindingLayout(layoutDesc);
+
+		// The pool takes the binding of the CBT
+		layoutDesc.addItem(nvrhi::BindingLayoutItem::StructuredBuffer_UAV(TESSELLATION_BINDING_POOL_SCRATCH));
+
+		m_PoolTerrainBindingLayout = m_Device->createBindingLayout(layoutDesc);
+	}
+	{
+		nvrhi::BindingLayoutDesc layoutDesc;
+		layoutDesc.setVisibility(nvrhi::ShaderType::Compute)
+			.setRegisterSpaceIsDescriptorSet(true)
+			.setRegisterSpace(TESSELLATION_SPACE_TERRAIN)
+			.addItem(nvrhi::BindingLayoutItem::PushConstants(TESSELLATION_BINDING_PUSH_CONSTANTS, sizeof(TerrainPushConstants)))
+			.addItem(nvrhi::BindingLayoutItem::ConstantBuffer(TESSELLATION_BINDING_TERRAIN_CONSTANTS))
+			.addItem(nvrhi::BindingLayoutItem::StructuredBuffer_SRV(TESSELLATION_BINDING_CBT))
+			.addItem(nvrhi::BindingLayoutItem::StructuredBuffer_SRV(TESSELLATION_BINDING_INSTANCE_BUFFER))
+			.addItem(nvrhi::BindingLayoutItem::Texture_SRV(TESSELLATION_BINDING_SUBDIVISION_HEIGHTMAP))
+			.addItem(nvrhi::BindingLayoutItem::Texture_SRV(TESSELLATION_BINDING_HEIGHT_BOUNDS))
+			.addItem(nvrhi::BindingLayoutItem::Texture_SRV(TESSELLATION_BINDING_HEIGHTMAP_PAGE_TABLE))
+			.addItem(nvrhi::BindingLayoutItem::Texture_SRV(TESSELLATION_BINDING_HEIGHTMAP_ATLAS))
+			.addItem(nvrhi::BindingLayoutItem::StructuredBuffer_UAV(TESSELLATION_BINDING_CULLED_NODES))
+			.addItem(nvrhi::BindingLayoutItem::StructuredBuffer_UAV(TESSELLATION_BINDING_CULLED_INDIRECT_ARGS));
+
+		m_CullingBindingLayout = m_Device->createBindingLayout(layoutDesc);
+	}
+	{
+		nvrhi::BindingLayoutDesc layoutDesc;
+		layoutDesc.setVisibility(nvrhi::ShaderType::Compute)
+			.setRegisterSpaceIsDescriptorSet(true)
+			.setRegisterSpace(TESSELLATION_SPACE_TERRAIN)
+			.addItem(nvrhi::BindingLayoutItem::PushConstants(TESSELLATION_BINDING_PUSH_CONSTANTS, sizeof(TerrainPushConstants)))
+			.addItem(nvrhi::BindingLayoutItem::ConstantBuffer(TESSELLATION_BINDING_TERRAIN_CONSTANTS))
+			.addItem(nvrhi::BindingLayoutItem::StructuredBuffer_SRV(TESSELLATION_BINDING_INSTANCE_BUFFER))
+			.addItem(nvrhi::BindingLayoutItem::Texture_SRV(TESSELLATION_BINDING_SUBDIVISION_HEIGHTMAP))
+			.addItem(nvrhi::BindingLayoutItem::Texture_SRV(TESSELLATION_BINDING_HEIGHT_BOUNDS))
+			.addItem(nvrhi::BindingLayoutItem::Texture_SRV(TESSELLATION_BINDING_HEIGHTMAP_PAGE_TABLE))
+			.addItem(nvrhi::BindingLayoutItem::Texture_SRV(TESSELLATION_BINDING_HEIGHTMAP_ATLAS))
+			.addItem(nvrhi::BindingLayoutItem::StructuredBuffer_SRV(TESSELLATION_BINDING_OCCLUDED_NODES))
+			.addItem(nvrhi::BindingLayoutItem::StructuredBuffer_UAV(TESSELLATION_BINDING_CULLED_NODES))
+			.addItem(nvrhi::BindingLayoutItem::StructuredBuffer_UAV(TESSELLATION_BINDING_CULLED_INDIRECT_ARGS));
+
+		m_RetestBindingLayout = m_Device->createBindingLayout(layoutDesc);
+	}
+
+	{
+		nvrhi::ComputePipelineDesc psoDesc;
+		psoDesc.bindingLayouts = { m_TerrainBindingLayout, m_ViewBindingLayout };
+
+		psoDesc.setComputeShader(m_SplitShader);
+		m_SplitPipeline = m_Device->createComputePipeline(psoDesc);
+
+		psoDesc.setComputeShader(m_MergeShader);
+		m_MergePipeline = m_Device->createComputePipeline(psoDesc);
+
+		psoDesc.bindingLayouts = { m_PoolTerrainBindingLayout, m_ViewBindingLayout };
+		psoDesc.setComputeShader(m_PoolSplitShader);
+		m_PoolSplitPipeline = m_Device->createComputePipeline(psoDesc);
+
+		psoDesc.setComputeShader(m_PoolMergeShader);
+		m_PoolMergePipeline = m_Device->createComputePipeline(psoDesc);
+
+		psoDesc.bindingLayouts = { m_CullingBindingLayout, m_ViewBindingLayout };
+		psoDesc.setComputeShader(m_CullingShader);
+		m_CullingPipeline = m_Device->createComputePipeline(psoDesc);
+
+		psoDesc.setComputeShader(m_PoolCullingShader);
+		m_PoolCullingPipeline = m_Device->createComputePipeline(psoDesc);
+
+		psoDesc.bindingLayouts = { m_RetestBindingLayout, m_ViewBindingLayout };
+		psoDesc.setComputeShader(m_RetestShader);
+		m_RetestPipeline = m_Device->createComputePipeline(psoDesc);
+	}
+
+	{
+		m_ViewCB = m_Device->createBuffer(nvrhi::utils::CreateVolatileConstantBufferDesc(
+			sizeof(SubdivisionConstants), "SubdivisionConstants", 16
+		));
+	}
+
+}
+
+void PrimaryViewTerrainTessellationPass::SetupView(nvrhi::ICommandList* commandList, const TerrainMeshView* terrainView, const donut::engine::IView* view, float lodBias)
+{
+	SubdivisionConstants constants;
+	view->FillPlanarViewConstants(constants.view);
+	nvrhi::ITexture* occlusionPyramid = nullptr;
+	if (auto viewEx = dynamic_cast<const PlanarViewEx*>(view))
+	{
+		viewEx->FillPlanarViewExConstants(constants.viewEx);
+		occlusionPyramid = viewEx->GetOcclusionPyramid();
+	}
+	else
+	{
+		// Tessellation pipeline will not work correctly
+		assert(false);
+	}
+
+	// Occlusion culling is disabled by the flags without a pyramid, but something must still be bound
+	m_ViewBindingSet = FindOrCreateViewBindingSet(occlusionPyramid ? occlusionPyramid : m_CommonPasses->m_BlackTexture.Get());
+
+	constants.lodFactor = ComputeLodFactor(constants.view.matViewToClip, constants.view.viewportSize, lodBias);
+	m_LodFactor = constants.lodFactor;
+	constants.patchVertexCount = terrainView->GetRenderMode() == TerrainRenderMode::Patch ? 3u << (2 * m_SubdivisionLevel) : 3u;
+
+	commandList->writeBuffer(m_ViewCB, &constants, sizeof(constants));
+}
+
+uint32_t PrimaryViewTerrainTessellationPass::GetLodScheme() const
+{
+	return LOD_SCHEME_PERSPECTIVE;
+}
+
+std::vector<donut::engine::ShaderMacro> PrimaryViewTerrainTessellationPass::GetSubdivisionMacros() const
+{
+	return { donut::engine::ShaderMacro("LOD_SCHEME", std::to_string(GetLodScheme())) };
+}
+
+bool PrimaryViewTerrainTessellationPass::GetSubdivisionReference(float& lodFactor, uint32_t& lodScheme) const
+{
+	lodFactor = m_LodFactor;
+	lodScheme = GetLodScheme();
+	return true;
+}
+
+float PrimaryViewTerrainTessellationPass::ComputeLodFactor(const dm::float4x4& viewToClip, const dm::float2& viewportSize, float lodBias) const
+{
+	// viewToClip.m11 == tan(fovy / 2)
+	float tmp = (2.0f / viewToClip.m11)
+		/ viewportSize.y * static_cast<float>(1 << m_SubdivisionLevel)
+		* m_PrimitivePixelLength;
+
+	return -2.0f * std::log2(tmp) + 2.0f + lodBias;
+}
+
+void PrimaryViewTerrainTessellationPass::SetupSubdivisionState(const TerrainMeshView* terrainView, SubdivisionPassTypes subdivisionPass, nvrhi::ComputeState& state)
+{
+	state.bindings = { FindOrCreateBindingSet(terrainView), m_ViewBindingSet };
+	if (terrainView->GetTopology() == TerrainTopology::BisectorPool)
+	{
+		state.pipeline = subdivisionPass == Subdivision_Split ? m_PoolSplitPipeline : m_PoolMergePipeline;
+	}
+	else
+	{
+		state.pipeline = subdivisionPass == Subdivision_Split ? m_SplitPipeline : m_MergePipeline;
+	}
+}
+
+void PrimaryViewTerrainTessellationPass::SetupCullingState(const TerrainMeshView* terrainView, CullingPassTypes cullingPass, nvrhi::ComputeState& state)
+{
+	if (cullingPass == Culling_OcclusionRetest)
+	{
+		state.bindings = { FindOrCreateRetestBindingSet(terrainView), m_ViewBindingSet };
+		state.pipeline = m_RetestPipeline;
+	}
+	else
+	{
+		// The pool takes the binding of the CBT, so the binding sets are the same for both topologies
+		state.bindings = { FindOrCreateCullingBindingSet(terrainView), m_ViewBindingSet };
+		state.pipeline = terrainView->GetTopology() == TerrainTopology::BisectorPool ? m_PoolCullingPipeline : m_CullingPipeline;
+	}
+}
+
+void PrimaryViewTerrainTessellationPass::SetupPushConstants(nvrhi::ICommandList* commandList, const TerrainMeshView* terrainView)
+{
+	TerrainPushConstants constants;
+	constants.startInstanceLocation = terrainView->GetInstance()->GetInstanceIndex();
+	commandList->setPushConstants(&constants, sizeof(constants));
+}
+
+void PrimaryViewTerrainTessellationPass::ResetBindingCache()
+{
+	m_TerrainBindingSets.clear();
+	m_CullingBindingSets.clear();
+	m_RetestBindingSets.clear();
+}
+
+nvrhi::BindingSetHandle PrimaryViewTerrainTessellationPass::FindOrCreateBindingSet(const TerrainMeshView* key)
+{
+	// Double buffered views tessellate into alternating buffers, so the binding sets are keyed by buffer
+	nvrhi::BindingSetHandle& bindingSet = m_TerrainBindingSets[key->GetTessellationCBTBuffer()];
+	if (!bindingSet)
+	{
+		const TerrainMeshInfo* terrainMesh = key->GetInstance()->GetTerrain();
+
+		nvrhi::BindingSetDesc setDesc;
+		setDesc.addItem(nvrhi::BindingSetItem::PushConstants(TESSELLATION_BINDING_PUSH_CONSTANTS, sizeof(TerrainPushConstants)))
+			.addItem(nvrhi::BindingSetItem::ConstantBuffer(TESSELLATION_BINDING_TERRAIN_CONSTANTS, terrainMesh->TerrainCB))
+			.addItem(nvrhi::BindingSetItem::StructuredBuffer_UAV(TESSELLATION_BINDING_CBT, key->GetTessellationCBTBuffer()))
+			.addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(TESSELLATION_BINDING_INSTANCE_BUFFER, terrainMesh->buffers->instanceBuffer.Get()))
+			.addItem(nvrhi::BindingSetItem::Texture_SRV(TESSELLATION_BINDING_SUBDIVISION_HEIGHTMAP, terrainMesh->HeightmapTexture->texture))
+			.addItem(nvrhi::BindingSetItem::Texture_SRV(TESSELLATION_BINDING_HEIGHT_BOUNDS, terrainMesh->HeightBoundsTexture))
+			.addItem(nvrhi::BindingSetItem::Texture_SRV(TESSELLATION_BINDING_HEIGHT_ERROR, terrainMesh->HeightErrorTexture))
+			.addItem(nvrhi::BindingSetItem::Texture_SRV(TESSELLATION_BINDING_HEIGHTMAP_PAGE_TABLE, terrainMesh->HeightmapPageTable))
+			.addItem(nvrhi::BindingSetItem::Texture_SRV(TESSELLATION_BINDING_HEIGHTMAP_ATLAS, terrainMesh->HeightmapAtlas))
+			.addItem(nvrhi::BindingSetItem::StructuredBuffer_UAV(TESSELLATION_BINDING_FEEDBACK, key->GetFeedbackBuffer()))
+			.addItem(nvrhi::BindingSetItem::StructuredBuffer_UAV(TESSELLATION_BINDING_HEIGHTMAP_FEEDBACK, terrainMesh->HeightmapTessellationFeedback));
+
+		if (key->GetTopology() == TerrainTopology::BisectorPool)
+		{
+			setDesc.addItem(nvrhi::BindingSetItem::StructuredBuffer_UAV(TESSELLATION_BINDING_POOL_SCRATCH, key->GetBisectorScratchBuffer()));
+			bindingSet = m_Device->createBindingSet(setDesc, m_PoolTerrainBindingLayout);
+		}
+		else
+		{
+			bindingSet = m_Device->createBindingSet(setDesc, m_TerrainBindingLayout);
+		}
+	}
+	return bindingSet;
+}
+
+nvrhi::BindingSetHandle PrimaryViewTerrainTessellationPass::FindOrCreateCullingBindingSet(const TerrainMeshView* key)
+{
+	// The culling outputs are swapped along with the CBT of double buffered views
+	nvrhi::BindingSetHandle& bindingSet = m_CullingBindingSets[key->GetTessellationCBTBuffer()];
+	if (!bindingSet)
+	{
+		const TerrainMeshInfo* terrainMesh = key->GetInstance()->GetTerrain();
+
+		nvrhi::BindingSetDesc setDesc;
+		setDesc.addItem(nvrhi::BindingSetItem::PushConstants(TESSELLATION_BINDING_PUSH_CONSTANTS, sizeof(TerrainPushConstants)))
+			.addItem(nvrhi::BindingSetItem::ConstantBuffer(TESSELLATION_BINDING_TERRAIN_CONSTANTS, terrainMesh->TerrainCB))
+			.addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(TESSELLATION_BINDING_CBT, key->GetTessellationCBTBuffer()))
+			.addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(TESSELLATION_BINDING_INSTANCE_BUFFER, terrainMesh->buffers->instanceBuffer.Get()))
+			.addItem(nvrhi::BindingSetItem::Texture_SRV(TESSELLATION_BINDING_SUBDIVISION_HEIGHTMAP, terrainMesh->HeightmapTexture->texture))
+			.addItem(nvrhi::BindingSetItem::Texture_SRV(TESSELLATION_BINDING_HEIGHT_BOUNDS, terrainMesh->HeightBoundsTexture))
+			.addItem(nvrhi::BindingSetItem::Texture_SRV(TESSELLATION_BINDING_HEIGHTMAP_PAGE_TABLE, terrainMesh->HeightmapPageTable))
+			.addItem(nvrhi::BindingSetItem::Texture_SRV(TESSELLATION_BINDING_HEIGHTMAP_ATLAS, terrainMesh->HeightmapAtlas))
+			.addItem(nvrhi::BindingSetItem::StructuredBuffer_UAV(TESSELLATION_BINDING_CULLED_NODES, key->GetTessellationCulledNodesBuffer()))
+			.addItem(nvrhi::BindingSetItem::StructuredBuffer_UAV(TESSELLATION_BINDING_CULLED_INDIRECT_ARGS, key->GetTessellationCulledIndirectArgsBuffer()));
+
+		bindingSet = m_Device->createBindingSet(setDesc, m_CullingBindingLayout);
+	}
+	return bindingSet;
+}
+
+nvrhi::BindingSetHandle PrimaryViewTerrainTessellationPass::FindOrCreateRetestBindingSet(const TerrainMeshView* key)
+{
+	// The retest reads the culling results of the rendered mesh, so it is keyed by its culled nodes
+	nvrhi::BindingSetHandle& bindingSet = m_RetestBindingSets[key->GetCulledNodesBuffer()];
+	if (!bindingSet)
+	{
+		const TerrainMeshInfo* terrainMesh = key->GetInstance()->GetTerrain();
+
+		nvrhi::BindingSetDesc setDesc;
+		setDesc.addItem(nvrhi::BindingSetItem::PushConstants(TESSELLATION_BINDING_PUSH_CONSTANTS, sizeof(TerrainPushConstants)))
+			.addItem(nvrhi::BindingSetItem::ConstantBuffer(TESSELLATION_BINDING_TERRAIN_CONSTANTS, terrainMesh->TerrainCB))
+			.addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(TESSELLATION_BINDING_INSTANCE_BUFFER, terrainMesh->buffers->instanceBuffer.Get()))
+			.addItem(nvrhi::BindingSetItem::Texture_SRV(TESSELLATION_BINDING_SUBDIVISION_HEIGHTMAP, terrainMesh->HeightmapTexture->texture))
+			.addItem(nvrhi::BindingSetItem::Texture_SRV(TESSELLATION_BINDING_HEIGHT_BOUNDS, terrainMesh->HeightBoundsTexture))
+			.addItem(nvrhi::BindingSetItem::Texture_SRV(TESSELLATION_BINDING_HEIGHTMAP_PAGE_TABLE, terrainMesh->HeightmapPageTable))
+			.addItem(nvrhi::BindingSetItem::Texture_SRV(TESSELLATION_BINDING_HEIGHTMAP_ATLAS, terrainMesh->HeightmapAtlas))
+			.addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(TESSELLATION_BINDING_OCCLUDED_NODES, key->GetCulledNodesBuffer()))
+			.addItem(nvrhi::BindingSetItem::StructuredBuffer_UAV(TESSELLATION_BINDING_CULLED_NODES, key->GetDisoccludedNodesBuffer()))
+			.addItem(nvrhi::BindingSetItem::StructuredBuffer_UAV(TESSELLATION_BINDING_CULLED_INDIRECT_ARGS, key->GetCulledIndirectArgsBuffer()));
+
+		bindingSet = m_Device->createBindingSet(setDesc, m_RetestBindingLayout);
+	}
+	return bindingSet;
+}
+
+nvrhi::BindingSetHandle PrimaryViewTerrainTessellationPass::FindOrCreateViewBindingSet(nvrhi::ITexture* occlusionPyramid)
+{
+	nvrhi::BindingSetHandle& bindingSet = m_ViewBindingSets[occlusionPyramid];
+	if (!bindingSet)
+	{
+		nvrhi::BindingSetDesc setDesc;
+		setDesc.addItem(nvrhi::BindingSetItem::ConstantBuffer(TESSELLATION_BINDING_SUBDIVISION_CONSTANTS, m_ViewCB));
+		setDesc.addItem(nvrhi::BindingSetItem::Sampler(TESSELLATION_BINDING_SUBDIVISION_HEIGHTMAP_SAMPLER, m_CommonPasses->m_LinearClampSampler));
+		setDesc.addItem(nvrhi::BindingSetItem::Texture_SRV(TESSELLATION_BINDING_OCCLUSION_PYRAMID, occlusionPyramid));
+
+		bindingSet = m_Device->createBindingSet(setDesc, m_ViewBindingLayout);
+	}
+	return bindingSet;
+}
+
+
+uint32_t GeometricErrorTerrainTessellationPass::GetLodScheme() const
+{
+	return LOD_SCHEME_GEOMETRIC;
+}
+
+float GeometricErrorTerrainTessellationPass::ComputeLodFactor(const dm::float4x4& viewToClip, const dm::float2& viewportSize, float lodBias) const
+{
+	// World space size of a pixel at a distance of 1
+	float pixelSize = (2.0f / viewToClip.m11) / viewportSize.y;
+
+	// log2(error / distance) exceeds log2(pixelSize * m_PixelError) when the error projects to more than m_PixelError pixels
+	//  As with the other schemes, each leaf stands for a patch of 2^level segments per edge, i.e. 2 * level bisections,
+	//  each of which halves the error of a smooth surface
+	return 1.0f - std::log2(pixelSize * m_PixelError) - 2.0f * static_cast<float>(GetSubdivisionLevel()) + lodBias;
+}
+
+
+uint32_t DirectionalLightTerrainTessellationPass::GetLodScheme() const
+{
+	return LOD_SCHEME_ORTHOGRAPHIC;
+}
+
+float DirectionalLightTerrainTessellationPass::ComputeLodFactor(const dm::float4x4& viewToClip, const dm::float2& viewportSize, float lodBias) const
+{
+	// viewToClip.m11 == 2 / height of the view volume, so this is the world space length of the target edge
+	float tmp = (2.0f / viewToClip.m11)
+		/ viewportSize.y * static_cast<float>(1 << GetSubdivisionLevel())
+		* GetPrimitivePixelLength();
+
+	return -2.0f * std::log2(tmp) + lodBias;
+}
+
+
+static std::vector<TerrainTessellator::Item> GatherTessellationItems(
+	const donut::engine::IView* view,
+	const std::shared_ptr<donut::engine::SceneGraphNode>& rootNode,
+	donut::render::IDrawStrategy& drawStrategy)
+{
+	drawStrategy.PrepareForView(rootNode, *view);
+
+	std::vector<TerrainTessellator::Item> items;
+	while (auto drawItem = drawStrategy.GetNextItem())
+	{
+		if (!drawItem->userData)
+			continue;
+		auto terrainView = static_cast<const TerrainMeshView*>(drawItem->userData);
+
+		// If tessellation scheme of terrain view was never set, then the returned shared_ptr will be empty (and evaluate to false)
+		if (auto pass = terrainView->GetTessellationScheme().lock())
+		{
+			// Passes are owned by the scene, which outlives the tessellation of this view
+			items.push_back({ pass.get(), terrainView });
+		}
+	}
+	return items;
+}
+
+void TessellateTerrainView(
+	nvrhi::ICommandList* commandList,
+	const donut::engine::IView* view,
+	const std::shared_ptr<donut::engine::SceneGraphNode>& rootNode,
+	donut::render::IDrawStrategy& drawStrategy,
+	TerrainTessellator& tessellator,
+	bool subdivide
+)
+{
+	commandList->beginMarker("Tessellate Terrain View");
+
+	std::vector<TerrainTessellator::Item> items = GatherTessellationItems(view, rootNode, drawStrategy);
+	tessellator.ExecutePassForTerrainViews(commandList, view, items, subdivide);
+
+	commandList->endMarker();
+}
+
+void RetestTerrainOcclusion(
+	nvrhi::ICommandList* commandList,
+	const donut::engine::IView* view,
+	const std::shared_ptr<donut::engine::SceneGraphNode>& rootNode,
+	donut::render::IDrawStrategy& drawStrategy,
+	TerrainTessellator& tessellator)
+{
+	commandList->beginMarker("Retest Terrain Occlusion");
+
+	std::vector<TerrainTessellator::Item> items = GatherTessellationItems(view, rootNode, drawStrategy);
+	tessellator.ExecuteOcclusionRetest(commandList, view, items);
+
+	commandList->endMarker();
+}
+
+bool IsTerrainViewConverged(
+	const donut::engine::IView* view,
+	const std::shared_ptr<donut::engine::SceneGraphNode>& rootNode,
+	donut::render::IDrawStrategy& drawStrategy,
+	const TerrainTessellator& tessellator)
+{
+	for (const auto& item : GatherTessellationItems(view, rootNode, drawStrategy))
+	{
+		TerrainTessellationStats stats;
+		if (!tessellator.GetStats(item.TerrainView, stats) || !stats.Converged)
+			return false;
+	}
+	return true;
 }
@@ -5,6 +5,8 @@
 
 #include "donut/engine/CommonRenderPasses.h"
 
+#include "render/ReadbackRing.h"
+
 
 namespace donut::render
 {
@@ -16,6 +18,7 @@ namespace donut::engine
 	class SceneGraphNode;
 }
 
+class GpuTimers;
 class TerrainMeshView;
 
 
@@ -28,27 +31,110 @@ public:
         Subdivision_Merge,
     };
 
+    enum CullingPassTypes : uint8_t
+    {
+        // Frustum and occlusion culling of the tessellated leaves, with the occlusion pyramid of an earlier frame
+        Culling_Initial = 0,
+        // Retests the occluded leaves of the rendered mesh with the occlusion pyramid of the current frame
+        Culling_OcclusionRetest,
+    };
+
+    enum class SubdivisionSchedule : uint8_t
+    {
+        // Split on one frame, merge on the next
+        Alternating = 0,
+        // Split or merge on every frame as well, but repeat whichever pass is the only one still changing the tree
+        Adaptive
+    };
+
 public:
     ITerrainTessellationPass(nvrhi::DeviceHandle device);
     virtual ~ITerrainTessellationPass() = default;
 
     virtual void Init(donut::engine::ShaderFactory& shaderFactory) = 0;
 
-    virtual void SetupView(nvrhi::ICommandList* commandList, const TerrainMeshView* terrainView, const donut::engine::IView* view) = 0;
+    // The LOD bias is added to the level of detail of each node (log2 domain); negative values coarsen the mesh
+    virtual void SetupView(nvrhi::ICommandList* commandList, const TerrainMeshView* terrainView, const donut::engine::IView* view, float lodBias) = 0;
+    // The pipelines depend on the topology of the terrain view (see TerrainTopology)
+    //  With the bisector pool topology, the split pass only claims the splits, which the tessellator then applies
     virtual void SetupSubdivisionState(const TerrainMeshView* terrainView, SubdivisionPassTypes subdivisionPass, nvrhi::ComputeState& state) = 0;
     virtual void SetupPushConstants(nvrhi::ICommandList* commandList, const TerrainMeshView* terrainView) = 0;
+    // Culls the leaves of the tessellated CBT against the view set up by SetupView
+    virtual void SetupCullingState(const TerrainMeshView* terrainView, CullingPassTypes cullingPass, nvrhi::ComputeState& state) = 0;
+
+    [[nodiscard]] virtual SubdivisionSchedule GetSubdivisionSchedule() const { return SubdivisionSchedule::Alternating; }
+
+    // Must change whenever a parameter affecting the result of the subdivision changes
+    [[nodiscard]] virtual uint64_t GetParameterVersion() const { return 0; }
+
+    // Leaves are sized for patches of 2^level subdivisions per edge, which patch rendering draws them as
+    [[nodiscard]] virtual uint32_t GetSubdivisionLevel() const { return 0; }
+
+    // Drops the binding sets of the terrain views, e.g. once some of their buffers were released
+    virtual void ResetBindingCache() {}
+
+    // LOD factor of the last SetupView, and LOD scheme of the subdivision shaders (LOD_SCHEME_*), with which the CPU
+    // reference tessellator replays the subdivision (see TerrainCpuTessellator); false if it cannot be replayed
+    [[nodiscard]] virtual bool GetSubdivisionReference(float& lodFactor, uint32_t& lodScheme) const { return false; }
 
 protected:
     nvrhi::DeviceHandle m_Device;
 };
 
+// Statistics of the last tessellation of a terrain view, read back a few frames late
+struct TerrainTessellationStats
+{
+    // Same as TESSELLATION_FEEDBACK_DEPTH_COUNT
+    static constexpr uint32_t DepthCount = 32;
+
+    uint32_t MaxDepth = 0;
+    // Capacity of the CBT, or of the bisector pool
+    uint64_t MaxLeafCount = 0;
+    uint32_t LeafCount = 0;
+
+    // Over the subdivision of the frame: nodes split (splits claimed with the bisector pool), and diamonds merged
+    uint32_t SplitCount = 0;
+    uint32_t MergeCount = 0;
+    // Leaves evaluated by the subdivision of the frame, before its own splits and merges
+    //  Leaves at MaxDepth can no longer be split, so their share is how close the view is to saturation
+    std::array<uint32_t, DepthCount> LeafCountPerDepth{};
+
+    // Leaves kept by the culling of the tessellation; the occluded leaves may still pass the occlusion retest
+    uint32_t VisibleLeafCount = 0;
+    uint32_t OccludedLeafCount = 0;
+    uint32_t FrustumCulledLeafCount = 0;
+
+    // The view is no longer tessellated once converged, and its statistics are those of its last tessellation
+    bool Converged = false;
+};
+
 class TerrainTessellator
 {
 public:
     TerrainTessellator(nvrhi::DeviceHandle device);
+    ~TerrainTessellator();
 
     void Init(donut::engine::ShaderFactory& shaderFactory);
 
+    struct Item
+    {
+        ITerrainTessellationPass* Pass = nullptr;
+        const TerrainMeshView* TerrainView = nullptr;
+    };
+
+    // Tessellates a batch of terrain views
+    //  Each stage of the pipeline is recorded for every view before moving on to the next stage, so that the
+    //  barriers between stages are issued once per batch rather than once per view
+    //  The leaves of every view are culled against the view, including those of converged views and, if subdivide is
+    //  false, those of views that are not subdivided at all, so the culled leaves always follow the view; double
+    //  buffered views are culled into their back buffers either way, so their buffers are swapped as usual
+    void ExecutePassForTerrainViews(
+        nvrhi::ICommandList* commandList,
+        const donut::engine::IView* view,
+        const std::vector<Item>& items,
+        bool subdivide = true
+    );
+
     void ExecutePassForTerrainView(
         nvrhi::ICommandList* commandList,
         const donut::engine::IView* view,
@@ -56,6 +142,84 @@ public:
         const TerrainMeshView* terrainView
     );
 
+    // Second phase of the occlusion culling, once the view's occlusion pyramid was rebuilt from the current frame
+    //  Compacts the leaves of the rendered meshes that the tessellation found occluded, but are visible now,
+    //  to be drawn with the disoccluded culled draw
+    void ExecuteOcclusionRetest(
+        nvrhi::ICommandList* commandList,
+        const donut::engine::IView* view,
+        const std::vector<Item>& items
+    );
+
+    // Upper bound on the number of leaf triangles of all terrain views tessellated in a frame, over all of its batches
+    // (0 means unlimited)
+    //  The leaf counts are read back a few frames late, and the LOD of each view is biased to keep its share
+    //  of the budget, which is proportional to its screen coverage among the views of the last frame
+    inline void SetTriangleBudget(uint32_t triangleBudget) { m_TriangleBudget = triangleBudget; }
+    [[nodiscard]] inline uint32_t GetTriangleBudget() const { return m_TriangleBudget; }
+
+    // Measures each stage of the pipeline, nested in the scopes open when the batch is recorded (may be null)
+    inline void SetGpuTimers(GpuTimers* gpuTimers) { m_GpuTimers = gpuTimers; }
+
+    // Starts the frame whose batches share the triangle budget; must be called once per frame, before any batch
+    void BeginFrame();
+
+    // Total leaf count of every batch of the last frame, as last read back
+    [[nodiscard]] inline uint64_t GetLeafCount() const { return m_LeafCount; }
+
+    // Returns false if the terrain view was never tessellated
+    [[nodiscard]] bool GetStats(const TerrainMeshView* terrainView, TerrainTessellationStats& stats) const;
+    // Every terrain view tessellated since the cache was last reset
+    [[nodiscard]] std::vector<const TerrainMeshView*> GetTerrainViews() const;
+
+    // Drops the binding sets and the state of every terrain view, e.g. once some of their buffers were released or recreated
+    void ResetTerrainCache();
+
+    // Replays the next subdivision of a terrain view on the CPU reference tessellator (see TerrainCpuTessellator),
+    // and compares the resulting trees bit for bit
+    //  Only views with the CBT topology whose pass can be replayed on the CPU are captured
+    inline void RequestValidation() { m_ValidationRequested = true; }
+    // The tree before and after the captured subdivision and the heightmap are read back, so the GPU must have
+    // finished the commands recorded with the capture before it is resolved
+    [[nodiscard]] bool HasValidationCapture() const;
+    // Returns a summary of the comparison, which is logged as well
+    std::string ResolveValidation();
+
+protected:
+    struct TerrainCachedData;
+    struct Job;
+    struct ValidationCapture;
+
+    void UpdateLodBiases(const donut::engine::IView* view, const std::vector<Item>& items);
+    [[nodiscard]] static float ComputeScreenCoverage(const donut::engine::IView* view, const dm::box3& bounds);
+
+    // Issues a single batch of UAV barriers on the given buffers
+    // Automatic UAV barriers are disabled on them until EndBatchedBarriers is called
+    static void BatchedUavBarrier(nvrhi::ICommandList* commandList, const std::vector<nvrhi::IBuffer*>& buffers);
+    static void EndBatchedBarriers(nvrhi::ICommandList* commandList, const std::vector<nvrhi::IBuffer*>& buffers);
+
+    void ExecuteCBTDispatch(nvrhi::ICommandList* commandList, const std::vector<Job*>& jobs);
+    // The one subdivision of the frame of a view, following the schedule of its pass
+    [[nodiscard]] static ITerrainTessellationPass::SubdivisionPassTypes ChooseSubdivisionPass(const ITerrainTessellationPass& pass, TerrainCachedData& cachedData);
+
+    void ExecuteSubdivision(nvrhi::ICommandList* commandList, const donut::engine::IView* view, const std::vector<Job*>& jobs);
+    void ExecuteSumReduction(nvrhi::ICommandList* commandList, const std::vector<Job*>& jobs);
+    void ExecuteLEBDispatch(nvrhi::ICommandList* commandList, const std::vector<Job*>& jobs);
+    // The bisector pool counterparts of the CBT dispatch before the subdivision, and of the reduction and LEB dispatch after it
+    void ExecuteBisectorPoolPrepare(nvrhi::ICommandList* commandList, const std::vector<Job*>& jobs);
+    void ExecuteBisectorPoolUpdate(nvrhi::ICommandList* commandList, const std::vector<Job*>& jobs);
+    void ExecuteCulling(nvrhi::ICommandList* commandList, const donut::engine::IView* view, const std::vector<Job*>& jobs);
+
+    // The fused reduction reduces the whole tree in groupshared memory in two steps, which bounds the depth it supports
+    [[nodiscard]] static bool SupportsFusedSumReduction(uint maxDepth);
+
+    // Copies the tree of the first job that can be validated and the heightmap of its terrain, before its subdivision
+    void BeginValidationCapture(nvrhi::ICommandList* commandList, const std::vector<Job>& jobs);
+    // Called for every subdivision recorded for the captured job, once its pass was set up for the view
+    void CaptureValidationPass(const donut::engine::IView* view, const Job& job);
+    // Copies the tree of the captured job once its subdivision was reduced
+    void EndValidationCapture(nvrhi::ICommandList* commandList);
+
 protected:
     nvrhi::DeviceHandle m_Device;
 
@@ -67,6 +231,10 @@ protected:
         Shaders_LEBDispatch,
         Shaders_SumReductionPrePass,
         Shaders_SumReduction,
+        Shaders_SumReductionFused,
+        Shaders_PoolPrepare,
+        Shaders_PoolBisect,
+        Shaders_PoolDispatch,
 
         Shaders_Count
     };
@@ -77,17 +245,95 @@ protected:
     {
 	    Bindings_CBTReadOnly = 0, // For dispatchers
         Bindings_CBTReadWrite,    // For reduction sum pipelines
+        Bindings_CBTReduceFused,  // For the fused reduction sum pipeline
+        Bindings_BisectorPool,    // For the bisector pool pipelines
         Bindings_Count
     };
     std::array<nvrhi::BindingLayoutHandle, Bindings_Count> m_BindingLayouts{};
 
+    using BindingSets = std::array<nvrhi::BindingSetHandle, Bindings_Count>;
+
+    void CreateBindingSets(const TerrainMeshView* terrainView, BindingSets& bindings);
+
+    static void CopyRenderBuffersToTessellationBuffers(nvrhi::ICommandList* commandList, const TerrainMeshView* terrainView);
+
+    // Returns false if the terrain view has converged and its inputs have not changed since, so tessellating it would be a no-op
+    [[nodiscard]] bool UpdateConvergence(const donut::engine::IView* view, const Item& item, TerrainCachedData& cachedData);
+    // Reads the culling results of the terrain view into its statistics; the feedback is read by UpdateConvergence
+    static void ReadCullingStats(TerrainCachedData& cachedData);
+
+    void CreateReductionScratch(nvrhi::ICommandList* commandList, const TerrainMeshView* terrainView, TerrainCachedData& cachedData, BindingSets& bindings);
+
     // The tessellator requires some persistent state for each terrain mesh view
     struct TerrainCachedData
     {
-        bool split = true; // flip-flops between slipping and merging
-        std::array<nvrhi::BindingSetHandle, Bindings_Count> bindings;
+        bool split = true; // flip-flops between splitting and merging
+        // Whether the last split and the last merge read back changed the tree (adaptive schedule only)
+        bool splitActive = true;
+        bool mergeActive = true;
+        uint32_t repeatCount = 0; // Frames the adaptive schedule repeated the same pass in a row
+
+        nvrhi::BufferHandle reductionScratch; // Only used by fused sum reduction
+
+        // Everything the subdivision depends on, compared bitwise with the previous frame
+        struct Inputs
+        {
+            dm::affine3 worldToView;
+            dm::float4x4 viewToClip;
+            nvrhi::Rect viewExtent;
+            dm::daffine3 instanceTransform;
+            const ITerrainTessellationPass* pass;
+            uint64_t passParameterVersion;
+            float lodBias;
+            uint32_t occlusionFlags;
+            uint64_t heightsVersion;
+        } inputs{};
+        uint64_t inputsVersion = 0; // Incremented whenever the inputs change
+
+        // Passes of the subdivisions with the current inputs since the last one that split or merged anything, as a mask
+        // of 1 << pass; the view has converged once neither a split nor a merge changes the tree
+        uint32_t unchangedPasses = 0;
+        std::unique_ptr<ReadbackRing> feedbackReadback;
+
+        // Statistics of the view, besides the leaf count
+        TerrainTessellationStats stats;
+        std::unique_ptr<ReadbackRing> cullingReadback;
+
+        bool backBuffersInSync = false; // Only used by double buffered views
+
+        // Triangle budget control
+        uint32_t leafCount = 0;
+        float lodBias = 0.0f;
+        std::unique_ptr<ReadbackRing> leafCountReadback;
     };
     std::unordered_map<const TerrainMeshView*, TerrainCachedData> m_TerrainCache;
+
+    // Binding sets are keyed by the CBT buffer being tessellated, as double buffered views alternate between two
+    std::unordered_map<const nvrhi::IBuffer*, BindingSets> m_BindingSets;
+
+    uint32_t m_TriangleBudget = 0;
+    uint64_t m_LeafCount = 0;
+    // Totals of the batches of the current frame so far, and screen coverage of every view of the last frame
+    uint64_t m_FrameLeafCount = 0;
+    float m_FrameCoverage = 0.0f;
+    float m_LastFrameCoverage = 0.0f;
+
+    GpuTimers* m_GpuTimers = nullptr;
+
+    bool m_ValidationRequested = false;
+    std::unique_ptr<ValidationCapture> m_Validation;
+
+    // Per-view state used while recording a batch
+    struct Job
+    {
+        ITerrainTessellationPass* pass;
+        const TerrainMeshView* terrainView;
+        TerrainCachedData* cachedData;
+        BindingSets* bindings;
+        bool fusedReduction;
+        // Of the subdivision recorded for the view
+        ITerrainTessellationPass::SubdivisionPassTypes subdivisionPass;
+    };
 };
 
 
@@ -100,18 +346,36 @@ public:
 
     void Init(donut::engine::ShaderFactory& shaderFactory) override;
 
-    virtual void SetupView(nvrhi::ICommandList* commandList, const TerrainMeshView* terrainView, const donut::engine::IView* view) override;
+    virtual void SetupView(nvrhi::ICommandList* commandList, const TerrainMeshView* terrainView, const donut::engine::IView* view, float lodBias) override;
     virtual void SetupSubdivisionState(const TerrainMeshView* terrainView, SubdivisionPassTypes subdivisionPass, nvrhi::ComputeState& state) override;
     virtual void SetupPushConstants(nvrhi::ICommandList* commandList, const TerrainMeshView* terrainView) override;
+    virtual void SetupCullingState(const TerrainMeshView* terrainView, CullingPassTypes cullingPass, nvrhi::ComputeState& state) override;
 
-    [[nodiscard]] inline uint32_t GetSubdivisionLevel() const { return m_SubdivisionLevel; }
+    [[nodiscard]] virtual uint32_t GetSubdivisionLevel() const override { return m_SubdivisionLevel; }
     [[nodiscard]] inline float GetPrimitivePixelLength() const { return m_PrimitivePixelLength; }
 
-    inline void SetSubdivisionLevel(uint32_t subdivisionLevel) { m_SubdivisionLevel = subdivisionLevel; }
-    inline void SetPrimitivePixelLength(float primitivePixelLength) { m_PrimitivePixelLength = primitivePixelLength; }
+    [[nodiscard]] virtual uint64_t GetParameterVersion() const override { return m_ParameterVersion; }
+
+    virtual void ResetBindingCache() override;
+
+    [[nodiscard]] virtual bool GetSubdivisionReference(float& lodFactor, uint32_t& lodScheme) const override;
+
+    inline void SetSubdivisionLevel(uint32_t subdivisionLevel) { m_SubdivisionLevel = subdivisionLevel; m_ParameterVersion++; }
+    inline void SetPrimitivePixelLength(float primitivePixelLength) { m_PrimitivePixelLength = primitivePixelLength; m_ParameterVersion++; }
+
+protected:
+    // LOD_SCHEME_* of the subdivision shader permutation
+    [[nodiscard]] virtual uint32_t GetLodScheme() const;
+    // Defines of the subdivision shader permutation
+    [[nodiscard]] virtual std::vector<donut::engine::ShaderMacro> GetSubdivisionMacros() const;
+    // Added to the log2 of the per node metric of the subdivision shaders, so that nodes are split above 1
+    [[nodiscard]] virtual float ComputeLodFactor(const dm::float4x4& viewToClip, const dm::float2& viewportSize, float lodBias) const;
 
 private:
     nvrhi::BindingSetHandle FindOrCreateBindingSet(const TerrainMeshView* key);
+    nvrhi::BindingSetHandle FindOrCreateCullingBindingSet(const TerrainMeshView* key);
+    nvrhi::BindingSetHandle FindOrCreateRetestBindingSet(const TerrainMeshView* key);
+    nvrhi::BindingSetHandle FindOrCreateViewBindingSet(nvrhi::ITexture* occlusionPyramid);
 
 private:
     std::shared_ptr<donut::engine::CommonRenderPasses> m_CommonPasses;
@@ -119,16 +383,84 @@ private:
     nvrhi::ShaderHandle m_SplitShader, m_MergeShader;
     nvrhi::ComputePipelineHandle m_SplitPipeline, m_MergePipeline;
 
+    nvrhi::ShaderHandle m_CullingShader, m_RetestShader;
+    nvrhi::ComputePipelineHandle m_CullingPipeline, m_RetestPipeline;
+
+    // Bisector pool topology; the occlusion retest only reads the culled nodes, so it is shared
+    nvrhi::ShaderHandle m_PoolSplitShader, m_PoolMergeShader, m_PoolCullingShader;
+    nvrhi::ComputePipelineHandle m_PoolSplitPipeline, m_PoolMergePipeline, m_PoolCullingPipeline;
+
     nvrhi::BindingLayoutHandle m_ViewBindingLayout;
     nvrhi::BindingLayoutHandle m_TerrainBindingLayout;
+    nvrhi::BindingLayoutHandle m_PoolTerrainBindingLayout;
+    nvrhi::BindingLayoutHandle m_CullingBindingLayout;
+    nvrhi::BindingLayoutHandle m_RetestBindingLayout;
 
-    std::unordered_map<const TerrainMeshView*, nvrhi::BindingSetHandle> m_TerrainBindingSets;
+    std::unordered_map<const nvrhi::IBuffer*, nvrhi::BindingSetHandle> m_TerrainBindingSets;
+    std::unordered_map<const nvrhi::IBuffer*, nvrhi::BindingSetHandle> m_CullingBindingSets;
+    std::unordered_map<const nvrhi::IBuffer*, nvrhi::BindingSetHandle> m_RetestBindingSets;
 
+    // Keyed by the occlusion pyramid of the view; the one for the current view is selected by SetupView
+    std::unordered_map<const nvrhi::ITexture*, nvrhi::BindingSetHandle> m_ViewBindingSets;
     nvrhi::BindingSetHandle m_ViewBindingSet;
     nvrhi::BufferHandle m_ViewCB;
 
     uint32_t m_SubdivisionLevel = 2;
     float m_PrimitivePixelLength = 5.0f;
+
+    // Of the last SetupView
+    float m_LodFactor = 0.0f;
+
+protected:
+    uint64_t m_ParameterVersion = 0;
+};
+
+
+// Same LOD criteria as the primary view scheme, with the adaptive subdivision schedule
+//  Each frame still runs a single split or merge, so the cost of a frame is that of the primary view scheme, but the
+//  split runs every frame while the merges change nothing (e.g. moving towards the terrain) and the other way around,
+//  which halves the number of frames the mesh takes to converge; views that need both alternate
+//  The pass that changed nothing is still tried every few frames, so that it is not starved once the view needs it
+class SplitMergeTerrainTessellationPass : public PrimaryViewTerrainTessellationPass
+{
+public:
+    using PrimaryViewTerrainTessellationPass::PrimaryViewTerrainTessellationPass;
+
+    [[nodiscard]] virtual SubdivisionSchedule GetSubdivisionSchedule() const override { return SubdivisionSchedule::Adaptive; }
+};
+
+
+// Splits a node while the deviation of the heightmap from its triangle projects to more than a number of pixels
+//  The deviation is read from the height error pyramid of the terrain, so flat areas stay coarse where the primary
+//  view scheme would split them as densely as cliffs; nodes are not split below the size of a heightmap texel
+class GeometricErrorTerrainTessellationPass : public PrimaryViewTerrainTessellationPass
+{
+public:
+    using PrimaryViewTerrainTessellationPass::PrimaryViewTerrainTessellationPass;
+
+    [[nodiscard]] inline float GetPixelError() const { return m_PixelError; }
+    inline void SetPixelError(float pixelError) { m_PixelError = pixelError; m_ParameterVersion++; }
+
+protected:
+    [[nodiscard]] virtual uint32_t GetLodScheme() const override;
+    [[nodiscard]] virtual float ComputeLodFactor(const dm::float4x4& viewToClip, const dm::float2& viewportSize, float lodBias) const override;
+
+private:
+    float m_PixelError = 1.0f;
+};
+
+
+// Splits a node while its edge projects to more than a number of texels of an orthographic view, such as a cascade of a
+//  directional light shadow map; the projected length does not depend on the distance to the view, so the mesh only
+//  gets finer where the cascade covers a smaller area, and each cascade can keep a coarse tessellation of its own
+class DirectionalLightTerrainTessellationPass : public PrimaryViewTerrainTessellationPass
+{
+public:
+    using PrimaryViewTerrainTessellationPass::PrimaryViewTerrainTessellationPass;
+
+protected:
+    [[nodiscard]] virtual uint32_t GetLodScheme() const override;
+    [[nodiscard]] virtual float ComputeLodFactor(const dm::float4x4& viewToClip, const dm::float2& viewportSize, float lodBias) const override;
 };
 
 
@@ -136,10 +468,30 @@ private:
 //  The draw strategy feeds the terrain instances
 //  Each terrain instance knows the tessellation scheme to be used
 //  The tessellator knows how to execute the tessellation pipeline
+//  If subdivide is false, the leaves are only culled (see TerrainTessellator::ExecutePassForTerrainViews)
 void TessellateTerrainView(
+    nvrhi::ICommandList* commandList,
+    const donut::engine::IView* view,
+    const std::shared_ptr<donut::engine::SceneGraphNode>& rootNode,
+    donut::render::IDrawStrategy& drawStrategy,
+    TerrainTessellator& tessellator,
+    bool subdivide = true
+);
+
+// Retests the occluded leaves of the rendered terrains for a given view (see TerrainTessellator::ExecuteOcclusionRetest)
+void RetestTerrainOcclusion(
     nvrhi::ICommandList* commandList,
     const donut::engine::IView* view,
     const std::shared_ptr<donut::engine::SceneGraphNode>& rootNode,
     donut::render::IDrawStrategy& drawStrategy,
     TerrainTessellator& tessellator
 );
+
+// Returns true if the last tessellation of every terrain of a given view had converged (see TerrainTessellationStats)
+//  Terrains that were never tessellated for the view have not converged
+[[nodiscard]] bool IsTerrainViewConverged(
+    const donut::engine::IView* view,
+    const std::shared_ptr<donut::engine::SceneGraphNode>& rootNode,
+    donut::render::IDrawStrategy& drawStrategy,
+    const TerrainTessellator& tessellator
+);
@@ -0,0 +1,536 @@
+#include "TerrainVirtualHeightmap.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+
+#include <donut/core/log.h>
+
+#include "render/ReadbackRing.h"
+#include "render/TextureUploadRing.h"
+
+using namespace donut;
+
+#include "TerrainShaders.h"
+
+
+TerrainVirtualHeightmap::TerrainVirtualHeightmap(nvrhi::IDevice* device, const TerrainVirtualHeightmapDesc& desc)
+	: m_Device(device)
+	, m_Desc(desc)
+{}
+
+TerrainVirtualHeightmap::~TerrainVirtualHeightmap()
+{
+	{
+		std::lock_guard lock(m_Mutex);
+		m_StopWorkers = true;
+	}
+	m_WorkAvailable.notify_all();
+
+	for (auto& worker : m_Workers)
+	{
+		worker.join();
+	}
+}
+
+bool TerrainVirtualHeightmap::Init(nvrhi::ICommandList* commandList)
+{
+	const std::string path = m_Desc.Path.generic_string();
+	const uint32_t resolution = m_Desc.Resolution;
+	const uint32_t pageSize = m_Desc.PageSize;
+	const uint32_t fallbackResolution = m_Desc.FallbackResolution;
+
+	if (resolution == 0 || pageSize == 0 || fallbackResolution == 0 || resolution % fallbackResolution != 0
+		|| !std::has_single_bit(resolution / fallbackResolution))
+	{
+		log::error("Virtual heightmap '%s': the resolution (%u) must be the fallback resolution (%u) times a power of two",
+			path.c_str(), resolution, fallbackResolution);
+		return false;
+	}
+	m_LevelCount = static_cast<uint32_t>(std::countr_zero(resolution / fallbackResolution));
+
+	// Every page of level 0 lies within a single page of each paged level
+	if (m_LevelCount > 0 && resolution % (pageSize << (m_LevelCount - 1)) != 0)
+	{
+		log::error("Virtual heightmap '%s': the resolution (%u) must be a multiple of the page size (%u) times %u",
+			path.c_str(), resolution, pageSize, 1u << (m_LevelCount - 1));
+		return false;
+	}
+	m_PageTableSize = uint2(std::max(resolution / pageSize, 1u));
+
+	if (m_PageTableSize.x > 4096 || m_Desc.AtlasPages == 0 || m_Desc.AtlasPages > VIRTUAL_PAGE_SLOT_MASK + 1)
+	{
+		log::error("Virtual heightmap '%s': up to 4096 pages per side and %u atlas pages per side are supported",
+			path.c_str(), VIRTUAL_PAGE_SLOT_MASK + 1);
+		return false;
+	}
+
+	std::vector<uint16_t> fallback;
+	if (!BuildFallback(fallback))
+		return false;
+
+	{
+		nvrhi::TextureDesc textureDesc;
+		textureDesc.setWidth(fallbackResolution)
+			.setHeight(fallbackResolution)
+			.setFormat(nvrhi::Format::R16_UNORM)
+			.setInitialState(nvrhi::ResourceStates::ShaderResource)
+			.setKeepInitialState(true)
+			.setDebugName("VirtualHeightmapFallback");
+		m_FallbackTexture = m_Device->createTexture(textureDesc);
+		commandList->writeTexture(m_FallbackTexture, 0, 0, fallback.data(), fallbackResolution * sizeof(uint16_t));
+
+		const uint32_t slotSize = pageSize + 2 * VIRTUAL_PAGE_BORDER;
+		textureDesc.setWidth(m_Desc.AtlasPages * slotSize)
+			.setHeight(m_Desc.AtlasPages * slotSize)
+			.setDebugName("VirtualHeightmapAtlas");
+		m_AtlasTexture = m_Device->createTexture(textureDesc);
+
+		textureDesc.setWidth(m_PageTableSize.x)
+			.setHeight(m_PageTableSize.y)
+			.setFormat(nvrhi::Format::R32_UINT)
+			.setDebugName("VirtualHeightmapPageTable");
+		m_PageTableTexture = m_Device->createTexture(textureDesc);
+
+		m_UploadRing = std::make_unique<TextureUploadRing>(m_Device, nvrhi::Format::R16_UNORM, uint2(slotSize),
+			std::max(m_Desc.UploadsPerFrame, 1u), "VirtualHeightmapUpload");
+	}
+
+	const size_t cellCount = static_cast<size_t>(m_PageTableSize.x) * m_PageTableSize.y;
+	m_PageTable.assign(cellCount, 0);
+	commandList->writeTexture(m_PageTableTexture, 0, 0, m_PageTable.data(), m_PageTableSize.x * sizeof(uint32_t));
+
+	{
+		nvrhi::BufferDesc bufferDesc;
+		bufferDesc.setByteSize(cellCount * sizeof(uint32_t))
+			.setStructStride(sizeof(uint32_t))
+			.setCanHaveUAVs(true)
+			.setInitialState(nvrhi::ResourceStates::UnorderedAccess)
+			.setKeepInitialState(true)
+			.setDebugName("VirtualHeightmapFeedback");
+		m_FeedbackBuffer = m_Device->createBuffer(bufferDesc);
+		commandList->clearBufferUInt(m_FeedbackBuffer, VIRTUAL_FEEDBACK_NONE);
+
+		m_FeedbackReadback = std::make_unique<ReadbackRing>(m_Device, bufferDesc.byteSize, "VirtualHeightmapFeedbackReadback");
+		m_Feedback.resize(cellCount);
+
+		bufferDesc.setDebugName("VirtualHeightmapTessellationFeedback");
+		m_TessellationFeedbackBuffer = m_Device->createBuffer(bufferDesc);
+		commandList->clearBufferUInt(m_TessellationFeedbackBuffer, VIRTUAL_FEEDBACK_NONE);
+
+		m_TessellationFeedbackReadback = std::make_unique<ReadbackRing>(m_Device, bufferDesc.byteSize,
+			"VirtualHeightmapTessellationFeedbackReadback");
+		m_TessellationFeedback.resize(cellCount);
+	}
+
+	const uint32_t slotCount = m_Desc.AtlasPages * m_Desc.AtlasPages;
+	m_SlotPages.assign(slotCount, InvalidPageKey);
+	// Slots are allocated from the first one
+	m_FreeSlots.resize(slotCount);
+	for (uint32_t slot = 0; slot < slotCount; slot++)
+	{
+		m_FreeSlots[slot] = slotCount - 1 - slot;
+	}
+
+	const uint32_t workerCount = m_Desc.WorkerCount > 0 ? m_Desc.WorkerCount : std::max(std::thread::hardware_concurrency() / 2, 1u);
+	for (uint32_t worker = 0; worker < workerCount; worker++)
+	{
+		m_Workers.emplace_back(&TerrainVirtualHeightmap::WorkerMain, this);
+	}
+
+	log::info("Virtual heightmap '%s': %u levels of %ux%u pages over a %ux%u fallback, height margin %.4f",
+		path.c_str(), m_LevelCount, pageSize, pageSize, fallbackResolution, fallbackResolution, m_HeightBoundsMargin);
+	return true;
+}
+
+bool TerrainVirtualHeightmap::BuildFallback(std::vector<uint16_t>& fallback)
+{
+	std::ifstream file(m_Desc.Path, std::ios::binary);
+	if (!file)
+	{
+		log::error("Cannot open virtual heightmap '%s'", m_Desc.Path.generic_string().c_str());
+		return false;
+	}
+
+	const uint32_t resolution = m_Desc.Resolution;
+	const uint32_t fallbackResolution = m_Desc.FallbackResolution;
+	const uint32_t scale = 1u << m_LevelCount;
+	const uint64_t texelCount = static_cast<uint64_t>(scale) * scale;
+
+	fallback.resize(static_cast<size_t>(fallbackResolution) * fallbackResolution);
+	std::vector<uint16_t> rows(static_cast<size_t>(scale) * resolution);
+	std::vector<int> deviations(fallbackResolution);
+	int maxDeviation = 0;
+
+	// The file is read a row of fallback texels at a time
+	for (uint32_t fallbackRow = 0; fallbackRow < fallbackResolution; fallbackRow++)
+	{
+		if (!file.read(reinterpret_cast<char*>(rows.data()), static_cast<std::streamsize>(rows.size() * sizeof(uint16_t))))
+		{
+			log::error("Virtual heightmap '%s' holds fewer than %ux%u texels", m_Desc.Path.generic_string().c_str(), resolution, resolution);
+			return false;
+		}
+
+		uint16_t* output = fallback.data() + static_cast<size_t>(fallbackRow) * fallbackResolution;
+		const int columnCount = static_cast<int>(fallbackResolution);
+#pragma omp parallel for
+		for (int column = 0; column < columnCount; column++)
+		{
+			uint64_t sum = 0;
+			int minHeight = UINT16_MAX;
+			int maxHeight = 0;
+			for (uint32_t y = 0; y < scale; y++)
+			{
+				const uint16_t* row = rows.data() + static_cast<size_t>(y) * resolution + static_cast<size_t>(column) * scale;
+				for (uint32_t x = 0; x < scale; x++)
+				{
+					sum += row[x];
+					minHeight = std::min<int>(minHeight, row[x]);
+					maxHeight = std::max<int>(maxHeight, row[x]);
+				}
+			}
+
+			const int average = static_cast<int>((sum + texelCount / 2) / texelCount);
+			output[column] = static_cast<uint16_t>(average);
+			deviations[column] = std::max(average - minHeight, maxHeight - average);
+		}
+		maxDeviation = std::max(maxDeviation, *std::max_element(deviations.begin(), deviations.end()));
+	}
+
+	// The texels of every level are averages of texels of level 0, so they are within the range of those of the
+	// fallback texel they lie in, as is any bilinear sample between them
+	m_HeightBoundsMargin = static_cast<float>(maxDeviation) / static_cast<float>(UINT16_MAX);
+	return true;
+}
+
+bool TerrainVirtualHeightmap::LoadPage(std::ifstream& file, PageKey key, std::vector<uint16_t>& texels, std::vector<uint16_t>& rows) const
+{
+	const uint32_t level = GetPageLevel(key);
+	const uint2 page = GetPageCoord(key);
+	const uint32_t scale = 1u << level;
+	const uint64_t texelCount = static_cast<uint64_t>(scale) * scale;
+	const int levelResolution = static_cast<int>(m_Desc.Resolution >> level);
+	const uint32_t slotSize = m_Desc.PageSize + 2 * VIRTUAL_PAGE_BORDER;
+
+	// Texels of the level covered by the slot, clamped to the edges of the heightmap
+	const int2 first = int2(page * m_Desc.PageSize) - VIRTUAL_PAGE_BORDER;
+	const int columnMin = std::max(first.x, 0);
+	const int columnMax = std::min(first.x + static_cast<int>(slotSize), levelResolution) - 1;
+	const size_t spanWidth = static_cast<size_t>(columnMax - columnMin + 1) * scale;
+
+	rows.resize(spanWidth * scale);
+	texels.resize(static_cast<size_t>(slotSize) * slotSize);
+
+	int previousRow = -1;
+	for (uint32_t y = 0; y < slotSize; y++)
+	{
+		uint16_t* output = texels.data() + static_cast<size_t>(y) * slotSize;
+
+		// Rows of the border clamped to an edge repeat the row next to them
+		const int levelRow = std::clamp(first.y + static_cast<int>(y), 0, levelResolution - 1);
+		if (levelRow == previousRow)
+		{
+			std::copy_n(output - slotSize, slotSize, output);
+			continue;
+		}
+		previousRow = levelRow;
+
+		for (uint32_t row = 0; row < scale; row++)
+		{
+			const uint64_t texel = (static_cast<uint64_t>(levelRow) * scale + row) * m_Desc.Resolution + static_cast<uint64_t>(columnMin) * scale;
+			file.seekg(static_cast<std::streamoff>(texel * sizeof(uint16_t)));
+			file.read(reinterpret_cast<char*>(rows.data() + row * spanWidth), static_cast<std::streamsize>(spanWidth * sizeof(uint16_t)));
+		}
+		if (!file)
+			return false;
+
+		for (uint32_t x = 0; x < slotSize; x++)
+		{
+			const size_t column = static_cast<size_t>(std::clamp(first.x + static_cast<int>(x), columnMin, columnMax) - columnMin) * scale;
+
+			uint64_t sum = 0;
+			for (uint32_t row = 0; row < scale; row++)
+			{
+				const uint16_t* input = rows.data() + row * spanWidth + column;
+				for (uint32_t texel = 0; texel < scale; texel++)
+				{
+					sum += input[texel];
+				}
+			}
+			output[x] = static_cast<uint16_t>((sum + texelCount / 2) / texelCount);
+		}
+	}
+	return true;
+}
+
+void TerrainVirtualHeightmap::WorkerMain()
+{
+	// Each worker reads through a stream of its own
+	std::ifstream file(m_Desc.Path, std::ios::binary);
+	std::vector<uint16_t> rows;
+
+	while (true)
+	{
+		PageKey key;
+		{
+			std::unique_lock lock(m_Mutex);
+			m_WorkAvailable.wait(lock, [this] { return m_StopWorkers || !m_LoadQueue.empty(); });
+			if (m_StopWorkers)
+				return;
+
+			key = m_LoadQueue.front();
+			m_LoadQueue.pop_front();
+		}
+
+		LoadedPage loadedPage;
+		loadedPage.key = key;
+		file.clear();
+		if (!LoadPage(file, key, loadedPage.texels, rows))
+		{
+			loadedPage.texels.clear();
+		}
+
+		std::lock_guard lock(m_Mutex);
+		m_LoadedPages.push_back(std::move(loadedPage));
+	}
+}
+
+void TerrainVirtualHeightmap::FillTerrainConstants(TerrainConstants& constants) const
+{
+	const float2 resolution = float2(static_cast<float>(m_Desc.Resolution));
+
+	constants.HeightmapResolutionAndInvResolution = float4(resolution, 1.0f / resolution);
+	constants.HeightPyramidResolution = float2(static_cast<float>(m_Desc.FallbackResolution));
+	constants.HeightBoundsMargin = m_HeightBoundsMargin;
+	constants.VirtualPageSize = m_Desc.PageSize;
+	constants.VirtualPageTableSize = m_PageTableSize;
+	constants.VirtualLevelCount = m_LevelCount;
+	constants.VirtualAtlasInvSize = 1.0f / static_cast<float>(m_Desc.AtlasPages * (m_Desc.PageSize + 2 * VIRTUAL_PAGE_BORDER));
+}
+
+bool TerrainVirtualHeightmap::Update(nvrhi::ICommandList* commandList, std::vector<box2>& changedRegions)
+{
+	// Both are read back by the same command list, so they are normally ready together
+	const bool feedbackRead = m_FeedbackReadback->Read(m_Feedback.data());
+	if (m_TessellationFeedbackReadback->Read(m_TessellationFeedback.data()))
+	{
+		if (!feedbackRead)
+		{
+			std::fill(m_Feedback.begin(), m_Feedback.end(), VIRTUAL_FEEDBACK_NONE);
+		}
+		// Finest level requested by either
+		for (size_t cell = 0; cell < m_Feedback.size(); cell++)
+		{
+			m_Feedback[cell] = std::min(m_Feedback[cell], m_TessellationFeedback[cell]);
+		}
+		RequestPages(m_Feedback);
+	}
+	else if (feedbackRead)
+	{
+		RequestPages(m_Feedback);
+	}
+
+	UploadPages(commandList);
+
+	const bool pageTableChanged = m_PageTableDirty;
+	if (m_PageTableDirty)
+	{
+		commandList->writeTexture(m_PageTableTexture, 0, 0, m_PageTable.data(), m_PageTableSize.x * sizeof(uint32_t));
+		m_PageTableDirty = false;
+	}
+
+	changedRegions.insert(changedRegions.end(), m_ChangedRegions.begin(), m_ChangedRegions.end());
+	m_ChangedRegions.clear();
+
+	m_FeedbackReadback->Write(commandList, m_FeedbackBuffer);
+	commandList->clearBufferUInt(m_FeedbackBuffer, VIRTUAL_FEEDBACK_NONE);
+	m_TessellationFeedbackReadback->Write(commandList, m_TessellationFeedbackBuffer);
+	commandList->clearBufferUInt(m_TessellationFeedbackBuffer, VIRTUAL_FEEDBACK_NONE);
+
+	return pageTableChanged;
+}
+
+void TerrainVirtualHeightmap::RequestPages(const std::vector<uint32_t>& feedback)
+{
+	m_Frame++;
+
+	std::unordered_set<PageKey> requests;
+	for (uint32_t y = 0; y < m_PageTableSize.y; y++)
+	{
+		for (uint32_t x = 0; x < m_PageTableSize.x; x++)
+		{
+			const uint32_t level = feedback[static_cast<size_t>(y) * m_PageTableSize.x + x];
+
+			// Pages are requested along with the coarser pages over them, so that the detail refines progressively
+			for (uint32_t parentLevel = level; parentLevel < m_LevelCount; parentLevel++)
+			{
+				if (!requests.insert(MakePageKey(parentLevel, uint2(x >> parentLevel, y >> parentLevel))).second)
+					break;
+			}
+		}
+	}
+
+	std::vector<PageKey> loads;
+	uint32_t residentRequests = 0;
+	for (PageKey key : requests)
+	{
+		if (auto it = m_ResidentPages.find(key); it != m_ResidentPages.end())
+		{
+			it->second.lastRequestFrame = m_Frame;
+			residentRequests++;
+		}
+		else if (!m_FailedPages.contains(key))
+		{
+			loads.push_back(key);
+		}
+	}
+
+	// Coarser levels first, as the level is in the upper bits of the keys
+	std::sort(loads.begin(), loads.end(), std::greater<PageKey>());
+	// Pages beyond the capacity of the atlas could only be uploaded by evicting pages requested along with them
+	loads.resize(std::min(loads.size(), m_SlotPages.size() - std::min<size_t>(residentRequests, m_SlotPages.size())));
+
+	std::lock_guard lock(m_Mutex);
+
+	// Queued pages that are no longer requested are dropped, those being loaded are kept
+	for (PageKey key : m_LoadQueue)
+	{
+		m_RequestedPages.erase(key);
+	}
+	m_LoadQueue.clear();
+
+	for (PageKey key : loads)
+	{
+		if (m_RequestedPages.insert(key).second)
+		{
+			m_LoadQueue.push_back(key);
+		}
+	}
+
+	if (!m_LoadQueue.empty())
+	{
+		m_WorkAvailable.notify_all();
+	}
+}
+
+void TerrainVirtualHeightmap::UploadPages(nvrhi::ICommandList* commandList)
+{
+	std::vector<LoadedPage> loadedPages;
+	{
+		std::lock_guard lock(m_Mutex);
+
+		// The pages beyond the upload budget wait for the next updates
+		const size_t count = std::min<size_t>(m_LoadedPages.size(), m_UploadRing->GetBlocksPerFrame());
+		loadedPages.assign(std::make_move_iterator(m_LoadedPages.begin()), std::make_move_iterator(m_LoadedPages.begin() + count));
+		m_LoadedPages.erase(m_LoadedPages.begin(), m_LoadedPages.begin() + count);
+	}
+
+	if (loadedPages.empty())
+		return;
+
+	size_t processed = 0;
+	if (m_UploadRing->BeginFrame())
+	{
+		const uint32_t slotSize = m_Desc.PageSize + 2 * VIRTUAL_PAGE_BORDER;
+		for (; processed < loadedPages.size(); processed++)
+		{
+			const LoadedPage& page = loadedPages[processed];
+			if (page.texels.empty())
+			{
+				const uint2 coord = GetPageCoord(page.key);
+				log::warning("Cannot read page (%u, %u) of level %u of virtual heightmap '%s'",
+					coord.x, coord.y, GetPageLevel(page.key), m_Desc.Path.generic_string().c_str());
+				m_FailedPages.insert(page.key);
+				m_RequestedPages.erase(page.key);
+				continue;
+			}
+
+			uint32_t slot;
+			if (!EvictPage(slot))
+				break;
+
+			const uint2 slotCoord(slot % m_Desc.AtlasPages, slot / m_Desc.AtlasPages);
+			m_UploadRing->WriteBlock(page.texels.data(), slotSize * sizeof(uint16_t), m_AtlasTexture, slotCoord * slotSize);
+
+			m_SlotPages[slot] = page.key;
+			m_ResidentPages[page.key] = ResidentPage{ slot, m_Frame };
+			m_RequestedPages.erase(page.key);
+			ResolvePageTable(page.key);
+		}
+
+		m_UploadRing->EndFrame(commandList);
+	}
+
+	// The pages that could not be uploaded, as no staging texture or slot was free, are retried first by the next
+	// updates rather than loaded again; they stay requested, so the feedback does not queue them meanwhile
+	if (processed < loadedPages.size())
+	{
+		std::lock_guard lock(m_Mutex);
+		m_LoadedPages.insert(m_LoadedPages.begin(),
+			std::make_move_iterator(loadedPages.begin() + processed), std::make_move_iterator(loadedPages.end()));
+	}
+}
+
+bool TerrainVirtualHeightmap::EvictPage(uint32_t& slot)
+{
+	if (!m_FreeSlots.empty())
+	{
+		slot = m_FreeSlots.back();
+		m_FreeSlots.pop_back();
+		return true;
+	}
+
+	auto evicted = m_ResidentPages.end();
+	for (auto it = m_ResidentPages.begin(); it != m_ResidentPages.end(); ++it)
+	{
+		if (it->second.lastRequestFrame < m_Frame
+			&& (evicted == m_ResidentPages.end() || it->second.lastRequestFrame < evicted->second.lastRequestFrame))
+		{
+			evicted = it;
+		}
+	}
+	if (evicted == m_ResidentPages.end())
+		return false;
+
+	const PageKey key = evicted->first;
+	slot = evicted->second.slot;
+	m_SlotPages[slot] = InvalidPageKey;
+	m_ResidentPages.erase(evicted);
+	ResolvePageTable(key);
+	return true;
+}
+
+void TerrainVirtualHeightmap::ResolvePageTable(PageKey key)
+{
+	const uint32_t level = GetPageLevel(key);
+	const uint2 page = GetPageCoord(key);
+	const uint2 cellMin(page.x << level, page.y << level);
+	const uint2 cellMax = cellMin + (1u << level);
+
+	for (uint32_t y = cellMin.y; y < cellMax.y; y++)
+	{
+		for (uint32_t x = cellMin.x; x < cellMax.x; x++)
+		{
+			// The finest resident page over the cell, or the fallback
+			uint32_t entry = 0;
+			for (uint32_t pageLevel = 0; pageLevel < m_LevelCount; pageLevel++)
+			{
+				auto it = m_ResidentPages.find(MakePageKey(pageLevel, uint2(x >> pageLevel, y >> pageLevel)));
+				if (it == m_ResidentPages.end())
+					continue;
+
+				const uint32_t slot = it->second.slot;
+				entry = VIRTUAL_PAGE_RESIDENT | (pageLevel << VIRTUAL_PAGE_LEVEL_SHIFT)
+					| ((slot / m_Desc.AtlasPages) << VIRTUAL_PAGE_SLOT_Y_SHIFT) | (slot % m_Desc.AtlasPages);
+				break;
+			}
+			m_PageTable[static_cast<size_t>(y) * m_PageTableSize.x + x] = entry;
+		}
+	}
+	m_PageTableDirty = true;
+
+	const float2 invTableSize = 1.0f / float2(m_PageTableSize);
+	m_ChangedRegions.push_back(box2(float2(cellMin) * invTableSize, float2(cellMax) * invTableSize));
+}
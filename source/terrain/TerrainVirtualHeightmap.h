@@ -0,0 +1,166 @@
+#pragma once
+
+#include <nvrhi/nvrhi.h>
+
+#include <donut/core/math/math.h>
+
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+using namespace donut::math;
+
+
+struct TerrainConstants;
+class ReadbackRing;
+class TextureUploadRing;
+
+
+struct TerrainVirtualHeightmapDesc
+{
+    // Raw heightmap of Resolution x Resolution 16-bit texels, in rows, in the byte order of the host
+    std::filesystem::path Path;
+    uint Resolution = 0;
+    // Texels per side of a page
+    uint PageSize = 128;
+    // Pages per side of the physical atlas, which holds AtlasPages^2 resident pages at most
+    uint AtlasPages = 32;
+    // Resolution of the coarse level that is always resident, Resolution divided by a power of two
+    uint FallbackResolution = 2048;
+    // Pages uploaded per frame at most
+    uint UploadsPerFrame = 16;
+    // Threads loading pages from disk, 0 for half of the hardware threads
+    uint WorkerCount = 0;
+};
+
+
+// Heightmap too large to be resident, streamed as a virtual texture
+//  Level l of the heightmap is the heightmap downsampled by 2^l, and is split into pages of PageSize^2 texels
+//  The levels from the fallback down are downsampled into a texture that is always resident; the pages of the finer
+//  levels are loaded on request into the slots of a physical atlas, with a border of one texel for bilinear filtering
+//  The page table has a texel for each page of level 0, which holds the slot of the finest resident page over it
+//  The terrain shaders write the level they need over each page of level 0 into the feedback buffer (see
+//  RequestHeightmapPage), which is read back a few frames later; the pages requested are loaded from disk by a pool
+//  of workers, coarser levels first, and uploaded as they complete, evicting the least recently requested pages
+//  Only a budget of pages is uploaded per frame, through a ring of staging textures, and requests beyond the capacity
+//  of the atlas are dropped, finest first
+class TerrainVirtualHeightmap
+{
+public:
+    TerrainVirtualHeightmap(nvrhi::IDevice* device, const TerrainVirtualHeightmapDesc& desc);
+    ~TerrainVirtualHeightmap();
+
+    // Downsamples the fallback level from the whole file, creates the textures, and starts the workers
+    //  Returns false if the description is invalid or the file cannot be read
+    bool Init(nvrhi::ICommandList* commandList);
+
+    [[nodiscard]] inline const TerrainVirtualHeightmapDesc& GetDesc() const { return m_Desc; }
+
+    // Always resident level, which the height bounds and height error pyramids are built from
+    [[nodiscard]] inline nvrhi::ITexture* GetFallbackTexture() const { return m_FallbackTexture; }
+    [[nodiscard]] inline nvrhi::ITexture* GetPageTableTexture() const { return m_PageTableTexture; }
+    [[nodiscard]] inline nvrhi::ITexture* GetAtlasTexture() const { return m_AtlasTexture; }
+    // Level requested over each page of level 0, cleared by every update
+    //  The render passes and the subdivision write to separate buffers, as the subdivision may run on the compute queue
+    // concurrently with the render passes; the two are merged once read back
+    [[nodiscard]] inline nvrhi::IBuffer* GetFeedbackBuffer() const { return m_FeedbackBuffer; }
+    [[nodiscard]] inline nvrhi::IBuffer* GetTessellationFeedbackBuffer() const { return m_TessellationFeedbackBuffer; }
+
+    // Normalized heights of the finer levels are within this margin of the fallback texel they lie in
+    [[nodiscard]] inline float GetHeightBoundsMargin() const { return m_HeightBoundsMargin; }
+    // Overrides the resolutions of the constants filled by TerrainMeshInfo::FillTerrainConstants
+    void FillTerrainConstants(TerrainConstants& constants) const;
+
+    // Requests the pages of the latest feedback read back, uploads the pages loaded since the last update, then reads
+    // back the feedback of the previous frame and clears it for the passes of this one
+    //  Recorded before any pass of the frame, once every pass of the previous frame is done with the feedback and atlas
+    //  Returns true if the heights changed, as pages were uploaded or evicted, and appends the rectangles of the
+    //  heightmap they changed over, in texture coordinates
+    bool Update(nvrhi::ICommandList* commandList, std::vector<box2>& changedRegions);
+
+    [[nodiscard]] inline uint32_t GetResidentPageCount() const { return static_cast<uint32_t>(m_ResidentPages.size()); }
+
+private:
+    // Level in the upper byte, then the page coordinates in 12 bits each
+    using PageKey = uint32_t;
+    static constexpr PageKey InvalidPageKey = ~0u;
+
+    [[nodiscard]] static inline PageKey MakePageKey(uint32_t level, uint2 page) { return (level << 24) | (page.y << 12) | page.x; }
+    [[nodiscard]] static inline uint32_t GetPageLevel(PageKey key) { return key >> 24; }
+    [[nodiscard]] static inline uint2 GetPageCoord(PageKey key) { return uint2(key & 0xFFF, (key >> 12) & 0xFFF); }
+
+    struct ResidentPage
+    {
+        uint32_t slot = 0;
+        uint64_t lastRequestFrame = 0;
+    };
+
+    struct LoadedPage
+    {
+        PageKey key = 0;
+        // Texels of the slot, with the border; empty if the page could not be read
+        std::vector<uint16_t> texels;
+    };
+
+    [[nodiscard]] bool BuildFallback(std::vector<uint16_t>& fallback);
+    // Texels of a page and its border, each averaged over the 2^level texels of level 0 it covers
+    [[nodiscard]] bool LoadPage(std::ifstream& file, PageKey key, std::vector<uint16_t>& texels, std::vector<uint16_t>& rows) const;
+    void WorkerMain();
+
+    void RequestPages(const std::vector<uint32_t>& feedback);
+    void UploadPages(nvrhi::ICommandList* commandList);
+    // Frees the slot of the least recently requested page, unless every page was requested by the latest feedback
+    [[nodiscard]] bool EvictPage(uint32_t& slot);
+    // Updates the entries of the page table under the page, after it became resident or was evicted
+    void ResolvePageTable(PageKey key);
+
+private:
+    nvrhi::DeviceHandle m_Device;
+    TerrainVirtualHeightmapDesc m_Desc;
+
+    // Levels that are paged, the fallback level being the next one
+    uint32_t m_LevelCount = 0;
+    uint2 m_PageTableSize = 0;
+    float m_HeightBoundsMargin = 0.0f;
+
+    nvrhi::TextureHandle m_FallbackTexture;
+    nvrhi::TextureHandle m_PageTableTexture;
+    nvrhi::TextureHandle m_AtlasTexture;
+    nvrhi::BufferHandle m_FeedbackBuffer;
+    std::unique_ptr<ReadbackRing> m_FeedbackReadback;
+    nvrhi::BufferHandle m_TessellationFeedbackBuffer;
+    std::unique_ptr<ReadbackRing> m_TessellationFeedbackReadback;
+    std::unique_ptr<TextureUploadRing> m_UploadRing;
+
+    std::vector<uint32_t> m_Feedback;
+    std::vector<uint32_t> m_TessellationFeedback;
+    std::vector<uint32_t> m_PageTable;
+    bool m_PageTableDirty = false;
+    // Rectangles of the page table resolved since the last update, in texture coordinates
+    std::vector<box2> m_ChangedRegions;
+
+    // Feedback read back so far
+    uint64_t m_Frame = 0;
+    std::unordered_map<PageKey, ResidentPage> m_ResidentPages;
+    // Page of each slot of the atlas, if any
+    std::vector<PageKey> m_SlotPages;
+    std::vector<uint32_t> m_FreeSlots;
+    // Pages queued, being loaded, or loaded but not uploaded yet
+    std::unordered_set<PageKey> m_RequestedPages;
+    std::unordered_set<PageKey> m_FailedPages;
+
+    // Shared with the workers
+    std::mutex m_Mutex;
+    std::condition_variable m_WorkAvailable;
+    std::deque<PageKey> m_LoadQueue;
+    std::vector<LoadedPage> m_LoadedPages;
+    bool m_StopWorkers = false;
+    std::vector<std::thread> m_Workers;
+};
@@ -0,0 +1,547 @@
+#include "TerrainBaker.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+
+namespace
+{
+	struct Float2
+	{
+		float x;
+		float y;
+	};
+
+	template<typename T>
+	BakedMip PackMip(uint32_t width, uint32_t height, const std::vector<T>& texels)
+	{
+		BakedMip mip;
+		mip.Width = width;
+		mip.Height = height;
+		mip.Data.resize(texels.size() * sizeof(T));
+		std::memcpy(mip.Data.data(), texels.data(), mip.Data.size());
+		return mip;
+	}
+
+	uint32_t GetMipCount(uint32_t width, uint32_t height)
+	{
+		return static_cast<uint32_t>(std::bit_width(std::max(width, height)));
+	}
+
+	// Range of input texels reduced into an output texel, as GetInputTexels in HeightPyramidHelpers.hlsli
+	void GetInputTexels(uint32_t outputX, uint32_t outputY, uint32_t inputWidth, uint32_t inputHeight, uint32_t outputWidth, uint32_t outputHeight,
+		uint32_t& firstX, uint32_t& firstY, uint32_t& lastX, uint32_t& lastY)
+	{
+		firstX = outputX * 2;
+		firstY = outputY * 2;
+		lastX = firstX + 1;
+		lastY = firstY + 1;
+		if ((inputWidth & 1) && outputX == outputWidth - 1)
+			lastX++;
+		if ((inputHeight & 1) && outputY == outputHeight - 1)
+			lastY++;
+		lastX = std::min(lastX, inputWidth - 1);
+		lastY = std::min(lastY, inputHeight - 1);
+	}
+
+	// Corners of the region of heights covered by a texel of the error pyramid, as GetRegionCorners in HeightError.hlsl
+	void GetRegionCorners(uint32_t outputX, uint32_t outputY, uint32_t level, uint32_t outputWidth, uint32_t outputHeight,
+		const BakeHeights& heights, int& x0, int& y0, int& x1, int& y1)
+	{
+		const int maxX = static_cast<int>(heights.Width) - 1;
+		const int maxY = static_cast<int>(heights.Height) - 1;
+		const int step = 2 << level;
+		x0 = std::min(static_cast<int>(outputX) * step, maxX);
+		y0 = std::min(static_cast<int>(outputY) * step, maxY);
+		x1 = std::min(x0 + step, maxX);
+		y1 = std::min(y0 + step, maxY);
+		if (outputX == outputWidth - 1)
+			x1 = maxX;
+		if (outputY == outputHeight - 1)
+			y1 = maxY;
+	}
+
+	// Deviation of the height from the bilinear patch through the corners of the region, as GetDeviation in HeightError.hlsl
+	float GetDeviation(const BakeHeights& heights, int x0, int y0, int x1, int y1, const float corners[4], int x, int y)
+	{
+		const float fx = static_cast<float>(x - x0) / std::max(static_cast<float>(x1 - x0), 1.0f);
+		const float fy = static_cast<float>(y - y0) / std::max(static_cast<float>(y1 - y0), 1.0f);
+		const float top = corners[0] + (corners[1] - corners[0]) * fx;
+		const float bottom = corners[2] + (corners[3] - corners[2]) * fx;
+		const float planar = top + (bottom - top) * fy;
+		return std::abs(heights.At(x, y) - planar);
+	}
+
+	// C++ mirror of EncodeTerrainNormal in TerrainNormals.hlsli, which encodes (x, z, y) so that the pole is on +y
+	Float2 EncodeOctahedral(float x, float y, float z)
+	{
+		const float invSum = 1.0f / (std::abs(x) + std::abs(y) + std::abs(z));
+		float px = x * invSum;
+		float py = z * invSum;
+		if (y <= 0.0f)
+		{
+			const float wrappedX = (1.0f - std::abs(py)) * (px >= 0.0f ? 1.0f : -1.0f);
+			const float wrappedY = (1.0f - std::abs(px)) * (py >= 0.0f ? 1.0f : -1.0f);
+			px = wrappedX;
+			py = wrappedY;
+		}
+		return { px, py };
+	}
+
+	void EncodeOctahedral(float x, float y, float z, int16_t* output)
+	{
+		const Float2 p = EncodeOctahedral(x, y, z);
+		output[0] = static_cast<int16_t>(std::lround(std::clamp(p.x, -1.0f, 1.0f) * 32767.0f));
+		output[1] = static_cast<int16_t>(std::lround(std::clamp(p.y, -1.0f, 1.0f) * 32767.0f));
+	}
+
+	// C++ mirror of DecodeTerrainNormal in TerrainNormals.hlsli, for CheckNormalEncoding only
+	void DecodeOctahedral(Float2 p, float normal[3])
+	{
+		float x = p.x;
+		float z = p.y;
+		const float y = 1.0f - std::abs(p.x) - std::abs(p.y);
+		if (y < 0.0f)
+		{
+			x = (1.0f - std::abs(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f);
+			z = (1.0f - std::abs(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f);
+		}
+		const float invLength = 1.0f / std::sqrt(x * x + y * y + z * z);
+		normal[0] = x * invLength;
+		normal[1] = y * invLength;
+		normal[2] = z * invLength;
+	}
+}
+
+
+bool CheckNormalEncoding()
+{
+	// Up is the pole of the encoding, at the center of the octahedral square
+	const Float2 up = EncodeOctahedral(0.0f, 1.0f, 0.0f);
+	if (up.x != 0.0f || up.y != 0.0f)
+		return false;
+
+	// Directions over the whole sphere, including those on the folded edges of the lower hemisphere, decode to
+	// themselves from the quantized texels
+	constexpr int steps = 32;
+	constexpr float pi = 3.14159265f;
+	for (int i = 0; i <= steps; i++)
+	{
+		const float polar = pi * static_cast<float>(i) / steps;
+		for (int j = 0; j < 2 * steps; j++)
+		{
+			const float azimuth = pi * static_cast<float>(j) / steps;
+			const float normal[3] = {
+				std::sin(polar) * std::cos(azimuth),
+				std::cos(polar),
+				std::sin(polar) * std::sin(azimuth)
+			};
+
+			int16_t texel[2];
+			EncodeOctahedral(normal[0], normal[1], normal[2], texel);
+
+			float decoded[3];
+			DecodeOctahedral({ std::max(texel[0] / 32767.0f, -1.0f), std::max(texel[1] / 32767.0f, -1.0f) }, decoded);
+			if (decoded[0] * normal[0] + decoded[1] * normal[1] + decoded[2] * normal[2] < 0.9999f)
+				return false;
+		}
+	}
+	return true;
+}
+
+BakedLayer BakeHeightLayer(BakeHeights& heights, TerrainFileFormat format)
+{
+	BakedLayer layer;
+	layer.Layer = TerrainFileLayer::Height;
+	layer.Format = format;
+
+	const uint32_t mipCount = GetMipCount(heights.Width, heights.Height);
+	std::vector<float> level = heights.Texels;
+	uint32_t width = heights.Width;
+	uint32_t height = heights.Height;
+
+	for (uint32_t mip = 0; mip < mipCount; mip++)
+	{
+		if (mip > 0)
+		{
+			// Box filter of the level above, whose last odd row and column are dropped like those of a mip chain
+			const uint32_t parentWidth = width;
+			width = std::max(width / 2, 1u);
+			height = std::max(height / 2, 1u);
+
+			std::vector<float> parent = std::move(level);
+			level.resize(static_cast<size_t>(width) * height);
+			const uint32_t parentHeight = static_cast<uint32_t>(parent.size() / parentWidth);
+			const int rowCount = static_cast<int>(height);
+#pragma omp parallel for
+			for (int y = 0; y < rowCount; y++)
+			{
+				const size_t row0 = static_cast<size_t>(std::min(2u * y, parentHeight - 1)) * parentWidth;
+				const size_t row1 = static_cast<size_t>(std::min(2u * y + 1, parentHeight - 1)) * parentWidth;
+				float* output = level.data() + static_cast<size_t>(y) * width;
+				if (parentWidth == 1)
+				{
+					output[0] = 0.5f * (parent[row0] + parent[row1]);
+					continue;
+				}
+				for (uint32_t x = 0; x < width; x++)
+				{
+					output[x] = 0.25f * (parent[row0 + 2 * x] + parent[row0 + 2 * x + 1] + parent[row1 + 2 * x] + parent[row1 + 2 * x + 1]);
+				}
+			}
+		}
+
+		if (format == TerrainFileFormat::R16_UNORM)
+		{
+			std::vector<uint16_t> texels(level.size());
+			const int64_t texelCount = static_cast<int64_t>(level.size());
+#pragma omp parallel for
+			for (int64_t i = 0; i < texelCount; i++)
+			{
+				texels[i] = static_cast<uint16_t>(std::clamp(level[i], 0.0f, 1.0f) * 65535.0f + 0.5f);
+			}
+
+			// The other layers are baked from the heights the GPU reads
+			if (mip == 0)
+			{
+#pragma omp parallel for
+				for (int64_t i = 0; i < texelCount; i++)
+				{
+					heights.Texels[i] = static_cast<float>(texels[i]) / 65535.0f;
+				}
+			}
+
+			layer.Mips.push_back(PackMip(width, height, texels));
+		}
+		else
+		{
+			layer.Mips.push_back(PackMip(width, height, level));
+		}
+	}
+
+	return layer;
+}
+
+BakedLayer BakeHeightBoundsLayer(const BakeHeights& heights)
+{
+	BakedLayer layer;
+	layer.Layer = TerrainFileLayer::HeightBounds;
+	layer.Format = TerrainFileFormat::RG32_FLOAT;
+
+	uint32_t inputWidth = heights.Width;
+	uint32_t inputHeight = heights.Height;
+	const uint32_t width = std::max(inputWidth / 2, 1u);
+	const uint32_t height = std::max(inputHeight / 2, 1u);
+	const uint32_t mipCount = GetMipCount(width, height);
+
+	std::vector<Float2> input;
+	for (uint32_t mip = 0; mip < mipCount; mip++)
+	{
+		const uint32_t outputWidth = std::max(width >> mip, 1u);
+		const uint32_t outputHeight = std::max(height >> mip, 1u);
+		std::vector<Float2> output(static_cast<size_t>(outputWidth) * outputHeight);
+
+		const int rowCount = static_cast<int>(outputHeight);
+#pragma omp parallel for
+		for (int y = 0; y < rowCount; y++)
+		{
+			for (uint32_t x = 0; x < outputWidth; x++)
+			{
+				uint32_t firstX, firstY, lastX, lastY;
+				GetInputTexels(x, y, inputWidth, inputHeight, outputWidth, outputHeight, firstX, firstY, lastX, lastY);
+
+				Float2 bounds = mip == 0
+					? Float2{ heights.At(firstX, firstY), heights.At(firstX, firstY) }
+					: input[static_cast<size_t>(firstY) * inputWidth + firstX];
+				for (uint32_t inputY = firstY; inputY <= lastY; inputY++)
+				{
+					for (uint32_t inputX = firstX; inputX <= lastX; inputX++)
+					{
+						const Float2 inputBounds = mip == 0
+							? Float2{ heights.At(inputX, inputY), heights.At(inputX, inputY) }
+							: input[static_cast<size_t>(inputY) * inputWidth + inputX];
+						bounds.x = std::min(bounds.x, inputBounds.x);
+						bounds.y = std::max(bounds.y, inputBounds.y);
+					}
+				}
+				output[static_cast<size_t>(y) * outputWidth + x] = bounds;
+			}
+		}
+
+		layer.Mips.push_back(PackMip(outputWidth, outputHeight, output));
+		input = std::move(output);
+		inputWidth = outputWidth;
+		inputHeight = outputHeight;
+	}
+
+	return layer;
+}
+
+BakedLayer BakeHeightErrorLayer(const BakeHeights& heights)
+{
+	BakedLayer layer;
+	layer.Layer = TerrainFileLayer::HeightError;
+	layer.Format = TerrainFileFormat::R32_FLOAT;
+
+	uint32_t inputWidth = heights.Width;
+	uint32_t inputHeight = heights.Height;
+	const uint32_t width = std::max(inputWidth / 2, 1u);
+	const uint32_t height = std::max(inputHeight / 2, 1u);
+	const uint32_t mipCount = GetMipCount(width, height);
+
+	std::vector<float> input;
+	for (uint32_t mip = 0; mip < mipCount; mip++)
+	{
+		const uint32_t outputWidth = std::max(width >> mip, 1u);
+		const uint32_t outputHeight = std::max(height >> mip, 1u);
+		std::vector<float> output(static_cast<size_t>(outputWidth) * outputHeight);
+
+		const int rowCount = static_cast<int>(outputHeight);
+#pragma omp parallel for
+		for (int y = 0; y < rowCount; y++)
+		{
+			for (uint32_t x = 0; x < outputWidth; x++)
+			{
+				int x0, y0, x1, y1;
+				GetRegionCorners(x, y, mip, outputWidth, outputHeight, heights, x0, y0, x1, y1);
+				const float corners[4] = { heights.At(x0, y0), heights.At(x1, y0), heights.At(x0, y1), heights.At(x1, y1) };
+
+				float error = 0.0f;
+				if (mip == 0)
+				{
+					// Every height of the region
+					for (int regionY = y0; regionY <= y1; regionY++)
+					{
+						for (int regionX = x0; regionX <= x1; regionX++)
+						{
+							error = std::max(error, GetDeviation(heights, x0, y0, x1, y1, corners, regionX, regionY));
+						}
+					}
+				}
+				else
+				{
+					// The largest error of the subregions, plus the deviation of their patches at their corners
+					uint32_t firstX, firstY, lastX, lastY;
+					GetInputTexels(x, y, inputWidth, inputHeight, outputWidth, outputHeight, firstX, firstY, lastX, lastY);
+
+					float childError = 0.0f;
+					for (uint32_t inputY = firstY; inputY <= lastY; inputY++)
+					{
+						for (uint32_t inputX = firstX; inputX <= lastX; inputX++)
+						{
+							childError = std::max(childError, input[static_cast<size_t>(inputY) * inputWidth + inputX]);
+						}
+					}
+
+					const int midX = (x0 + x1) / 2;
+					const int midY = (y0 + y1) / 2;
+					error = std::max(error, GetDeviation(heights, x0, y0, x1, y1, corners, midX, y0));
+					error = std::max(error, GetDeviation(heights, x0, y0, x1, y1, corners, x0, midY));
+					error = std::max(error, GetDeviation(heights, x0, y0, x1, y1, corners, midX, midY));
+					error = std::max(error, GetDeviation(heights, x0, y0, x1, y1, corners, x1, midY));
+					error = std::max(error, GetDeviation(heights, x0, y0, x1, y1, corners, midX, y1));
+					error += childError;
+				}
+
+				output[static_cast<size_t>(y) * outputWidth + x] = error;
+			}
+		}
+
+		layer.Mips.push_back(PackMip(outputWidth, outputHeight, output));
+		input = std::move(output);
+		inputWidth = outputWidth;
+		inputHeight = outputHeight;
+	}
+
+	return layer;
+}
+
+BakedLayer BakeNormalLayer(const BakeHeights& heights, const float extents[2], float heightScale)
+{
+	BakedLayer layer;
+	layer.Layer = TerrainFileLayer::Normal;
+	layer.Format = TerrainFileFormat::RG16_SNORM;
+
+	uint32_t width = heights.Width;
+	uint32_t height = heights.Height;
+	const uint32_t mipCount = GetMipCount(width, height);
+
+	// Central differences of the clamped heights, as sampled by GetTerrainNormal at the center of each texel
+	const float worldOffsetX = 2.0f * extents[0] / static_cast<float>(width);
+	const float worldOffsetY = 2.0f * extents[1] / static_cast<float>(height);
+	std::vector<float> normals(static_cast<size_t>(width) * height * 3);
+	const int rowCount = static_cast<int>(height);
+#pragma omp parallel for
+	for (int y = 0; y < rowCount; y++)
+	{
+		const uint32_t bottomY = static_cast<uint32_t>(std::max(y - 1, 0));
+		const uint32_t topY = std::min(static_cast<uint32_t>(y) + 1, height - 1);
+		float* output = normals.data() + static_cast<size_t>(y) * width * 3;
+		for (uint32_t x = 0; x < width; x++)
+		{
+			const uint32_t leftX = x > 0 ? x - 1 : 0;
+			const uint32_t rightX = std::min(x + 1, width - 1);
+			const float tangentY = (heights.At(rightX, y) - heights.At(leftX, y)) * heightScale;
+			const float bitangentY = (heights.At(x, topY) - heights.At(x, bottomY)) * heightScale;
+
+			// cross(bitangent, tangent)
+			const float nx = -worldOffsetY * tangentY;
+			const float ny = worldOffsetY * worldOffsetX;
+			const float nz = -bitangentY * worldOffsetX;
+			const float invLength = 1.0f / std::sqrt(nx * nx + ny * ny + nz * nz);
+			output[3 * x + 0] = nx * invLength;
+			output[3 * x + 1] = ny * invLength;
+			output[3 * x + 2] = nz * invLength;
+		}
+	}
+
+	for (uint32_t mip = 0; mip < mipCount; mip++)
+	{
+		if (mip > 0)
+		{
+			// Normalized average of the normals of the level above, dropping its last odd row and column
+			const uint32_t parentWidth = width;
+			const uint32_t parentHeight = height;
+			width = std::max(width / 2, 1u);
+			height = std::max(height / 2, 1u);
+
+			std::vector<float> parent = std::move(normals);
+			normals.resize(static_cast<size_t>(width) * height * 3);
+			const int mipRowCount = static_cast<int>(height);
+#pragma omp parallel for
+			for (int y = 0; y < mipRowCount; y++)
+			{
+				const size_t row0 = static_cast<size_t>(std::min(2u * y, parentHeight - 1)) * parentWidth * 3;
+				const size_t row1 = static_cast<size_t>(std::min(2u * y + 1, parentHeight - 1)) * parentWidth * 3;
+				float* output = normals.data() + static_cast<size_t>(y) * width * 3;
+				for (uint32_t x = 0; x < width; x++)
+				{
+					const size_t x0 = static_cast<size_t>(std::min(2 * x, parentWidth - 1)) * 3;
+					const size_t x1 = static_cast<size_t>(std::min(2 * x + 1, parentWidth - 1)) * 3;
+					float sum[3];
+					for (int c = 0; c < 3; c++)
+					{
+						sum[c] = parent[row0 + x0 + c] + parent[row0 + x1 + c] + parent[row1 + x0 + c] + parent[row1 + x1 + c];
+					}
+					const float length = std::sqrt(sum[0] * sum[0] + sum[1] * sum[1] + sum[2] * sum[2]);
+					const float invLength = length > 0.0f ? 1.0f / length : 0.0f;
+					output[3 * x + 0] = length > 0.0f ? sum[0] * invLength : 0.0f;
+					output[3 * x + 1] = length > 0.0f ? sum[1] * invLength : 1.0f;
+					output[3 * x + 2] = length > 0.0f ? sum[2] * invLength : 0.0f;
+				}
+			}
+		}
+
+		std::vector<int16_t> texels(static_cast<size_t>(width) * height * 2);
+		const int64_t texelCount = static_cast<int64_t>(width) * height;
+#pragma omp parallel for
+		for (int64_t i = 0; i < texelCount; i++)
+		{
+			EncodeOctahedral(normals[3 * i + 0], normals[3 * i + 1], normals[3 * i + 2], texels.data() + 2 * i);
+		}
+
+		layer.Mips.push_back(PackMip(width, height, texels));
+	}
+
+	return layer;
+}
+
+bool WriteTerrainFile(const std::filesystem::path& path, const TerrainFileHeader& header, const std::vector<BakedLayer>& layers)
+{
+	auto alignOffset = [](uint64_t offset) { return (offset + TerrainFileAlignment - 1) / TerrainFileAlignment * TerrainFileAlignment; };
+
+	// Tiles of every layer, in the order of the index, along with the mip level they are cut from
+	struct TileSource
+	{
+		const BakedMip* mip;
+		uint32_t bytesPerTexel;
+	};
+	std::vector<TerrainFileLayerDesc> layerDescs;
+	std::vector<TerrainFileTile> tiles;
+	std::vector<TileSource> sources;
+
+	for (const BakedLayer& layer : layers)
+	{
+		TerrainFileLayerDesc& desc = layerDescs.emplace_back();
+		desc.Layer = layer.Layer;
+		desc.Format = layer.Format;
+		desc.Width = layer.Mips.front().Width;
+		desc.Height = layer.Mips.front().Height;
+		desc.MipLevels = static_cast<uint32_t>(layer.Mips.size());
+		desc.FirstTile = static_cast<uint32_t>(tiles.size());
+
+		for (uint32_t mipLevel = 0; mipLevel < desc.MipLevels; mipLevel++)
+		{
+			const BakedMip& mip = layer.Mips[mipLevel];
+			for (uint32_t y = 0; y < mip.Height; y += header.TileSize)
+			{
+				for (uint32_t x = 0; x < mip.Width; x += header.TileSize)
+				{
+					TerrainFileTile& tile = tiles.emplace_back();
+					tile.MipLevel = mipLevel;
+					tile.X = x;
+					tile.Y = y;
+					tile.Width = std::min(header.TileSize, mip.Width - x);
+					tile.Height = std::min(header.TileSize, mip.Height - y);
+					sources.push_back({ &mip, GetTerrainFileBytesPerTexel(layer.Format) });
+				}
+			}
+		}
+
+		desc.TileCount = static_cast<uint32_t>(tiles.size()) - desc.FirstTile;
+	}
+
+	uint64_t offset = alignOffset(sizeof(TerrainFileHeader) + layerDescs.size() * sizeof(TerrainFileLayerDesc) + tiles.size() * sizeof(TerrainFileTile));
+	for (size_t i = 0; i < tiles.size(); i++)
+	{
+		tiles[i].Offset = offset;
+		offset = alignOffset(offset + static_cast<uint64_t>(tiles[i].Width) * tiles[i].Height * sources[i].bytesPerTexel);
+	}
+
+	TerrainFileHeader fileHeader = header;
+	fileHeader.LayerCount = static_cast<uint32_t>(layerDescs.size());
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		std::fprintf(stderr, "Cannot create '%s'\n", path.generic_string().c_str());
+		return false;
+	}
+
+	file.write(reinterpret_cast<const char*>(&fileHeader), sizeof(fileHeader));
+	file.write(reinterpret_cast<const char*>(layerDescs.data()), static_cast<std::streamsize>(layerDescs.size() * sizeof(TerrainFileLayerDesc)));
+	file.write(reinterpret_cast<const char*>(tiles.data()), static_cast<std::streamsize>(tiles.size() * sizeof(TerrainFileTile)));
+
+	// The padding up to each tile is written out rather than seeked over, so that the file is never sparse
+	std::vector<char> padding(TerrainFileAlignment, 0);
+	uint64_t position = sizeof(TerrainFileHeader) + layerDescs.size() * sizeof(TerrainFileLayerDesc) + tiles.size() * sizeof(TerrainFileTile);
+	for (size_t i = 0; i < tiles.size(); i++)
+	{
+		const TerrainFileTile& tile = tiles[i];
+		const TileSource& source = sources[i];
+
+		file.write(padding.data(), static_cast<std::streamsize>(tile.Offset - position));
+
+		const size_t rowBytes = static_cast<size_t>(tile.Width) * source.bytesPerTexel;
+		const size_t mipRowBytes = static_cast<size_t>(source.mip->Width) * source.bytesPerTexel;
+		for (uint32_t row = 0; row < tile.Height; row++)
+		{
+			const uint8_t* data = source.mip->Data.data() + (tile.Y + row) * mipRowBytes + static_cast<size_t>(tile.X) * source.bytesPerTexel;
+			file.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(rowBytes));
+		}
+
+		position = tile.Offset + rowBytes * tile.Height;
+	}
+
+	if (!file)
+	{
+		std::fprintf(stderr, "Cannot write '%s'\n", path.generic_string().c_str());
+		return false;
+	}
+
+	return true;
+}
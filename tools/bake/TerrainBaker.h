@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+#include "terrain/TerrainFileFormat.h"
+
+
+// Mip level of a layer, in tightly packed rows of texels of the format of the layer
+struct BakedMip
+{
+    uint32_t Width = 0;
+    uint32_t Height = 0;
+    std::vector<uint8_t> Data;
+};
+
+struct BakedLayer
+{
+    TerrainFileLayer Layer = TerrainFileLayer::Height;
+    TerrainFileFormat Format = TerrainFileFormat::R16_UNORM;
+    std::vector<BakedMip> Mips;
+};
+
+// Normalized heights of mip level 0, in rows
+struct BakeHeights
+{
+    uint32_t Width = 0;
+    uint32_t Height = 0;
+    std::vector<float> Texels;
+
+    [[nodiscard]] inline float At(uint32_t x, uint32_t y) const { return Texels[static_cast<size_t>(y) * Width + x]; }
+};
+
+
+// The kernels run on all cores with OpenMP, their inner loops running over contiguous rows for the compiler to vectorize
+
+// Quantizes the heights to the format, R16_UNORM or R32_FLOAT, and downsamples them into a full mip chain
+//  The heights are replaced by those of mip level 0 as they are stored, which the other layers are baked from
+[[nodiscard]] BakedLayer BakeHeightLayer(BakeHeights& heights, TerrainFileFormat format);
+
+// Same pyramids as TerrainHeightBoundsPass builds on the GPU (see HeightBounds.hlsl and HeightError.hlsl)
+[[nodiscard]] BakedLayer BakeHeightBoundsLayer(const BakeHeights& heights);
+[[nodiscard]] BakedLayer BakeHeightErrorLayer(const BakeHeights& heights);
+
+// Octahedral normals of the heights as GetTerrainNormal computes them, for a terrain of the given extents and height
+// scale, with a full mip chain of the normalized averages
+[[nodiscard]] BakedLayer BakeNormalLayer(const BakeHeights& heights, const float extents[2], float heightScale);
+// The normals are encoded by a C++ mirror of EncodeTerrainNormal (TerrainNormals.hlsli); returns false if its texels
+// do not decode to the normals they encode through a mirror of DecodeTerrainNormal, or if the pole is not on +y
+[[nodiscard]] bool CheckNormalEncoding();
+
+// Lays the tiles of the layers out in order, each aligned to TerrainFileAlignment; the header describes the normals
+bool WriteTerrainFile(const std::filesystem::path& path, const TerrainFileHeader& header, const std::vector<BakedLayer>& layers);
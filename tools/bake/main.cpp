@@ -0,0 +1,176 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "TerrainBaker.h"
+
+
+// Bakes a raw heightmap into a terrain file (see TerrainFileFormat.h), which LandscapesScene loads without any
+// processing when the "path" of a terrain ends in .terrain
+static void PrintUsage()
+{
+	std::fprintf(stderr,
+		"Usage: landscapes_bake <input> <output.terrain> --size <width> <height> [options]\n"
+		"  --input u16|f32        Texels of the input, in rows, in the byte order of the host (default u16)\n"
+		"                         16-bit heights are normalized by 65535, 32-bit heights over their range\n"
+		"  --format r16|r32f      Format of the heights in the file (default r16 for u16 inputs, r32f for f32)\n"
+		"  --tile <texels>        Size of the tiles (default 256)\n"
+		"  --extents <x> <z>      Extents of the terrain the normals are baked for (default 1 1)\n"
+		"  --height <scale>       Height scale of the terrain the normals are baked for (default 1)\n"
+		"  --no-normals           Omits the normals\n");
+}
+
+static bool ReadHeights(const char* path, bool floatInput, BakeHeights& heights)
+{
+	const size_t texelCount = static_cast<size_t>(heights.Width) * heights.Height;
+
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+	{
+		std::fprintf(stderr, "Cannot open '%s'\n", path);
+		return false;
+	}
+
+	heights.Texels.resize(texelCount);
+	if (floatInput)
+	{
+		file.read(reinterpret_cast<char*>(heights.Texels.data()), static_cast<std::streamsize>(texelCount * sizeof(float)));
+		if (!file)
+		{
+			std::fprintf(stderr, "'%s' holds fewer than %ux%u 32-bit texels\n", path, heights.Width, heights.Height);
+			return false;
+		}
+
+		const auto [minHeight, maxHeight] = std::minmax_element(heights.Texels.begin(), heights.Texels.end());
+		const float offset = *minHeight;
+		const float range = *maxHeight - *minHeight;
+		const float invRange = range > 0.0f ? 1.0f / range : 0.0f;
+		for (float& height : heights.Texels)
+		{
+			height = (height - offset) * invRange;
+		}
+
+		std::printf("Heights range from %g to %g: the height of the terrain should be %g\n", offset, offset + range, range);
+	}
+	else
+	{
+		std::vector<uint16_t> texels(texelCount);
+		file.read(reinterpret_cast<char*>(texels.data()), static_cast<std::streamsize>(texelCount * sizeof(uint16_t)));
+		if (!file)
+		{
+			std::fprintf(stderr, "'%s' holds fewer than %ux%u 16-bit texels\n", path, heights.Width, heights.Height);
+			return false;
+		}
+
+		std::transform(texels.begin(), texels.end(), heights.Texels.begin(),
+			[](uint16_t texel) { return static_cast<float>(texel) / 65535.0f; });
+	}
+
+	return true;
+}
+
+int main(int argc, const char** argv)
+{
+	if (argc < 3)
+	{
+		PrintUsage();
+		return EXIT_FAILURE;
+	}
+
+	const char* inputPath = argv[1];
+	const char* outputPath = argv[2];
+
+	BakeHeights heights;
+	bool floatInput = false;
+	bool formatSet = false;
+	TerrainFileFormat format = TerrainFileFormat::R16_UNORM;
+	bool normals = true;
+
+	TerrainFileHeader header;
+	header.TileSize = 256;
+
+	for (int i = 3; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--size") && i + 2 < argc)
+		{
+			heights.Width = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+			heights.Height = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (!strcmp(argv[i], "--input") && i + 1 < argc)
+		{
+			floatInput = !strcmp(argv[++i], "f32");
+		}
+		else if (!strcmp(argv[i], "--format") && i + 1 < argc)
+		{
+			format = !strcmp(argv[++i], "r32f") ? TerrainFileFormat::R32_FLOAT : TerrainFileFormat::R16_UNORM;
+			formatSet = true;
+		}
+		else if (!strcmp(argv[i], "--tile") && i + 1 < argc)
+		{
+			header.TileSize = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (!strcmp(argv[i], "--extents") && i + 2 < argc)
+		{
+			header.NormalExtents[0] = std::strtof(argv[++i], nullptr);
+			header.NormalExtents[1] = std::strtof(argv[++i], nullptr);
+		}
+		else if (!strcmp(argv[i], "--height") && i + 1 < argc)
+		{
+			header.NormalHeightScale = std::strtof(argv[++i], nullptr);
+		}
+		else if (!strcmp(argv[i], "--no-normals"))
+		{
+			normals = false;
+		}
+		else
+		{
+			std::fprintf(stderr, "Unknown option '%s'\n", argv[i]);
+			PrintUsage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (heights.Width == 0 || heights.Height == 0 || header.TileSize == 0)
+	{
+		PrintUsage();
+		return EXIT_FAILURE;
+	}
+
+	if (floatInput && !formatSet)
+	{
+		format = TerrainFileFormat::R32_FLOAT;
+	}
+
+	if (normals && !CheckNormalEncoding())
+	{
+		std::fprintf(stderr, "The octahedral encoding of the normals does not match the one of the shaders\n");
+		return EXIT_FAILURE;
+	}
+
+	const auto startTime = std::chrono::steady_clock::now();
+
+	if (!ReadHeights(inputPath, floatInput, heights))
+		return EXIT_FAILURE;
+
+	std::vector<BakedLayer> layers;
+	layers.push_back(BakeHeightLayer(heights, format));
+	layers.push_back(BakeHeightBoundsLayer(heights));
+	layers.push_back(BakeHeightErrorLayer(heights));
+	if (normals)
+	{
+		layers.push_back(BakeNormalLayer(heights, header.NormalExtents, header.NormalHeightScale));
+	}
+
+	if (!WriteTerrainFile(outputPath, header, layers))
+		return EXIT_FAILURE;
+
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+	std::printf("Baked '%s' (%ux%u) into '%s' in %.2f s\n", inputPath, heights.Width, heights.Height, outputPath, seconds);
+
+	return EXIT_SUCCESS;
+}